@@ -0,0 +1,304 @@
+// Multi-agent coherence simulation harness.
+//
+// Runs one thread per agent (GPU or process sharing the CXL pool) against a
+// single CoherenceManager and reports per-op latency percentiles, throughput
+// and coherence traffic (invalidations, snoops, writebacks saved by the
+// OWNED state, device round trips) as JSON
+// (stdout or --output), for each sharing pattern requested.
+//
+// Patterns:
+//   private            each agent touches its own slice of the lines
+//   shared             every agent touches every line (uniform)
+//   producer-consumer  agent 0 writes a line, the others then read it
+//   migratory          read-modify-write by whichever agent holds the line next
+//
+// --write-ratio applies to private and shared; the other patterns fix it.
+// The device is the software home agent (SpeckvSimDriver) with
+// --latency-ns per command.
+
+#include "cxl_memory/coherence_manager.h"
+#include "speckv_sim_driver.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cxlspeckv;
+
+namespace {
+
+struct BenchOptions {
+    std::string output_path;
+    std::vector<std::string> patterns = {"private", "shared", "producer-consumer", "migratory"};
+    size_t agents = CoherenceManager::kMaxAgents;
+    size_t lines = 4096;
+    size_t ops_per_agent = 100000;
+    double write_ratio = 0.2;
+    size_t access_size = 64;
+    uint64_t latency_ns = 0;
+};
+
+struct BenchResult {
+    std::string pattern;
+    uint64_t ops = 0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double p999_us = 0.0;
+    double mean_us = 0.0;
+    double ops_per_sec = 0.0;
+    uint64_t failed_ops = 0;
+    CoherenceManager::Statistics stats{};
+};
+
+double percentile(std::vector<uint64_t>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index] / 1000.0;
+}
+
+bool known_pattern(const std::string& name) {
+    return name == "private" || name == "shared" || name == "producer-consumer" || name == "migratory";
+}
+
+BenchResult run_pattern(const std::string& pattern, const BenchOptions& options) {
+    SpeckvSimDriver::Config config;
+    config.read_latency = config.write_latency = config.invalidate_latency =
+        config.writeback_latency = config.flush_latency = std::chrono::nanoseconds(options.latency_ns);
+    config.cache_line_size = options.access_size;
+    auto driver = std::make_shared<SpeckvSimDriver>(config);
+    CoherenceManager manager(driver, options.access_size);
+    // Size the directory to the working set so the run measures sharing, not eviction
+    manager.set_directory_capacity(0);
+
+    const uint64_t base = 0x10000000;
+    const size_t agents = options.agents;
+    const size_t lines = options.lines;
+    std::vector<std::vector<uint64_t>> latencies(agents);
+    std::vector<uint64_t> failures(agents, 0);
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+
+    auto worker = [&](size_t agent) {
+        std::mt19937_64 rng(1234 + agent);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::vector<uint8_t> buffer(options.access_size, static_cast<uint8_t>(agent));
+        auto& samples = latencies[agent];
+        samples.reserve(options.ops_per_agent);
+
+        size_t slice = std::max<size_t>(lines / agents, 1);
+        std::uniform_int_distribution<size_t> any_line(0, lines - 1);
+        std::uniform_int_distribution<size_t> own_line(0, slice - 1);
+
+        ready.fetch_add(1);
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        for (size_t i = 0; i < options.ops_per_agent; ++i) {
+            size_t line;
+            bool write;
+            if (pattern == "private") {
+                line = (agent * slice + own_line(rng)) % lines;
+                write = unit(rng) < options.write_ratio;
+            } else if (pattern == "producer-consumer") {
+                // Lines are produced in order; consumers trail the producer
+                line = i % lines;
+                write = agent == 0;
+            } else if (pattern == "migratory") {
+                // Read, then write the same line; agents walk the lines out of phase
+                line = (i / 2 + agent * 7) % lines;
+                write = (i & 1) != 0;
+            } else {
+                line = any_line(rng);
+                write = unit(rng) < options.write_ratio;
+            }
+
+            uint64_t addr = base + line * options.access_size;
+            auto start = std::chrono::steady_clock::now();
+            bool ok = write ? manager.request_write(addr, buffer.data(), buffer.size(), static_cast<uint8_t>(agent))
+                            : manager.request_read(addr, buffer.data(), buffer.size(), static_cast<uint8_t>(agent));
+            auto end = std::chrono::steady_clock::now();
+            samples.push_back(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+            if (!ok) {
+                failures[agent]++;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t agent = 0; agent < agents; ++agent) {
+        workers.emplace_back(worker, agent);
+    }
+    while (ready.load() < agents) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) {
+        w.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    BenchResult result;
+    result.pattern = pattern;
+    result.stats = manager.get_statistics();
+    std::vector<uint64_t> all;
+    uint64_t total_ns = 0;
+    for (size_t agent = 0; agent < agents; ++agent) {
+        all.insert(all.end(), latencies[agent].begin(), latencies[agent].end());
+        result.failed_ops += failures[agent];
+    }
+    for (uint64_t ns : all) {
+        total_ns += ns;
+    }
+    result.ops = all.size();
+    if (!all.empty()) {
+        result.mean_us = static_cast<double>(total_ns) / all.size() / 1000.0;
+    }
+    if (seconds > 0.0) {
+        result.ops_per_sec = all.size() / seconds;
+    }
+    result.p50_us = percentile(all, 0.50);
+    result.p99_us = percentile(all, 0.99);
+    result.p999_us = percentile(all, 0.999);
+    return result;
+}
+
+std::vector<std::string> parse_names(const char* text) {
+    std::vector<std::string> names;
+    std::string item;
+    std::istringstream stream(text);
+    while (std::getline(stream, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --patterns LIST         private,shared,producer-consumer,migratory\n"
+              << "  --agents N              sharing agents, 1-" << CoherenceManager::kMaxAgents << " (default "
+              << CoherenceManager::kMaxAgents << ")\n"
+              << "  --lines N               lines in the shared working set (default 4096)\n"
+              << "  --ops N                 operations per agent (default 100000)\n"
+              << "  --write-ratio F         fraction of writes for private/shared (default 0.2)\n"
+              << "  --access-size N         bytes per access and line size (default 64)\n"
+              << "  --latency-ns N          simulated device latency per command (default 0)\n"
+              << "  --output PATH           write JSON here instead of stdout\n";
+}
+
+bool parse_options(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--output") {
+            options.output_path = value;
+        } else if (arg == "--patterns") {
+            options.patterns = parse_names(value);
+        } else if (arg == "--agents") {
+            options.agents = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--lines") {
+            options.lines = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else if (arg == "--ops") {
+            options.ops_per_agent = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--write-ratio") {
+            options.write_ratio = std::strtod(value, nullptr);
+        } else if (arg == "--latency-ns") {
+            options.latency_ns = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--access-size") {
+            options.access_size = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else {
+            return false;
+        }
+    }
+    return options.agents >= 1 && options.agents <= CoherenceManager::kMaxAgents;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // The manager logs flushes to stdout; keep it for the JSON report
+    std::streambuf* stdout_buf = std::cout.rdbuf(nullptr);
+    std::vector<BenchResult> results;
+    for (const auto& pattern : options.patterns) {
+        if (!known_pattern(pattern)) {
+            std::cout.rdbuf(stdout_buf);
+            std::cerr << "Unknown pattern " << pattern << "\n";
+            return 1;
+        }
+        BenchResult result = run_pattern(pattern, options);
+        results.push_back(result);
+        std::cerr << pattern << ": p50 " << result.p50_us << " us, p99 " << result.p99_us
+                  << " us, sharer invalidations " << result.stats.sharer_invalidations
+                  << ", snoop writebacks " << result.stats.snoop_writebacks
+                  << ", writebacks saved " << result.stats.writebacks_saved << "\n";
+    }
+
+    std::cout.rdbuf(stdout_buf);
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"agents\": " << options.agents << ",\n"
+         << "  \"lines\": " << options.lines << ",\n"
+         << "  \"ops_per_agent\": " << options.ops_per_agent << ",\n"
+         << "  \"write_ratio\": " << options.write_ratio << ",\n"
+         << "  \"access_size\": " << options.access_size << ",\n"
+         << "  \"latency_ns\": " << options.latency_ns << ",\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        json << "    {\"pattern\": \"" << r.pattern << "\""
+             << ", \"ops\": " << r.ops
+             << ", \"failed_ops\": " << r.failed_ops
+             << ", \"p50_us\": " << r.p50_us
+             << ", \"p99_us\": " << r.p99_us
+             << ", \"p999_us\": " << r.p999_us
+             << ", \"mean_us\": " << r.mean_us
+             << ", \"ops_per_sec\": " << r.ops_per_sec
+             << ", \"hit_rate\": " << r.stats.hit_rate()
+             << ", \"coherence_ops\": " << r.stats.coherence_ops
+             << ", \"device_round_trips\": " << r.stats.device_round_trips
+             << ", \"invalidations_sent\": " << r.stats.invalidations_sent
+             << ", \"sharer_invalidations\": " << r.stats.sharer_invalidations
+             << ", \"snoop_writebacks\": " << r.stats.snoop_writebacks
+             << ", \"writebacks_performed\": " << r.stats.writebacks_performed
+             << ", \"owned_forwards\": " << r.stats.owned_forwards
+             << ", \"writebacks_saved\": " << r.stats.writebacks_saved
+             << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+
+    if (options.output_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(options.output_path);
+        file << json.str();
+        if (!file) {
+            std::cerr << "Failed to write " << options.output_path << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
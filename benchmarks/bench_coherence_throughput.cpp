@@ -0,0 +1,281 @@
+// Coherence throughput harness against the software home agent.
+//
+// Drives CoherenceManager over SpeckvSimDriver with a configurable per-op
+// device latency and queue depth, and reports throughput, latency
+// percentiles and home-agent utilization as JSON (stdout or --output) for
+// each submission mode:
+//
+//   sync    request_write from --threads threads, one device op each
+//   async   submit_async from one thread, ops overlapping in the device queue
+//   batch   batch_invalidate of --batch lines per doorbell
+//
+// Every op touches a distinct line, so each one reaches the device.
+
+#include "cxl_memory/coherence_manager.h"
+#include "speckv_sim_driver.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cxlspeckv;
+
+namespace {
+
+struct BenchOptions {
+    std::string output_path;
+    std::vector<std::string> modes = {"sync", "async", "batch"};
+    uint64_t latency_ns = 1000;
+    size_t queue_depth = 64;
+    size_t threads = 1;
+    size_t ops = 20000;
+    size_t batch = 256;
+};
+
+struct BenchResult {
+    std::string mode;
+    uint64_t ops = 0;
+    uint64_t failed_ops = 0;
+    double seconds = 0.0;
+    double ops_per_sec = 0.0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    uint64_t device_round_trips = 0;
+    double device_utilization = 0.0;
+    uint64_t max_queue_occupancy = 0;
+};
+
+double percentile(std::vector<uint64_t>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index] / 1000.0;
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+void count_completion(void* user_data, uint64_t, bool success) {
+    if (!success) {
+        static_cast<std::atomic<uint64_t>*>(user_data)->fetch_add(1);
+    }
+}
+
+BenchResult run_mode(const std::string& mode, const BenchOptions& options) {
+    SpeckvSimDriver::Config config;
+    config.read_latency = config.write_latency = config.invalidate_latency =
+        config.writeback_latency = config.flush_latency = std::chrono::nanoseconds(options.latency_ns);
+    config.queue_depth = options.queue_depth;
+    auto sim = std::make_shared<SpeckvSimDriver>(config);
+    CoherenceManager manager(sim, 64);
+    manager.set_directory_capacity(0);
+
+    const uint64_t base = 0x20000000;
+    char data[64] = {};
+    std::vector<uint64_t> samples;
+    std::atomic<uint64_t> failures{0};
+
+    // Batch mode invalidates lines that are already tracked
+    std::vector<uint64_t> lines;
+    if (mode == "batch") {
+        for (size_t i = 0; i < options.ops; ++i) {
+            lines.push_back(base + i * 64);
+        }
+        for (uint64_t line : lines) {
+            manager.request_read(line, data, sizeof(data));
+        }
+    }
+    manager.reset_statistics();
+    sim->reset_device_statistics();
+
+    auto start = std::chrono::steady_clock::now();
+    if (mode == "sync") {
+        std::vector<std::vector<uint64_t>> latencies(options.threads);
+        auto worker = [&](size_t thread_index) {
+            char buffer[64] = {};
+            for (size_t i = thread_index; i < options.ops; i += options.threads) {
+                auto op_start = std::chrono::steady_clock::now();
+                if (!manager.request_write(base + i * 64, buffer, sizeof(buffer))) {
+                    failures++;
+                }
+                latencies[thread_index].push_back(elapsed_ns(op_start));
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < options.threads; ++i) {
+            workers.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto& w : workers) {
+            w.join();
+        }
+        for (auto& thread_samples : latencies) {
+            samples.insert(samples.end(), thread_samples.begin(), thread_samples.end());
+        }
+    } else if (mode == "async") {
+        manager.enable_async();
+        for (size_t i = 0; i < options.ops; ++i) {
+            manager.submit_async(CoherenceManager::CoherenceOp::WRITE, base + i * 64, data, sizeof(data),
+                                 count_completion, &failures);
+        }
+        manager.disable_async();
+    } else {
+        for (size_t first = 0; first < lines.size(); first += options.batch) {
+            size_t count = std::min(options.batch, lines.size() - first);
+            std::vector<uint64_t> chunk(lines.begin() + first, lines.begin() + first + count);
+            auto op_start = std::chrono::steady_clock::now();
+            if (!manager.batch_invalidate(chunk)) {
+                failures += count;
+            }
+            samples.push_back(elapsed_ns(op_start));
+        }
+    }
+    uint64_t total_ns = elapsed_ns(start);
+
+    auto stats = manager.get_statistics();
+    auto device = sim->get_device_statistics();
+    BenchResult result;
+    result.mode = mode;
+    result.ops = options.ops;
+    result.failed_ops = failures.load();
+    result.seconds = total_ns / 1e9;
+    if (total_ns > 0) {
+        result.ops_per_sec = options.ops / result.seconds;
+        result.device_utilization = static_cast<double>(device.busy_ns) / total_ns;
+    }
+    if (mode == "async") {
+        // Completions arrive on the reaper; take the manager's round-trip histogram
+        const auto& writes = stats.device_ops[static_cast<size_t>(CoherenceManager::CoherenceOp::WRITE)];
+        result.p50_us = writes.p50_ns / 1000.0;
+        result.p99_us = writes.p99_ns / 1000.0;
+    } else {
+        result.p50_us = percentile(samples, 0.50);
+        result.p99_us = percentile(samples, 0.99);
+    }
+    result.device_round_trips = stats.device_round_trips;
+    result.max_queue_occupancy = device.max_queue_occupancy;
+    return result;
+}
+
+std::vector<std::string> parse_names(const char* text) {
+    std::vector<std::string> names;
+    std::string item;
+    std::istringstream stream(text);
+    while (std::getline(stream, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --modes LIST            sync,async,batch\n"
+              << "  --latency-ns N          device latency per op (default 1000)\n"
+              << "  --queue-depth N         device command queue depth (default 64)\n"
+              << "  --threads N             sync-mode threads (default 1)\n"
+              << "  --ops N                 operations per mode (default 20000)\n"
+              << "  --batch N               lines per batch doorbell (default 256)\n"
+              << "  --output PATH           write JSON here instead of stdout\n";
+}
+
+bool parse_options(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--output") {
+            options.output_path = value;
+        } else if (arg == "--modes") {
+            options.modes = parse_names(value);
+        } else if (arg == "--latency-ns") {
+            options.latency_ns = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--queue-depth") {
+            options.queue_depth = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else if (arg == "--threads") {
+            options.threads = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else if (arg == "--ops") {
+            options.ops = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--batch") {
+            options.batch = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // The manager logs flushes to stdout; keep it for the JSON report
+    std::streambuf* stdout_buf = std::cout.rdbuf(nullptr);
+    std::vector<BenchResult> results;
+    for (const auto& mode : options.modes) {
+        if (mode != "sync" && mode != "async" && mode != "batch") {
+            std::cout.rdbuf(stdout_buf);
+            std::cerr << "Unknown mode " << mode << "\n";
+            return 1;
+        }
+        BenchResult result = run_mode(mode, options);
+        results.push_back(result);
+        std::cerr << mode << ": " << result.ops_per_sec << " ops/s, device utilization "
+                  << result.device_utilization << "\n";
+    }
+    std::cout.rdbuf(stdout_buf);
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"backend\": \"SpeckvSimDriver\",\n"
+         << "  \"latency_ns\": " << options.latency_ns << ",\n"
+         << "  \"queue_depth\": " << options.queue_depth << ",\n"
+         << "  \"threads\": " << options.threads << ",\n"
+         << "  \"ops\": " << options.ops << ",\n"
+         << "  \"batch\": " << options.batch << ",\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        json << "    {\"mode\": \"" << r.mode << "\""
+             << ", \"ops\": " << r.ops
+             << ", \"failed_ops\": " << r.failed_ops
+             << ", \"seconds\": " << r.seconds
+             << ", \"ops_per_sec\": " << r.ops_per_sec
+             << ", \"p50_us\": " << r.p50_us
+             << ", \"p99_us\": " << r.p99_us
+             << ", \"device_round_trips\": " << r.device_round_trips
+             << ", \"device_utilization\": " << r.device_utilization
+             << ", \"max_queue_occupancy\": " << r.max_queue_occupancy
+             << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+
+    if (options.output_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(options.output_path);
+        file << json.str();
+        if (!file) {
+            std::cerr << "Failed to write " << options.output_path << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,557 @@
+// Predictor microbenchmark and accuracy harness.
+//
+// Replays token-ID traces through each predictor and reports latency
+// percentiles, per-thread throughput, top-k hit rate and memory footprint as
+// JSON (stdout or --output), so releases can be gated on the numbers.
+//
+// Trace format: one sequence per line, token IDs separated by whitespace or
+// commas; '#' starts a comment. Each token after the first is predicted from
+// the tokens before it, then revealed to the predictor (decode order).
+// Without --trace a synthetic Markov trace is generated.
+
+#include "prefetcher/lstm_predictor.h"
+#include "prefetcher/online_adaptation.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cxlspeckv;
+
+namespace {
+
+using Sequence = std::vector<uint32_t>;
+
+struct BenchOptions {
+    std::string trace_path;
+    std::string model_path;
+    std::string output_path;
+    std::vector<std::string> predictors = {"lstm-fp32", "lstm-int8", "lstm-shortlist", "lstm-adaptive",
+                                           "ngram", "stride"};
+    std::vector<size_t> k_values = {1, 4, 8};
+    std::vector<size_t> history_lengths = {16};
+    size_t threads = 1;
+    size_t max_predictions = 5000;      // per configuration
+    size_t vocab_size = 32000;
+    float peaked_output = 0.0f;         // 0 keeps the model's own output projection
+    size_t synthetic_sequences = 64;
+    size_t synthetic_length = 256;
+};
+
+// Common interface over the predictors under test
+class BenchPredictor {
+public:
+    virtual ~BenchPredictor() = default;
+
+    // Top-k for the token following history[0, len); sequence_id is stable
+    // across the calls of one trace sequence
+    virtual size_t predict(uint64_t sequence_id, const uint32_t* history, size_t len,
+                           size_t k, std::pair<uint32_t, float>* out) = 0;
+
+    // The true next token, revealed after the prediction was scored
+    virtual void observe(const uint32_t* /*history*/, size_t /*len*/, uint32_t /*actual*/) {}
+
+    virtual void finish_sequence(uint64_t /*sequence_id*/) {}
+    virtual size_t memory_bytes() const = 0;
+
+    // Shortlist fallbacks and output rows scored per prediction; false
+    // without a shortlist
+    virtual bool shortlist_statistics(uint64_t* /*fallbacks*/, double* /*avg_rows_scored*/) const {
+        return false;
+    }
+};
+
+// LSTMPredictor on the decode path (cached per-sequence state)
+class LstmBench : public BenchPredictor {
+public:
+    explicit LstmBench(std::unique_ptr<LSTMPredictor> predictor) : predictor_(std::move(predictor)) {}
+
+    size_t predict(uint64_t sequence_id, const uint32_t* history, size_t len,
+                   size_t k, std::pair<uint32_t, float>* out) override {
+        return predictor_->predict_next(sequence_id, history, len, k, out);
+    }
+
+    void finish_sequence(uint64_t sequence_id) override {
+        predictor_->release_sequence(sequence_id);
+    }
+
+    size_t memory_bytes() const override {
+        return predictor_->get_model_size();
+    }
+
+    bool shortlist_statistics(uint64_t* fallbacks, double* avg_rows_scored) const override {
+        if (!predictor_->is_shortlist_enabled()) {
+            return false;
+        }
+        auto stats = predictor_->get_statistics();
+        *fallbacks = stats.shortlist_fallbacks;
+        *avg_rows_scored = stats.avg_rows_scored;
+        return true;
+    }
+
+private:
+    std::unique_ptr<LSTMPredictor> predictor_;
+};
+
+// Bigram/trigram successor counts learned online from the trace
+class NgramBench : public BenchPredictor {
+public:
+    NgramBench() : table_(65536, 256.0f) {}
+
+    size_t predict(uint64_t, const uint32_t* history, size_t len,
+                   size_t k, std::pair<uint32_t, float>* out) override {
+        uint32_t tokens[TokenNgramTable::kWays];
+        float probs[TokenNgramTable::kWays];
+        float total = 0.0f;
+        size_t found;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            found = table_.lookup(history, len, tokens, probs, total);
+        }
+        std::pair<uint32_t, float> ranked[TokenNgramTable::kWays];
+        for (size_t i = 0; i < found; ++i) {
+            ranked[i] = {tokens[i], probs[i]};
+        }
+        std::sort(ranked, ranked + found, [](const auto& a, const auto& b) { return a.second > b.second; });
+        size_t count = std::min(found, k);
+        std::copy(ranked, ranked + count, out);
+        return count;
+    }
+
+    void observe(const uint32_t* history, size_t len, uint32_t actual) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        table_.observe(history, len, actual);
+    }
+
+    size_t memory_bytes() const override {
+        return table_.memory_bytes();
+    }
+
+private:
+    std::mutex mutex_;
+    TokenNgramTable table_;
+};
+
+// Repeats the last token delta (token + stride, + 2*stride, ...)
+class StrideBench : public BenchPredictor {
+public:
+    size_t predict(uint64_t, const uint32_t* history, size_t len,
+                   size_t k, std::pair<uint32_t, float>* out) override {
+        if (len == 0) {
+            return 0;
+        }
+        int64_t last = history[len - 1];
+        int64_t stride = len >= 2 ? last - static_cast<int64_t>(history[len - 2]) : 1;
+        if (stride == 0) {
+            stride = 1;
+        }
+        for (size_t i = 0; i < k; ++i) {
+            out[i] = {static_cast<uint32_t>(last + stride * static_cast<int64_t>(i + 1)), 1.0f / k};
+        }
+        return k;
+    }
+
+    size_t memory_bytes() const override {
+        return 0;
+    }
+};
+
+// Output projection whose rows sit around 256 random directions, scaled so
+// the softmax is as peaked as a trained model's (an untrained projection is
+// near-uniform and defeats the shortlist)
+std::vector<float> peaked_output_weights(size_t vocab_size, size_t hidden_dim, float scale) {
+    constexpr size_t kDirections = 256;
+    std::mt19937 rng(7);
+    std::normal_distribution<float> normal(0.0f, 1.0f / 8.0f);
+    std::vector<float> directions(kDirections * hidden_dim);
+    for (auto& w : directions) {
+        w = normal(rng);
+    }
+    std::uniform_int_distribution<size_t> any_direction(0, kDirections - 1);
+    std::vector<float> weights(vocab_size * hidden_dim);
+    for (size_t row = 0; row < vocab_size; ++row) {
+        const float* direction = directions.data() + any_direction(rng) * hidden_dim;
+        for (size_t j = 0; j < hidden_dim; ++j) {
+            weights[row * hidden_dim + j] = scale * (direction[j] + 0.3f * normal(rng));
+        }
+    }
+    return weights;
+}
+
+std::unique_ptr<BenchPredictor> make_predictor(const std::string& name, const BenchOptions& options,
+                                               size_t history_length) {
+    if (name == "ngram") {
+        return std::make_unique<NgramBench>();
+    }
+    if (name == "stride") {
+        return std::make_unique<StrideBench>();
+    }
+    if (name != "lstm-fp32" && name != "lstm-int8" && name != "lstm-shortlist" && name != "lstm-adaptive") {
+        return nullptr;
+    }
+
+    auto predictor = std::make_unique<LSTMPredictor>(options.vocab_size, 64, 64, 2, history_length);
+    if (!options.model_path.empty() && !predictor->load_model(options.model_path)) {
+        std::cerr << "Failed to load model " << options.model_path << "\n";
+        return nullptr;
+    }
+    if (options.model_path.empty() && options.peaked_output > 0.0f) {
+        predictor->set_output_weights(peaked_output_weights(options.vocab_size, 64, options.peaked_output).data());
+    }
+    if (name != "lstm-fp32") {
+        predictor->quantize_weights();
+    }
+    if (name == "lstm-shortlist") {
+        predictor->enable_shortlist();
+    }
+    if (name == "lstm-adaptive") {
+        predictor->enable_shortlist();
+        predictor->enable_adaptation();
+    }
+    return std::make_unique<LstmBench>(std::move(predictor));
+}
+
+bool load_trace(const std::string& path, std::vector<Sequence>& sequences) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream tokens(line);
+        Sequence sequence;
+        uint64_t token;
+        while (tokens >> token) {
+            sequence.push_back(static_cast<uint32_t>(token));
+        }
+        if (!tokens.eof()) {
+            return false;
+        }
+        if (sequence.size() >= 2) {
+            sequences.push_back(std::move(sequence));
+        }
+    }
+    return true;
+}
+
+// Markov trace over a working set of hot tokens: each token has a few
+// preferred successors (Zipf-like choice), plus uniform noise
+std::vector<Sequence> synthetic_trace(const BenchOptions& options) {
+    std::mt19937 rng(42);
+    constexpr size_t kHotTokens = 1024;
+    constexpr size_t kSuccessors = 4;
+    std::uniform_int_distribution<uint32_t> any_token(0, static_cast<uint32_t>(options.vocab_size - 1));
+    std::vector<uint32_t> hot(kHotTokens);
+    for (auto& token : hot) {
+        token = any_token(rng);
+    }
+    std::uniform_int_distribution<size_t> any_hot(0, kHotTokens - 1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<Sequence> sequences(options.synthetic_sequences);
+    for (auto& sequence : sequences) {
+        sequence.push_back(hot[any_hot(rng)]);
+        while (sequence.size() < options.synthetic_length) {
+            uint32_t last = sequence.back();
+            float u = unit(rng);
+            if (u < 0.1f) {
+                sequence.push_back(hot[any_hot(rng)]);
+                continue;
+            }
+            size_t choice = u < 0.55f ? 0 : u < 0.8f ? 1 : u < 0.92f ? 2 : 3;
+            uint64_t mixed = (static_cast<uint64_t>(last) * kSuccessors + choice) * 0x9E3779B97F4A7C15ull;
+            sequence.push_back(hot[(mixed >> 32) % kHotTokens]);
+        }
+    }
+    return sequences;
+}
+
+struct BenchResult {
+    std::string predictor;
+    size_t k = 0;
+    size_t history_length = 0;
+    uint64_t predictions = 0;
+    uint64_t hits = 0;
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double mean_us = 0.0;
+    double predictions_per_sec_per_thread = 0.0;
+    size_t memory_bytes = 0;
+    bool shortlist = false;
+    uint64_t shortlist_fallbacks = 0;
+    double avg_rows_scored = 0.0;
+};
+
+double percentile(std::vector<uint64_t>& samples, double fraction) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t index = std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index] / 1000.0;
+}
+
+BenchResult run_config(BenchPredictor& predictor, const std::vector<Sequence>& sequences,
+                       size_t k, size_t threads, uint64_t max_predictions) {
+    // Sequences are dealt round-robin to the threads; the shared budget
+    // caps the predictions of the whole configuration
+    std::atomic<uint64_t> budget{0};
+    std::vector<std::vector<uint64_t>> latencies(threads);
+    std::vector<uint64_t> hits(threads, 0);
+    std::vector<double> thread_seconds(threads, 0.0);
+
+    auto worker = [&](size_t thread_index) {
+        std::vector<std::pair<uint32_t, float>> out(k);
+        auto& samples = latencies[thread_index];
+        samples.reserve(max_predictions / threads + 1);
+        auto start = std::chrono::steady_clock::now();
+        bool exhausted = false;
+        for (size_t s = thread_index; s < sequences.size() && !exhausted; s += threads) {
+            const Sequence& sequence = sequences[s];
+            for (size_t t = 1; t < sequence.size(); ++t) {
+                if (budget.fetch_add(1) >= max_predictions) {
+                    exhausted = true;
+                    break;
+                }
+                auto predict_start = std::chrono::steady_clock::now();
+                size_t count = predictor.predict(s, sequence.data(), t, k, out.data());
+                auto predict_end = std::chrono::steady_clock::now();
+                samples.push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(predict_end - predict_start).count()));
+
+                for (size_t i = 0; i < count; ++i) {
+                    if (out[i].first == sequence[t]) {
+                        hits[thread_index]++;
+                        break;
+                    }
+                }
+                predictor.observe(sequence.data(), t, sequence[t]);
+            }
+            predictor.finish_sequence(s);
+        }
+        thread_seconds[thread_index] =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    BenchResult result;
+    result.k = k;
+    result.memory_bytes = predictor.memory_bytes();
+    result.shortlist = predictor.shortlist_statistics(&result.shortlist_fallbacks, &result.avg_rows_scored);
+    std::vector<uint64_t> all;
+    double rate_sum = 0.0;
+    uint64_t total_ns = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+        result.hits += hits[i];
+        if (thread_seconds[i] > 0.0) {
+            rate_sum += latencies[i].size() / thread_seconds[i];
+        }
+    }
+    for (uint64_t ns : all) {
+        total_ns += ns;
+    }
+    result.predictions = all.size();
+    result.predictions_per_sec_per_thread = rate_sum / threads;
+    if (!all.empty()) {
+        result.mean_us = static_cast<double>(total_ns) / all.size() / 1000.0;
+    }
+    result.p50_us = percentile(all, 0.50);
+    result.p99_us = percentile(all, 0.99);
+    return result;
+}
+
+std::vector<size_t> parse_list(const char* text) {
+    std::vector<size_t> values;
+    std::string item;
+    std::istringstream stream(text);
+    while (std::getline(stream, item, ',')) {
+        values.push_back(std::strtoull(item.c_str(), nullptr, 10));
+    }
+    return values;
+}
+
+std::vector<std::string> parse_names(const char* text) {
+    std::vector<std::string> names;
+    std::string item;
+    std::istringstream stream(text);
+    while (std::getline(stream, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --trace PATH            token trace (one sequence per line); synthetic if omitted\n"
+              << "  --model PATH            LSTM model file (format: lstm_model_format.h)\n"
+              << "  --predictors LIST       lstm-fp32,lstm-int8,lstm-shortlist,lstm-adaptive,ngram,stride\n"
+              << "  --k LIST                top-k values (default 1,4,8)\n"
+              << "  --history LIST          LSTM history lengths (default 16; a model file fixes its own)\n"
+              << "  --threads N             replay threads (default 1)\n"
+              << "  --max-predictions N     predictions per configuration (default 5000)\n"
+              << "  --vocab N               vocabulary size without a model (default 32000)\n"
+              << "  --peaked-output SCALE   without a model, use a clustered output projection scaled by\n"
+              << "                          SCALE (peaked like a trained model's; try 256)\n"
+              << "  --output PATH           write JSON here instead of stdout\n";
+}
+
+bool parse_options(int argc, char* argv[], BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h" || i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--trace") {
+            options.trace_path = value;
+        } else if (arg == "--model") {
+            options.model_path = value;
+        } else if (arg == "--output") {
+            options.output_path = value;
+        } else if (arg == "--predictors") {
+            options.predictors = parse_names(value);
+        } else if (arg == "--k") {
+            options.k_values = parse_list(value);
+        } else if (arg == "--history") {
+            options.history_lengths = parse_list(value);
+        } else if (arg == "--threads") {
+            options.threads = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else if (arg == "--max-predictions") {
+            options.max_predictions = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--vocab") {
+            options.vocab_size = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+        } else if (arg == "--peaked-output") {
+            options.peaked_output = std::strtof(value, nullptr);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string json_escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Sequence> sequences;
+    if (options.trace_path.empty()) {
+        sequences = synthetic_trace(options);
+    } else if (!load_trace(options.trace_path, sequences)) {
+        std::cerr << "Failed to read trace " << options.trace_path << "\n";
+        return 1;
+    }
+    size_t tokens = 0;
+    for (const auto& sequence : sequences) {
+        tokens += sequence.size();
+    }
+
+    std::vector<BenchResult> results;
+    for (const auto& name : options.predictors) {
+        bool is_lstm = name.rfind("lstm", 0) == 0;
+        // History length only shapes the LSTM; the baselines run once
+        std::vector<size_t> histories = is_lstm ? options.history_lengths : std::vector<size_t>{0};
+        for (size_t history : histories) {
+            for (size_t k : options.k_values) {
+                if (k == 0) {
+                    continue;
+                }
+                auto predictor = make_predictor(name, options, history);
+                if (!predictor) {
+                    std::cerr << "Unknown or unavailable predictor " << name << "\n";
+                    return 1;
+                }
+                BenchResult result = run_config(*predictor, sequences, k, options.threads,
+                                                options.max_predictions);
+                result.predictor = name;
+                result.history_length = history;
+                results.push_back(result);
+                std::cerr << name << " k=" << k << " history=" << history
+                          << ": p50 " << result.p50_us << " us, hit rate "
+                          << (result.predictions ? static_cast<double>(result.hits) / result.predictions : 0.0)
+                          << "\n";
+            }
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"trace\": \"" << json_escape(options.trace_path.empty() ? "synthetic" : options.trace_path) << "\",\n"
+         << "  \"model\": \"" << json_escape(options.model_path) << "\",\n"
+         << "  \"peaked_output\": " << options.peaked_output << ",\n"
+         << "  \"sequences\": " << sequences.size() << ",\n"
+         << "  \"tokens\": " << tokens << ",\n"
+         << "  \"threads\": " << options.threads << ",\n"
+         << "  \"lstm_kernel_isa\": \"" << lstm_kernel_isa() << "\",\n"
+         << "  \"int8_kernel_isa\": \"" << int8_kernel_isa() << "\",\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        json << "    {\"predictor\": \"" << r.predictor << "\""
+             << ", \"k\": " << r.k
+             << ", \"history_length\": " << r.history_length
+             << ", \"predictions\": " << r.predictions
+             << ", \"hit_rate\": " << (r.predictions ? static_cast<double>(r.hits) / r.predictions : 0.0)
+             << ", \"p50_us\": " << r.p50_us
+             << ", \"p99_us\": " << r.p99_us
+             << ", \"mean_us\": " << r.mean_us
+             << ", \"predictions_per_sec_per_thread\": " << r.predictions_per_sec_per_thread
+             << ", \"memory_bytes\": " << r.memory_bytes;
+        if (r.shortlist) {
+            json << ", \"shortlist_fallbacks\": " << r.shortlist_fallbacks
+                 << ", \"avg_rows_scored\": " << r.avg_rows_scored;
+        }
+        json << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+
+    if (options.output_path.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(options.output_path);
+        file << json.str();
+        if (!file) {
+            std::cerr << "Failed to write " << options.output_path << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
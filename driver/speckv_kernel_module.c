@@ -7,13 +7,16 @@
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/io.h>
+#include <linux/iopoll.h>
 #include <linux/ioport.h>
 #include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/dma-mapping.h>
 #include "uapi/speckv_ioctl.h"
 
 #define DEVICE_NAME "speckv"
 #define SPECKV_MMIO_BASE    0xE0000000  // FPGA MMIO base address (adjust for your system)
-#define SPECKV_MMIO_SIZE    (128 * 1024)  // 128KB MMIO region
+#define SPECKV_MMIO_SIZE    SPECKV_MMIO_MAP_SIZE  // 128KB MMIO region
 
 // MMIO register offsets
 #define SPECKV_REG_DMA_RING_BASE    0x0000
@@ -24,13 +27,28 @@
 #define SPECKV_REG_PREFETCH_STATUS  0x0028
 #define SPECKV_REG_PARAM_PREFETCH_K 0x0030
 #define SPECKV_REG_PARAM_COMP_SCHEME 0x0038
+#define SPECKV_REG_COH_BATCH_BASE   0x0040
+#define SPECKV_REG_COH_BATCH_COUNT  0x0048  // doorbell
+#define SPECKV_REG_COH_BATCH_DONE   0x0050
+#define SPECKV_REG_DIR_SNAP_BASE    0x0058
+#define SPECKV_REG_DIR_SNAP_CAP     0x0060  // doorbell
+#define SPECKV_REG_DIR_SNAP_STATUS  0x0068  // bit31 = done, bits 0-30 = valid entries
+#define SPECKV_REG_COH_BATCH_ABORT  0x0070  // write 1 to stop; reads 0 once no DMA is outstanding
+#define SPECKV_REG_DIR_SNAP_ABORT   0x0078  // write 1 to stop; reads 0 once no DMA is outstanding
 
 #define DMA_RING_SIZE       1024
 #define PREFETCH_FIFO_SIZE  256
 
+// Engine waits sleep between register polls (usleep_range), so a slow
+// device does not hold a CPU while the engine's mutex is held
+#define SPECKV_POLL_US          20
+#define SPECKV_ENGINE_TIMEOUT_US (1000 * USEC_PER_MSEC)
+#define SPECKV_ABORT_TIMEOUT_US  (100 * USEC_PER_MSEC)
+
 static dev_t speckv_dev;
 static struct cdev speckv_cdev;
 static struct class *speckv_class;
+static struct device *speckv_device;   // DMA buffers are allocated against it
 
 static void __iomem *mmio_base = NULL;
 static resource_size_t mmio_phys_base = SPECKV_MMIO_BASE;
@@ -41,6 +59,11 @@ static uint32_t dma_ring_wr_ptr = 0;
 static uint32_t dma_ring_rd_ptr = 0;
 static atomic_t dma_pending = ATOMIC_INIT(0);
 
+// The batch and snapshot engines each have one set of registers, so their
+// ioctls are serialized
+static DEFINE_MUTEX(coh_batch_lock);
+static DEFINE_MUTEX(dir_snap_lock);
+
 // ========== 文件 open/close ==========
 static int speckv_open(struct inode *inode, struct file *file)
 {
@@ -54,6 +77,22 @@ static int speckv_release(struct inode *inode, struct file *file)
     return 0;
 }
 
+// ========== MMIO mmap ==========
+// Userspace drives the MMIO_COHERENCE_* registers directly
+static int speckv_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    unsigned long size = vma->vm_end - vma->vm_start;
+
+    if (!mmio_base)
+        return -ENODEV;
+    if (vma->vm_pgoff != 0 || size > SPECKV_MMIO_SIZE)
+        return -EINVAL;
+
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    return io_remap_pfn_range(vma, vma->vm_start, mmio_phys_base >> PAGE_SHIFT,
+                              size, vma->vm_page_prot);
+}
+
 // ========== DMA 批处理 ==========
 static long handle_dma_batch(unsigned long arg)
 {
@@ -112,6 +151,145 @@ static long handle_dma_batch(unsigned long arg)
     return 0;
 }
 
+// Stops an engine that timed out. Returns false if it is still busy, in
+// which case the buffer it was given must not be freed.
+static bool speckv_abort_engine(uint32_t abort_reg)
+{
+    uint32_t busy;
+
+    iowrite32(1, mmio_base + abort_reg);
+    return read_poll_timeout(ioread32, busy, busy == 0, SPECKV_POLL_US,
+                             SPECKV_ABORT_TIMEOUT_US, false, mmio_base + abort_reg) == 0;
+}
+
+// ========== 一致性批处理 ==========
+static long handle_coh_batch(unsigned long arg)
+{
+    struct speckv_ioctl_coh_batch batch;
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+        return -EFAULT;
+
+    if (batch.count == 0 || batch.count > SPECKV_COH_BATCH_MAX)
+        return -EINVAL;
+
+    if (!mmio_base)
+        return -ENODEV;
+
+    size_t desc_bytes = sizeof(struct speckv_ioctl_coh_desc) * batch.count;
+
+    // FPGA reads the descriptor table and writes the statuses by DMA
+    dma_addr_t descs_dma;
+    struct speckv_ioctl_coh_desc *descs = dma_alloc_coherent(speckv_device, desc_bytes, &descs_dma, GFP_KERNEL);
+    if (!descs)
+        return -ENOMEM;
+
+    if (copy_from_user(descs, (void __user *)(uintptr_t)batch.user_ptr, desc_bytes)) {
+        dma_free_coherent(speckv_device, desc_bytes, descs, descs_dma);
+        return -EFAULT;
+    }
+
+    if (mutex_lock_interruptible(&coh_batch_lock)) {
+        dma_free_coherent(speckv_device, desc_bytes, descs, descs_dma);
+        return -ERESTARTSYS;
+    }
+
+    // One doorbell for the whole table
+    iowrite32(0, mmio_base + SPECKV_REG_COH_BATCH_DONE);
+    iowrite64(descs_dma, mmio_base + SPECKV_REG_COH_BATCH_BASE);
+    wmb();
+    iowrite32(batch.count, mmio_base + SPECKV_REG_COH_BATCH_COUNT);
+
+    // One completion: the device writes each status, then the done count
+    uint32_t done;
+    if (read_poll_timeout(ioread32, done, done >= batch.count, SPECKV_POLL_US,
+                          SPECKV_ENGINE_TIMEOUT_US, false, mmio_base + SPECKV_REG_COH_BATCH_DONE)) {
+        pr_warn("[speckv] coherence batch timed out\n");
+        if (speckv_abort_engine(SPECKV_REG_COH_BATCH_ABORT))
+            dma_free_coherent(speckv_device, desc_bytes, descs, descs_dma);
+        else
+            pr_err("[speckv] coherence batch engine did not stop; leaking its table\n");
+        mutex_unlock(&coh_batch_lock);
+        return -ETIMEDOUT;
+    }
+    rmb();
+    mutex_unlock(&coh_batch_lock);
+
+    batch.failed = 0;
+    for (uint32_t i = 0; i < batch.count; i++) {
+        if (descs[i].status != 0)
+            batch.failed++;
+    }
+
+    long ret = 0;
+    if (copy_to_user((void __user *)(uintptr_t)batch.user_ptr, descs, desc_bytes) ||
+        copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+        ret = -EFAULT;
+
+    dma_free_coherent(speckv_device, desc_bytes, descs, descs_dma);
+    return ret;
+}
+
+// ========== 目录快照 ==========
+static long handle_dir_snapshot(unsigned long arg)
+{
+    struct speckv_ioctl_dir_snapshot snap;
+
+    if (copy_from_user(&snap, (void __user *)arg, sizeof(snap)))
+        return -EFAULT;
+
+    if (snap.capacity == 0 || snap.capacity > SPECKV_DIR_SNAPSHOT_MAX)
+        return -EINVAL;
+
+    if (!mmio_base)
+        return -ENODEV;
+
+    size_t entry_bytes = sizeof(struct speckv_ioctl_dir_entry) * snap.capacity;
+
+    // FPGA writes the table by DMA
+    dma_addr_t entries_dma;
+    struct speckv_ioctl_dir_entry *entries = dma_alloc_coherent(speckv_device, entry_bytes, &entries_dma, GFP_KERNEL);
+    if (!entries)
+        return -ENOMEM;
+
+    if (mutex_lock_interruptible(&dir_snap_lock)) {
+        dma_free_coherent(speckv_device, entry_bytes, entries, entries_dma);
+        return -ERESTARTSYS;
+    }
+
+    iowrite32(0, mmio_base + SPECKV_REG_DIR_SNAP_STATUS);
+    iowrite64(entries_dma, mmio_base + SPECKV_REG_DIR_SNAP_BASE);
+    wmb();
+    iowrite32(snap.capacity, mmio_base + SPECKV_REG_DIR_SNAP_CAP);
+
+    // The device writes up to capacity entries, then the done bit and the
+    // number of valid entries it holds
+    uint32_t status;
+    if (read_poll_timeout(ioread32, status, status & 0x80000000, SPECKV_POLL_US,
+                          SPECKV_ENGINE_TIMEOUT_US, false, mmio_base + SPECKV_REG_DIR_SNAP_STATUS)) {
+        pr_warn("[speckv] directory snapshot timed out\n");
+        if (speckv_abort_engine(SPECKV_REG_DIR_SNAP_ABORT))
+            dma_free_coherent(speckv_device, entry_bytes, entries, entries_dma);
+        else
+            pr_err("[speckv] directory snapshot engine did not stop; leaking its buffer\n");
+        mutex_unlock(&dir_snap_lock);
+        return -ETIMEDOUT;
+    }
+    rmb();
+    mutex_unlock(&dir_snap_lock);
+
+    snap.count = status & 0x7FFFFFFF;
+    size_t copied = min_t(size_t, snap.count, snap.capacity) * sizeof(struct speckv_ioctl_dir_entry);
+
+    long ret = 0;
+    if (copy_to_user((void __user *)(uintptr_t)snap.user_ptr, entries, copied) ||
+        copy_to_user((void __user *)arg, &snap, sizeof(snap)))
+        ret = -EFAULT;
+
+    dma_free_coherent(speckv_device, entry_bytes, entries, entries_dma);
+    return ret;
+}
+
 // ========== PREFETCH ==========
 static long handle_prefetch(unsigned long arg)
 {
@@ -226,6 +404,10 @@ static long speckv_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         return handle_set_param(arg);
     case SPECKV_IOCTL_POLL_DONE:
         return handle_poll_done(arg);
+    case SPECKV_IOCTL_COH_BATCH:
+        return handle_coh_batch(arg);
+    case SPECKV_IOCTL_DIR_SNAPSHOT:
+        return handle_dir_snapshot(arg);
     default:
         return -ENOTTY;
     }
@@ -236,6 +418,7 @@ static const struct file_operations speckv_fops = {
     .open           = speckv_open,
     .release        = speckv_release,
     .unlocked_ioctl = speckv_ioctl,
+    .mmap           = speckv_mmap,
 };
 
 // ========== 模块加载 ==========
@@ -258,7 +441,18 @@ static int __init speckv_init(void)
         goto err_cdev;
     }
 
-    device_create(speckv_class, NULL, speckv_dev, NULL, "speckv0");
+    speckv_device = device_create(speckv_class, NULL, speckv_dev, NULL, "speckv0");
+    if (IS_ERR(speckv_device)) {
+        ret = PTR_ERR(speckv_device);
+        goto err_class;
+    }
+
+    // With a PCIe BAR this would be the PCI device; the FPGA addresses 64 bits
+    ret = dma_coerce_mask_and_coherent(speckv_device, DMA_BIT_MASK(64));
+    if (ret < 0) {
+        pr_err("[speckv] Failed to set DMA mask\n");
+        goto err_device;
+    }
 
     // Map FPGA MMIO region
     // In real system, this would be done via device tree or PCIe BAR
@@ -290,6 +484,7 @@ static int __init speckv_init(void)
 
 err_device:
     device_destroy(speckv_class, speckv_dev);
+err_class:
     class_destroy(speckv_class);
 err_cdev:
     cdev_del(&speckv_cdev);
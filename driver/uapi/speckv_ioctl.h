@@ -6,6 +6,9 @@
 
 #define SPECKV_MAGIC  'K'
 
+// mmap(fd, offset 0) maps the device's MMIO register window (uncached)
+#define SPECKV_MMIO_MAP_SIZE  (128 * 1024)
+
 // ========== DMA 描述符 ==========
 struct speckv_ioctl_dma_desc {
     __u64 fpga_addr;
@@ -21,6 +24,42 @@ struct speckv_ioctl_dma_batch {
     __u32 reserved;
 };
 
+// ========== 一致性批处理 ==========
+// 描述符数组一次门铃提交, 设备逐项写回 status
+struct speckv_ioctl_coh_desc {
+    __u64 addr;
+    __u64 data_ptr;   // writeback 数据 (可为 0)
+    __u32 bytes;
+    __u16 op;         // 1 = write, 2 = invalidate, 3 = writeback
+    __u16 status;     // 0 = ok
+};
+
+struct speckv_ioctl_coh_batch {
+    __u64 user_ptr;   // userspace array ptr
+    __u32 count;
+    __u32 failed;     // out: 失败的描述符数
+};
+
+#define SPECKV_COH_BATCH_MAX  65536
+
+// ========== 目录快照 ==========
+// 设备把一致性目录表一次 DMA 到缓冲区 (只含有效项, 按表序)
+struct speckv_ioctl_dir_entry {
+    __u64 addr;       // line address
+    __u8  state;      // 0 = I, 1 = S, 2 = E, 3 = M, 4 = O
+    __u8  sharers;    // bit i = sharer i
+    __u16 flags;      // bit0 = valid
+    __u32 reserved;
+};
+
+struct speckv_ioctl_dir_snapshot {
+    __u64 user_ptr;   // userspace array ptr
+    __u32 capacity;   // 缓冲区可容纳的项数
+    __u32 count;      // out: 设备上的有效项数 (可能大于 capacity)
+};
+
+#define SPECKV_DIR_SNAPSHOT_MAX  65536
+
 // ========== Prefetch ==========
 struct speckv_ioctl_prefetch_req {
     __u32 req_id;
@@ -47,4 +86,6 @@ struct speckv_ioctl_param {
 #define SPECKV_IOCTL_PREFETCH    _IOW(SPECKV_MAGIC, 0x02, struct speckv_ioctl_prefetch_req)
 #define SPECKV_IOCTL_SET_PARAM   _IOW(SPECKV_MAGIC, 0x03, struct speckv_ioctl_param)
 #define SPECKV_IOCTL_POLL_DONE   _IOR(SPECKV_MAGIC, 0x04, __u32)
+#define SPECKV_IOCTL_COH_BATCH   _IOWR(SPECKV_MAGIC, 0x05, struct speckv_ioctl_coh_batch)
+#define SPECKV_IOCTL_DIR_SNAPSHOT _IOWR(SPECKV_MAGIC, 0x06, struct speckv_ioctl_dir_snapshot)
 
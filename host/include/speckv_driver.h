@@ -3,33 +3,58 @@
 #include <cstdint>
 #include <string>
 #include <memory>
+#include <mutex>
 
 namespace cxlspeckv {
 
+// FPGA MMIO register offsets for coherence operations (home agent)
+constexpr uint32_t MMIO_COHERENCE_OP_REG = 0x1000;         // writing it rings the doorbell
+constexpr uint32_t MMIO_COHERENCE_ADDR_LO_REG = 0x1004;
+constexpr uint32_t MMIO_COHERENCE_ADDR_HI_REG = 0x1008;
+constexpr uint32_t MMIO_COHERENCE_STATUS_REG = 0x100C;
+constexpr uint32_t MMIO_DIR_ENTRIES_USED_REG = 0x1010;
+constexpr uint32_t MMIO_DIR_SHARED_COUNT_REG = 0x1014;
+constexpr uint32_t MMIO_DIR_EXCLUSIVE_COUNT_REG = 0x1018;
+constexpr uint32_t MMIO_DIR_MODIFIED_COUNT_REG = 0x101C;
+constexpr uint32_t MMIO_COHERENCE_OPS_COUNT_REG = 0x1020;
+constexpr uint32_t MMIO_COHERENCE_SIZE_REG = 0x1024;       // bytes covered by the op (0 = one line)
+
+// MMIO_COHERENCE_STATUS_REG bits. Commands complete in doorbell order; the
+// status describes the oldest one. Writing DONE pops it.
+constexpr uint64_t MMIO_COHERENCE_STATUS_BUSY = 0x1;       // oldest command still executing
+constexpr uint64_t MMIO_COHERENCE_STATUS_ERROR = 0x2;      // oldest command failed
+constexpr uint64_t MMIO_COHERENCE_STATUS_DONE = 0x4;       // oldest command completed
+constexpr uint64_t MMIO_COHERENCE_STATUS_FULL = 0x8;       // queue full; a doorbell now is dropped
+
 /**
  * SpeckvDriver
  * 
  * Low-level driver for communicating with the FPGA via kernel module.
- * Wraps IOCTL calls to /dev/speckv0 device.
+ * Wraps IOCTL calls to /dev/speckv0 device; open() also maps the device's
+ * register window for the MMIO accessors. Until open() succeeds, every
+ * device call returns false.
+ *
+ * The device-facing methods are virtual so a backend without hardware
+ * (SpeckvSimDriver) can stand in for the device.
  */
 class SpeckvDriver {
 public:
     explicit SpeckvDriver(const std::string& device_path = "/dev/speckv0");
-    ~SpeckvDriver();
+    virtual ~SpeckvDriver();
     
     // Disable copy
     SpeckvDriver(const SpeckvDriver&) = delete;
     SpeckvDriver& operator=(const SpeckvDriver&) = delete;
     
     // Device operations
-    bool open();
-    void close();
-    bool is_open() const { return fd_ >= 0; }
+    virtual bool open();
+    virtual void close();
+    virtual bool is_open() const { return fd_ >= 0; }
     
     // DMA operations
     struct DmaDescriptor {
-        uint64_t src_addr;      // Source address
-        uint64_t dst_addr;      // Destination address
+        uint64_t src_addr;      // Source address (FPGA side of speckv_ioctl_dma_desc)
+        uint64_t dst_addr;      // Destination address (GPU side)
         uint32_t size;          // Transfer size in bytes
         uint32_t flags;         // Flags (compress, decompress, etc.)
     };
@@ -53,8 +78,8 @@ public:
     bool set_compression_scheme(uint32_t scheme);
     
     // MMIO register access (for coherence operations)
-    bool write_mmio(uint32_t offset, uint64_t value);
-    bool read_mmio(uint32_t offset, uint64_t* value);
+    virtual bool write_mmio(uint32_t offset, uint64_t value);
+    virtual bool read_mmio(uint32_t offset, uint64_t* value);
     
     // Coherence-specific operations
     enum class CoherenceOp : uint32_t {
@@ -65,8 +90,35 @@ public:
         FLUSH = 4
     };
     
-    bool coherence_request(CoherenceOp op, uint64_t addr, const void* data = nullptr, size_t size = 0);
-    bool coherence_wait_complete();
+    virtual bool coherence_request(CoherenceOp op, uint64_t addr, const void* data = nullptr, size_t size = 0);
+    virtual bool coherence_wait_complete();
+    
+    // Batched coherence command (SPECKV_IOCTL_COH_BATCH): one doorbell and
+    // one completion for the whole array; the device fills in each status
+    // (0 = success). Returns false if any descriptor failed.
+    struct CoherenceDescriptor {
+        uint64_t addr;
+        uint64_t data;          // Writeback source (0 if none)
+        uint32_t size;
+        uint16_t op;            // CoherenceOp
+        uint16_t status;
+    };
+    
+    virtual bool coherence_batch(CoherenceDescriptor* descriptors, size_t count);
+    
+    // Directory snapshot (SPECKV_IOCTL_DIR_SNAPSHOT): the device DMAs its
+    // valid directory entries, in table order, into the buffer
+    struct DirectorySnapshotEntry {
+        uint64_t addr;          // line address
+        uint8_t state;          // 0 = I, 1 = S, 2 = E, 3 = M, 4 = O
+        uint8_t sharers;        // bit i = sharer i
+        uint16_t flags;         // bit 0 = valid
+        uint32_t reserved;
+    };
+    
+    // *count receives the number of valid entries on the device. Returns
+    // false if they did not all fit (*count > capacity) or on error.
+    virtual bool snapshot_directory(DirectorySnapshotEntry* entries, size_t capacity, size_t* count);
     
     // Statistics
     struct Statistics {
@@ -82,7 +134,9 @@ public:
 private:
     std::string device_path_;
     int fd_;
+    volatile uint8_t* mmio_;    // register window mapped from fd_
     mutable Statistics stats_;
+    mutable std::mutex stats_mutex_;
     
     // Helper for IOCTL calls
     bool ioctl_call(unsigned long request, void* arg);
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "speckv_driver.h"
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <vector>
+
+namespace cxlspeckv {
+
+/**
+ * SpeckvSimDriver
+ *
+ * Software home agent behind the SpeckvDriver interface, for machines
+ * without the FPGA. It implements the MMIO_COHERENCE_* register protocol
+ * and the batched coherence command, and models coherence_directory.v:
+ * a direct-mapped directory of NUM_ENTRIES lines with MESI state and a
+ * sharer bitmap, processing one command at a time in doorbell order.
+ * It adds an OWNED state the RTL lacks: a read of a MODIFIED line leaves
+ * it OWNED, and only a writeback cleans it.
+ *
+ * Timing is simulated: each command occupies the home agent for its
+ * configured latency, after the commands queued ahead of it, and reports
+ * BUSY until then. Up to queue_depth commands may be queued; a doorbell on
+ * a full queue is dropped. Failure injection completes a fraction of the
+ * commands with an error and leaves the directory unchanged.
+ */
+class SpeckvSimDriver : public SpeckvDriver {
+public:
+    struct Config {
+        std::chrono::nanoseconds read_latency;
+        std::chrono::nanoseconds write_latency;
+        std::chrono::nanoseconds invalidate_latency;
+        std::chrono::nanoseconds writeback_latency;
+        std::chrono::nanoseconds flush_latency;
+        size_t queue_depth;         // commands queued before the queue reports FULL
+        size_t num_entries;         // NUM_ENTRIES in coherence_directory.v
+        size_t cache_line_size;     // CACHE_LINE_SIZE
+        double failure_rate;        // probability a command completes with an error
+        uint32_t seed;              // failure injection RNG
+
+        Config()
+            : read_latency(0), write_latency(0), invalidate_latency(0)
+            , writeback_latency(0), flush_latency(0)
+            , queue_depth(64), num_entries(4096), cache_line_size(64)
+            , failure_rate(0.0), seed(1) {}
+    };
+
+    struct DeviceStatistics {
+        uint64_t commands;              // doorbells accepted
+        uint64_t batch_commands;        // descriptors executed from batches
+        uint64_t failed_commands;       // completed with an error (injected or invalid)
+        uint64_t dropped_doorbells;     // rung while the queue was full
+        uint64_t conflict_evictions;    // directory slots taken over by another line
+        uint64_t max_queue_occupancy;
+        uint64_t busy_ns;               // time the home agent spent executing
+        uint64_t snapshots;             // directory snapshots taken
+        uint64_t owned_reads;           // reads of a dirty line served without a writeback
+    };
+
+    explicit SpeckvSimDriver(const Config& config = Config());
+    ~SpeckvSimDriver() override;
+
+    // Always open; close() makes the device unavailable until open()
+    bool open() override;
+    void close() override;
+    bool is_open() const override;
+
+    bool write_mmio(uint32_t offset, uint64_t value) override;
+    bool read_mmio(uint32_t offset, uint64_t* value) override;
+
+    // Single-command convenience API over the same queue
+    bool coherence_request(CoherenceOp op, uint64_t addr, const void* data = nullptr, size_t size = 0) override;
+    bool coherence_wait_complete() override;
+
+    // Executes the table after the queued commands and returns once all of
+    // it has completed, like SPECKV_IOCTL_COH_BATCH
+    bool coherence_batch(CoherenceDescriptor* descriptors, size_t count) override;
+
+    // Copies the valid directory slots in table order
+    bool snapshot_directory(DirectorySnapshotEntry* entries, size_t capacity, size_t* count) override;
+
+    // Forget every directory entry, as after a device reset
+    void reset_directory();
+
+    // Adjust failure injection at run time
+    void set_failure_rate(double rate);
+
+    Config get_config() const;
+    DeviceStatistics get_device_statistics() const;
+    void reset_device_statistics();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Command {
+        Clock::time_point done;
+        bool failed;
+    };
+
+    // One entry of the direct-mapped directory
+    struct DirectorySlot {
+        uint64_t tag = 0;
+        uint8_t state = 0;      // STATE_* as in the RTL, plus STATE_OWNED
+        uint8_t sharers = 0;
+        bool valid = false;
+    };
+
+    // Caller holds mutex_. Applies op to the directory and returns the time
+    // it occupies the home agent; *failed is set for injected or invalid ops.
+    std::chrono::nanoseconds execute(uint32_t op, uint64_t addr, uint64_t size, bool* failed);
+    void apply_line(uint32_t op, uint64_t line);
+    uint64_t read_status(Clock::time_point now) const;
+    uint32_t count_entries(int state) const;    // -1 counts every valid entry
+
+    Config config_;
+    std::atomic<bool> open_{true};
+
+    mutable std::mutex mutex_;
+    uint64_t addr_reg_ = 0;
+    uint64_t size_reg_ = 0;
+    std::deque<Command> queue_;             // oldest first
+    Clock::time_point busy_until_;          // when the last queued command completes
+    std::vector<DirectorySlot> directory_;
+    uint64_t coherence_ops_ = 0;            // COHERENCE_OPS_COUNT: invalidations and writebacks
+    std::mt19937 rng_;
+    std::uniform_real_distribution<double> unit_{0.0, 1.0};
+    DeviceStatistics stats_;
+};
+
+} // namespace cxlspeckv
@@ -41,11 +41,12 @@ except OSError as e:
 
 # Enum definitions matching C++
 class CoherenceState(IntEnum):
-    """Cache coherence states (MESI protocol)"""
+    """Cache coherence states (MOESI protocol)"""
     INVALID = 0
     SHARED = 1
     EXCLUSIVE = 2
     MODIFIED = 3
+    OWNED = 4
 
 class MemoryTier(IntEnum):
     """Memory tier locations"""
@@ -53,7 +54,27 @@ class MemoryTier(IntEnum):
     L2_PREFETCH = 1
     L3_CXL = 2
 
+class CoherenceOp(IntEnum):
+    """Device coherence operations"""
+    READ = 0
+    WRITE = 1
+    INVALIDATE = 2
+    WRITEBACK = 3
+    FLUSH = 4
+
 # C structures
+class _OpStatistics(ctypes.Structure):
+    """C structure for one op type's device round trips"""
+    _fields_ = [
+        ("count", ctypes.c_uint64),
+        ("failures", ctypes.c_uint64),
+        ("mean_ns", ctypes.c_double),
+        ("p50_ns", ctypes.c_uint64),
+        ("p99_ns", ctypes.c_uint64),
+        ("p999_ns", ctypes.c_uint64),
+        ("max_ns", ctypes.c_uint64),
+    ]
+
 class _Statistics(ctypes.Structure):
     """C structure for statistics"""
     _fields_ = [
@@ -64,6 +85,12 @@ class _Statistics(ctypes.Structure):
         ("writebacks_performed", ctypes.c_uint64),
         ("directory_hits", ctypes.c_uint64),
         ("directory_misses", ctypes.c_uint64),
+        ("device_round_trips", ctypes.c_uint64),
+        ("lock_contentions", ctypes.c_uint64),
+        ("lock_wait_ns", ctypes.c_uint64),
+        ("entry_waits", ctypes.c_uint64),
+        ("entry_wait_ns", ctypes.c_uint64),
+        ("ops", _OpStatistics * len(CoherenceOp)),
     ]
 
 # C API function signatures
@@ -326,6 +353,13 @@ class CoherenceManager:
                 - directory_hits: Directory lookup hits
                 - directory_misses: Directory lookup misses
                 - hit_rate: Directory hit rate (0.0 - 1.0)
+                - device_round_trips: Doorbells rung (a batch counts once)
+                - lock_contentions: Directory locks that had to wait
+                - lock_wait_ns: Time spent waiting for them
+                - entry_waits: Operations that waited for another on the same entry
+                - entry_wait_ns: Time spent waiting for them
+                - ops: Per op name (READ, WRITE, ...), device round trips:
+                  count, failures, mean_ns, p50_ns, p99_ns, p999_ns, max_ns
         """
         stats = _Statistics()
         _lib.coherence_manager_get_statistics(self._handle, ctypes.byref(stats))
@@ -342,6 +376,15 @@ class CoherenceManager:
             'directory_hits': stats.directory_hits,
             'directory_misses': stats.directory_misses,
             'hit_rate': hit_rate,
+            'device_round_trips': stats.device_round_trips,
+            'lock_contentions': stats.lock_contentions,
+            'lock_wait_ns': stats.lock_wait_ns,
+            'entry_waits': stats.entry_waits,
+            'entry_wait_ns': stats.entry_wait_ns,
+            'ops': {
+                op.name: {name: getattr(stats.ops[op], name) for name, _ in _OpStatistics._fields_}
+                for op in CoherenceOp
+            },
         }
     
     def reset_statistics(self):
@@ -391,6 +434,10 @@ if __name__ == "__main__":
             for key, value in stats.items():
                 if key == 'hit_rate':
                     print(f"   {key}: {value:.2%}")
+                elif key == 'ops':
+                    for name, op in value.items():
+                        print(f"   {name}: {op['count']} ops, p50 {op['p50_ns']} ns, "
+                              f"p99 {op['p99_ns']} ns, p999 {op['p999_ns']} ns")
                 else:
                     print(f"   {key}: {value}")
             
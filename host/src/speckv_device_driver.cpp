@@ -0,0 +1,281 @@
+// host/src/speckv_device_driver.cpp
+// cxlspeckv::SpeckvDriver on the kernel module: ioctls on /dev/speckv0 and
+// MMIO through the register window mapped from it
+#include "../include/speckv_driver.h"
+#include "../../driver/uapi/speckv_ioctl.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace cxlspeckv {
+
+namespace {
+
+// The coherence registers are 32 bits wide
+constexpr uint32_t kMmioRegisterBytes = 4;
+
+// Bound on coherence_wait_complete, like the kernel's batch timeout
+constexpr std::chrono::milliseconds kCompletionTimeout(1000);
+
+} // namespace
+
+SpeckvDriver::SpeckvDriver(const std::string& device_path)
+    : device_path_(device_path)
+    , fd_(-1)
+    , mmio_(nullptr)
+    , stats_{}
+{
+}
+
+SpeckvDriver::~SpeckvDriver() {
+    // Not virtual dispatch: a derived backend has already been destroyed
+    SpeckvDriver::close();
+}
+
+bool SpeckvDriver::open() {
+    if (fd_ >= 0) {
+        return true;
+    }
+
+    fd_ = ::open(device_path_.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // Coherence commands go through the registers, so a device without the
+    // window is of no use
+    void* window = mmap(nullptr, SPECKV_MMIO_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (window == MAP_FAILED) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    mmio_ = static_cast<volatile uint8_t*>(window);
+    return true;
+}
+
+void SpeckvDriver::close() {
+    if (mmio_) {
+        munmap(const_cast<uint8_t*>(mmio_), SPECKV_MMIO_MAP_SIZE);
+        mmio_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool SpeckvDriver::ioctl_call(unsigned long request, void* arg) {
+    if (fd_ < 0) {
+        return false;
+    }
+    int ret;
+    do {
+        ret = ioctl(fd_, request, arg);
+    } while (ret < 0 && errno == EINTR);
+    return ret == 0;
+}
+
+bool SpeckvDriver::submit_dma_batch(const DmaDescriptor* descriptors, size_t count) {
+    if (count == 0) {
+        return is_open();
+    }
+
+    std::vector<speckv_ioctl_dma_desc> descs(count);
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        descs[i].fpga_addr = descriptors[i].src_addr;
+        descs[i].gpu_addr = descriptors[i].dst_addr;
+        descs[i].bytes = descriptors[i].size;
+        descs[i].flags = descriptors[i].flags;
+        bytes += descriptors[i].size;
+    }
+
+    speckv_ioctl_dma_batch batch;
+    batch.user_ptr = reinterpret_cast<uint64_t>(descs.data());
+    batch.count = static_cast<uint32_t>(count);
+    batch.reserved = 0;
+    if (!ioctl_call(SPECKV_IOCTL_DMA_BATCH, &batch)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.total_dma_ops += count;
+    stats_.bytes_transferred += bytes;
+    return true;
+}
+
+bool SpeckvDriver::poll_completion(uint32_t* completed_count) {
+    *completed_count = 0;
+    return ioctl_call(SPECKV_IOCTL_POLL_DONE, completed_count);
+}
+
+bool SpeckvDriver::submit_prefetch(const PrefetchRequest& req) {
+    speckv_ioctl_prefetch_req ioctl_req;
+    ioctl_req.req_id = req.req_id;
+    ioctl_req.layer = req.layer;
+    ioctl_req.reserved0 = 0;
+    ioctl_req.cur_pos = req.pos;
+    ioctl_req.depth_k = req.depth_k;
+    ioctl_req.history_len = sizeof(req.tokens) / sizeof(req.tokens[0]);
+    ioctl_req.tokens_user_ptr = reinterpret_cast<uint64_t>(req.tokens);
+    if (!ioctl_call(SPECKV_IOCTL_PREFETCH, &ioctl_req)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.total_prefetch_ops++;
+    return true;
+}
+
+bool SpeckvDriver::set_prefetch_depth(uint32_t depth) {
+    speckv_ioctl_param param;
+    param.key = SPECKV_PARAM_PREFETCH_DEPTH;
+    param.value = depth;
+    return ioctl_call(SPECKV_IOCTL_SET_PARAM, &param);
+}
+
+bool SpeckvDriver::set_compression_scheme(uint32_t scheme) {
+    speckv_ioctl_param param;
+    param.key = SPECKV_PARAM_COMP_SCHEME;
+    param.value = scheme;
+    return ioctl_call(SPECKV_IOCTL_SET_PARAM, &param);
+}
+
+bool SpeckvDriver::write_mmio(uint32_t offset, uint64_t value) {
+    if (!mmio_ || offset % kMmioRegisterBytes != 0 || offset + kMmioRegisterBytes > SPECKV_MMIO_MAP_SIZE) {
+        return false;
+    }
+    *reinterpret_cast<volatile uint32_t*>(mmio_ + offset) = static_cast<uint32_t>(value);
+    return true;
+}
+
+bool SpeckvDriver::read_mmio(uint32_t offset, uint64_t* value) {
+    *value = 0;
+    if (!mmio_ || offset % kMmioRegisterBytes != 0 || offset + kMmioRegisterBytes > SPECKV_MMIO_MAP_SIZE) {
+        return false;
+    }
+    *value = *reinterpret_cast<volatile uint32_t*>(mmio_ + offset);
+    return true;
+}
+
+bool SpeckvDriver::coherence_request(CoherenceOp op, uint64_t addr, const void* data, size_t size) {
+    (void)data;     // the device sources line data by address
+
+    // The op register is the doorbell, so it is written last
+    bool rung = write_mmio(MMIO_COHERENCE_ADDR_LO_REG, addr & 0xFFFFFFFF) &&
+                write_mmio(MMIO_COHERENCE_ADDR_HI_REG, addr >> 32) &&
+                write_mmio(MMIO_COHERENCE_SIZE_REG, size) &&
+                write_mmio(MMIO_COHERENCE_OP_REG, static_cast<uint32_t>(op));
+    if (!rung) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.total_coherence_ops++;
+    return true;
+}
+
+bool SpeckvDriver::coherence_wait_complete() {
+    auto deadline = std::chrono::steady_clock::now() + kCompletionTimeout;
+    uint64_t status = 0;
+    while (read_mmio(MMIO_COHERENCE_STATUS_REG, &status)) {
+        if (status & MMIO_COHERENCE_STATUS_DONE) {
+            // Pop the oldest command
+            write_mmio(MMIO_COHERENCE_STATUS_REG, MMIO_COHERENCE_STATUS_DONE);
+            return !(status & MMIO_COHERENCE_STATUS_ERROR);
+        }
+        if (!(status & MMIO_COHERENCE_STATUS_BUSY) || std::chrono::steady_clock::now() >= deadline) {
+            return false;   // nothing queued, or the device stopped answering
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+// The descriptor table goes to the kernel as-is
+static_assert(sizeof(SpeckvDriver::CoherenceDescriptor) == sizeof(speckv_ioctl_coh_desc) &&
+              offsetof(SpeckvDriver::CoherenceDescriptor, data) == offsetof(speckv_ioctl_coh_desc, data_ptr) &&
+              offsetof(SpeckvDriver::CoherenceDescriptor, size) == offsetof(speckv_ioctl_coh_desc, bytes) &&
+              offsetof(SpeckvDriver::CoherenceDescriptor, op) == offsetof(speckv_ioctl_coh_desc, op) &&
+              offsetof(SpeckvDriver::CoherenceDescriptor, status) == offsetof(speckv_ioctl_coh_desc, status),
+              "CoherenceDescriptor must match speckv_ioctl_coh_desc");
+
+bool SpeckvDriver::coherence_batch(CoherenceDescriptor* descriptors, size_t count) {
+    if (!is_open()) {
+        return false;
+    }
+
+    // One SPECKV_IOCTL_COH_BATCH per SPECKV_COH_BATCH_MAX descriptors; the
+    // kernel copies the table back with every status filled in
+    bool all_success = true;
+    for (size_t first = 0; first < count; first += SPECKV_COH_BATCH_MAX) {
+        size_t chunk = std::min<size_t>(SPECKV_COH_BATCH_MAX, count - first);
+        CoherenceDescriptor* table = descriptors + first;
+
+        speckv_ioctl_coh_batch batch;
+        batch.user_ptr = reinterpret_cast<uint64_t>(table);
+        batch.count = static_cast<uint32_t>(chunk);
+        batch.failed = 0;
+        if (!ioctl_call(SPECKV_IOCTL_COH_BATCH, &batch)) {
+            // No status came back: none of the chunk is known to have run
+            for (size_t i = 0; i < chunk; i++) {
+                table[i].status = 1;
+            }
+            all_success = false;
+            continue;
+        }
+        all_success &= batch.failed == 0;
+
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.total_coherence_ops += chunk;
+    }
+    return all_success;
+}
+
+static_assert(sizeof(SpeckvDriver::DirectorySnapshotEntry) == sizeof(speckv_ioctl_dir_entry) &&
+              offsetof(SpeckvDriver::DirectorySnapshotEntry, state) == offsetof(speckv_ioctl_dir_entry, state) &&
+              offsetof(SpeckvDriver::DirectorySnapshotEntry, sharers) == offsetof(speckv_ioctl_dir_entry, sharers) &&
+              offsetof(SpeckvDriver::DirectorySnapshotEntry, flags) == offsetof(speckv_ioctl_dir_entry, flags),
+              "DirectorySnapshotEntry must match speckv_ioctl_dir_entry");
+
+bool SpeckvDriver::snapshot_directory(DirectorySnapshotEntry* entries, size_t capacity, size_t* count) {
+    *count = 0;
+    if (!is_open()) {
+        return false;
+    }
+
+    // The kernel rejects an empty buffer; a one-entry probe still reports
+    // how many entries the device holds
+    DirectorySnapshotEntry probe;
+    speckv_ioctl_dir_snapshot snap;
+    snap.user_ptr = reinterpret_cast<uint64_t>(capacity > 0 ? entries : &probe);
+    snap.capacity = static_cast<uint32_t>(std::min<size_t>(std::max<size_t>(capacity, 1), SPECKV_DIR_SNAPSHOT_MAX));
+    snap.count = 0;
+    if (!ioctl_call(SPECKV_IOCTL_DIR_SNAPSHOT, &snap)) {
+        return false;
+    }
+
+    // More entries than fit: the caller grows the buffer to *count and retries
+    *count = snap.count;
+    return snap.count <= capacity && snap.count <= snap.capacity;
+}
+
+SpeckvDriver::Statistics SpeckvDriver::get_statistics() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void SpeckvDriver::reset_statistics() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_ = Statistics{};
+}
+
+} // namespace cxlspeckv
@@ -0,0 +1,366 @@
+// host/src/speckv_sim_driver.cpp
+#include "../include/speckv_sim_driver.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace cxlspeckv {
+
+namespace {
+
+// Directory state encoding of coherence_directory.v
+constexpr uint8_t STATE_INVALID = 0;
+constexpr uint8_t STATE_SHARED = 1;
+constexpr uint8_t STATE_EXCLUSIVE = 2;
+constexpr uint8_t STATE_MODIFIED = 3;
+constexpr uint8_t STATE_OWNED = 4;      // beyond the RTL's 2-bit MESI encoding
+
+constexpr uint8_t HOST_SHARER = 0x1;    // the GPU is sharer 0 in the RTL
+
+void wait_until(std::chrono::steady_clock::time_point deadline) {
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+} // namespace
+
+SpeckvSimDriver::SpeckvSimDriver(const Config& config)
+    : SpeckvDriver("simulated")
+    , config_(config)
+    , busy_until_(Clock::now())
+    , directory_(std::max<size_t>(config.num_entries, 1))
+    , rng_(config.seed)
+{
+    if (config_.cache_line_size == 0) {
+        config_.cache_line_size = 64;
+    }
+    config_.queue_depth = std::max<size_t>(config_.queue_depth, 1);
+    reset_device_statistics();
+}
+
+SpeckvSimDriver::~SpeckvSimDriver() = default;
+
+bool SpeckvSimDriver::open() {
+    open_.store(true);
+    return true;
+}
+
+void SpeckvSimDriver::close() {
+    open_.store(false);
+}
+
+bool SpeckvSimDriver::is_open() const {
+    return open_.load();
+}
+
+bool SpeckvSimDriver::write_mmio(uint32_t offset, uint64_t value) {
+    if (!is_open()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (offset) {
+        case MMIO_COHERENCE_ADDR_LO_REG:
+            addr_reg_ = (addr_reg_ & ~0xFFFFFFFFull) | (value & 0xFFFFFFFFull);
+            return true;
+
+        case MMIO_COHERENCE_ADDR_HI_REG:
+            addr_reg_ = (addr_reg_ & 0xFFFFFFFFull) | ((value & 0xFFFFFFFFull) << 32);
+            return true;
+
+        case MMIO_COHERENCE_SIZE_REG:
+            size_reg_ = value & 0xFFFFFFFFull;
+            return true;
+
+        case MMIO_COHERENCE_OP_REG: {
+            // Doorbell
+            if (queue_.size() >= config_.queue_depth) {
+                stats_.dropped_doorbells++;
+                return false;
+            }
+            bool failed = false;
+            auto latency = execute(static_cast<uint32_t>(value), addr_reg_, size_reg_, &failed);
+            Clock::time_point start = std::max(Clock::now(), busy_until_);
+            busy_until_ = start + latency;
+            queue_.push_back(Command{busy_until_, failed});
+
+            stats_.commands++;
+            stats_.busy_ns += latency.count();
+            stats_.max_queue_occupancy = std::max<uint64_t>(stats_.max_queue_occupancy, queue_.size());
+            return true;
+        }
+
+        case MMIO_COHERENCE_STATUS_REG:
+            // Write-1-to-clear: DONE pops the oldest completed command
+            if ((value & MMIO_COHERENCE_STATUS_DONE) && !queue_.empty() && queue_.front().done <= Clock::now()) {
+                queue_.pop_front();
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool SpeckvSimDriver::read_mmio(uint32_t offset, uint64_t* value) {
+    *value = 0;
+    if (!is_open()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (offset) {
+        case MMIO_COHERENCE_OP_REG:
+            return true;
+        case MMIO_COHERENCE_ADDR_LO_REG:
+            *value = addr_reg_ & 0xFFFFFFFFull;
+            return true;
+        case MMIO_COHERENCE_ADDR_HI_REG:
+            *value = addr_reg_ >> 32;
+            return true;
+        case MMIO_COHERENCE_SIZE_REG:
+            *value = size_reg_;
+            return true;
+        case MMIO_COHERENCE_STATUS_REG:
+            *value = read_status(Clock::now());
+            return true;
+        case MMIO_DIR_ENTRIES_USED_REG:
+            *value = count_entries(-1);
+            return true;
+        case MMIO_DIR_SHARED_COUNT_REG:
+            *value = count_entries(STATE_SHARED);
+            return true;
+        case MMIO_DIR_EXCLUSIVE_COUNT_REG:
+            *value = count_entries(STATE_EXCLUSIVE);
+            return true;
+        case MMIO_DIR_MODIFIED_COUNT_REG:
+            *value = count_entries(STATE_MODIFIED);
+            return true;
+        case MMIO_COHERENCE_OPS_COUNT_REG:
+            *value = coherence_ops_ & 0xFFFFFFFFull;     // 32-bit counter in the RTL
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool SpeckvSimDriver::coherence_request(CoherenceOp op, uint64_t addr, const void* data, size_t size) {
+    (void)data;     // the model tracks directory state, not line contents
+    return write_mmio(MMIO_COHERENCE_ADDR_LO_REG, addr & 0xFFFFFFFF) &&
+           write_mmio(MMIO_COHERENCE_ADDR_HI_REG, addr >> 32) &&
+           write_mmio(MMIO_COHERENCE_SIZE_REG, size) &&
+           write_mmio(MMIO_COHERENCE_OP_REG, static_cast<uint32_t>(op));
+}
+
+bool SpeckvSimDriver::coherence_wait_complete() {
+    while (true) {
+        Clock::time_point done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.empty()) {
+                return false;
+            }
+            if (queue_.front().done <= Clock::now()) {
+                bool failed = queue_.front().failed;
+                queue_.pop_front();
+                return !failed;
+            }
+            done = queue_.front().done;
+        }
+        wait_until(done);
+    }
+}
+
+bool SpeckvSimDriver::coherence_batch(CoherenceDescriptor* descriptors, size_t count) {
+    if (!is_open()) {
+        return false;
+    }
+
+    Clock::time_point done;
+    bool all_success = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::chrono::nanoseconds total(0);
+        for (size_t i = 0; i < count; i++) {
+            bool failed = false;
+            total += execute(descriptors[i].op, descriptors[i].addr, descriptors[i].size, &failed);
+            descriptors[i].status = failed ? 1 : 0;
+            all_success &= !failed;
+        }
+        Clock::time_point start = std::max(Clock::now(), busy_until_);
+        busy_until_ = start + total;
+        done = busy_until_;
+
+        stats_.batch_commands += count;
+        stats_.busy_ns += total.count();
+    }
+
+    // One completion for the whole table
+    wait_until(done);
+    return all_success;
+}
+
+bool SpeckvSimDriver::snapshot_directory(DirectorySnapshotEntry* entries, size_t capacity, size_t* count) {
+    *count = 0;
+    if (!is_open()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t valid = 0;
+    for (const auto& slot : directory_) {
+        if (!slot.valid) {
+            continue;
+        }
+        if (valid < capacity) {
+            DirectorySnapshotEntry& entry = entries[valid];
+            entry.addr = slot.tag * config_.cache_line_size;
+            entry.state = slot.state;
+            entry.sharers = slot.sharers;
+            entry.flags = 1;
+            entry.reserved = 0;
+        }
+        valid++;
+    }
+    *count = valid;
+    stats_.snapshots++;
+    return valid <= capacity;
+}
+
+void SpeckvSimDriver::reset_directory() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fill(directory_.begin(), directory_.end(), DirectorySlot{});
+}
+
+void SpeckvSimDriver::set_failure_rate(double rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_.failure_rate = rate;
+}
+
+SpeckvSimDriver::Config SpeckvSimDriver::get_config() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+}
+
+SpeckvSimDriver::DeviceStatistics SpeckvSimDriver::get_device_statistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void SpeckvSimDriver::reset_device_statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::memset(&stats_, 0, sizeof(stats_));
+}
+
+std::chrono::nanoseconds SpeckvSimDriver::execute(uint32_t op, uint64_t addr, uint64_t size, bool* failed) {
+    std::chrono::nanoseconds latency(0);
+    switch (static_cast<CoherenceOp>(op)) {
+        case CoherenceOp::READ:       latency = config_.read_latency; break;
+        case CoherenceOp::WRITE:      latency = config_.write_latency; break;
+        case CoherenceOp::INVALIDATE: latency = config_.invalidate_latency; break;
+        case CoherenceOp::WRITEBACK:  latency = config_.writeback_latency; break;
+        case CoherenceOp::FLUSH:      latency = config_.flush_latency; break;
+        default:
+            // Unknown opcode: rejected without touching the directory
+            *failed = true;
+            stats_.failed_commands++;
+            return latency;
+    }
+
+    *failed = config_.failure_rate > 0.0 && unit_(rng_) < config_.failure_rate;
+    if (*failed) {
+        stats_.failed_commands++;
+        return latency;
+    }
+
+    // A region command covers every line in [addr, addr + size)
+    const uint64_t line_size = config_.cache_line_size;
+    uint64_t first = addr / line_size;
+    uint64_t last = (addr + std::max<uint64_t>(size, 1) - 1) / line_size;
+    for (uint64_t line = first; line <= last; line++) {
+        apply_line(op, line);
+    }
+    return latency;
+}
+
+void SpeckvSimDriver::apply_line(uint32_t op, uint64_t line) {
+    DirectorySlot& slot = directory_[line % directory_.size()];
+    bool hit = slot.valid && slot.tag == line;
+
+    switch (static_cast<CoherenceOp>(op)) {
+        case CoherenceOp::READ:
+            if (hit && (slot.state == STATE_MODIFIED || slot.state == STATE_OWNED)) {
+                // The dirty holder forwards the data and keeps ownership; no writeback
+                stats_.owned_reads++;
+                slot.state = STATE_OWNED;
+                break;
+            }
+            if (!hit && slot.valid) {
+                stats_.conflict_evictions++;
+            }
+            slot = DirectorySlot{line, STATE_SHARED, HOST_SHARER, true};
+            break;
+
+        case CoherenceOp::WRITE:
+            if (hit && (slot.state == STATE_SHARED || slot.state == STATE_EXCLUSIVE || slot.state == STATE_OWNED)) {
+                coherence_ops_++;   // FSM_SEND_INVAL
+            } else if (!hit && slot.valid) {
+                stats_.conflict_evictions++;
+            }
+            slot = DirectorySlot{line, STATE_MODIFIED, HOST_SHARER, true};
+            break;
+
+        case CoherenceOp::INVALIDATE:
+            if (hit) {
+                coherence_ops_++;
+                slot = DirectorySlot{};
+            }
+            break;
+
+        case CoherenceOp::WRITEBACK:
+            if (hit && (slot.state == STATE_MODIFIED || slot.state == STATE_OWNED)) {
+                coherence_ops_++;
+                slot.state = STATE_SHARED;
+            }
+            break;
+
+        case CoherenceOp::FLUSH:
+            if (hit) {
+                coherence_ops_++;
+                slot = DirectorySlot{};
+            }
+            break;
+    }
+}
+
+uint64_t SpeckvSimDriver::read_status(Clock::time_point now) const {
+    uint64_t status = 0;
+    if (!queue_.empty()) {
+        const Command& oldest = queue_.front();
+        if (oldest.done <= now) {
+            status |= MMIO_COHERENCE_STATUS_DONE;
+            if (oldest.failed) {
+                status |= MMIO_COHERENCE_STATUS_ERROR;
+            }
+        } else {
+            status |= MMIO_COHERENCE_STATUS_BUSY;
+        }
+    }
+    if (queue_.size() >= config_.queue_depth) {
+        status |= MMIO_COHERENCE_STATUS_FULL;
+    }
+    return status;
+}
+
+uint32_t SpeckvSimDriver::count_entries(int state) const {
+    uint32_t count = 0;
+    for (const auto& slot : directory_) {
+        if (slot.valid && (state < 0 || slot.state == state)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+} // namespace cxlspeckv
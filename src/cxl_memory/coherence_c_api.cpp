@@ -16,6 +16,17 @@ extern "C" {
 
 typedef void* coherence_manager_handle_t;
 
+// Device round trips of one op type (C-compatible)
+typedef struct {
+    uint64_t count;
+    uint64_t failures;
+    double mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+} coherence_op_statistics_t;
+
 // Statistics structure (C-compatible)
 typedef struct {
     uint64_t total_reads;
@@ -25,6 +36,12 @@ typedef struct {
     uint64_t writebacks_performed;
     uint64_t directory_hits;
     uint64_t directory_misses;
+    uint64_t device_round_trips;
+    uint64_t lock_contentions;
+    uint64_t lock_wait_ns;
+    uint64_t entry_waits;
+    uint64_t entry_wait_ns;
+    coherence_op_statistics_t ops[CoherenceManager::kNumCoherenceOps];  // READ, WRITE, INVALIDATE, WRITEBACK, FLUSH
 } coherence_statistics_t;
 
 /**
@@ -35,7 +52,9 @@ coherence_manager_handle_t coherence_manager_create(
     size_t cache_line_size
 ) {
     try {
+        // Without the device the manager runs on its shadow directory alone
         auto driver = std::make_shared<SpeckvDriver>(device_path);
+        driver->open();
         auto* mgr = new CoherenceManager(driver, cache_line_size);
         return static_cast<coherence_manager_handle_t>(mgr);
     } catch (...) {
@@ -197,6 +216,15 @@ void coherence_manager_get_statistics(
     stats_out->writebacks_performed = stats.writebacks_performed;
     stats_out->directory_hits = stats.directory_hits;
     stats_out->directory_misses = stats.directory_misses;
+    stats_out->device_round_trips = stats.device_round_trips;
+    stats_out->lock_contentions = stats.lock_contentions;
+    stats_out->lock_wait_ns = stats.lock_wait_ns;
+    stats_out->entry_waits = stats.entry_waits;
+    stats_out->entry_wait_ns = stats.entry_wait_ns;
+    for (size_t i = 0; i < CoherenceManager::kNumCoherenceOps; i++) {
+        const auto& op = stats.device_ops[i];
+        stats_out->ops[i] = {op.count, op.failures, op.mean_ns, op.p50_ns, op.p99_ns, op.p999_ns, op.max_ns};
+    }
 }
 
 /**
@@ -1,200 +1,735 @@
 #include "coherence_manager.h"
 #include "../../host/include/speckv_driver.h"
 #include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <thread>
 
-namespace cxlspeckv {
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-// FPGA MMIO register offsets for coherence operations
-constexpr uint32_t MMIO_COHERENCE_OP_REG = 0x1000;
-constexpr uint32_t MMIO_COHERENCE_ADDR_LO_REG = 0x1004;
-constexpr uint32_t MMIO_COHERENCE_ADDR_HI_REG = 0x1008;
-constexpr uint32_t MMIO_COHERENCE_STATUS_REG = 0x100C;
-constexpr uint32_t MMIO_DIR_ENTRIES_USED_REG = 0x1010;
-constexpr uint32_t MMIO_DIR_SHARED_COUNT_REG = 0x1014;
-constexpr uint32_t MMIO_DIR_EXCLUSIVE_COUNT_REG = 0x1018;
-constexpr uint32_t MMIO_DIR_MODIFIED_COUNT_REG = 0x101C;
-constexpr uint32_t MMIO_COHERENCE_OPS_COUNT_REG = 0x1020;
+namespace cxlspeckv {
 
 CoherenceManager::CoherenceManager(std::shared_ptr<SpeckvDriver> driver, size_t cache_line_size)
     : driver_(driver)
     , cache_line_size_(cache_line_size)
+    , epoch_(std::chrono::steady_clock::now())
     , pending_ops_(0)
 {
-    std::memset(&stats_, 0, sizeof(stats_));
 }
 
 CoherenceManager::~CoherenceManager() {
+    stop_writeback_daemon();
+    disable_async();
+    
     // Flush all modified data before destruction
     flush_all();
 }
 
-bool CoherenceManager::request_read(uint64_t addr, void* data_out, size_t size) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
+bool CoherenceManager::request_read(uint64_t addr, void* data_out, size_t size, uint8_t agent) {
+    if (agent >= kMaxAgents) {
+        return false;
+    }
     
-    // Check local directory
-    auto* entry = get_entry(cache_line_addr);
+    // Immutable pages were made SHARED when sealed; nothing to check
+    if (is_sealed(addr)) {
+        stats_.total_reads.fetch_add(1, std::memory_order_relaxed);
+        stats_.sealed_reads.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
     
-    if (entry && (entry->state == CoherenceState::SHARED || 
-                  entry->state == CoherenceState::EXCLUSIVE ||
-                  entry->state == CoherenceState::MODIFIED)) {
+    // Fast path: a valid line (or region) with no operation in flight needs no lock
+    if (try_read_hit(addr, agent)) {
         // Cache hit - data is already valid
         update_statistics(CoherenceOp::READ, true);
-        entry->last_access_time = std::chrono::steady_clock::now().time_since_epoch().count();
-        entry->access_count++;
         
         // In real implementation, copy data from GPU/CXL memory
         // For now, just signal success
         return true;
     }
     
-    // Cache miss - need to fetch from CXL memory via FPGA
-    update_statistics(CoherenceOp::READ, false);
+    return run_transition(CoherenceOp::READ, addr, data_out, size, agent);
+}
+
+bool CoherenceManager::request_write(uint64_t addr, const void* data, size_t size, uint8_t agent) {
+    if (agent >= kMaxAgents || trap_sealed_write(addr, size)) {
+        return false;
+    }
+    return run_transition(CoherenceOp::WRITE, addr, data, size, agent);
+}
+
+bool CoherenceManager::release_copy(uint64_t addr, uint8_t agent) {
+    if (agent >= kMaxAgents) {
+        return false;
+    }
+    
+    uint64_t tag = 0;
+    uint64_t meta = 0;
+    if (!acquire_for_address(addr, false, &tag, &meta)) {
+        return true;  // Untracked
+    }
     
-    // Send read request to FPGA coherence controller
-    bool success = send_coherence_op_to_fpga(CoherenceOp::READ, cache_line_addr, nullptr, size);
+    CoherenceState state = meta_state(meta);
+    MemoryTier tier = meta_tier(meta);
+    uint64_t remaining = meta & kSharerMask & ~sharer_bit(agent);
+    if (state == CoherenceState::INVALID || (meta & sharer_bit(agent)) == 0) {
+        release_entry(tag, state, tier);
+        return true;
+    }
     
-    if (success) {
-        // Update directory entry to SHARED state
-        auto* new_entry = get_or_create_entry(cache_line_addr);
-        new_entry->state = CoherenceState::SHARED;
-        new_entry->tier = MemoryTier::L1_GPU;  // Data is now in GPU L1
-        new_entry->last_access_time = std::chrono::steady_clock::now().time_since_epoch().count();
-        new_entry->access_count = 1;
+    bool success = true;
+    bool owner = is_dirty_state(state) && dirty_owner(meta) == agent;
+    if (owner) {
+        // The dirty copy leaves with its owner: write it back before dropping it
+        success = send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, tag_address(tag), nullptr, tag_span(tag));
+        if (!success) {
+            release_entry(tag, state, tier);
+            return false;
+        }
+        stats_.writebacks_performed.fetch_add(1, std::memory_order_relaxed);
+        if (state == CoherenceState::OWNED) {
+            stats_.owned_writebacks.fetch_add(1, std::memory_order_relaxed);
+        }
     }
     
+    // Clean copies, and a reader's copy of an OWNED line, are dropped silently
+    if (remaining == 0) {
+        release_entry(tag, CoherenceState::INVALID, tier);
+    } else {
+        CoherenceState kept = owner || state != CoherenceState::OWNED ? CoherenceState::SHARED : state;
+        release_entry(tag, kept, tier, false, remaining);
+    }
     return success;
 }
 
-bool CoherenceManager::request_write(uint64_t addr, const void* data, size_t size) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    auto* entry = get_entry(cache_line_addr);
-    
-    // Check current state
-    if (entry) {
-        if (entry->state == CoherenceState::SHARED) {
-            // Need to invalidate other sharers
-            // FPGA will handle sending CXL.cache invalidations
-            update_statistics(CoherenceOp::INVALIDATE, false);
-            stats_.invalidations_sent++;
+bool CoherenceManager::invalidate(uint64_t addr) {
+    return run_transition(CoherenceOp::INVALIDATE, addr, nullptr, 0);
+}
+
+bool CoherenceManager::writeback(uint64_t addr, const void* data, size_t size) {
+    uint64_t meta = 0;
+    if (!load_meta(directory_tag(addr), &meta) || !is_dirty_state(meta_state(meta))) {
+        return true;  // Nothing to writeback
+    }
+    return run_transition(CoherenceOp::WRITEBACK, addr, data, size);
+}
+
+CoherenceManager::TransitionStep CoherenceManager::begin_transition(
+    CoherenceOp op,
+    uint64_t addr,
+    const void* data,
+    size_t size,
+    bool wait,
+    Transition* t,
+    uint8_t agent
+) {
+    uint64_t tag = 0;
+    uint64_t meta = 0;
+    bool created = false;
+    bool busy = false;
+    bool* busy_out = wait ? nullptr : &busy;
+    bool create = op == CoherenceOp::READ || op == CoherenceOp::WRITE;
+    
+    if (!acquire_for_address(addr, create, &tag, &meta, &created, busy_out)) {
+        if (busy) {
+            return TransitionStep::BUSY;
         }
+        // Untracked: already invalid, nothing to write back. A READ or WRITE
+        // fails if no entry could be evicted to make room for it.
+        t->result = !create;
+        return TransitionStep::DONE;
     }
     
-    update_statistics(CoherenceOp::WRITE, entry != nullptr);
+    CoherenceState state = meta_state(meta);
+    MemoryTier tier = meta_tier(meta);
+    uint64_t sharers = meta & kSharerMask;
+    uint64_t others = sharers & ~sharer_bit(agent);
+    t->tag = tag;
+    t->data = data;
+    t->size = size;
+    t->failure_state = state;
+    t->failure_tier = tier;
+    t->sharers = 0;
+    t->accessed = false;
+    t->writeback = false;
+    t->writeback_first = false;
+    t->snoop = false;
+    t->forward = false;
     
-    // Send write request to FPGA coherence controller
-    // FPGA will:
-    // 1. Send invalidations to other sharers via CXL.cache
-    // 2. Write data to CXL memory via CXL.mem
-    // 3. Update its directory to MODIFIED state
-    bool success = send_coherence_op_to_fpga(CoherenceOp::WRITE, cache_line_addr, data, size);
+    switch (op) {
+        case CoherenceOp::READ:
+            if (state != CoherenceState::INVALID && (sharers & sharer_bit(agent))) {
+                // Filled by the operation we waited for
+                update_statistics(CoherenceOp::READ, true);
+                release_entry(tag, state, tier, true);
+                t->result = true;
+                return TransitionStep::DONE;
+            }
+            
+            // Cache miss - need to fetch from CXL memory via FPGA
+            update_statistics(CoherenceOp::READ, false);
+            
+            // Held by other agents: join them as a sharer. A dirty copy is
+            // forwarded by its holder, which keeps the line OWNED and writes
+            // it back only when it gives the line up.
+            t->sharers = (state == CoherenceState::INVALID ? 0 : others) | sharer_bit(agent);
+            if (state == CoherenceState::MODIFIED) {
+                t->forward = true;
+                t->sharers |= owner_flag(static_cast<uint8_t>(dirty_owner(meta)));
+            }
+            
+            // Read request to FPGA coherence controller; a region is fetched whole
+            t->device_op = CoherenceOp::READ;
+            t->device_addr = tag_address(tag);
+            t->data = nullptr;
+            t->size = std::max(size, tag_span(tag));
+            
+            // Update directory entry to SHARED state (OWNED if dirty)
+            // Data is now in GPU L1
+            t->state = is_dirty_state(state) ? CoherenceState::OWNED : CoherenceState::SHARED;
+            t->tier = MemoryTier::L1_GPU;
+            t->accessed = true;
+            return TransitionStep::ISSUE;
+            
+        case CoherenceOp::WRITE:
+            if ((tag & kTagKindMask) == kRegionTag && state == CoherenceState::SHARED) {
+                // Written while read-shared: track this region's lines individually
+                split_region(tag, meta);
+                tag = line_tag(addr);
+                if (!acquire_entry(tag, true, &meta, nullptr, busy_out)) {
+                    if (busy) {
+                        return TransitionStep::BUSY;
+                    }
+                    t->result = false;
+                    return TransitionStep::DONE;
+                }
+                state = meta_state(meta);
+                tier = meta_tier(meta);
+                t->tag = tag;
+                t->failure_state = state;
+                t->failure_tier = tier;
+            }
+            
+            // Check current state
+            if (state != CoherenceState::INVALID && others != 0) {
+                // Need to invalidate other sharers, and only those
+                // FPGA will handle sending CXL.cache invalidations
+                update_statistics(CoherenceOp::INVALIDATE, false);
+                stats_.invalidations_sent.fetch_add(1, std::memory_order_relaxed);
+                stats_.sharer_invalidations.fetch_add(__builtin_popcountll(others), std::memory_order_relaxed);
+                if (state == CoherenceState::MODIFIED) {
+                    // Another agent's dirty copy is written back first, in the
+                    // same batch as the write; an OWNED line's data is
+                    // forwarded to the writer instead
+                    t->writeback_first = true;
+                    t->snoop = true;
+                    t->writeback = true;
+                }
+            }
+            t->sharers = sharer_bit(agent);
+            
+            update_statistics(CoherenceOp::WRITE, !created);
+            
+            // Write request to FPGA coherence controller
+            // FPGA will:
+            // 1. Send invalidations to other sharers via CXL.cache
+            // 2. Write data to CXL memory via CXL.mem
+            // 3. Update its directory to MODIFIED state
+            t->device_op = CoherenceOp::WRITE;
+            t->device_addr = align_to_cache_line(addr);
+            
+            // Update directory entry to MODIFIED state
+            // Data is now in GPU L1
+            t->state = CoherenceState::MODIFIED;
+            t->tier = MemoryTier::L1_GPU;
+            t->accessed = true;
+            return TransitionStep::ISSUE;
+            
+        case CoherenceOp::INVALIDATE:
+            // A dirty line is written back first, in the same batch as the
+            // invalidation; if that fails the line stays dirty
+            if (is_dirty_state(state)) {
+                t->writeback_first = true;
+                t->writeback = true;
+            }
+            
+            // Mark as invalid before the device round-trip so queries stop using the line
+            set_pending_status(tag, CoherenceState::INVALID, tier);
+            unseal_entry(tag);
+            stats_.invalidations_sent.fetch_add(1, std::memory_order_relaxed);
+            if (state != CoherenceState::INVALID) {
+                stats_.sharer_invalidations.fetch_add(__builtin_popcountll(sharers), std::memory_order_relaxed);
+            }
+            
+            t->device_op = CoherenceOp::INVALIDATE;
+            t->device_addr = tag_address(tag);
+            t->data = nullptr;
+            t->size = tag_span(tag);
+            t->state = CoherenceState::INVALID;
+            t->tier = tier;
+            if (!t->writeback_first) {
+                t->failure_state = CoherenceState::INVALID;
+            }
+            return TransitionStep::ISSUE;
+            
+        case CoherenceOp::WRITEBACK:
+            if (!is_dirty_state(state)) {
+                release_entry(tag, state, tier);
+                t->result = true;  // Written back while we waited
+                return TransitionStep::DONE;
+            }
+            
+            t->device_op = CoherenceOp::WRITEBACK;
+            t->device_addr = tag_address(tag);
+            
+            // Transition to SHARED or EXCLUSIVE state (data is clean now)
+            // Data is written back to CXL
+            t->state = CoherenceState::SHARED;
+            t->tier = MemoryTier::L3_CXL;
+            t->writeback = true;
+            return TransitionStep::ISSUE;
+            
+        case CoherenceOp::FLUSH:
+            break;
+    }
     
+    release_entry(tag, state, tier);
+    t->result = false;
+    return TransitionStep::DONE;
+}
+
+bool CoherenceManager::finish_transition(const Transition& t, bool success) {
     if (success) {
-        // Update directory entry to MODIFIED state
-        auto* new_entry = get_or_create_entry(cache_line_addr);
-        new_entry->state = CoherenceState::MODIFIED;
-        new_entry->tier = MemoryTier::L1_GPU;  // Data is now in GPU L1
-        new_entry->last_access_time = std::chrono::steady_clock::now().time_since_epoch().count();
-        new_entry->access_count++;
+        release_entry(t.tag, t.state, t.tier, t.accessed, t.sharers);
+        if (t.writeback) {
+            stats_.writebacks_performed.fetch_add(1, std::memory_order_relaxed);
+            // failure_state is the state written back from
+            if (t.failure_state == CoherenceState::OWNED) {
+                stats_.owned_writebacks.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (t.forward) {
+            stats_.owned_forwards.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (t.snoop) {
+            stats_.snoop_writebacks.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        release_entry(t.tag, t.failure_state, t.failure_tier);
     }
-    
     return success;
 }
 
-bool CoherenceManager::invalidate(uint64_t addr) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    auto* entry = get_entry(cache_line_addr);
-    if (!entry) {
-        return true;  // Already invalid
+bool CoherenceManager::run_transition(CoherenceOp op, uint64_t addr, const void* data, size_t size, uint8_t agent) {
+    Transition t;
+    if (begin_transition(op, addr, data, size, true, &t, agent) == TransitionStep::DONE) {
+        return t.result;
     }
     
-    // If modified, need to writeback first
-    if (entry->state == CoherenceState::MODIFIED) {
-        // In real implementation, writeback data
-        stats_.writebacks_performed++;
+    return finish_transition(t, issue_transition(t));
+}
+
+bool CoherenceManager::issue_transition(const Transition& t) {
+    if (!t.writeback_first) {
+        return send_coherence_op_to_fpga(t.device_op, t.device_addr, t.data, t.size);
     }
     
-    // Mark as invalid
-    entry->state = CoherenceState::INVALID;
+    // The dirty copy is written back and the operation issued in one batch,
+    // so the device never sees the operation without the data before it
+    std::vector<BatchDescriptor> descriptors = {
+        {tag_address(t.tag), 0, static_cast<uint32_t>(tag_span(t.tag)), static_cast<uint16_t>(CoherenceOp::WRITEBACK), 0},
+        {t.device_addr, 0, static_cast<uint32_t>(t.size), static_cast<uint16_t>(t.device_op), 0}
+    };
+    return send_coherence_batch_to_fpga(descriptors);
+}
+
+bool CoherenceManager::flush_all() {
+    std::cout << "CoherenceManager: Flushing all modified cache lines..." << std::endl;
     
-    // Send invalidation to FPGA
-    bool success = send_coherence_op_to_fpga(CoherenceOp::INVALIDATE, cache_line_addr);
+    // Only the dirty set is visited; writebacks go out in descriptor batches
+    size_t flushed = write_back_tags(collect_dirty(), true, kMaxBatchDescriptors);
     
-    stats_.invalidations_sent++;
+    std::cout << "CoherenceManager: Flushed " << flushed << " cache lines" << std::endl;
+    stats_.writebacks_performed.fetch_add(flushed, std::memory_order_relaxed);
     
-    return success;
+    return true;
 }
 
-bool CoherenceManager::writeback(uint64_t addr, const void* data, size_t size) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    auto* entry = get_entry(cache_line_addr);
-    if (!entry || entry->state != CoherenceState::MODIFIED) {
-        return true;  // Nothing to writeback
+bool CoherenceManager::start_writeback_daemon(const WritebackConfig& config) {
+    if (writeback_.running.load(std::memory_order_acquire) ||
+        config.low_watermark >= config.high_watermark || config.batch_size == 0) {
+        return false;
     }
     
-    // Send writeback to FPGA
-    bool success = send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, cache_line_addr, data, size);
-    
-    if (success) {
-        // Transition to SHARED or EXCLUSIVE state (data is clean now)
-        entry->state = CoherenceState::SHARED;
-        entry->tier = MemoryTier::L3_CXL;  // Data is written back to CXL
-        stats_.writebacks_performed++;
+    writeback_.config = config;
+    writeback_.stop = false;
+    writeback_.wake_at.store(config.high_watermark, std::memory_order_relaxed);
+    writeback_.running.store(true, std::memory_order_release);
+    writeback_.thread = std::thread(&CoherenceManager::writeback_loop, this);
+    return true;
+}
+
+void CoherenceManager::stop_writeback_daemon() {
+    if (!writeback_.running.load(std::memory_order_acquire)) {
+        return;
     }
     
-    return success;
+    {
+        std::lock_guard<std::mutex> lock(writeback_.mutex);
+        writeback_.stop = true;
+    }
+    writeback_.wake.notify_all();
+    writeback_.thread.join();
+    writeback_.wake_at.store(0, std::memory_order_relaxed);
+    writeback_.running.store(false, std::memory_order_release);
 }
 
-bool CoherenceManager::flush_all() {
-    std::lock_guard<std::mutex> lock(directory_mutex_);
+void CoherenceManager::writeback_loop() {
+    const WritebackConfig& config = writeback_.config;
+    auto next_batch = std::chrono::steady_clock::now();
+    
+    std::unique_lock<std::mutex> lock(writeback_.mutex);
+    while (!writeback_.stop) {
+        // release_entry wakes us at the high watermark; the timeout covers a
+        // wakeup lost between the check and the wait
+        bool woken = writeback_.wake.wait_for(lock, std::chrono::milliseconds(50), [this, &config] {
+            return writeback_.stop || dirty_lines() >= config.high_watermark;
+        });
+        if (!woken) {
+            continue;
+        }
+        
+        while (!writeback_.stop && dirty_lines() > config.low_watermark) {
+            // Rate limit: each batch earns the next one its share of a second
+            if (writeback_.wake.wait_until(lock, next_batch, [this] { return writeback_.stop; })) {
+                break;
+            }
+            
+            size_t count = std::min(config.batch_size, dirty_lines() - config.low_watermark);
+            lock.unlock();
+            size_t written = write_back_tags(collect_dirty(count), false, config.batch_size);
+            lock.lock();
+            
+            stats_.background_writebacks.fetch_add(written, std::memory_order_relaxed);
+            stats_.writebacks_performed.fetch_add(written, std::memory_order_relaxed);
+            if (config.max_lines_per_second > 0) {
+                next_batch = std::max(next_batch, std::chrono::steady_clock::now()) +
+                             std::chrono::microseconds(written * 1000000 / config.max_lines_per_second);
+            }
+            if (written == 0) {
+                break;  // everything left is busy; retry after the next wakeup
+            }
+        }
+    }
+}
+
+bool CoherenceManager::enable_async(const AsyncConfig& config) {
+    if (async_ || config.queue_depth == 0) {
+        return false;
+    }
     
-    std::cout << "CoherenceManager: Flushing all modified cache lines..." << std::endl;
+    async_ = std::make_unique<AsyncPipeline>();
+    async_->config = config;
+    async_->ring.resize(config.queue_depth);
+    async_->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (config.reaper_thread) {
+        async_->reaper = std::thread(&CoherenceManager::async_loop, this);
+    }
+    return true;
+}
+
+void CoherenceManager::disable_async() {
+    if (!async_) {
+        return;
+    }
     
-    size_t flushed = 0;
-    for (auto& [addr, entry] : directory_) {
-        if (entry->state == CoherenceState::MODIFIED) {
-            // In real implementation, writeback data
-            send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, addr);
-            entry->state = CoherenceState::SHARED;
-            entry->tier = MemoryTier::L3_CXL;
-            flushed++;
+    {
+        std::lock_guard<std::mutex> lock(async_->mutex);
+        async_->stop = true;
+    }
+    async_->wake.notify_all();
+    async_->space.notify_all();
+    
+    if (async_->reaper.joinable()) {
+        async_->reaper.join();
+    } else {
+        while (outstanding_async_ops() > 0) {
+            poll_completions();
         }
     }
     
-    std::cout << "CoherenceManager: Flushed " << flushed << " cache lines" << std::endl;
-    stats_.writebacks_performed += flushed;
+    if (async_->event_fd >= 0) {
+        close(async_->event_fd);
+    }
+    async_.reset();
+}
+
+std::future<bool> CoherenceManager::submit_async(CoherenceOp op, uint64_t addr, const void* data, size_t size) {
+    AsyncOp async_op;
+    async_op.op = op;
+    async_op.addr = addr;
+    async_op.data = data;
+    async_op.size = size;
+    return enqueue_async(std::move(async_op));
+}
+
+bool CoherenceManager::submit_async(
+    CoherenceOp op,
+    uint64_t addr,
+    const void* data,
+    size_t size,
+    CompletionCallback callback,
+    void* user_data
+) {
+    if (!async_ || !callback || op == CoherenceOp::FLUSH) {
+        return false;
+    }
     
+    AsyncOp async_op;
+    async_op.op = op;
+    async_op.addr = addr;
+    async_op.data = data;
+    async_op.size = size;
+    async_op.callback = callback;
+    async_op.user_data = user_data;
+    enqueue_async(std::move(async_op));
     return true;
 }
 
-CoherenceManager::CoherenceState CoherenceManager::get_state(uint64_t addr) const {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
+size_t CoherenceManager::poll_completions() {
+    if (!async_) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(async_->reap_mutex);
+    return process_async(nullptr);
+}
+
+int CoherenceManager::completion_fd() const {
+    return async_ ? async_->event_fd : -1;
+}
+
+size_t CoherenceManager::outstanding_async_ops() const {
+    if (!async_) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(async_->mutex);
+    return async_->outstanding;
+}
+
+std::future<bool> CoherenceManager::enqueue_async(AsyncOp op) {
+    std::future<bool> future;
+    if (!op.callback) {
+        future = op.promise.get_future();
+    }
+    
+    if (!async_ || op.op == CoherenceOp::FLUSH) {
+        deliver_async(op, false);
+        return future;
+    }
     
-    std::lock_guard<std::mutex> lock(directory_mutex_);
+    // Outcomes known without a device operation complete immediately
+    if (op.op == CoherenceOp::READ) {
+        if (is_sealed(op.addr)) {
+            stats_.total_reads.fetch_add(1, std::memory_order_relaxed);
+            stats_.sealed_reads.fetch_add(1, std::memory_order_relaxed);
+            deliver_async(op, true);
+            return future;
+        }
+        if (try_read_hit(op.addr)) {
+            update_statistics(CoherenceOp::READ, true);
+            deliver_async(op, true);
+            return future;
+        }
+    } else if (op.op == CoherenceOp::WRITE && trap_sealed_write(op.addr, op.size)) {
+        deliver_async(op, false);
+        return future;
+    }
     
-    const auto* entry = get_entry(cache_line_addr);
-    return entry ? entry->state : CoherenceState::INVALID;
+    auto& pipeline = *async_;
+    bool reaping = pipeline.reaping.load(std::memory_order_relaxed) == std::this_thread::get_id();
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    while (pipeline.outstanding >= pipeline.config.queue_depth && !pipeline.stop) {
+        if (reaping) {
+            // A callback resubmitting into a full queue: only this thread
+            // could make room, so waiting would never return
+            break;
+        }
+        if (pipeline.config.reaper_thread) {
+            pipeline.space.wait(lock);
+            continue;
+        }
+        
+        // Poll mode: nobody else reaps, so make room here
+        lock.unlock();
+        size_t completed;
+        {
+            std::lock_guard<std::mutex> reap_lock(pipeline.reap_mutex);
+            completed = process_async(nullptr);
+        }
+        if (completed == 0) {
+            std::this_thread::yield();
+        }
+        lock.lock();
+    }
+    if (pipeline.stop || pipeline.outstanding >= pipeline.config.queue_depth) {
+        lock.unlock();
+        deliver_async(op, false);
+        return future;
+    }
+    pipeline.ring[(pipeline.head + pipeline.count) % pipeline.ring.size()] = std::move(op);
+    pipeline.count++;
+    pipeline.outstanding++;
+    lock.unlock();
+    pipeline.wake.notify_one();
+    return future;
 }
 
-CoherenceManager::MemoryTier CoherenceManager::get_tier(uint64_t addr) const {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
+void CoherenceManager::deliver_async(AsyncOp& op, bool success) {
+    if (op.callback) {
+        op.callback(op.user_data, op.addr, success);
+    } else {
+        op.promise.set_value(success);
+    }
+}
+
+void CoherenceManager::complete_async(AsyncOp& op, bool success) {
+    // Free the slot first so a callback can resubmit into it
+    {
+        std::lock_guard<std::mutex> lock(async_->mutex);
+        async_->outstanding--;
+    }
+    async_->space.notify_one();
+    deliver_async(op, success);
+}
+
+size_t CoherenceManager::process_async(bool* idle) {
+    auto& pipeline = *async_;
+    pipeline.reaping.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        while (pipeline.count > 0) {
+            pipeline.deferred.push_back(std::move(pipeline.ring[pipeline.head]));
+            pipeline.head = (pipeline.head + 1) % pipeline.ring.size();
+            pipeline.count--;
+        }
+    }
     
-    std::lock_guard<std::mutex> lock(directory_mutex_);
+    // Start ops in submission order. Once an op finds its line busy, later
+    // ops on the same line wait behind it.
+    size_t completed = 0;
+    std::vector<uint64_t> blocked;
+    std::deque<AsyncOp> waiting;
+    for (auto& op : pipeline.deferred) {
+        uint64_t tag = directory_tag(op.addr);
+        if (std::find(blocked.begin(), blocked.end(), tag) != blocked.end()) {
+            waiting.push_back(std::move(op));
+            continue;
+        }
+        
+        Transition& t = op.transition;
+        switch (begin_transition(op.op, op.addr, op.data, op.size, false, &t)) {
+            case TransitionStep::BUSY:
+                blocked.push_back(tag);
+                waiting.push_back(std::move(op));
+                break;
+            case TransitionStep::DONE:
+                complete_async(op, t.result);
+                completed++;
+                break;
+            case TransitionStep::ISSUE:
+                if (t.writeback_first) {
+                    // A batch completes in one round trip; it is not posted
+                    complete_async(op, finish_transition(t, issue_transition(t)));
+                    completed++;
+                    break;
+                }
+                op.posted = std::chrono::steady_clock::now();
+                if (post_coherence_op_to_fpga(t.device_op, t.device_addr, t.data, t.size, &op.device_seq)) {
+                    pipeline.inflight.push_back(std::move(op));
+                } else {
+                    record_device_op(t.device_op, op.posted, false);
+                    complete_async(op, finish_transition(t, false));
+                    completed++;
+                }
+                break;
+        }
+    }
+    pipeline.deferred.swap(waiting);
+    
+    // Reap in posting order
+    bool success = false;
+    while (!pipeline.inflight.empty() && poll_fpga_completion(pipeline.inflight.front().device_seq, &success)) {
+        AsyncOp op = std::move(pipeline.inflight.front());
+        pipeline.inflight.pop_front();
+        record_device_op(op.transition.device_op, op.posted, success);
+        complete_async(op, finish_transition(op.transition, success));
+        completed++;
+    }
     
-    const auto* entry = get_entry(cache_line_addr);
-    return entry ? entry->tier : MemoryTier::L3_CXL;
+    if (completed > 0 && pipeline.event_fd >= 0 && pipeline.reaper.joinable()) {
+        uint64_t value = completed;
+        ssize_t written = write(pipeline.event_fd, &value, sizeof(value));
+        (void)written;
+    }
+    if (idle) {
+        *idle = pipeline.deferred.empty() && pipeline.inflight.empty();
+    }
+    pipeline.reaping.store(std::thread::id(), std::memory_order_relaxed);
+    return completed;
+}
+
+void CoherenceManager::async_loop() {
+    auto& pipeline = *async_;
+    bool idle = true;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            auto ready = [&pipeline] { return pipeline.count > 0 || pipeline.stop; };
+            if (idle) {
+                pipeline.wake.wait(lock, ready);
+            } else {
+                // Deferred or in-flight ops: keep polling
+                pipeline.wake.wait_for(lock, std::chrono::microseconds(50), ready);
+            }
+            if (pipeline.stop && pipeline.outstanding == 0) {
+                return;
+            }
+        }
+        
+        std::lock_guard<std::mutex> lock(pipeline.reap_mutex);
+        process_async(&idle);
+    }
+}
+
+CoherenceManager::CoherenceState CoherenceManager::get_state(uint64_t addr) const {
+    uint64_t meta = 0;
+    return load_meta(directory_tag(addr), &meta) ? meta_state(meta) : CoherenceState::INVALID;
+}
+
+uint8_t CoherenceManager::get_sharers(uint64_t addr) const {
+    uint64_t meta = 0;
+    if (!load_meta(directory_tag(addr), &meta) || meta_state(meta) == CoherenceState::INVALID) {
+        return 0;
+    }
+    return static_cast<uint8_t>((meta & kSharerMask) >> kSharerShift);
+}
+
+int CoherenceManager::get_owner(uint64_t addr) const {
+    uint64_t meta = 0;
+    if (!load_meta(directory_tag(addr), &meta) || !is_dirty_state(meta_state(meta))) {
+        return -1;
+    }
+    return dirty_owner(meta);
+}
+
+CoherenceManager::MemoryTier CoherenceManager::get_tier(uint64_t addr) const {
+    uint64_t meta = 0;
+    return load_meta(directory_tag(addr), &meta) ? meta_tier(meta) : MemoryTier::L3_CXL;
 }
 
 bool CoherenceManager::is_valid(uint64_t addr) const {
@@ -207,13 +742,16 @@ bool CoherenceManager::is_modified(uint64_t addr) const {
 }
 
 bool CoherenceManager::promote_to_l1(uint64_t addr) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    auto* entry = get_or_create_entry(cache_line_addr);
+    uint64_t tag = 0;
+    uint64_t meta = 0;
+    if (!acquire_for_address(addr, true, &tag, &meta)) {
+        return false;
+    }
+    CoherenceState state = meta_state(meta);
+    MemoryTier tier = meta_tier(meta);
     
-    if (entry->tier == MemoryTier::L1_GPU) {
+    if (tier == MemoryTier::L1_GPU) {
+        release_entry(tag, state, tier);
         return true;  // Already in L1
     }
     
@@ -223,138 +761,605 @@ bool CoherenceManager::promote_to_l1(uint64_t addr) {
     // 2. Copying to GPU HBM
     // 3. Updating directory
     
-    bool success = send_coherence_op_to_fpga(CoherenceOp::READ, cache_line_addr);
+    bool success = send_coherence_op_to_fpga(CoherenceOp::READ, tag_address(tag), nullptr, tag_span(tag));
     
     if (success) {
-        entry->tier = MemoryTier::L1_GPU;
-        // State remains the same (SHARED/EXCLUSIVE/MODIFIED)
+        tier = MemoryTier::L1_GPU;
+        // State remains the same (SHARED/EXCLUSIVE/MODIFIED/OWNED)
     }
     
+    release_entry(tag, state, tier);
     return success;
 }
 
 bool CoherenceManager::demote_to_l3(uint64_t addr) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    auto* entry = get_entry(cache_line_addr);
-    if (!entry || entry->tier == MemoryTier::L3_CXL) {
-        return true;  // Already in L3 or invalid
+    uint64_t tag = 0;
+    uint64_t meta = 0;
+    if (!acquire_for_address(addr, false, &tag, &meta)) {
+        return true;  // Invalid
     }
     
-    // If modified, writeback first
-    if (entry->state == CoherenceState::MODIFIED) {
-        send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, cache_line_addr);
-        entry->state = CoherenceState::SHARED;
-        stats_.writebacks_performed++;
+    CoherenceState state = meta_state(meta);
+    if (meta_tier(meta) == MemoryTier::L3_CXL) {
+        release_entry(tag, state, MemoryTier::L3_CXL);
+        return true;  // Already in L3
     }
     
-    entry->tier = MemoryTier::L3_CXL;
+    // If modified, writeback first; a failed writeback leaves the line dirty
+    if (is_dirty_state(state) &&
+        send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, tag_address(tag), nullptr, tag_span(tag))) {
+        if (state == CoherenceState::OWNED) {
+            stats_.owned_writebacks.fetch_add(1, std::memory_order_relaxed);
+        }
+        state = CoherenceState::SHARED;
+        stats_.writebacks_performed.fetch_add(1, std::memory_order_relaxed);
+    }
     
+    release_entry(tag, state, MemoryTier::L3_CXL);
     return true;
 }
 
 void CoherenceManager::update_tier(uint64_t addr, MemoryTier new_tier) {
-    uint64_t cache_line_addr = align_to_cache_line(addr);
-    
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    auto* entry = get_or_create_entry(cache_line_addr);
-    entry->tier = new_tier;
+    uint64_t tag = 0;
+    uint64_t meta = 0;
+    if (acquire_for_address(addr, true, &tag, &meta)) {
+        release_entry(tag, meta_state(meta), new_tier);
+    }
 }
 
 bool CoherenceManager::batch_invalidate(const std::vector<uint64_t>& addrs) {
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    bool all_success = true;
+    // Addresses in one unsplit region share a single invalidation
+    std::vector<uint64_t> tags;
+    tags.reserve(addrs.size());
     for (uint64_t addr : addrs) {
-        uint64_t cache_line_addr = align_to_cache_line(addr);
-        auto* entry = get_entry(cache_line_addr);
-        if (entry) {
-            entry->state = CoherenceState::INVALID;
-            // In real implementation, batch these MMIO writes
-            all_success &= send_coherence_op_to_fpga(CoherenceOp::INVALIDATE, cache_line_addr);
+        tags.push_back(directory_tag(addr));
+    }
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+    
+    // Claim every tracked entry (in tag order, so concurrent batches cannot
+    // deadlock), send one descriptor table, then release them all
+    std::vector<uint64_t> claimed;
+    std::vector<MemoryTier> tiers;
+    std::vector<BatchDescriptor> descriptors;
+    claimed.reserve(tags.size());
+    tiers.reserve(tags.size());
+    descriptors.reserve(tags.size());
+    for (uint64_t tag : tags) {
+        uint64_t meta = 0;
+        if (acquire_for_address(tag_address(tag), false, &tag, &meta)) {
+            MemoryTier tier = meta_tier(meta);
+            set_pending_status(tag, CoherenceState::INVALID, tier);
+            unseal_entry(tag);
+            claimed.push_back(tag);
+            tiers.push_back(tier);
+            descriptors.push_back({tag_address(tag), 0, static_cast<uint32_t>(tag_span(tag)),
+                                   static_cast<uint16_t>(CoherenceOp::INVALIDATE), 0});
         }
     }
     
-    stats_.invalidations_sent += addrs.size();
+    bool all_success = send_coherence_batch_to_fpga(descriptors);
+    for (size_t i = 0; i < claimed.size(); i++) {
+        release_entry(claimed[i], CoherenceState::INVALID, tiers[i]);
+    }
+    
+    stats_.invalidations_sent.fetch_add(tags.size(), std::memory_order_relaxed);
     
     return all_success;
 }
 
 bool CoherenceManager::batch_writeback(const std::vector<std::pair<uint64_t, const void*>>& data) {
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    bool all_success = true;
+    // One writeback per entry, in tag order (see batch_invalidate)
+    std::vector<std::pair<uint64_t, const void*>> tagged;
+    tagged.reserve(data.size());
     for (const auto& [addr, ptr] : data) {
-        uint64_t cache_line_addr = align_to_cache_line(addr);
-        auto* entry = get_entry(cache_line_addr);
-        if (entry && entry->state == CoherenceState::MODIFIED) {
-            // In real implementation, batch these operations
-            all_success &= send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, cache_line_addr, ptr, cache_line_size_);
-            entry->state = CoherenceState::SHARED;
-            entry->tier = MemoryTier::L3_CXL;
+        tagged.emplace_back(directory_tag(addr), ptr);
+    }
+    std::stable_sort(tagged.begin(), tagged.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    tagged.erase(std::unique(tagged.begin(), tagged.end(),
+                             [](const auto& a, const auto& b) { return a.first == b.first; }),
+                 tagged.end());
+    
+    std::vector<uint64_t> claimed;
+    std::vector<uint64_t> metas;
+    std::vector<BatchDescriptor> descriptors;
+    for (auto [tag, ptr] : tagged) {
+        uint64_t meta = 0;
+        if (!acquire_for_address(tag_address(tag), false, &tag, &meta)) {
+            continue;
+        }
+        if (is_dirty_state(meta_state(meta))) {
+            claimed.push_back(tag);
+            metas.push_back(meta);
+            // A region entry is cleaned as a whole, so the writeback covers the whole span
+            descriptors.push_back({tag_address(tag), reinterpret_cast<uint64_t>(ptr),
+                                   static_cast<uint32_t>(tag_span(tag)),
+                                   static_cast<uint16_t>(CoherenceOp::WRITEBACK), 0});
+        } else {
+            release_entry(tag, meta_state(meta), meta_tier(meta));
         }
     }
     
-    stats_.writebacks_performed += data.size();
+    bool all_success = send_coherence_batch_to_fpga(descriptors);
+    uint64_t written = 0;
+    for (size_t i = 0; i < claimed.size(); i++) {
+        // A failed writeback leaves the line dirty (see write_back_tags)
+        if (descriptors[i].status == 0) {
+            if (meta_state(metas[i]) == CoherenceState::OWNED) {
+                stats_.owned_writebacks.fetch_add(1, std::memory_order_relaxed);
+            }
+            release_entry(claimed[i], CoherenceState::SHARED, MemoryTier::L3_CXL);
+            written++;
+        } else {
+            release_entry(claimed[i], meta_state(metas[i]), meta_tier(metas[i]));
+        }
+    }
+    
+    stats_.writebacks_performed.fetch_add(written, std::memory_order_relaxed);
     
     return all_success;
 }
 
 CoherenceManager::Statistics CoherenceManager::get_statistics() const {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    return stats_;
+    Statistics stats;
+    stats.total_reads = stats_.total_reads.load(std::memory_order_relaxed);
+    stats.total_writes = stats_.total_writes.load(std::memory_order_relaxed);
+    stats.coherence_ops = stats_.coherence_ops.load(std::memory_order_relaxed);
+    stats.invalidations_sent = stats_.invalidations_sent.load(std::memory_order_relaxed);
+    stats.writebacks_performed = stats_.writebacks_performed.load(std::memory_order_relaxed);
+    stats.directory_hits = stats_.directory_hits.load(std::memory_order_relaxed);
+    stats.directory_misses = stats_.directory_misses.load(std::memory_order_relaxed);
+    stats.region_splits = stats_.region_splits.load(std::memory_order_relaxed);
+    stats.sealed_reads = stats_.sealed_reads.load(std::memory_order_relaxed);
+    stats.sealed_write_violations = stats_.sealed_write_violations.load(std::memory_order_relaxed);
+    stats.device_round_trips = stats_.device_round_trips.load(std::memory_order_relaxed);
+    stats.background_writebacks = stats_.background_writebacks.load(std::memory_order_relaxed);
+    stats.directory_entries = directory_entries_.load(std::memory_order_relaxed);
+    stats.directory_capacity = directory_capacity();
+    stats.evictions = stats_.evictions.load(std::memory_order_relaxed);
+    stats.dirty_evictions = stats_.dirty_evictions.load(std::memory_order_relaxed);
+    stats.eviction_failures = stats_.eviction_failures.load(std::memory_order_relaxed);
+    stats.sharer_invalidations = stats_.sharer_invalidations.load(std::memory_order_relaxed);
+    stats.snoop_writebacks = stats_.snoop_writebacks.load(std::memory_order_relaxed);
+    // A reset between the forward and the writeback can leave more writebacks
+    stats.owned_forwards = stats_.owned_forwards.load(std::memory_order_relaxed);
+    uint64_t owned_writebacks = stats_.owned_writebacks.load(std::memory_order_relaxed);
+    stats.writebacks_saved = stats.owned_forwards > owned_writebacks ? stats.owned_forwards - owned_writebacks : 0;
+    for (size_t i = 0; i < kNumCoherenceOps; i++) {
+        const LatencyHistogram& latency = stats_.op_latency[i];
+        OpStatistics& op = stats.device_ops[i];
+        op.count = latency.count();
+        op.failures = stats_.op_failures[i].load(std::memory_order_relaxed);
+        op.mean_ns = latency.mean();
+        op.p50_ns = latency.percentile(0.50);
+        op.p99_ns = latency.percentile(0.99);
+        op.p999_ns = latency.percentile(0.999);
+        op.max_ns = latency.max();
+    }
+    stats.lock_contentions = stats_.lock_contentions.load(std::memory_order_relaxed);
+    stats.lock_wait_ns = stats_.lock_wait_ns.load(std::memory_order_relaxed);
+    stats.entry_waits = stats_.entry_waits.load(std::memory_order_relaxed);
+    stats.entry_wait_ns = stats_.entry_wait_ns.load(std::memory_order_relaxed);
+    return stats;
 }
 
 void CoherenceManager::reset_statistics() {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
-    std::memset(&stats_, 0, sizeof(stats_));
+    stats_.total_reads.store(0, std::memory_order_relaxed);
+    stats_.total_writes.store(0, std::memory_order_relaxed);
+    stats_.coherence_ops.store(0, std::memory_order_relaxed);
+    stats_.invalidations_sent.store(0, std::memory_order_relaxed);
+    stats_.writebacks_performed.store(0, std::memory_order_relaxed);
+    stats_.directory_hits.store(0, std::memory_order_relaxed);
+    stats_.directory_misses.store(0, std::memory_order_relaxed);
+    stats_.region_splits.store(0, std::memory_order_relaxed);
+    stats_.sealed_reads.store(0, std::memory_order_relaxed);
+    stats_.sealed_write_violations.store(0, std::memory_order_relaxed);
+    stats_.device_round_trips.store(0, std::memory_order_relaxed);
+    stats_.background_writebacks.store(0, std::memory_order_relaxed);
+    stats_.evictions.store(0, std::memory_order_relaxed);
+    stats_.dirty_evictions.store(0, std::memory_order_relaxed);
+    stats_.eviction_failures.store(0, std::memory_order_relaxed);
+    stats_.sharer_invalidations.store(0, std::memory_order_relaxed);
+    stats_.snoop_writebacks.store(0, std::memory_order_relaxed);
+    stats_.owned_forwards.store(0, std::memory_order_relaxed);
+    stats_.owned_writebacks.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < kNumCoherenceOps; i++) {
+        stats_.op_latency[i].reset();
+        stats_.op_failures[i].store(0, std::memory_order_relaxed);
+    }
+    stats_.lock_contentions.store(0, std::memory_order_relaxed);
+    stats_.lock_wait_ns.store(0, std::memory_order_relaxed);
+    stats_.entry_waits.store(0, std::memory_order_relaxed);
+    stats_.entry_wait_ns.store(0, std::memory_order_relaxed);
 }
 
-bool CoherenceManager::sync_directory_from_fpga() {
-    if (!driver_) {
+bool CoherenceManager::sync_directory_from_fpga(SyncReport* report, bool repair) {
+    SyncReport local;
+    SyncReport& result = report ? *report : local;
+    result = SyncReport();
+    if (!driver_ || !driver_->is_open()) {
         return false;
     }
+    auto start = std::chrono::steady_clock::now();
+    
+    // One DMA of the whole device directory; grow the buffer if it reports more entries
+    std::vector<SpeckvDriver::DirectorySnapshotEntry> snapshot(kDefaultDirectoryCapacity);
+    size_t count = 0;
+    while (!driver_->snapshot_directory(snapshot.data(), snapshot.size(), &count)) {
+        if (count <= snapshot.size()) {
+            std::cerr << "CoherenceManager: Directory snapshot failed" << std::endl;
+            return false;
+        }
+        snapshot.resize(count);
+    }
+    snapshot.resize(count);
     
-    // Read FPGA directory statistics via MMIO
-    // In real implementation, use driver_->read_mmio()
+    // Bucket the valid lines by the shard holding their directory key
+    std::array<std::vector<DeviceLine>, kDirectoryShards> buckets;
+    for (const auto& entry : snapshot) {
+        if ((entry.flags & 1) == 0) {
+            continue;
+        }
+        CoherenceState state = static_cast<CoherenceState>(std::min<uint8_t>(entry.state, 4));
+        buckets[hash_tag(directory_tag(entry.addr)) % kDirectoryShards].push_back(
+            DeviceLine{entry.addr, state, entry.sharers});
+        result.device_entries++;
+    }
     
-    std::cout << "CoherenceManager: Syncing directory state from FPGA..." << std::endl;
+    // Shards are independent; workers take them one at a time
+    size_t workers = std::min<size_t>(kDirectoryShards, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<SyncReport> partial(workers);
+    std::atomic<size_t> next_shard{0};
+    auto worker = [&](size_t w) {
+        for (size_t i; (i = next_shard.fetch_add(1)) < kDirectoryShards;) {
+            reconcile_shard(i, buckets[i], repair, &partial[w]);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < workers; w++) {
+        threads.emplace_back(worker, w);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
     
-    // This would read FPGA registers and update local shadow copy
-    // For now, just a placeholder
+    for (const auto& part : partial) {
+        result.host_entries += part.host_entries;
+        result.matched += part.matched;
+        result.state_mismatches += part.state_mismatches;
+        result.device_only += part.device_only;
+        result.host_only += part.host_only;
+        result.repaired += part.repaired;
+        result.skipped += part.skipped;
+        for (const auto& difference : part.differences) {
+            if (result.differences.size() < kMaxSyncDifferences) {
+                result.differences.push_back(difference);
+            }
+        }
+    }
+    result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
     
+    std::cout << "CoherenceManager: Synced directory from FPGA: " << result.device_entries << " device entries, "
+              << result.state_mismatches + result.device_only + result.host_only << " differences, "
+              << result.repaired << " repaired (" << result.elapsed_ms << " ms)" << std::endl;
     return true;
 }
 
-void CoherenceManager::print_directory_state() const {
-    std::lock_guard<std::mutex> lock(directory_mutex_);
-    
-    std::cout << "\n=== Coherence Directory State ===" << std::endl;
-    std::cout << "Total entries: " << directory_.size() << std::endl;
+void CoherenceManager::reconcile_shard(size_t shard_index, const std::vector<DeviceLine>& lines, bool repair,
+                                       SyncReport* report) {
+    auto note = [report](uint64_t addr, CoherenceState host_state, CoherenceState device_state) {
+        if (report->differences.size() < kMaxSyncDifferences) {
+            report->differences.push_back(SyncDifference{addr, host_state, device_state});
+        }
+    };
+    
+    std::vector<uint64_t> seen;
+    seen.reserve(lines.size());
+    for (const DeviceLine& line : lines) {
+        uint64_t tag = directory_tag(line.addr);
+        bool region = (tag & kTagKindMask) == kRegionTag;
+        seen.push_back(tag);
+        
+        // Region entries are only compared, so they are not claimed
+        uint64_t meta = 0;
+        bool created = false;
+        bool claimed = false;
+        if (repair && !region) {
+            bool busy = false;
+            if (!acquire_entry(tag, true, &meta, &created, &busy)) {
+                report->skipped++;
+                continue;
+            }
+            claimed = true;
+        } else if (!load_meta(tag, &meta)) {
+            created = true;
+        }
+        CoherenceState host_state = created ? CoherenceState::INVALID : meta_state(meta);
+        
+        CoherenceState state = host_state;
+        if (host_state == line.state) {
+            report->matched++;
+        } else {
+            if (host_state == CoherenceState::INVALID) {
+                report->device_only++;
+            } else {
+                report->state_mismatches++;
+            }
+            note(line.addr, host_state, line.state);
+            if (repair) {
+                if (region || is_dirty_state(host_state)) {
+                    report->skipped++;
+                } else {
+                    state = line.state;
+                    report->repaired++;
+                }
+            }
+        }
+        
+        if (claimed) {
+            // A new entry takes the device's sharers; an existing one keeps its own
+            uint64_t sharers = created ? (static_cast<uint64_t>(line.sharers) << kSharerShift) & kSharerMask : 0;
+            release_entry(tag, state, created ? MemoryTier::L3_CXL : meta_tier(meta), false, sharers);
+        }
+    }
     
-    size_t invalid_count = 0, shared_count = 0, exclusive_count = 0, modified_count = 0;
-    size_t l1_count = 0, l2_count = 0, l3_count = 0;
+    // Host entries the device no longer has
+    std::sort(seen.begin(), seen.end());
+    DirectoryShard& shard = shards_[shard_index];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for_each_entry(shard, [&](const DirectoryEntry& entry) {
+        uint64_t tag = entry.tag.load(std::memory_order_acquire);
+        uint64_t meta = entry.meta.load(std::memory_order_acquire);
+        CoherenceState state = meta_state(meta);
+        if ((meta & kSplitBit) || state == CoherenceState::INVALID) {
+            return;
+        }
+        report->host_entries++;
+        if (!std::binary_search(seen.begin(), seen.end(), tag)) {
+            report->host_only++;
+            note(tag_address(tag), state, CoherenceState::INVALID);
+        }
+    });
+}
+
+bool CoherenceManager::enable_region_mode(size_t region_size) {
+    if (region_size < cache_line_size_ || (region_size & (region_size - 1)) != 0 || directory_size() != 0) {
+        return false;
+    }
+    region_size_ = region_size;
+    return true;
+}
+
+bool CoherenceManager::disable_region_mode() {
+    if (directory_size() != 0) {
+        return false;
+    }
+    region_size_ = 0;
+    return true;
+}
+
+bool CoherenceManager::seal_pages(uint64_t addr, size_t size) {
+    uint64_t first = addr & ~(uint64_t)(kSealedPageSize - 1);
+    uint64_t end = addr + std::max<size_t>(size, 1);
     
-    for (const auto& [addr, entry] : directory_) {
-        switch (entry->state) {
-            case CoherenceState::INVALID: invalid_count++; break;
-            case CoherenceState::SHARED: shared_count++; break;
-            case CoherenceState::EXCLUSIVE: exclusive_count++; break;
-            case CoherenceState::MODIFIED: modified_count++; break;
+    // Bring every directory entry overlapping the pages to SHARED once
+    uint64_t pages_end = (end + kSealedPageSize - 1) & ~(uint64_t)(kSealedPageSize - 1);
+    bool all_success = true;
+    for (uint64_t cursor = first; cursor < pages_end; ) {
+        uint64_t tag = 0;
+        uint64_t meta = 0;
+        if (!acquire_for_address(cursor, true, &tag, &meta)) {
+            return false;
         }
+        CoherenceState state = meta_state(meta);
+        MemoryTier tier = meta_tier(meta);
         
-        switch (entry->tier) {
-            case MemoryTier::L1_GPU: l1_count++; break;
-            case MemoryTier::L2_PREFETCH: l2_count++; break;
-            case MemoryTier::L3_CXL: l3_count++; break;
+        bool success = true;
+        if (state == CoherenceState::INVALID) {
+            success = send_coherence_op_to_fpga(CoherenceOp::READ, tag_address(tag), nullptr, tag_span(tag));
+            if (success) {
+                tier = MemoryTier::L1_GPU;
+            }
+        } else if (is_dirty_state(state)) {
+            success = send_coherence_op_to_fpga(CoherenceOp::WRITEBACK, tag_address(tag), nullptr, tag_span(tag));
+            stats_.writebacks_performed.fetch_add(1, std::memory_order_relaxed);
         }
+        
+        release_entry(tag, success ? CoherenceState::SHARED : state, tier);
+        all_success &= success;
+        
+        // A region entry may cover several pages
+        cursor = tag_address(tag) + tag_span(tag);
+    }
+    if (!all_success) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> lock(sealed_mutex_);
+    for (uint64_t page = first; page < pages_end; page += kSealedPageSize) {
+        set_page_flag(page, kPageSealed);
+    }
+    return true;
+}
+
+void CoherenceManager::unseal_pages(uint64_t addr, size_t size) {
+    if (sealed_count_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    
+    uint64_t first = addr & ~(uint64_t)(kSealedPageSize - 1);
+    uint64_t end = addr + std::max<size_t>(size, 1);
+    std::lock_guard<std::mutex> lock(sealed_mutex_);
+    for (uint64_t page = first; page < end; page += kSealedPageSize) {
+        set_page_flag(page, kPageUnsealed);
+    }
+}
+
+bool CoherenceManager::is_sealed(uint64_t addr) const {
+    if (sealed_count_.load(std::memory_order_acquire) == 0) {
+        return false;
     }
     
+    const SealedTable* table = sealed_table_.load(std::memory_order_acquire);
+    uint64_t page = addr & ~(uint64_t)(kSealedPageSize - 1);
+    size_t slot = hash_tag(page) & table->mask;
+    while (true) {
+        uint64_t key = table->keys[slot].load(std::memory_order_acquire);
+        if (key == 0) {
+            return false;
+        }
+        if ((key & ~kTagKindMask) == page) {
+            return (key & kTagKindMask) == kPageSealed;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+}
+
+void CoherenceManager::set_page_flag(uint64_t page, uint64_t flag) {
+    SealedTable* table = sealed_tables_.empty() ? nullptr : sealed_tables_.back().get();
+    
+    if (table) {
+        size_t slot = hash_tag(page) & table->mask;
+        while (uint64_t key = table->keys[slot].load(std::memory_order_relaxed)) {
+            if ((key & ~kTagKindMask) == page) {
+                if ((key & kTagKindMask) != flag) {
+                    table->keys[slot].store(page | flag, std::memory_order_release);
+                    if (flag == kPageSealed) {
+                        sealed_count_.fetch_add(1, std::memory_order_release);
+                    } else {
+                        sealed_count_.fetch_sub(1, std::memory_order_release);
+                    }
+                }
+                return;
+            }
+            slot = (slot + 1) & table->mask;
+        }
+    }
+    if (flag == kPageUnsealed) {
+        return;  // Never sealed
+    }
+    
+    if (!table || (sealed_keys_ + 1) * 2 > table->mask + 1) {
+        // Lookups may still be probing the old table; it stays allocated
+        size_t capacity = table ? (table->mask + 1) * 2 : 1024;
+        auto grown = std::make_unique<SealedTable>();
+        grown->mask = capacity - 1;
+        grown->keys = std::make_unique<std::atomic<uint64_t>[]>(capacity);
+        for (size_t i = 0; i < capacity; ++i) {
+            grown->keys[i].store(0, std::memory_order_relaxed);
+        }
+        if (table) {
+            for (size_t i = 0; i <= table->mask; ++i) {
+                uint64_t key = table->keys[i].load(std::memory_order_relaxed);
+                if (key == 0) {
+                    continue;
+                }
+                size_t slot = hash_tag(key & ~kTagKindMask) & grown->mask;
+                while (grown->keys[slot].load(std::memory_order_relaxed)) {
+                    slot = (slot + 1) & grown->mask;
+                }
+                grown->keys[slot].store(key, std::memory_order_relaxed);
+            }
+        }
+        table = grown.get();
+        sealed_tables_.push_back(std::move(grown));
+        sealed_table_.store(table, std::memory_order_release);
+    }
+    
+    size_t slot = hash_tag(page) & table->mask;
+    while (table->keys[slot].load(std::memory_order_relaxed)) {
+        slot = (slot + 1) & table->mask;
+    }
+    table->keys[slot].store(page | kPageSealed, std::memory_order_release);
+    sealed_keys_++;
+    sealed_count_.fetch_add(1, std::memory_order_release);
+}
+
+void CoherenceManager::unseal_entry(uint64_t tag) {
+    unseal_pages(tag_address(tag), tag_span(tag));
+}
+
+bool CoherenceManager::trap_sealed_write(uint64_t addr, size_t size) {
+    if (sealed_count_.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    
+    uint64_t first = addr & ~(uint64_t)(kSealedPageSize - 1);
+    uint64_t end = addr + std::max<size_t>(size, 1);
+    for (uint64_t page = first; page < end; page += kSealedPageSize) {
+        if (is_sealed(page)) {
+            stats_.sealed_write_violations.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "CoherenceManager: rejected write to sealed page 0x"
+                      << std::hex << page << std::dec << std::endl;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t CoherenceManager::directory_size() const {
+    size_t total = 0;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.size;
+    }
+    return total;
+}
+
+size_t CoherenceManager::directory_memory_bytes() const {
+    size_t bytes = sizeof(shards_);
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const DirectoryTable* table : {shard.owned_table.get(), shard.owned_draining.get()}) {
+            if (table) {
+                bytes += sizeof(DirectoryTable) + table->capacity() * sizeof(DirectoryEntry);
+            }
+        }
+        for (const auto& table : shard.retired) {
+            bytes += sizeof(DirectoryTable) + table->capacity() * sizeof(DirectoryEntry);
+        }
+    }
+    return bytes;
+}
+
+void CoherenceManager::print_directory_state() const {
+    size_t total_entries = 0;
+    size_t invalid_count = 0, shared_count = 0, exclusive_count = 0, modified_count = 0, owned_count = 0;
+    size_t l1_count = 0, l2_count = 0, l3_count = 0;
+    
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total_entries += shard.size;
+        
+        for_each_entry(shard, [&](const DirectoryEntry& entry) {
+            switch (entry.state()) {
+                case CoherenceState::INVALID: invalid_count++; break;
+                case CoherenceState::SHARED: shared_count++; break;
+                case CoherenceState::EXCLUSIVE: exclusive_count++; break;
+                case CoherenceState::MODIFIED: modified_count++; break;
+                case CoherenceState::OWNED: owned_count++; break;
+            }
+            
+            switch (entry.tier()) {
+                case MemoryTier::L1_GPU: l1_count++; break;
+                case MemoryTier::L2_PREFETCH: l2_count++; break;
+                case MemoryTier::L3_CXL: l3_count++; break;
+            }
+        });
+    }
+    
+    std::cout << "\n=== Coherence Directory State ===" << std::endl;
+    std::cout << "Total entries: " << total_entries;
+    if (shard_capacity_ != 0) {
+        std::cout << " / " << directory_capacity();
+    }
+    std::cout << std::endl;
+    
     std::cout << "States: I=" << invalid_count << ", S=" << shared_count 
-              << ", E=" << exclusive_count << ", M=" << modified_count << std::endl;
+              << ", E=" << exclusive_count << ", M=" << modified_count
+              << ", O=" << owned_count << std::endl;
     std::cout << "Tiers: L1=" << l1_count << ", L2=" << l2_count << ", L3=" << l3_count << std::endl;
     
     auto stats = get_statistics();
@@ -364,33 +1369,688 @@ void CoherenceManager::print_directory_state() const {
     std::cout << "  Coherence ops: " << stats.coherence_ops << std::endl;
     std::cout << "  Invalidations: " << stats.invalidations_sent << std::endl;
     std::cout << "  Writebacks: " << stats.writebacks_performed << std::endl;
+    std::cout << "  Writebacks saved (OWNED): " << stats.writebacks_saved
+              << " of " << stats.owned_forwards << " deferred" << std::endl;
     std::cout << "  Directory hit rate: " << (stats.hit_rate() * 100.0) << "%" << std::endl;
+    std::cout << "  Evictions: " << stats.evictions << " (" << stats.dirty_evictions << " written back)" << std::endl;
     std::cout << "================================\n" << std::endl;
 }
 
 // Private helper functions
 
-CoherenceManager::DirectoryEntry* CoherenceManager::get_entry(uint64_t addr) {
-    auto it = directory_.find(addr);
-    return it != directory_.end() ? it->second.get() : nullptr;
+uint64_t CoherenceManager::hash_tag(uint64_t tag) {
+    // splitmix64 finalizer; tracked addresses share their low bits
+    uint64_t h = tag;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+CoherenceManager::DirectoryShard& CoherenceManager::shard_for(uint64_t tag) const {
+    return shards_[hash_tag(tag) % kDirectoryShards];
+}
+
+CoherenceManager::DirectoryEntry* CoherenceManager::probe(
+    const DirectoryTable* table,
+    uint64_t tag,
+    uint64_t hash
+) {
+    // The shard index uses the low hash bits; start from the ones above them
+    size_t group = (hash / kDirectoryShards) & table->group_mask;
+    for (size_t probed = 0; probed <= table->group_mask; ++probed) {
+        EntryGroup& g = table->groups[group];
+        
+        // Tags are matched as a group; the matching slot is then re-read
+        // through its atomic so the caller observes a published entry
+#if defined(__AVX512F__)
+        __m512i words = _mm512_load_si512(static_cast<const void*>(&g));
+        __mmask8 hits = _mm512_cmpeq_epi64_mask(words, _mm512_set1_epi64(static_cast<long long>(tag))) & 0x55;
+        __mmask8 empty = _mm512_cmpeq_epi64_mask(words, _mm512_setzero_si512()) & 0x55;
+        while (hits) {
+            size_t slot = static_cast<size_t>(__builtin_ctz(hits)) / 2;
+            if (g.entries[slot].tag.load(std::memory_order_acquire) == tag) {
+                return &g.entries[slot];
+            }
+            hits &= hits - 1;
+        }
+        if (empty) {
+            return nullptr;
+        }
+#elif defined(__AVX2__)
+        __m256i key = _mm256_set1_epi64x(static_cast<long long>(tag));
+        __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(&g.entries[0]));
+        __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(&g.entries[2]));
+        int hits = (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, key))) & 0x5) |
+                   ((_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, key))) & 0x5) << 4);
+        int empty = (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, _mm256_setzero_si256()))) & 0x5) |
+                    (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, _mm256_setzero_si256()))) & 0x5);
+        while (hits) {
+            size_t slot = static_cast<size_t>(__builtin_ctz(hits)) / 2;
+            if (g.entries[slot].tag.load(std::memory_order_acquire) == tag) {
+                return &g.entries[slot];
+            }
+            hits &= hits - 1;
+        }
+        if (empty) {
+            return nullptr;
+        }
+#else
+        for (size_t slot = 0; slot < kGroupEntries; ++slot) {
+            uint64_t current = g.entries[slot].tag.load(std::memory_order_acquire);
+            if (current == tag) {
+                return &g.entries[slot];
+            }
+            if (current == 0) {
+                return nullptr;
+            }
+        }
+#endif
+        group = (group + 1) & table->group_mask;
+    }
+    return nullptr;
+}
+
+bool CoherenceManager::load_meta(uint64_t tag, uint64_t* meta) const {
+    auto& shard = shard_for(tag);
+    uint64_t hash = hash_tag(tag);
+    
+    // Registering as a reader keeps a drained table alive until we are done;
+    // the newer table is checked first, since an entry is only moved forward
+    shard.readers.fetch_add(1, std::memory_order_seq_cst);
+    DirectoryEntry* entry = nullptr;
+    const DirectoryTable* table = shard.table.load(std::memory_order_seq_cst);
+    const DirectoryTable* draining = shard.draining.load(std::memory_order_seq_cst);
+    if (table) {
+        entry = probe(table, tag, hash);
+    }
+    if (!entry && draining) {
+        entry = probe(draining, tag, hash);
+    }
+    if (entry) {
+        *meta = entry->meta.load(std::memory_order_acquire);
+        // The slot may have been evicted and reused since it matched
+        if (entry->tag.load(std::memory_order_acquire) != tag) {
+            entry = nullptr;
+        }
+    }
+    shard.readers.fetch_sub(1, std::memory_order_release);
+    return entry != nullptr;
+}
+
+uint64_t CoherenceManager::directory_tag(uint64_t addr) const {
+    if (region_size_ == 0) {
+        return line_tag(addr);
+    }
+    
+    uint64_t tag = region_tag(addr);
+    uint64_t meta = 0;
+    if (load_meta(tag, &meta) && (meta & kSplitBit)) {
+        return line_tag(addr);
+    }
+    return tag;
+}
+
+bool CoherenceManager::try_read_hit(uint64_t addr, uint8_t agent) {
+    uint64_t tag = region_size_ ? region_tag(addr) : line_tag(addr);
+    
+    while (true) {
+        auto& shard = shard_for(tag);
+        uint64_t hash = hash_tag(tag);
+        
+        shard.readers.fetch_add(1, std::memory_order_seq_cst);
+        DirectoryEntry* entry = nullptr;
+        const DirectoryTable* table = shard.table.load(std::memory_order_seq_cst);
+        const DirectoryTable* draining = shard.draining.load(std::memory_order_seq_cst);
+        if (table) {
+            entry = probe(table, tag, hash);
+        }
+        if (!entry && draining) {
+            entry = probe(draining, tag, hash);
+        }
+        
+        uint64_t meta = entry ? entry->meta.load(std::memory_order_acquire) : 0;
+        if (entry && entry->tag.load(std::memory_order_acquire) != tag) {
+            entry = nullptr;    // evicted since it matched
+        }
+        bool hit = entry && (meta & (kPendingBit | kSplitBit)) == 0 &&
+                   meta_state(meta) != CoherenceState::INVALID && (meta & sharer_bit(agent)) != 0;
+        if (hit) {
+            record_access(entry, access_stamp());
+        }
+        shard.readers.fetch_sub(1, std::memory_order_release);
+        
+        if (entry && (meta & kSplitBit)) {
+            tag = line_tag(addr);
+            continue;
+        }
+        return hit;
+    }
+}
+
+CoherenceManager::DirectoryEntry* CoherenceManager::locate(DirectoryShard& shard, uint64_t tag) const {
+    uint64_t hash = hash_tag(tag);
+    DirectoryTable* table = shard.owned_table.get();
+    DirectoryEntry* entry = table ? probe(table, tag, hash) : nullptr;
+    if (!entry && shard.owned_draining) {
+        entry = probe(shard.owned_draining.get(), tag, hash);
+    }
+    return entry;
+}
+
+template <typename Fn>
+void CoherenceManager::for_each_entry(const DirectoryShard& shard, Fn&& fn) {
+    // Groups of the draining table below the cursor have already moved
+    if (shard.owned_draining) {
+        const DirectoryTable& draining = *shard.owned_draining;
+        for (size_t g = shard.migrate_cursor; g <= draining.group_mask; ++g) {
+            for (const DirectoryEntry& entry : draining.groups[g].entries) {
+                uint64_t tag = entry.tag.load(std::memory_order_relaxed);
+                if (tag != 0 && tag != kTombstoneTag) {
+                    fn(entry);
+                }
+            }
+        }
+    }
+    if (shard.owned_table) {
+        const DirectoryTable& table = *shard.owned_table;
+        for (size_t g = 0; g <= table.group_mask; ++g) {
+            for (const DirectoryEntry& entry : table.groups[g].entries) {
+                uint64_t tag = entry.tag.load(std::memory_order_relaxed);
+                if (tag != 0 && tag != kTombstoneTag) {
+                    fn(entry);
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+// Claim the first free or evicted slot in a group; only the shard lock
+// holder inserts, so no other thread races for the slot. The meta store is a
+// release so a lock-free reader that sees the new meta also sees the
+// eviction of the slot's previous tag.
+CoherenceManager::DirectoryEntry* claim_slot(
+    CoherenceManager::DirectoryEntry* group_begin,
+    size_t group_entries,
+    uint64_t tag,
+    uint64_t meta,
+    uint64_t tombstone,
+    bool* reused
+) {
+    for (size_t slot = 0; slot < group_entries; ++slot) {
+        auto& entry = group_begin[slot];
+        uint64_t current = entry.tag.load(std::memory_order_relaxed);
+        if (current == 0 || current == tombstone) {
+            entry.meta.store(meta, std::memory_order_release);
+            entry.tag.store(tag, std::memory_order_release);
+            *reused = current == tombstone;
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+void CoherenceManager::migrate_groups(DirectoryShard& shard, size_t max_groups) {
+    DirectoryTable* draining = shard.owned_draining.get();
+    DirectoryTable* table = shard.owned_table.get();
+    
+    for (size_t moved = 0; moved < max_groups && shard.migrate_cursor <= draining->group_mask; ++moved) {
+        for (DirectoryEntry& entry : draining->groups[shard.migrate_cursor].entries) {
+            uint64_t tag = entry.tag.load(std::memory_order_relaxed);
+            if (tag == 0 || tag == kTombstoneTag) {
+                continue;
+            }
+            // The old copy stays intact for readers already probing it
+            size_t group = (hash_tag(tag) / kDirectoryShards) & table->group_mask;
+            bool reused = false;
+            while (!claim_slot(table->groups[group].entries, kGroupEntries, tag,
+                               entry.meta.load(std::memory_order_acquire), kTombstoneTag, &reused)) {
+                group = (group + 1) & table->group_mask;
+            }
+        }
+        shard.migrate_cursor++;
+    }
+    
+    if (shard.migrate_cursor > draining->group_mask) {
+        shard.draining.store(nullptr, std::memory_order_seq_cst);
+        shard.retired.push_back(std::move(shard.owned_draining));
+        shard.migrate_cursor = 0;
+        release_retired(shard);
+    }
+}
+
+CoherenceManager::DirectoryEntry* CoherenceManager::pick_victim(DirectoryShard& shard) {
+    // Evict only from a settled table
+    if (shard.owned_draining) {
+        migrate_groups(shard, shard.owned_draining->group_mask + 1);
+    }
+    DirectoryTable* table = shard.owned_table.get();
+    if (!table) {
+        return nullptr;
+    }
+    
+    uint64_t now = access_stamp();
+    DirectoryEntry* clean = nullptr;
+    DirectoryEntry* dirty = nullptr;
+    uint64_t clean_age = 0;
+    uint64_t dirty_age = 0;
+    size_t sampled = 0;
+    size_t groups = table->group_mask + 1;
+    for (size_t scanned = 0; scanned < groups && sampled < kEvictionSample; ++scanned) {
+        size_t g = (shard.evict_hand + scanned) & table->group_mask;
+        for (DirectoryEntry& entry : table->groups[g].entries) {
+            uint64_t tag = entry.tag.load(std::memory_order_relaxed);
+            if (tag == 0 || tag == kTombstoneTag) {
+                continue;
+            }
+            sampled++;
+            
+            // A split region redirects lookups to its lines; keep it
+            uint64_t meta = entry.meta.load(std::memory_order_relaxed);
+            if (meta & (kPendingBit | kSplitBit)) {
+                continue;
+            }
+            if (meta_state(meta) == CoherenceState::INVALID) {
+                shard.evict_hand = (g + 1) & table->group_mask;
+                return &entry;
+            }
+            uint64_t age = (now - ((meta >> kStampShift) & kStampMask)) & kStampMask;
+            if (is_dirty_state(meta_state(meta))) {
+                if (!dirty || age > dirty_age) {
+                    dirty = &entry;
+                    dirty_age = age;
+                }
+            } else if (!clean || age > clean_age) {
+                clean = &entry;
+                clean_age = age;
+            }
+        }
+        if (sampled >= kEvictionSample) {
+            shard.evict_hand = (g + 1) & table->group_mask;
+        }
+    }
+    return clean ? clean : dirty;
+}
+
+void CoherenceManager::evict_entry(DirectoryShard& shard, DirectoryEntry* entry) {
+    uint64_t meta = entry->meta.load(std::memory_order_relaxed);
+    uint64_t tag = entry->tag.load(std::memory_order_relaxed);
+    if (meta & kDirtyBit) {
+        track_dirty(shard, tag, meta, pack_status(CoherenceState::INVALID, MemoryTier::L3_CXL, false));
+    }
+    
+    // An evicted entry can no longer track its sharers; the caller has
+    // already back-invalidated them on the device
+    if (meta_state(meta) != CoherenceState::INVALID) {
+        stats_.sharer_invalidations.fetch_add(__builtin_popcountll(meta & kSharerMask), std::memory_order_relaxed);
+    }
+    
+    // Probes continue past the tombstone; inserts reuse it
+    entry->tag.store(kTombstoneTag, std::memory_order_release);
+    shard.size--;
+    shard.tombstones++;
+    directory_entries_.fetch_sub(1, std::memory_order_relaxed);
+    stats_.evictions.fetch_add(1, std::memory_order_relaxed);
 }
 
-const CoherenceManager::DirectoryEntry* CoherenceManager::get_entry(uint64_t addr) const {
-    auto it = directory_.find(addr);
-    return it != directory_.end() ? it->second.get() : nullptr;
+void CoherenceManager::set_directory_capacity(size_t entries) {
+    shard_capacity_ = (entries + kDirectoryShards - 1) / kDirectoryShards;
 }
 
-CoherenceManager::DirectoryEntry* CoherenceManager::get_or_create_entry(uint64_t addr) {
-    auto it = directory_.find(addr);
-    if (it != directory_.end()) {
-        return it->second.get();
+void CoherenceManager::release_retired(DirectoryShard& shard) {
+    // A lookup that registered after draining was cleared cannot reach a
+    // retired table, so none is in use once the reader count drops to zero
+    if (!shard.retired.empty() && shard.readers.load(std::memory_order_seq_cst) == 0) {
+        shard.retired.clear();
+    }
+}
+
+CoherenceManager::DirectoryEntry* CoherenceManager::get_or_create_entry(
+    DirectoryShard& shard,
+    uint64_t tag,
+    bool* created
+) {
+    if (auto* entry = locate(shard, tag)) {
+        return entry;
+    }
+    
+    release_retired(shard);
+    
+    if (shard.owned_draining) {
+        migrate_groups(shard, 2);
+    }
+    
+    size_t capacity = shard.owned_table ? shard.owned_table->capacity() : 0;
+    if ((shard.size + shard.tombstones + 1) * 8 > capacity * 7) {
+        // Grow at 7/8 load, counting evicted slots. A previous migration
+        // normally finished long before the new table filled; complete it if
+        // not. Mostly evicted slots are reclaimed by rehashing at the same size.
+        if (shard.owned_draining) {
+            migrate_groups(shard, shard.owned_draining->group_mask + 1);
+        }
+        size_t groups = 16;
+        if (shard.owned_table) {
+            groups = shard.owned_table->group_mask + 1;
+            if ((shard.size + 1) * 16 > capacity * 7) {
+                groups *= 2;
+            }
+        }
+        shard.owned_draining = std::move(shard.owned_table);
+        shard.owned_table = std::make_unique<DirectoryTable>(groups);
+        shard.tombstones = 0;
+        shard.evict_hand = 0;
+        shard.migrate_cursor = 0;
+        shard.draining.store(shard.owned_draining.get(), std::memory_order_seq_cst);
+        shard.table.store(shard.owned_table.get(), std::memory_order_seq_cst);
+        if (!shard.owned_draining) {
+            shard.draining.store(nullptr, std::memory_order_seq_cst);
+        }
+    }
+    
+    DirectoryTable* table = shard.owned_table.get();
+    uint64_t meta = pack_status(CoherenceState::INVALID, MemoryTier::L3_CXL, false);
+    size_t group = (hash_tag(tag) / kDirectoryShards) & table->group_mask;
+    DirectoryEntry* entry = nullptr;
+    bool reused = false;
+    while (!(entry = claim_slot(table->groups[group].entries, kGroupEntries, tag, meta, kTombstoneTag, &reused))) {
+        group = (group + 1) & table->group_mask;
+    }
+    if (reused) {
+        shard.tombstones--;
     }
+    shard.size++;
+    directory_entries_.fetch_add(1, std::memory_order_relaxed);
     
-    auto entry = std::make_unique<DirectoryEntry>();
-    entry->cache_line_addr = addr;
-    auto* ptr = entry.get();
-    directory_[addr] = std::move(entry);
-    return ptr;
+    if (created) {
+        *created = true;
+    }
+    return entry;
+}
+
+bool CoherenceManager::acquire_entry(uint64_t tag, bool create, uint64_t* meta, bool* created, bool* busy) {
+    auto& shard = shard_for(tag);
+    std::unique_lock<std::mutex> lock = lock_shard(shard);
+    
+    // Entries move during migration, so look the entry up again after each wait
+    DirectoryEntry* entry = nullptr;
+    while (true) {
+        if (create && shard_capacity_ != 0 && shard.size >= shard_capacity_ && !locate(shard, tag)) {
+            // Make room. A valid victim's copies are back-invalidated (a dirty
+            // one written back first) in one batch, with the lock released.
+            DirectoryEntry* victim = pick_victim(shard);
+            if (victim && meta_state(victim->meta.load(std::memory_order_relaxed)) != CoherenceState::INVALID) {
+                uint64_t victim_tag = victim->tag.load(std::memory_order_relaxed);
+                uint64_t victim_meta = victim->meta.fetch_or(kPendingBit, std::memory_order_acq_rel);
+                CoherenceState victim_state = meta_state(victim_meta);
+                bool dirty = is_dirty_state(victim_state);
+                lock.unlock();
+                std::vector<BatchDescriptor> descriptors;
+                if (dirty) {
+                    descriptors.push_back({tag_address(victim_tag), 0, static_cast<uint32_t>(tag_span(victim_tag)),
+                                           static_cast<uint16_t>(CoherenceOp::WRITEBACK), 0});
+                }
+                descriptors.push_back({tag_address(victim_tag), 0, static_cast<uint32_t>(tag_span(victim_tag)),
+                                       static_cast<uint16_t>(CoherenceOp::INVALIDATE), 0});
+                bool evicted = send_coherence_batch_to_fpga(descriptors);
+                lock.lock();
+                victim = locate(shard, victim_tag);
+                if (evicted) {
+                    if (dirty) {
+                        stats_.writebacks_performed.fetch_add(1, std::memory_order_relaxed);
+                        stats_.dirty_evictions.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    if (victim_state == CoherenceState::OWNED) {
+                        stats_.owned_writebacks.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    stats_.invalidations_sent.fetch_add(1, std::memory_order_relaxed);
+                    evict_entry(shard, victim);
+                } else {
+                    victim->meta.fetch_and(~kPendingBit, std::memory_order_acq_rel);
+                }
+                lock.unlock();
+                shard.released.notify_all();
+                lock.lock();
+                if (evicted) {
+                    continue;   // the table may have changed meanwhile
+                }
+                // Growing past the capacity would desynchronize from the device
+                stats_.eviction_failures.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else if (victim) {
+                evict_entry(shard, victim);
+            }
+        }
+        
+        entry = create ? get_or_create_entry(shard, tag, created) : locate(shard, tag);
+        if (!entry) {
+            return false;
+        }
+        if (!entry->pending_operation()) {
+            break;
+        }
+        if (busy) {
+            *busy = true;
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        shard.released.wait(lock);
+        auto waited = std::chrono::steady_clock::now() - start;
+        stats_.entry_waits.fetch_add(1, std::memory_order_relaxed);
+        stats_.entry_wait_ns.fetch_add(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()), std::memory_order_relaxed);
+    }
+    
+    *meta = entry->meta.fetch_or(kPendingBit, std::memory_order_acq_rel);
+    return true;
+}
+
+bool CoherenceManager::acquire_for_address(
+    uint64_t addr,
+    bool create,
+    uint64_t* tag,
+    uint64_t* meta,
+    bool* created,
+    bool* busy
+) {
+    *tag = directory_tag(addr);
+    if (!acquire_entry(*tag, create, meta, created, busy)) {
+        return false;
+    }
+    
+    if ((*tag & kTagKindMask) == kRegionTag && (*meta & kSplitBit)) {
+        // Split while we waited for it
+        release_entry(*tag, meta_state(*meta), meta_tier(*meta));
+        *tag = line_tag(addr);
+        return acquire_entry(*tag, create, meta, created, busy);
+    }
+    return true;
+}
+
+void CoherenceManager::release_entry(
+    uint64_t tag,
+    CoherenceState state,
+    MemoryTier tier,
+    bool accessed,
+    uint64_t set_flags
+) {
+    auto& shard = shard_for(tag);
+    {
+        auto lock = lock_shard(shard);
+        DirectoryEntry* entry = locate(shard, tag);
+        uint64_t meta = entry->meta.load(std::memory_order_relaxed);
+        // Sharer and dirty bits only change under the shard mutex, so they are stable across retries
+        uint64_t sharers = (set_flags & kSharerMask) ? (set_flags & kSharerMask) : (meta & kSharerMask);
+        if (state == CoherenceState::INVALID) {
+            sharers = 0;
+        } else if (sharers == 0) {
+            sharers = sharer_bit(kHostAgent);
+        }
+        uint64_t owner = 0;
+        if (state == CoherenceState::OWNED) {
+            owner = (set_flags & kOwnerMask) ? (set_flags & kOwnerMask) : (meta & kOwnerMask);
+        }
+        uint64_t status = pack_status(state, tier, false) | (set_flags & ~(kSharerMask | kOwnerMask)) | sharers | owner;
+        status = track_dirty(shard, tag, meta, status);
+        uint64_t updated;
+        do {
+            updated = (meta & ~(kStatusMask | kPendingBit | kDirtyBit | kSharerMask | kOwnerMask)) | status;
+        } while (!entry->meta.compare_exchange_weak(meta, updated, std::memory_order_acq_rel));
+        if (accessed) {
+            record_access(entry, access_stamp());
+        }
+    }
+    shard.released.notify_all();
+}
+
+uint64_t CoherenceManager::track_dirty(DirectoryShard& shard, uint64_t tag, uint64_t meta, uint64_t updated) {
+    bool was_dirty = (meta & kDirtyBit) != 0;
+    bool dirty = is_dirty_state(meta_state(updated)) && ((meta | updated) & kSplitBit) == 0;
+    if (dirty == was_dirty) {
+        return updated | (meta & kDirtyBit);
+    }
+    
+    if (dirty) {
+        shard.dirty.push_back(tag);
+        shard.dirty_live++;
+        size_t total = dirty_lines_.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (total == writeback_.wake_at.load(std::memory_order_relaxed)) {
+            writeback_.wake.notify_one();
+        }
+        return updated | kDirtyBit;
+    }
+    
+    shard.dirty_live--;
+    dirty_lines_.fetch_sub(1, std::memory_order_relaxed);
+    return updated & ~kDirtyBit;
+}
+
+void CoherenceManager::set_pending_status(uint64_t tag, CoherenceState state, MemoryTier tier) {
+    auto& shard = shard_for(tag);
+    auto lock = lock_shard(shard);
+    DirectoryEntry* entry = locate(shard, tag);
+    uint64_t meta = entry->meta.load(std::memory_order_relaxed);
+    uint64_t updated;
+    do {
+        updated = (meta & ~kStatusMask) | pack_status(state, tier, true);
+    } while (!entry->meta.compare_exchange_weak(meta, updated, std::memory_order_acq_rel));
+}
+
+void CoherenceManager::split_region(uint64_t tag, uint64_t meta) {
+    CoherenceState state = meta_state(meta);
+    MemoryTier tier = meta_tier(meta);
+    uint64_t base = tag_address(tag);
+    
+    // Lines take over the region's state before lookups are redirected to them
+    for (uint64_t offset = 0; offset < region_size_; offset += cache_line_size_) {
+        uint64_t line = line_tag(base + offset);
+        uint64_t line_meta = 0;
+        // A line that cannot be inserted stays untracked, as if it had been evicted
+        if (acquire_entry(line, true, &line_meta)) {
+            release_entry(line, state, tier, false, meta & kSharerMask);
+        }
+    }
+    
+    release_entry(tag, state, tier, false, kSplitBit);
+    stats_.region_splits.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> CoherenceManager::collect_dirty(size_t max) {
+    std::vector<std::pair<uint64_t, uint64_t>> dirty;    // (last access, tag)
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.dirty.empty()) {
+            continue;
+        }
+        
+        // Drop tags that were cleaned or listed twice
+        std::sort(shard.dirty.begin(), shard.dirty.end());
+        shard.dirty.erase(std::unique(shard.dirty.begin(), shard.dirty.end()), shard.dirty.end());
+        size_t kept = 0;
+        for (uint64_t tag : shard.dirty) {
+            DirectoryEntry* entry = locate(shard, tag);
+            uint64_t meta = entry ? entry->meta.load(std::memory_order_acquire) : 0;
+            if (meta & kDirtyBit) {
+                shard.dirty[kept++] = tag;
+                dirty.emplace_back((meta >> kStampShift) & kStampMask, tag);
+            }
+        }
+        shard.dirty.resize(kept);
+    }
+    
+    if (max > 0 && dirty.size() > max) {
+        std::nth_element(dirty.begin(), dirty.begin() + max, dirty.end());
+        dirty.resize(max);
+    }
+    
+    std::vector<uint64_t> tags;
+    tags.reserve(dirty.size());
+    for (const auto& [stamp, tag] : dirty) {
+        tags.push_back(tag);
+    }
+    return tags;
+}
+
+size_t CoherenceManager::write_back_tags(std::vector<uint64_t> tags, bool demote, size_t batch_size) {
+    // Claim in tag order, like batch_invalidate, so concurrent batches cannot deadlock
+    std::sort(tags.begin(), tags.end());
+    
+    size_t written = 0;
+    std::vector<uint64_t> claimed;
+    std::vector<uint64_t> metas;
+    std::vector<BatchDescriptor> descriptors;
+    for (size_t first = 0; first < tags.size(); first += batch_size) {
+        size_t last = std::min(first + batch_size, tags.size());
+        claimed.clear();
+        metas.clear();
+        descriptors.clear();
+        for (size_t i = first; i < last; i++) {
+            uint64_t meta = 0;
+            if (!acquire_entry(tags[i], false, &meta)) {
+                continue;
+            }
+            if (!is_dirty_state(meta_state(meta))) {
+                release_entry(tags[i], meta_state(meta), meta_tier(meta));
+                continue;
+            }
+            claimed.push_back(tags[i]);
+            metas.push_back(meta);
+            // The device sources the line's data by address, so data is 0
+            descriptors.push_back({tag_address(tags[i]), 0, static_cast<uint32_t>(tag_span(tags[i])),
+                                   static_cast<uint16_t>(CoherenceOp::WRITEBACK), 0});
+        }
+        
+        send_coherence_batch_to_fpga(descriptors);
+        for (size_t i = 0; i < claimed.size(); i++) {
+            // A failed writeback leaves the line dirty
+            if (descriptors[i].status == 0) {
+                if (meta_state(metas[i]) == CoherenceState::OWNED) {
+                    stats_.owned_writebacks.fetch_add(1, std::memory_order_relaxed);
+                }
+                release_entry(claimed[i], CoherenceState::SHARED, demote ? MemoryTier::L3_CXL : meta_tier(metas[i]));
+                written++;
+            } else {
+                release_entry(claimed[i], meta_state(metas[i]), meta_tier(metas[i]));
+            }
+        }
+    }
+    return written;
+}
+
+uint64_t CoherenceManager::access_stamp() const {
+    auto elapsed = std::chrono::steady_clock::now() - epoch_;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()) & kStampMask;
+}
+
+void CoherenceManager::record_access(DirectoryEntry* entry, uint64_t stamp) {
+    uint64_t meta = entry->meta.load(std::memory_order_relaxed);
+    uint64_t updated;
+    do {
+        uint64_t count = std::min<uint64_t>((meta >> kCountShift) + 1, kCountMax);
+        updated = (meta & (((1ull << kStampShift) - 1) | kOwnerMask)) | (stamp << kStampShift) | (count << kCountShift);
+    } while (!entry->meta.compare_exchange_weak(meta, updated, std::memory_order_relaxed));
 }
 
 bool CoherenceManager::send_coherence_op_to_fpga(CoherenceOp op, uint64_t addr, const void* data, size_t size) {
@@ -398,59 +2058,229 @@ bool CoherenceManager::send_coherence_op_to_fpga(CoherenceOp op, uint64_t addr,
         return false;
     }
     
-    // In real implementation, this would:
-    // 1. Write operation type to MMIO_COHERENCE_OP_REG
-    // 2. Write address to MMIO_COHERENCE_ADDR registers
-    // 3. If write/writeback, write data via DMA
-    // 4. Poll MMIO_COHERENCE_STATUS_REG for completion
-    
-    // For now, simulate the operation
+    // Write data, if any, moves through the DMA engine; the command itself
+    // goes through the MMIO_COHERENCE_* registers. Without an open device
+    // the operation completes immediately.
+    (void)data;
     pending_ops_++;
+    auto issued = std::chrono::steady_clock::now();
     
-    // Simulate FPGA processing time (would be actual MMIO in real implementation)
-    // driver_->write_mmio(MMIO_COHERENCE_OP_REG, static_cast<uint32_t>(op));
-    // driver_->write_mmio(MMIO_COHERENCE_ADDR_LO_REG, addr & 0xFFFFFFFF);
-    // driver_->write_mmio(MMIO_COHERENCE_ADDR_HI_REG, addr >> 32);
-    
-    bool success = wait_for_fpga_completion();
+    bool success = true;
+    if (driver_->is_open()) {
+        uint64_t seq = 0;
+        success = ring_coherence_doorbell(op, addr, size, &seq) && wait_for_fpga_completion(seq);
+    }
     
     pending_ops_--;
-    
-    update_statistics(op, true);
+    stats_.device_round_trips.fetch_add(1, std::memory_order_relaxed);
+    record_device_op(op, issued, success);
     
     return success;
 }
 
-bool CoherenceManager::wait_for_fpga_completion() {
-    // In real implementation:
-    // while (driver_->read_mmio(MMIO_COHERENCE_STATUS_REG) & 0x1) {
-    //     // Wait for operation complete bit
-    // }
+bool CoherenceManager::post_coherence_op_to_fpga(CoherenceOp op, uint64_t addr, const void* data, size_t size,
+                                                 uint64_t* seq) {
+    if (!driver_) {
+        return false;
+    }
+    
+    // Ring the doorbell without polling MMIO_COHERENCE_STATUS_REG; the
+    // reaper polls it later
+    (void)data;
+    *seq = 0;
+    if (driver_->is_open() && !ring_coherence_doorbell(op, addr, size, seq)) {
+        return false;
+    }
+    pending_ops_++;
+    async_->posted++;
+    stats_.device_round_trips.fetch_add(1, std::memory_order_relaxed);
     
-    // For now, assume immediate completion
     return true;
 }
 
-void CoherenceManager::update_statistics(CoherenceOp op, bool hit) {
-    std::lock_guard<std::mutex> lock(stats_mutex_);
+bool CoherenceManager::poll_fpga_completion(uint64_t seq, bool* success) {
+    if (async_->posted == 0) {
+        return false;
+    }
+    
+    // Without an open device operations complete as soon as they are polled
+    if (!driver_->is_open()) {
+        *success = true;
+    } else if (!poll_device_completion(seq, success)) {
+        return false;
+    }
+    async_->posted--;
+    pending_ops_--;
+    return true;
+}
+
+bool CoherenceManager::ring_coherence_doorbell(CoherenceOp op, uint64_t addr, size_t size, uint64_t* seq) {
+    std::lock_guard<std::mutex> lock(mmio_mutex_);
+    
+    // A doorbell on a full queue is dropped: drain completions until there
+    // is room, holding them for their issuers
+    uint64_t status = 0;
+    while (true) {
+        if (!driver_->read_mmio(MMIO_COHERENCE_STATUS_REG, &status)) {
+            return false;
+        }
+        if (!(status & MMIO_COHERENCE_STATUS_FULL)) {
+            break;
+        }
+        if (!acknowledge_device_completion(status)) {
+            std::this_thread::yield();
+        }
+    }
     
+    // The op register is the doorbell, so it is written last
+    bool rung = driver_->write_mmio(MMIO_COHERENCE_ADDR_LO_REG, addr & 0xFFFFFFFF) &&
+                driver_->write_mmio(MMIO_COHERENCE_ADDR_HI_REG, addr >> 32) &&
+                driver_->write_mmio(MMIO_COHERENCE_SIZE_REG, size) &&
+                driver_->write_mmio(MMIO_COHERENCE_OP_REG, static_cast<uint32_t>(op));
+    if (!rung) {
+        return false;
+    }
+    *seq = doorbells_rung_++;
+    return true;
+}
+
+bool CoherenceManager::acknowledge_device_completion(uint64_t status) {
+    if (!(status & MMIO_COHERENCE_STATUS_DONE)) {
+        return false;
+    }
+    device_results_[completions_acknowledged_++] = !(status & MMIO_COHERENCE_STATUS_ERROR);
+    driver_->write_mmio(MMIO_COHERENCE_STATUS_REG, MMIO_COHERENCE_STATUS_DONE);
+    return true;
+}
+
+bool CoherenceManager::poll_device_completion(uint64_t seq, bool* success) {
+    std::lock_guard<std::mutex> lock(mmio_mutex_);
+    while (true) {
+        auto it = device_results_.find(seq);
+        if (it != device_results_.end()) {
+            *success = it->second;
+            device_results_.erase(it);
+            return true;
+        }
+        
+        // Completions arrive in doorbell order; acknowledge up to seq
+        uint64_t status = 0;
+        if (!driver_->read_mmio(MMIO_COHERENCE_STATUS_REG, &status)) {
+            // The device went away: the command is lost
+            *success = false;
+            return true;
+        }
+        if (!acknowledge_device_completion(status)) {
+            return false;
+        }
+    }
+}
+
+bool CoherenceManager::send_coherence_batch_to_fpga(std::vector<BatchDescriptor>& descriptors) {
+    static_assert(sizeof(BatchDescriptor) == sizeof(SpeckvDriver::CoherenceDescriptor),
+                  "batch descriptors are passed to the driver as-is");
+    
+    if (descriptors.empty()) {
+        return true;
+    }
+    if (!driver_) {
+        for (auto& descriptor : descriptors) {
+            descriptor.status = 1;
+        }
+        return false;
+    }
+    
+    bool all_success = true;
+    for (size_t first = 0; first < descriptors.size(); first += kMaxBatchDescriptors) {
+        size_t count = std::min(kMaxBatchDescriptors, descriptors.size() - first);
+        BatchDescriptor* batch = descriptors.data() + first;
+        pending_ops_ += count;
+        auto issued = std::chrono::steady_clock::now();
+        
+        bool success = true;
+        if (driver_->is_open()) {
+            // One SPECKV_IOCTL_COH_BATCH: the table is handed to the FPGA by
+            // address, one doorbell write starts it, and one completion
+            // reports every status
+            success = driver_->coherence_batch(reinterpret_cast<SpeckvDriver::CoherenceDescriptor*>(batch), count);
+        } else {
+            // Without an open device the table is consumed here
+            for (size_t i = 0; i < count; i++) {
+                CoherenceOp op = static_cast<CoherenceOp>(batch[i].op);
+                bool valid = op == CoherenceOp::WRITE ||
+                             ((op == CoherenceOp::INVALIDATE || op == CoherenceOp::WRITEBACK) && batch[i].size > 0);
+                batch[i].status = valid ? 0 : 1;
+            }
+        }
+        pending_ops_ -= count;
+        stats_.device_round_trips.fetch_add(1, std::memory_order_relaxed);
+        
+        // Every descriptor's round trip is the whole table's
+        for (size_t i = 0; i < count; i++) {
+            bool descriptor_success = success && batch[i].status == 0;
+            record_device_op(static_cast<CoherenceOp>(batch[i].op), issued, descriptor_success);
+            all_success &= descriptor_success;
+        }
+    }
+    
+    return all_success;
+}
+
+bool CoherenceManager::wait_for_fpga_completion(uint64_t seq) {
+    bool success = false;
+    while (!poll_device_completion(seq, &success)) {
+        std::this_thread::yield();
+    }
+    return success;
+}
+
+void CoherenceManager::record_device_op(CoherenceOp op, std::chrono::steady_clock::time_point issued, bool success) {
+    size_t index = static_cast<size_t>(op);
+    if (index >= kNumCoherenceOps) {
+        return;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - issued;
+    stats_.op_latency[index].record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    if (!success) {
+        stats_.op_failures[index].fetch_add(1, std::memory_order_relaxed);
+    }
+    if (op == CoherenceOp::INVALIDATE || op == CoherenceOp::WRITEBACK || op == CoherenceOp::FLUSH) {
+        stats_.coherence_ops.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::unique_lock<std::mutex> CoherenceManager::lock_shard(DirectoryShard& shard) {
+    std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        auto waited = std::chrono::steady_clock::now() - start;
+        stats_.lock_contentions.fetch_add(1, std::memory_order_relaxed);
+        stats_.lock_wait_ns.fetch_add(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()), std::memory_order_relaxed);
+    }
+    return lock;
+}
+
+void CoherenceManager::update_statistics(CoherenceOp op, bool hit) {
     switch (op) {
         case CoherenceOp::READ:
-            stats_.total_reads++;
-            if (hit) stats_.directory_hits++;
-            else stats_.directory_misses++;
+            stats_.total_reads.fetch_add(1, std::memory_order_relaxed);
+            if (hit) stats_.directory_hits.fetch_add(1, std::memory_order_relaxed);
+            else stats_.directory_misses.fetch_add(1, std::memory_order_relaxed);
             break;
             
         case CoherenceOp::WRITE:
-            stats_.total_writes++;
-            if (hit) stats_.directory_hits++;
-            else stats_.directory_misses++;
+            stats_.total_writes.fetch_add(1, std::memory_order_relaxed);
+            if (hit) stats_.directory_hits.fetch_add(1, std::memory_order_relaxed);
+            else stats_.directory_misses.fetch_add(1, std::memory_order_relaxed);
             break;
             
         case CoherenceOp::INVALIDATE:
         case CoherenceOp::WRITEBACK:
         case CoherenceOp::FLUSH:
-            stats_.coherence_ops++;
+            stats_.coherence_ops.fetch_add(1, std::memory_order_relaxed);
             break;
     }
 }
@@ -1,11 +1,18 @@
 #pragma once
 
+#include "latency_histogram.h"
 #include <cstdint>
 #include <memory>
+#include <array>
+#include <deque>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
 
 namespace cxlspeckv {
 
@@ -23,6 +30,11 @@ class SpeckvDriver;
  * - FPGA acts as the home agent and maintains the authoritative directory
  * - This class maintains a shadow copy for fast lookups and batching
  * - GPU accesses are translated through FPGA to maintain coherence
+ *
+ * Threading: the shadow directory is sharded by line address. Queries and
+ * read hits never lock; an operation marks its line pending, releases the
+ * shard lock for the device round-trip, then publishes the new state.
+ * Each shard is a flat open-addressed table of 16-byte entries.
  */
 class CoherenceManager {
 public:
@@ -31,7 +43,8 @@ public:
         INVALID = 0,    // Not cached or invalid
         SHARED = 1,     // Read-only, may be shared with others
         EXCLUSIVE = 2,  // Read-only, not shared
-        MODIFIED = 3    // Modified, must writeback
+        MODIFIED = 3,   // Modified, must writeback
+        OWNED = 4       // Modified and shared: the owner supplies readers, writes back on eviction
     };
     
     // Memory tier for tracking location
@@ -41,6 +54,14 @@ public:
         L3_CXL = 2      // CXL memory pool
     };
     
+    // Directory shards; lines are spread across them by address hash
+    static constexpr size_t kDirectoryShards = 64;
+    
+    // Agents sharing the CXL pool (GPUs or processes). Each entry keeps a
+    // sharer bit per agent, like dir_sharers in the FPGA directory.
+    static constexpr unsigned kMaxAgents = 4;   // NUM_SHARERS in coherence_directory.v
+    static constexpr uint8_t kHostAgent = 0;    // the agent of the single-agent API
+    
     // Coherence operation types
     enum class CoherenceOp : uint8_t {
         READ = 0,
@@ -50,22 +71,49 @@ public:
         FLUSH = 4
     };
     
-    // Directory entry (shadow copy of FPGA directory)
+    // Directory entry (shadow copy of FPGA directory), packed into 16 bytes.
+    // tag holds the tracked address with its low bits marking a cache line
+    // (1) or a region (2); 0 marks a free slot. meta packs
+    //   bits  0-7   state
+    //   bits  8-15  tier
+    //   bit   16    pending operation
+    //   bit   17    region split into per-line entries
+    //   bit   18    on the shard's dirty list
+    //   bits 20-23  sharer bitmap, one bit per agent
+    //   bits 24-47  last access time, milliseconds since construction (wraps after ~4.6 h)
+    //   bits 48-50  owner agent + 1 of an OWNED entry, 0 = none
+    //   bits 51-63  access count, saturating
+    // Both words are atomic so queries read them without locking.
     struct DirectoryEntry {
-        uint64_t cache_line_addr;   // Cache line aligned address
-        CoherenceState state;
-        MemoryTier tier;
-        uint64_t last_access_time;
-        uint32_t access_count;
-        bool pending_operation;
+        std::atomic<uint64_t> tag;
+        std::atomic<uint64_t> meta;
         
-        DirectoryEntry() 
-            : cache_line_addr(0)
-            , state(CoherenceState::INVALID)
-            , tier(MemoryTier::L3_CXL)
-            , last_access_time(0)
-            , access_count(0)
-            , pending_operation(false) {}
+        DirectoryEntry() : tag(0), meta(0) {}
+        
+        uint64_t cache_line_addr() const { return tag.load(std::memory_order_acquire) & ~kTagKindMask; }
+        bool is_region() const { return (tag.load(std::memory_order_acquire) & kTagKindMask) == kRegionTag; }
+        CoherenceState state() const { return meta_state(meta.load(std::memory_order_acquire)); }
+        MemoryTier tier() const { return meta_tier(meta.load(std::memory_order_acquire)); }
+        bool pending_operation() const { return (meta.load(std::memory_order_acquire) & kPendingBit) != 0; }
+        uint32_t last_access_time() const {
+            return static_cast<uint32_t>((meta.load(std::memory_order_relaxed) >> kStampShift) & kStampMask);
+        }
+        uint32_t access_count() const {
+            return static_cast<uint32_t>(meta.load(std::memory_order_relaxed) >> kCountShift);
+        }
+    };
+    
+    static constexpr size_t kNumCoherenceOps = 5;
+    
+    // Device round trips of one op type
+    struct OpStatistics {
+        uint64_t count;         // device ops; each batch descriptor counts
+        uint64_t failures;      // completed with an error
+        double mean_ns;
+        uint64_t p50_ns;
+        uint64_t p99_ns;
+        uint64_t p999_ns;
+        uint64_t max_ns;
     };
     
     // Statistics
@@ -77,6 +125,25 @@ public:
         uint64_t writebacks_performed;
         uint64_t directory_hits;
         uint64_t directory_misses;
+        uint64_t region_splits;         // regions moved to per-line tracking
+        uint64_t sealed_reads;          // reads served without touching the directory
+        uint64_t sealed_write_violations;  // writes rejected because the page is sealed
+        uint64_t device_round_trips;    // doorbells rung on the FPGA (a batch counts once)
+        uint64_t background_writebacks; // lines cleaned by the writeback daemon
+        uint64_t directory_entries;     // occupancy at snapshot time
+        uint64_t directory_capacity;    // 0 = unbounded
+        uint64_t evictions;             // entries dropped to stay within capacity
+        uint64_t dirty_evictions;       // evicted MODIFIED entries, written back first
+        uint64_t eviction_failures;     // inserts refused because evicting the victim failed
+        uint64_t sharer_invalidations;  // invalidations delivered to individual agents
+        uint64_t snoop_writebacks;      // MODIFIED copies written back for another agent
+        uint64_t owned_forwards;        // MODIFIED lines shared as OWNED instead of written back
+        uint64_t writebacks_saved;      // owned_forwards less the OWNED lines written back since
+        OpStatistics device_ops[kNumCoherenceOps];  // indexed by CoherenceOp
+        uint64_t lock_contentions;      // directory shard locks that had to wait
+        uint64_t lock_wait_ns;          // time spent waiting for them
+        uint64_t entry_waits;           // operations that waited out another's on the same entry
+        uint64_t entry_wait_ns;
         
         double hit_rate() const {
             uint64_t total = directory_hits + directory_misses;
@@ -84,6 +151,31 @@ public:
         }
     };
 
+    // Asynchronous pipeline (enable_async)
+    struct AsyncConfig {
+        size_t queue_depth;     // ops submitted but not completed; matches the FPGA directory
+        bool reaper_thread;     // false: the caller reaps with poll_completions(), and a
+                                // submission into a full queue reaps inline
+        
+        AsyncConfig() : queue_depth(4096), reaper_thread(true) {}
+    };
+    
+    // Background writeback (start_writeback_daemon)
+    struct WritebackConfig {
+        size_t high_watermark;          // dirty lines that wake the daemon
+        size_t low_watermark;           // the daemon writes back until this many remain
+        size_t max_lines_per_second;    // rate limit; 0 = unlimited
+        size_t batch_size;              // lines per descriptor batch
+        
+        WritebackConfig()
+            : high_watermark(2048), low_watermark(512), max_lines_per_second(0), batch_size(256) {}
+    };
+    
+    // Completion callback: runs on the reaping thread (or inline on the
+    // submitting thread when no device operation is needed). It must not
+    // wait for queue space: a submission it makes into a full queue fails.
+    using CompletionCallback = void (*)(void* user_data, uint64_t addr, bool success);
+
 public:
     CoherenceManager(std::shared_ptr<SpeckvDriver> driver, size_t cache_line_size = 64);
     ~CoherenceManager();
@@ -97,8 +189,10 @@ public:
      * 2. If miss, send request to FPGA home agent
      * 3. FPGA checks CXL memory and issues coherence actions if needed
      * 4. Update local directory state
+     * A line held only by other agents is fetched for this agent too; if
+     * another agent holds it MODIFIED, that copy is written back first.
      */
-    bool request_read(uint64_t addr, void* data_out, size_t size);
+    bool request_read(uint64_t addr, void* data_out, size_t size, uint8_t agent = kHostAgent);
     
     /**
      * Request write access to a cache line
@@ -108,8 +202,17 @@ public:
      * 3. FPGA sends invalidations to other sharers via CXL.cache
      * 4. FPGA writes to CXL memory
      * 5. Update local directory to MODIFIED state
+     * Only agents in the line's sharer bitmap are invalidated.
      */
-    bool request_write(uint64_t addr, const void* data, size_t size);
+    bool request_write(uint64_t addr, const void* data, size_t size, uint8_t agent = kHostAgent);
+    
+    /**
+     * Drop agent's copy of a line (e.g. evicted from that GPU). A MODIFIED
+     * copy, or the owner's copy of an OWNED line, is written back first and
+     * the other sharers keep a SHARED copy; the line becomes INVALID once no
+     * agent holds it.
+     */
+    bool release_copy(uint64_t addr, uint8_t agent);
     
     /**
      * Invalidate a cache line
@@ -126,10 +229,73 @@ public:
     
     /**
      * Flush all modified cache lines
-     * Writes back all MODIFIED state entries to CXL memory
+     * Writes back all MODIFIED state entries to CXL memory. Only the dirty
+     * set is visited, so the cost does not grow with the directory size.
      */
     bool flush_all();
     
+    // Background writeback
+    
+    /**
+     * Start a thread that cleans MODIFIED lines ahead of eviction and
+     * shutdown: once dirty lines reach high_watermark it writes back the
+     * least recently used ones, in batches and at most max_lines_per_second,
+     * until low_watermark remain. Lines stay in their tier.
+     */
+    bool start_writeback_daemon(const WritebackConfig& config = WritebackConfig());
+    void stop_writeback_daemon();
+    bool is_writeback_daemon_running() const { return writeback_.running.load(std::memory_order_acquire); }
+    
+    /**
+     * Number of MODIFIED entries
+     */
+    size_t dirty_lines() const { return dirty_lines_.load(std::memory_order_relaxed); }
+    
+    // Asynchronous operations
+    
+    /**
+     * Start the async pipeline. Submitted READ, WRITE, INVALIDATE and
+     * WRITEBACK ops go onto a bounded submission ring; the reaper claims each
+     * line, posts the op to the FPGA without waiting, and completes it when
+     * the FPGA reports completion, so ops on different lines overlap. Ops on
+     * the same line complete in submission order.
+     */
+    bool enable_async(const AsyncConfig& config = AsyncConfig());
+    
+    /**
+     * Complete every outstanding op, then stop the reaper
+     */
+    void disable_async();
+    bool is_async_enabled() const { return async_ != nullptr; }
+    
+    /**
+     * Submit an op; blocks only while queue_depth ops are outstanding (in
+     * poll mode it reaps inline until there is room). From a completion
+     * callback a submission into a full queue completes with false instead.
+     * Reads that hit and writes to sealed pages complete immediately. The
+     * data buffer must stay valid until completion.
+     */
+    std::future<bool> submit_async(CoherenceOp op, uint64_t addr, const void* data = nullptr, size_t size = 0);
+    bool submit_async(CoherenceOp op, uint64_t addr, const void* data, size_t size,
+                      CompletionCallback callback, void* user_data);
+    
+    /**
+     * Reap without a reaper thread: issue submitted ops and complete those
+     * the FPGA has finished. Returns the number completed.
+     */
+    size_t poll_completions();
+    
+    /**
+     * eventfd the reaper thread signals with the number of ops it completed,
+     * for callers that wait in an event loop; -1 when unavailable
+     */
+    int completion_fd() const;
+    
+    /**
+     * Ops submitted and not yet completed
+     */
+    size_t outstanding_async_ops() const;
+    
     // Directory queries
     
     /**
@@ -137,6 +303,17 @@ public:
      */
     CoherenceState get_state(uint64_t addr) const;
     
+    /**
+     * Agents holding a copy, one bit per agent (bit 0 = agent 0)
+     */
+    uint8_t get_sharers(uint64_t addr) const;
+    
+    /**
+     * Agent that must write a dirty line back: the writer of a MODIFIED
+     * line or the owner of an OWNED one; -1 if the line is clean
+     */
+    int get_owner(uint64_t addr) const;
+    
     /**
      * Check which tier the data is in
      */
@@ -175,12 +352,13 @@ public:
     
     /**
      * Batch invalidate multiple addresses
-     * More efficient than individual invalidations
+     * Sent to the FPGA as one descriptor table: one doorbell, one completion
      */
     bool batch_invalidate(const std::vector<uint64_t>& addrs);
     
     /**
      * Batch writeback multiple addresses
+     * Modified lines are written back with one doorbell, like batch_invalidate
      */
     bool batch_writeback(const std::vector<std::pair<uint64_t, const void*>>& data);
     
@@ -189,11 +367,98 @@ public:
     Statistics get_statistics() const;
     void reset_statistics();
     
+    // Outcome of sync_directory_from_fpga
+    struct SyncDifference {
+        uint64_t addr;
+        CoherenceState host_state;      // INVALID if untracked
+        CoherenceState device_state;    // INVALID if absent from the device
+    };
+    
+    struct SyncReport {
+        uint64_t device_entries = 0;    // valid entries in the device snapshot
+        uint64_t host_entries = 0;      // valid host entries
+        uint64_t matched = 0;
+        uint64_t state_mismatches = 0;  // valid on both sides, states differ
+        uint64_t device_only = 0;       // valid on the device only
+        uint64_t host_only = 0;         // valid on the host only
+        uint64_t repaired = 0;          // host entries given the device's state
+        uint64_t skipped = 0;           // pending, or left as they were (see below)
+        double elapsed_ms = 0.0;
+        std::vector<SyncDifference> differences;    // the first kMaxSyncDifferences
+    };
+    static constexpr size_t kMaxSyncDifferences = 64;
+    
+    /**
+     * Reconcile the shadow directory with the device, e.g. after a fault or
+     * restart. The device DMAs its whole directory into a host buffer in one
+     * snapshot, which is compared with the shadow copy shard by shard on
+     * parallel threads.
+     *
+     * With repair set, host entries take the device's state where they
+     * differ, except:
+     * - a line the host holds MODIFIED stays MODIFIED, since its writeback
+     *   is still owed;
+     * - a region entry is not changed from a single line's state;
+     * - entries with an operation pending are skipped.
+     * Lines only the host tracks are reported but kept, because the device's
+     * direct-mapped directory displaces lines on conflicts.
+     * Returns false if no device is open or the snapshot failed.
+     */
+    bool sync_directory_from_fpga(SyncReport* report = nullptr, bool repair = true);
+    
+    /**
+     * Track coherence per region of region_size bytes (a power of two, at
+     * least one cache line) instead of per line. A read, write, writeback,
+     * invalidation or tier move then covers the whole region with one device
+     * operation. A region written while SHARED has real read/write sharing,
+     * so it is split and its lines are tracked individually from then on.
+     * Only allowed while the directory is empty; call before sharing the
+     * manager between threads.
+     */
+    bool enable_region_mode(size_t region_size);
+    bool disable_region_mode();
+    size_t region_size() const { return region_size_; }
+    size_t cache_line_size() const { return cache_line_size_; }
+    
+    /**
+     * Bytes covered by one transition at addr: its region, or its line when
+     * region mode is off or the region was split
+     */
+    size_t coherence_span(uint64_t addr) const { return tag_span(directory_tag(addr)); }
+    
+    /**
+     * Seal the pages (kSealedPageSize) overlapping [addr, addr + size) as
+     * immutable. Each is brought to SHARED once: fetched if invalid, written
+     * back if modified. After that, reads of a sealed page return without a
+     * directory lookup or device operation, and writes to it are rejected
+     * and counted in sealed_write_violations. Invalidating a sealed page
+     * unseals it; so does unseal_pages() when the page is recycled.
+     */
+    bool seal_pages(uint64_t addr, size_t size);
+    void unseal_pages(uint64_t addr, size_t size);
+    bool is_sealed(uint64_t addr) const;
+    
+    static constexpr size_t kSealedPageSize = 4096;
+    
     /**
-     * Sync directory state from FPGA
-     * Reads FPGA directory registers and updates local shadow copy
+     * Entries (lines and regions) tracked by the shadow directory, and the bytes it occupies
      */
-    bool sync_directory_from_fpga();
+    size_t directory_size() const;
+    size_t directory_memory_bytes() const;
+    
+    /**
+     * Bound the shadow directory to about as many entries as the FPGA can
+     * track (0 = unbounded). The bound is split evenly across shards, so it is
+     * rounded up to a multiple of kDirectoryShards. A shard at its bound
+     * evicts an INVALID entry, else the least recently used clean one, else
+     * writes back the least recently used MODIFIED one and evicts it. Entries
+     * with an operation in flight are never evicted; when a shard holds only
+     * those it goes over its bound. Call before sharing the manager.
+     */
+    void set_directory_capacity(size_t entries);
+    size_t directory_capacity() const { return shard_capacity_ * kDirectoryShards; }
+    
+    static constexpr size_t kDefaultDirectoryCapacity = 4096;   // NUM_ENTRIES in coherence_directory.v
     
     /**
      * Print directory state for debugging
@@ -207,31 +472,401 @@ private:
         return addr & ~(cache_line_size_ - 1);
     }
     
-    DirectoryEntry* get_entry(uint64_t addr);
-    const DirectoryEntry* get_entry(uint64_t addr) const;
+    uint64_t line_tag(uint64_t addr) const { return align_to_cache_line(addr) | kLineTag; }
+    uint64_t region_tag(uint64_t addr) const { return (addr & ~(uint64_t)(region_size_ - 1)) | kRegionTag; }
+    static uint64_t tag_address(uint64_t tag) { return tag & ~kTagKindMask; }
+    size_t tag_span(uint64_t tag) const {
+        return (tag & kTagKindMask) == kRegionTag ? region_size_ : cache_line_size_;
+    }
+    
+    static constexpr uint64_t kStatusMask = 0xFFFF;         // state | tier
+    static constexpr uint64_t kPendingBit = 1ull << 16;
+    static constexpr uint64_t kSplitBit = 1ull << 17;
+    static constexpr uint64_t kDirtyBit = 1ull << 18;       // on its shard's dirty list
+    static constexpr unsigned kSharerShift = 20;
+    static constexpr uint64_t kSharerMask = ((1ull << kMaxAgents) - 1) << kSharerShift;
+    static constexpr uint64_t sharer_bit(uint8_t agent) { return 1ull << (kSharerShift + agent); }
+    static constexpr uint64_t kLineTag = 1;
+    static constexpr uint64_t kRegionTag = 2;
+    static constexpr uint64_t kTagKindMask = 3;
+    static constexpr uint64_t kTombstoneTag = 3;    // evicted slot; probes continue past it
+    static constexpr unsigned kStampShift = 24;
+    static constexpr uint64_t kStampMask = (1ull << 24) - 1;
+    static constexpr unsigned kOwnerShift = 48;             // owner agent + 1 of an OWNED entry; 0 = none
+    static constexpr uint64_t kOwnerMask = 7ull << kOwnerShift;
+    static constexpr uint64_t owner_flag(uint8_t agent) { return (agent + 1ull) << kOwnerShift; }
+    static constexpr unsigned kCountShift = 51;
+    static constexpr uint64_t kCountMax = 0x1FFF;
+    
+    // MODIFIED or OWNED: memory is stale until the line is written back
+    static constexpr bool is_dirty_state(CoherenceState state) {
+        return state == CoherenceState::MODIFIED || state == CoherenceState::OWNED;
+    }
+    
+    // Owner recorded for an OWNED entry, else its lowest sharer; -1 if none
+    static int dirty_owner(uint64_t meta) {
+        uint64_t owner = (meta & kOwnerMask) >> kOwnerShift;
+        uint64_t sharers = (meta & kSharerMask) >> kSharerShift;
+        if (owner != 0) {
+            return static_cast<int>(owner) - 1;
+        }
+        return sharers ? __builtin_ctzll(sharers) : -1;
+    }
+    
+    static constexpr uint64_t pack_status(CoherenceState state, MemoryTier tier, bool pending) {
+        return static_cast<uint64_t>(state) | (static_cast<uint64_t>(tier) << 8) | (pending ? kPendingBit : 0);
+    }
+    static constexpr CoherenceState meta_state(uint64_t meta) {
+        return static_cast<CoherenceState>(meta & 0xFF);
+    }
+    static constexpr MemoryTier meta_tier(uint64_t meta) {
+        return static_cast<MemoryTier>((meta >> 8) & 0xFF);
+    }
+    
+    // Entries per probe group; a group fills one 64-byte cache line, so a
+    // lookup that hits its home group costs a single miss
+    static constexpr size_t kGroupEntries = 4;
+    
+    struct alignas(64) EntryGroup {
+        DirectoryEntry entries[kGroupEntries];
+    };
+    
+    // Open-addressed table probed group by group from the line's home group
+    struct DirectoryTable {
+        size_t group_mask;
+        std::unique_ptr<EntryGroup[]> groups;
+        
+        explicit DirectoryTable(size_t num_groups)
+            : group_mask(num_groups - 1), groups(new EntryGroup[num_groups]) {}
+        size_t capacity() const { return (group_mask + 1) * kGroupEntries; }
+    };
+    
+    // A full shard grows into a table twice the size; entries move over a few
+    // groups per insert, and lookups check both tables until the old one drains.
+    // The shard mutex serializes inserts, migration and pending-bit hand-offs;
+    // it is never held across a device round-trip.
+    struct alignas(64) DirectoryShard {
+        std::mutex mutex;
+        std::condition_variable released;   // a pending operation completed
+        std::atomic<DirectoryTable*> table{nullptr};
+        std::atomic<DirectoryTable*> draining{nullptr};
+        std::atomic<uint32_t> readers{0};    // lock-free lookups in progress
+        std::unique_ptr<DirectoryTable> owned_table;
+        std::unique_ptr<DirectoryTable> owned_draining;
+        std::vector<std::unique_ptr<DirectoryTable>> retired;  // drained, freed once no reader can hold them
+        size_t migrate_cursor = 0;          // next group of the draining table to move
+        size_t size = 0;
+        std::vector<uint64_t> dirty;        // tags that were MODIFIED; stale ones dropped lazily
+        size_t dirty_live = 0;              // entries with kDirtyBit set
+        size_t tombstones = 0;              // evicted slots in the current table
+        size_t evict_hand = 0;              // group where the next eviction scan starts
+    };
+    
+    static uint64_t hash_tag(uint64_t tag);
+    
+    DirectoryShard& shard_for(uint64_t tag) const;
+    
+    // Find tag in table; safe without the shard lock as long as the table stays alive
+    static DirectoryEntry* probe(const DirectoryTable* table, uint64_t tag, uint64_t hash);
+    
+    // Lock-free snapshot of an entry's meta word; false if untracked
+    bool load_meta(uint64_t tag, uint64_t* meta) const;
+    
+    // Directory key covering addr: its region's in region mode unless that
+    // region was split, else its line's
+    uint64_t directory_tag(uint64_t addr) const;
+    
+    // Lock-free read hit: the entry covering addr is valid with no operation
+    // pending. Records the access.
+    bool try_read_hit(uint64_t addr, uint8_t agent = kHostAgent);
+    
+    // Caller holds the shard mutex
+    DirectoryEntry* locate(DirectoryShard& shard, uint64_t tag) const;
+    DirectoryEntry* get_or_create_entry(DirectoryShard& shard, uint64_t tag, bool* created);
+    void migrate_groups(DirectoryShard& shard, size_t max_groups);
+    void release_retired(DirectoryShard& shard);
+    
+    // Capacity bound; caller holds the shard mutex. pick_victim scans up to
+    // kEvictionSample entries from the shard's hand and returns an evictable
+    // entry (INVALID, else LRU clean, else LRU MODIFIED), or nullptr if all
+    // have an operation pending.
+    static constexpr size_t kEvictionSample = 64;
+    DirectoryEntry* pick_victim(DirectoryShard& shard);
+    void evict_entry(DirectoryShard& shard, DirectoryEntry* entry);
+    
+    // Visit each tracked entry of a shard once; caller holds the shard mutex
+    template <typename Fn>
+    static void for_each_entry(const DirectoryShard& shard, Fn&& fn);
+    
+    // A valid line of a device directory snapshot
+    struct DeviceLine {
+        uint64_t addr;
+        CoherenceState state;
+        uint8_t sharers;    // device sharer bitmap, agent i at bit i
+    };
+    
+    // sync_directory_from_fpga() for one shard: lines are the snapshot
+    // entries whose directory key falls in it
+    void reconcile_shard(size_t shard_index, const std::vector<DeviceLine>& lines, bool repair,
+                         SyncReport* report);
+    
+    // Claim an entry for an operation: wait out any operation already
+    // pending on it, then set its pending bit. Returns false when create is
+    // false and the entry is untracked, or when a full shard could not evict
+    // a victim to make room; meta receives the claimed entry's word.
+    // With busy set, a pending entry is not waited for: *busy is set and
+    // false returned instead.
+    bool acquire_entry(uint64_t tag, bool create, uint64_t* meta, bool* created = nullptr,
+                       bool* busy = nullptr);
+    
+    // acquire_entry() on the entry covering addr, following a region split
+    // that lands while waiting; tag receives the claimed key
+    bool acquire_for_address(uint64_t addr, bool create, uint64_t* tag, uint64_t* meta,
+                             bool* created = nullptr, bool* busy = nullptr);
+    
+    // A read, write, invalidate or writeback split around its device
+    // operation, so the synchronous calls and the async pipeline share the
+    // same state transitions
+    struct Transition {
+        uint64_t tag = 0;                   // claimed entry
+        CoherenceOp device_op = CoherenceOp::READ;
+        uint64_t device_addr = 0;
+        const void* data = nullptr;
+        size_t size = 0;
+        CoherenceState state = CoherenceState::INVALID;         // published on success
+        MemoryTier tier = MemoryTier::L3_CXL;
+        CoherenceState failure_state = CoherenceState::INVALID; // published on failure
+        MemoryTier failure_tier = MemoryTier::L3_CXL;
+        uint64_t sharers = 0;               // sharer (and owner) bits published on success; 0 keeps them
+        bool accessed = false;
+        bool writeback = false;             // count a writeback on success
+        bool writeback_first = false;       // a WRITEBACK of the entry precedes device_op in one batch
+        bool snoop = false;                 // that writeback is for another agent's request
+        bool forward = false;               // count an owned forward on success
+        bool result = false;                // outcome when no device op was needed
+    };
+    
+    enum class TransitionStep {
+        DONE,    // completed without the device; result is set
+        ISSUE,   // entry claimed; issue_transition(), then finish_transition()
+        BUSY     // entry pending and wait was false; nothing claimed
+    };
+    
+    TransitionStep begin_transition(CoherenceOp op, uint64_t addr, const void* data, size_t size,
+                                    bool wait, Transition* t, uint8_t agent = kHostAgent);
+    bool finish_transition(const Transition& t, bool success);
+    // Synchronous device round trip for a claimed transition
+    bool issue_transition(const Transition& t);
+    bool run_transition(CoherenceOp op, uint64_t addr, const void* data, size_t size,
+                        uint8_t agent = kHostAgent);
+    
+    // Publish the entry's new state and tier, clear pending and wake waiters.
+    // Sharer bits in set_flags replace the entry's; without any, they are
+    // kept. An INVALID entry has no sharers; a valid one has at least the host.
+    // The owner field likewise, but only an OWNED entry keeps one.
+    void release_entry(uint64_t tag, CoherenceState state, MemoryTier tier, bool accessed = false,
+                       uint64_t set_flags = 0);
+    
+    // Publish a state change visible to queries while the operation is still pending
+    void set_pending_status(uint64_t tag, CoherenceState state, MemoryTier tier);
+    
+    // Give each line of a claimed region its own entry in the region's state,
+    // then mark the region split and release it
+    void split_region(uint64_t tag, uint64_t meta);
+    
+    // Append-only open-addressed set of sealed pages. Keys are never removed
+    // (unsealing flips a flag bit) and outgrown tables are kept until
+    // destruction, so lookups need no reader registration and never write.
+    struct SealedTable {
+        size_t mask;
+        std::unique_ptr<std::atomic<uint64_t>[]> keys;   // page address | kPageSealed or kPageUnsealed
+    };
+    static constexpr uint64_t kPageSealed = 1;
+    static constexpr uint64_t kPageUnsealed = 2;
+    
+    // Caller holds sealed_mutex_; sets the page's flag, inserting it if new
+    void set_page_flag(uint64_t page, uint64_t flag);
     
-    DirectoryEntry* get_or_create_entry(uint64_t addr);
+    // Drop the seal on every page overlapping the entry behind tag
+    void unseal_entry(uint64_t tag);
+    
+    // Reject and report a write to a sealed page
+    bool trap_sealed_write(uint64_t addr, size_t size);
+    
+    // Keep an entry's dirty bit and its shard's dirty list in step with its
+    // new state; caller holds the shard mutex. Returns the meta bits to apply.
+    uint64_t track_dirty(DirectoryShard& shard, uint64_t tag, uint64_t meta, uint64_t updated);
+    
+    // Dirty tags, collected shard by shard (compacting each dirty list);
+    // with max set, the least recently accessed max of them
+    std::vector<uint64_t> collect_dirty(size_t max = 0);
+    
+    // Write back the MODIFIED entries among tags in descriptor batches,
+    // leaving them SHARED (in L3 when demote is set). Returns lines written.
+    size_t write_back_tags(std::vector<uint64_t> tags, bool demote, size_t batch_size);
+    
+    void writeback_loop();
+    
+    uint64_t access_stamp() const;
+    static void record_access(DirectoryEntry* entry, uint64_t stamp);
     
     bool send_coherence_op_to_fpga(CoherenceOp op, uint64_t addr, const void* data = nullptr, size_t size = 0);
     
-    bool wait_for_fpga_completion();
+    // Post an op to the FPGA without waiting; *seq identifies it to
+    // poll_fpga_completion(), which returns false while it is in flight
+    bool post_coherence_op_to_fpga(CoherenceOp op, uint64_t addr, const void* data, size_t size, uint64_t* seq);
+    bool poll_fpga_completion(uint64_t seq, bool* success);
+    
+    // MMIO_COHERENCE_* command queue of an open device. Commands complete in
+    // doorbell order; seq is the doorbell's sequence number.
+    bool ring_coherence_doorbell(CoherenceOp op, uint64_t addr, size_t size, uint64_t* seq);
+    bool poll_device_completion(uint64_t seq, bool* success);
+    bool acknowledge_device_completion(uint64_t status);   // caller holds mmio_mutex_
+    
+    // Batched coherence command, laid out as SpeckvDriver::CoherenceDescriptor
+    // (speckv_ioctl_coh_desc). The table is submitted with one doorbell and
+    // completed with one notification; the device fills in each status.
+    struct BatchDescriptor {
+        uint64_t addr;
+        uint64_t data;
+        uint32_t size;
+        uint16_t op;
+        uint16_t status;        // 0 = success
+    };
+    static constexpr size_t kMaxBatchDescriptors = 65536;   // SPECKV_COH_BATCH_MAX
+    
+    // Returns true if every descriptor succeeded
+    bool send_coherence_batch_to_fpga(std::vector<BatchDescriptor>& descriptors);
+    
+    struct AsyncOp {
+        CoherenceOp op = CoherenceOp::READ;
+        uint64_t addr = 0;
+        const void* data = nullptr;
+        size_t size = 0;
+        CompletionCallback callback = nullptr;
+        void* user_data = nullptr;
+        std::promise<bool> promise;         // used when callback is null
+        Transition transition;
+        uint64_t device_seq = 0;            // from post_coherence_op_to_fpga
+        std::chrono::steady_clock::time_point posted;
+    };
     
+    struct AsyncPipeline {
+        AsyncConfig config;
+        std::mutex mutex;                   // guards ring, outstanding, stop
+        std::condition_variable wake;       // reaper: submissions or stop
+        std::condition_variable space;      // submitters: outstanding dropped below queue_depth
+        std::vector<AsyncOp> ring;          // submission ring
+        size_t head = 0;
+        size_t count = 0;
+        size_t outstanding = 0;
+        bool stop = false;
+        
+        std::mutex reap_mutex;              // one reaper at a time
+        std::atomic<std::thread::id> reaping{};     // thread in process_async (runs the callbacks)
+        std::deque<AsyncOp> deferred;       // waiting for their line; reaper only
+        std::deque<AsyncOp> inflight;       // posted to the FPGA, oldest first; reaper only
+        size_t posted = 0;                  // posted ops not yet reaped
+        
+        int event_fd = -1;
+        std::thread reaper;
+    };
+    
+    std::future<bool> enqueue_async(AsyncOp op);
+    static void deliver_async(AsyncOp& op, bool success);
+    void complete_async(AsyncOp& op, bool success);
+    
+    // One reaper pass; caller holds reap_mutex. idle is set when nothing is
+    // left deferred or in flight.
+    size_t process_async(bool* idle);
+    void async_loop();
+    
+    bool wait_for_fpga_completion(uint64_t seq);
+    
+    // Reads and writes as seen by callers; hit means the directory already tracked the entry
     void update_statistics(CoherenceOp op, bool hit);
     
+    // One device op's round trip, from doorbell to completion
+    void record_device_op(CoherenceOp op, std::chrono::steady_clock::time_point issued, bool success);
+    
+    // Lock a shard's mutex, timing the wait when it is contended
+    std::unique_lock<std::mutex> lock_shard(DirectoryShard& shard);
+    
 private:
     std::shared_ptr<SpeckvDriver> driver_;
     size_t cache_line_size_;
+    size_t region_size_ = 0;     // 0 tracks individual lines
     
     // Shadow directory (local copy)
-    std::unordered_map<uint64_t, std::unique_ptr<DirectoryEntry>> directory_;
-    mutable std::mutex directory_mutex_;
-    
-    // Statistics
-    mutable Statistics stats_;
-    mutable std::mutex stats_mutex_;
+    mutable std::array<DirectoryShard, kDirectoryShards> shards_;
+    std::chrono::steady_clock::time_point epoch_;  // origin of compressed access times
+    
+    // Sealed pages
+    mutable std::mutex sealed_mutex_;
+    std::atomic<const SealedTable*> sealed_table_{nullptr};
+    std::vector<std::unique_ptr<SealedTable>> sealed_tables_;
+    size_t sealed_keys_ = 0;                 // keys inserted into the current table
+    std::atomic<size_t> sealed_count_{0};    // pages currently sealed
+    
+    // Statistics, updated without locking and snapshotted by get_statistics()
+    struct Counters {
+        std::atomic<uint64_t> total_reads{0};
+        std::atomic<uint64_t> total_writes{0};
+        std::atomic<uint64_t> coherence_ops{0};
+        std::atomic<uint64_t> invalidations_sent{0};
+        std::atomic<uint64_t> writebacks_performed{0};
+        std::atomic<uint64_t> directory_hits{0};
+        std::atomic<uint64_t> directory_misses{0};
+        std::atomic<uint64_t> region_splits{0};
+        std::atomic<uint64_t> sealed_reads{0};
+        std::atomic<uint64_t> sealed_write_violations{0};
+        std::atomic<uint64_t> device_round_trips{0};
+        std::atomic<uint64_t> background_writebacks{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> dirty_evictions{0};
+        std::atomic<uint64_t> eviction_failures{0};
+        std::atomic<uint64_t> sharer_invalidations{0};
+        std::atomic<uint64_t> snoop_writebacks{0};
+        std::atomic<uint64_t> owned_forwards{0};
+        std::atomic<uint64_t> owned_writebacks{0};  // deferred writebacks that happened after all
+        std::array<LatencyHistogram, kNumCoherenceOps> op_latency;
+        std::array<std::atomic<uint64_t>, kNumCoherenceOps> op_failures{};
+        std::atomic<uint64_t> lock_contentions{0};
+        std::atomic<uint64_t> lock_wait_ns{0};
+        std::atomic<uint64_t> entry_waits{0};
+        std::atomic<uint64_t> entry_wait_ns{0};
+    };
+    mutable Counters stats_;
     
     // Pending operations tracking
     std::atomic<uint32_t> pending_ops_;
+    
+    // Device command queue (ring_coherence_doorbell)
+    std::mutex mmio_mutex_;                         // register sequence and the fields below
+    uint64_t doorbells_rung_ = 0;
+    uint64_t completions_acknowledged_ = 0;
+    std::unordered_map<uint64_t, bool> device_results_;    // acknowledged, not yet claimed by seq
+    
+    std::unique_ptr<AsyncPipeline> async_;
+    
+    // Dirty set and background writeback
+    struct WritebackDaemon {
+        WritebackConfig config;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::atomic<bool> running{false};
+        std::atomic<size_t> wake_at{0};     // dirty count that wakes the thread; 0 when stopped
+        bool stop = false;
+        std::thread thread;
+    };
+    WritebackDaemon writeback_;
+    std::atomic<size_t> dirty_lines_{0};
+    
+    // Capacity bound (set_directory_capacity)
+    size_t shard_capacity_ = kDefaultDirectoryCapacity / kDirectoryShards;  // 0 = unbounded
+    std::atomic<size_t> directory_entries_{0};
 };
 
+static_assert(sizeof(CoherenceManager::DirectoryEntry) == 16, "directory entries are packed into 16 bytes");
+
 } // namespace cxlspeckv
@@ -0,0 +1,76 @@
+#include "latency_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace cxlspeckv {
+
+void LatencyHistogram::record(uint64_t value_ns) {
+    buckets_[bucket_index(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value_ns, std::memory_order_relaxed);
+
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (value_ns > seen && !max_.compare_exchange_weak(seen, value_ns, std::memory_order_relaxed)) {
+    }
+}
+
+double LatencyHistogram::mean() const {
+    uint64_t samples = count();
+    return samples > 0 ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / samples : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    // Walk the buckets rather than trusting count_, which may run ahead of them
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    fraction = std::min(std::max(fraction, 0.0), 1.0);
+    uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * total)), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucket_upper(i), max());
+        }
+    }
+    return max();
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::bucket_index(uint64_t value) {
+    if (value < kSubBuckets) {
+        return static_cast<size_t>(value);
+    }
+    // The top kSubBucketBits bits below the leading one pick the linear bucket
+    unsigned exponent = std::min<unsigned>(63 - __builtin_clzll(value), kMaxExponent);
+    if (exponent == kMaxExponent) {
+        return kBuckets - 1;
+    }
+    unsigned shift = exponent - kSubBucketBits;
+    size_t sub = static_cast<size_t>(value >> shift) - kSubBuckets;
+    return kSubBuckets + static_cast<size_t>(shift) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper(size_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    size_t shift = (index - kSubBuckets) / kSubBuckets;
+    uint64_t sub = (index - kSubBuckets) % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+}
+
+} // namespace cxlspeckv
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+
+namespace cxlspeckv {
+
+/**
+ * LatencyHistogram
+ *
+ * Log-linear histogram of nanosecond latencies in the style of HdrHistogram:
+ * values below 2^kSubBucketBits get a bucket each, and every power of two
+ * above is split into 2^kSubBucketBits linear buckets, so a percentile is
+ * reported within 1/32 (about 3%) of the recorded value. Values beyond
+ * 2^kMaxExponent ns (about 18 minutes) land in the last bucket.
+ *
+ * record() is lock-free and may run on any number of threads; readers see
+ * a snapshot that is consistent per bucket, not across buckets.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 5;
+    static constexpr unsigned kMaxExponent = 40;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBuckets = kSubBuckets * (kMaxExponent - kSubBucketBits + 1);
+
+    LatencyHistogram() { reset(); }
+
+    // Disable copy
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(uint64_t value_ns);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    double mean() const;
+
+    // Smallest recorded value v such that fraction of the samples are <= v,
+    // rounded up to its bucket's upper bound; 0 when empty
+    uint64_t percentile(double fraction) const;
+
+    void reset();
+
+private:
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_upper(size_t index);
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_;
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+} // namespace cxlspeckv
@@ -0,0 +1,191 @@
+#include "write_combining_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace cxlspeckv {
+
+WriteCombiningBuffer::WriteCombiningBuffer(CoherenceManager& manager, const Config& config)
+    : manager_(manager)
+    , config_(config)
+{
+    reset_statistics();
+}
+
+WriteCombiningBuffer::~WriteCombiningBuffer() {
+    fence();
+}
+
+bool WriteCombiningBuffer::write(uint64_t addr, const void* data, size_t size) {
+    if (size == 0) {
+        return true;
+    }
+
+    // Sealed pages are rejected (and reported) by the manager right away
+    if (manager_.is_sealed(addr) || manager_.is_sealed(addr + size - 1)) {
+        return manager_.request_write(addr, data, size);
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const size_t span = granule();
+    auto now = std::chrono::steady_clock::now();
+    bool must_issue = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.writes_received++;
+
+        bool combined = false;
+        for (size_t done = 0; done < size;) {
+            uint64_t base = (addr + done) & ~(uint64_t)(span - 1);
+            size_t begin = addr + done - base;
+            size_t len = std::min(span - begin, size - done);
+
+            auto it = index_.find(base);
+            if (it == index_.end()) {
+                entries_.push_back(Entry{base, now, std::vector<uint8_t>(span), {}});
+                it = index_.emplace(base, std::prev(entries_.end())).first;
+            } else {
+                combined = true;
+            }
+
+            Entry& entry = *it->second;
+            std::memcpy(entry.data.data() + begin, bytes + done, len);
+            add_run(entry, static_cast<uint32_t>(begin), static_cast<uint32_t>(begin + len));
+            done += len;
+        }
+        if (combined) {
+            stats_.writes_combined++;
+        }
+
+        must_issue = entries_.size() > config_.max_entries || entries_.front().opened + config_.window <= now;
+    }
+
+    if (must_issue) {
+        std::lock_guard<std::mutex> issue_lock(issue_mutex_);
+        EntryList taken = take_oldest(config_.max_entries, now - config_.window);
+        issue(taken);
+    }
+    return true;
+}
+
+bool WriteCombiningBuffer::fence() {
+    std::lock_guard<std::mutex> issue_lock(issue_mutex_);
+    EntryList taken = take_oldest(0, std::chrono::steady_clock::time_point::max());
+    issue(taken);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.fences++;
+    bool success = !failed_;
+    failed_ = false;
+    return success;
+}
+
+bool WriteCombiningBuffer::drain(uint64_t addr, size_t size) {
+    std::lock_guard<std::mutex> issue_lock(issue_mutex_);
+    EntryList taken = take_range(addr, addr + size);
+    return issue(taken);
+}
+
+size_t WriteCombiningBuffer::poll() {
+    std::lock_guard<std::mutex> issue_lock(issue_mutex_);
+    EntryList taken = take_oldest(config_.max_entries, std::chrono::steady_clock::now() - config_.window);
+    size_t count = taken.size();
+    issue(taken);
+    return count;
+}
+
+size_t WriteCombiningBuffer::open_entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+WriteCombiningBuffer::Statistics WriteCombiningBuffer::get_statistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void WriteCombiningBuffer::reset_statistics() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::memset(&stats_, 0, sizeof(stats_));
+}
+
+size_t WriteCombiningBuffer::granule() const {
+    return manager_.region_size() ? manager_.region_size() : manager_.cache_line_size();
+}
+
+void WriteCombiningBuffer::add_run(Entry& entry, uint32_t begin, uint32_t end) {
+    auto& runs = entry.runs;
+    auto it = std::lower_bound(runs.begin(), runs.end(), std::make_pair(begin, end));
+    it = runs.insert(it, {begin, end});
+
+    // Merge with an overlapping or adjacent predecessor, then absorb successors
+    if (it != runs.begin() && std::prev(it)->second >= it->first) {
+        std::prev(it)->second = std::max(std::prev(it)->second, it->second);
+        it = std::prev(runs.erase(it));
+    }
+    auto next = std::next(it);
+    while (next != runs.end() && next->first <= it->second) {
+        it->second = std::max(it->second, next->second);
+        next = runs.erase(next);
+    }
+}
+
+WriteCombiningBuffer::EntryList WriteCombiningBuffer::take_oldest(
+    size_t keep,
+    std::chrono::steady_clock::time_point cutoff
+) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EntryList taken;
+    while (!entries_.empty() && (entries_.size() > keep || entries_.front().opened <= cutoff)) {
+        index_.erase(entries_.front().base);
+        taken.splice(taken.end(), entries_, entries_.begin());
+    }
+    return taken;
+}
+
+WriteCombiningBuffer::EntryList WriteCombiningBuffer::take_range(uint64_t begin, uint64_t end) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EntryList taken;
+    const size_t span = granule();
+    for (uint64_t base = begin & ~(uint64_t)(span - 1); base < end; base += span) {
+        auto it = index_.find(base);
+        if (it != index_.end()) {
+            taken.splice(taken.end(), entries_, it->second);
+            index_.erase(it);
+        }
+    }
+    return taken;
+}
+
+bool WriteCombiningBuffer::issue(EntryList& entries) {
+    uint64_t transitions = 0;
+    uint64_t bytes = 0;
+    uint64_t failures = 0;
+
+    for (const Entry& entry : entries) {
+        for (const auto& [run_begin, run_end] : entry.runs) {
+            // One write per contiguous run, split only where the manager
+            // tracks finer than the entry (a split region)
+            uint64_t pos = entry.base + run_begin;
+            uint64_t end = entry.base + run_end;
+            while (pos < end) {
+                uint64_t span = manager_.coherence_span(pos);
+                uint64_t stop = std::min(end, (pos & ~(span - 1)) + span);
+                if (!manager_.request_write(pos, entry.data.data() + (pos - entry.base), stop - pos)) {
+                    failures++;
+                }
+                transitions++;
+                bytes += stop - pos;
+                pos = stop;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.transitions_issued += transitions;
+    stats_.bytes_issued += bytes;
+    stats_.failed_writes += failures;
+    failed_ |= failures > 0;
+    return failures == 0;
+}
+
+} // namespace cxlspeckv
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "coherence_manager.h"
+#include <cstdint>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+namespace cxlspeckv {
+
+/**
+ * WriteCombiningBuffer
+ *
+ * Coalesces partial writes in front of a CoherenceManager. Writes to the same
+ * line (or region, in region mode) are merged into one buffered entry and
+ * issued later as one write transition carrying one data transfer, instead of
+ * one WRITE per call. A decode step that writes K and V for many heads into
+ * the same page therefore costs a single coherence operation.
+ *
+ * An entry is issued when:
+ * - it has been open longer than Config::window (checked on write() and poll())
+ * - more than Config::max_entries entries are open (oldest first)
+ * - fence() is called, or drain() covers it
+ *
+ * Buffered data is not visible through the CoherenceManager until issued:
+ * fence() (or drain() of the range) before another agent reads it. Issuing is
+ * serialized, so writes reach the manager in the order they were buffered per
+ * entry, and everything buffered before a fence() is issued before it returns.
+ */
+class WriteCombiningBuffer {
+public:
+    struct Config {
+        size_t max_entries;                 // open entries before the oldest is issued
+        std::chrono::microseconds window;   // longest an entry stays open
+
+        Config() : max_entries(64), window(100) {}
+    };
+
+    struct Statistics {
+        uint64_t writes_received;       // write() calls
+        uint64_t writes_combined;       // writes merged into an open entry
+        uint64_t transitions_issued;    // request_write calls made on the manager
+        uint64_t bytes_issued;
+        uint64_t fences;
+        uint64_t failed_writes;         // issued writes the manager rejected
+    };
+
+    WriteCombiningBuffer(CoherenceManager& manager, const Config& config = Config());
+
+    // Issues everything still buffered
+    ~WriteCombiningBuffer();
+
+    // Disable copy
+    WriteCombiningBuffer(const WriteCombiningBuffer&) = delete;
+    WriteCombiningBuffer& operator=(const WriteCombiningBuffer&) = delete;
+
+    /**
+     * Buffer a write; data is copied. Returns false only for writes rejected
+     * up front (sealed pages); failures of later issued writes are reported
+     * by the next fence() or drain().
+     */
+    bool write(uint64_t addr, const void* data, size_t size);
+
+    /**
+     * Ordering point: issue every buffered write before returning.
+     * Returns false if any write issued since the last fence failed.
+     */
+    bool fence();
+
+    /**
+     * Issue the buffered writes overlapping [addr, addr + size), e.g. before
+     * that range is handed to a reader. Returns false if any of them failed.
+     */
+    bool drain(uint64_t addr, size_t size);
+
+    /**
+     * Issue entries whose window has expired; returns the number issued
+     */
+    size_t poll();
+
+    size_t open_entries() const;
+    Statistics get_statistics() const;
+    void reset_statistics();
+
+private:
+    // Buffered bytes of one line or region; runs are the written [begin, end)
+    // offsets, kept sorted and merged
+    struct Entry {
+        uint64_t base;
+        std::chrono::steady_clock::time_point opened;
+        std::vector<uint8_t> data;
+        std::vector<std::pair<uint32_t, uint32_t>> runs;
+    };
+    using EntryList = std::list<Entry>;
+
+    size_t granule() const;
+    static void add_run(Entry& entry, uint32_t begin, uint32_t end);
+
+    // Remove entries under mutex_; caller holds issue_mutex_.
+    // take_oldest: from the front while more than keep are open or the
+    // oldest opened before cutoff. take_range: those overlapping [begin, end).
+    EntryList take_oldest(size_t keep, std::chrono::steady_clock::time_point cutoff);
+    EntryList take_range(uint64_t begin, uint64_t end);
+
+    // Caller holds issue_mutex_; returns false if any write failed
+    bool issue(EntryList& entries);
+
+    CoherenceManager& manager_;
+    Config config_;
+
+    // Lock order: issue_mutex_ before mutex_
+    std::mutex issue_mutex_;            // serializes issuing, preserving order
+    mutable std::mutex mutex_;          // guards entries_, index_, stats_, failed_
+    EntryList entries_;                 // oldest first
+    std::unordered_map<uint64_t, EntryList::iterator> index_;
+    Statistics stats_;
+    bool failed_ = false;               // a write failed since the last fence
+};
+
+} // namespace cxlspeckv
@@ -0,0 +1,1252 @@
+#include "lstm_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace cxlspeckv {
+
+AlignedFloatBuffer allocate_aligned_floats(size_t count) {
+    size_t bytes = (count * sizeof(float) + kWeightAlignment - 1) / kWeightAlignment * kWeightAlignment;
+    void* ptr = ::operator new(bytes > 0 ? bytes : kWeightAlignment, std::align_val_t(kWeightAlignment));
+    std::memset(ptr, 0, bytes);
+    return AlignedFloatBuffer(static_cast<float*>(ptr));
+}
+
+AlignedByteBuffer allocate_aligned_bytes(size_t count) {
+    size_t bytes = (count + kWeightAlignment - 1) / kWeightAlignment * kWeightAlignment;
+    void* ptr = ::operator new(bytes > 0 ? bytes : kWeightAlignment, std::align_val_t(kWeightAlignment));
+    std::memset(ptr, 0, bytes);
+    return AlignedByteBuffer(static_cast<int8_t*>(ptr));
+}
+
+size_t packed_lstm_weights_size(size_t input_dim, size_t hidden_dim) {
+    return round_up_to_block(hidden_dim) * (input_dim + hidden_dim) * kLstmGates;
+}
+
+size_t packed_lstm_bias_size(size_t hidden_dim) {
+    return round_up_to_block(hidden_dim) * kLstmGates;
+}
+
+void pack_lstm_weights(
+    const float* w_ih,
+    const float* w_hh,
+    const float* bias,
+    size_t input_dim,
+    size_t hidden_dim,
+    float* packed_weights,
+    float* packed_bias
+) {
+    size_t num_cols = input_dim + hidden_dim;
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+    size_t block_stride = num_cols * kLstmGates * kLstmBlock;
+
+    for (size_t b = 0; b < num_blocks; ++b) {
+        float* block = packed_weights + b * block_stride;
+        for (size_t k = 0; k < num_cols; ++k) {
+            for (size_t g = 0; g < kLstmGates; ++g) {
+                for (size_t lane = 0; lane < kLstmBlock; ++lane) {
+                    size_t unit = b * kLstmBlock + lane;
+                    float w = 0.0f;
+                    if (unit < hidden_dim) {
+                        size_t row = g * hidden_dim + unit;
+                        w = k < input_dim ? w_ih[row * input_dim + k]
+                                          : w_hh[row * hidden_dim + (k - input_dim)];
+                    }
+                    block[(k * kLstmGates + g) * kLstmBlock + lane] = w;
+                }
+            }
+        }
+
+        for (size_t g = 0; g < kLstmGates; ++g) {
+            for (size_t lane = 0; lane < kLstmBlock; ++lane) {
+                size_t unit = b * kLstmBlock + lane;
+                packed_bias[(b * kLstmGates + g) * kLstmBlock + lane] =
+                    unit < hidden_dim ? bias[g * hidden_dim + unit] : 0.0f;
+            }
+        }
+    }
+}
+
+void topk_init(LogitTopK& state, std::pair<uint32_t, float>* heap, size_t k) {
+    state.heap = heap;
+    state.k = k;
+    state.size = 0;
+    state.max_logit = -std::numeric_limits<float>::infinity();
+    state.sum_exp = 0.0f;
+}
+
+static inline bool topk_heap_order(const std::pair<uint32_t, float>& a, const std::pair<uint32_t, float>& b) {
+    return a.second > b.second;  // min-heap on logit
+}
+
+// Logit a candidate must beat to enter the heap
+static inline float topk_threshold(const LogitTopK& state) {
+    if (state.k == 0) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return state.size < state.k ? -std::numeric_limits<float>::infinity() : state.heap[0].second;
+}
+
+static inline void topk_offer(LogitTopK& state, uint32_t token, float logit) {
+    if (state.size < state.k) {
+        state.heap[state.size++] = {token, logit};
+        std::push_heap(state.heap, state.heap + state.size, topk_heap_order);
+    } else if (state.k > 0 && logit > state.heap[0].second) {
+        std::pop_heap(state.heap, state.heap + state.size, topk_heap_order);
+        state.heap[state.size - 1] = {token, logit};
+        std::push_heap(state.heap, state.heap + state.size, topk_heap_order);
+    }
+}
+
+// Rebase the running softmax sum when a larger logit shows up
+static inline void topk_rebase(LogitTopK& state, float chunk_max) {
+    if (chunk_max > state.max_logit) {
+        state.sum_exp *= std::exp(state.max_logit - chunk_max);
+        state.max_logit = chunk_max;
+    }
+}
+
+void topk_add_mass(LogitTopK& state, float logit, float weight) {
+    if (weight <= 0.0f) {
+        return;
+    }
+    topk_rebase(state, logit);
+    state.sum_exp += weight * std::exp(logit - state.max_logit);
+}
+
+size_t topk_finalize(LogitTopK& state, std::pair<uint32_t, float>* out) {
+    std::sort_heap(state.heap, state.heap + state.size, topk_heap_order);  // highest first
+    for (size_t i = 0; i < state.size; ++i) {
+        float prob = state.sum_exp > 0.0f ? std::exp(state.heap[i].second - state.max_logit) / state.sum_exp : 0.0f;
+        out[i] = {state.heap[i].first, prob};
+    }
+    return state.size;
+}
+
+#if defined(__AVX512F__)
+
+// exp() via range reduction to [-ln2/2, ln2/2] and a degree-5 polynomial
+// (Cephes). Inputs are clamped at -87 so results stay normal: denormal
+// results (e.g. from -inf logits) cost a microcode assist per lane.
+static inline __m512 exp_ps(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.0f)), _mm512_set1_ps(88.0f));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504f)),
+                                    _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+
+    __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+    return _mm512_scalef_ps(p, n);
+}
+
+// 1 / (1 + exp(-x)); the reciprocal is rcp14 plus one Newton step (~1e-7
+// relative) because a full-width divide per gate dominates a small step
+static inline __m512 sigmoid_ps(__m512 x) {
+    __m512 d = _mm512_add_ps(_mm512_set1_ps(1.0f), exp_ps(_mm512_sub_ps(_mm512_setzero_ps(), x)));
+    __m512 r = _mm512_rcp14_ps(d);
+    return _mm512_mul_ps(r, _mm512_fnmadd_ps(d, r, _mm512_set1_ps(2.0f)));
+}
+
+static inline __m512 tanh_ps(__m512 x) {
+    // tanh(x) = 2 * sigmoid(2x) - 1
+    __m512 s = sigmoid_ps(_mm512_add_ps(x, x));
+    return _mm512_sub_ps(_mm512_add_ps(s, s), _mm512_set1_ps(1.0f));
+}
+
+// c = sigmoid(f) * c + sigmoid(i) * tanh(g); h = sigmoid(o) * tanh(c)
+static inline void lstm_gate_update(__m512 acc_i, __m512 acc_f, __m512 acc_g, __m512 acc_o, float* c, float* h_out) {
+    __m512 cell = _mm512_fmadd_ps(sigmoid_ps(acc_f), _mm512_load_ps(c),
+                                  _mm512_mul_ps(sigmoid_ps(acc_i), tanh_ps(acc_g)));
+    _mm512_store_ps(c, cell);
+    _mm512_store_ps(h_out, _mm512_mul_ps(sigmoid_ps(acc_o), tanh_ps(cell)));
+}
+
+void lstm_cell_step(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x,
+    size_t input_dim,
+    const float* h_prev,
+    float* c,
+    float* h_out,
+    size_t hidden_dim
+) {
+    size_t num_cols = input_dim + hidden_dim;
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* w = packed_weights + b * num_cols * kLstmGates * kLstmBlock;
+        const float* bias = packed_bias + b * kLstmGates * kLstmBlock;
+
+        // Two accumulator sets (even/odd columns) hide the FMA latency
+        __m512 acc[2][kLstmGates];
+        #pragma GCC unroll 16
+        for (size_t g = 0; g < kLstmGates; ++g) {
+            acc[0][g] = _mm512_load_ps(bias + g * 16);
+            acc[1][g] = _mm512_setzero_ps();
+        }
+
+        // Fused W_ih x + W_hh h: one streaming pass over the block
+        auto accumulate = [&](const float* v, size_t n) {
+            size_t k = 0;
+            for (; k + 1 < n; k += 2, w += 2 * kLstmGates * kLstmBlock) {
+                __m512 v0 = _mm512_set1_ps(v[k]);
+                __m512 v1 = _mm512_set1_ps(v[k + 1]);
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < kLstmGates; ++g) {
+                    acc[0][g] = _mm512_fmadd_ps(_mm512_load_ps(w + g * 16), v0, acc[0][g]);
+                    acc[1][g] = _mm512_fmadd_ps(_mm512_load_ps(w + 64 + g * 16), v1, acc[1][g]);
+                }
+            }
+            if (k < n) {
+                __m512 v0 = _mm512_set1_ps(v[k]);
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < kLstmGates; ++g) {
+                    acc[0][g] = _mm512_fmadd_ps(_mm512_load_ps(w + g * 16), v0, acc[0][g]);
+                }
+                w += kLstmGates * kLstmBlock;
+            }
+        };
+        accumulate(x, input_dim);
+        accumulate(h_prev, hidden_dim);
+
+        __m512 acc_i = _mm512_add_ps(acc[0][0], acc[1][0]);
+        __m512 acc_f = _mm512_add_ps(acc[0][1], acc[1][1]);
+        __m512 acc_g = _mm512_add_ps(acc[0][2], acc[1][2]);
+        __m512 acc_o = _mm512_add_ps(acc[0][3], acc[1][3]);
+
+        size_t base = b * kLstmBlock;
+        lstm_gate_update(acc_i, acc_f, acc_g, acc_o, c + base, h_out + base);
+    }
+}
+
+// Cell and hidden update from gate pre-activations laid out like the packed
+// bias (block, gate, lane)
+static void lstm_apply_gates(const float* gates, float* c, float* h_out, size_t hidden_dim) {
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* g = gates + b * kLstmGates * kLstmBlock;
+        size_t base = b * kLstmBlock;
+        lstm_gate_update(_mm512_load_ps(g), _mm512_load_ps(g + 16), _mm512_load_ps(g + 32), _mm512_load_ps(g + 48),
+                         c + base, h_out + base);
+    }
+}
+
+// Gate accumulators for kLstmBlock units of S sequences, sharing every
+// weight load across the S sequences
+template <size_t S>
+static inline void lstm_block_tile(
+    const float* w,
+    const float* bias,
+    const float* x, size_t ldx, size_t input_dim,
+    const float* h_prev, size_t ldh, size_t hidden_dim,
+    float* c, float* h_out, size_t base
+) {
+    __m512 acc[S][kLstmGates];
+    #pragma GCC unroll 16
+    for (size_t s = 0; s < S; ++s) {
+        #pragma GCC unroll 16
+        for (size_t g = 0; g < kLstmGates; ++g) {
+            acc[s][g] = _mm512_load_ps(bias + g * 16);
+        }
+    }
+
+    auto accumulate = [&](const float* v, size_t ld, size_t n) {
+        for (size_t k = 0; k < n; ++k, w += kLstmGates * kLstmBlock) {
+            __m512 wg[kLstmGates];
+            #pragma GCC unroll 16
+            for (size_t g = 0; g < kLstmGates; ++g) {
+                wg[g] = _mm512_load_ps(w + g * 16);
+            }
+            #pragma GCC unroll 16
+            for (size_t s = 0; s < S; ++s) {
+                __m512 vk = _mm512_set1_ps(v[s * ld + k]);
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < kLstmGates; ++g) {
+                    acc[s][g] = _mm512_fmadd_ps(wg[g], vk, acc[s][g]);
+                }
+            }
+        }
+    };
+    accumulate(x, ldx, input_dim);
+    accumulate(h_prev, ldh, hidden_dim);
+
+    #pragma GCC unroll 16
+    for (size_t s = 0; s < S; ++s) {
+        lstm_gate_update(acc[s][0], acc[s][1], acc[s][2], acc[s][3],
+                         c + s * ldh + base, h_out + s * ldh + base);
+    }
+}
+
+void lstm_cell_step_batch(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x, size_t ldx, size_t input_dim,
+    const float* h_prev, float* c, float* h_out, size_t ldh,
+    size_t hidden_dim,
+    size_t batch
+) {
+    constexpr size_t kTile = 4;     // 16 gate accumulators + 4 weight registers
+    size_t num_cols = input_dim + hidden_dim;
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+
+    // Block-major: one block's weights stay cache-resident across the batch
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* w = packed_weights + b * num_cols * kLstmGates * kLstmBlock;
+        const float* bias = packed_bias + b * kLstmGates * kLstmBlock;
+        size_t base = b * kLstmBlock;
+
+        size_t s = 0;
+        for (; s + kTile <= batch; s += kTile) {
+            lstm_block_tile<kTile>(w, bias, x + s * ldx, ldx, input_dim, h_prev + s * ldh, ldh, hidden_dim,
+                                   c + s * ldh, h_out + s * ldh, base);
+        }
+        for (; s < batch; ++s) {
+            lstm_block_tile<1>(w, bias, x + s * ldx, ldx, input_dim, h_prev + s * ldh, ldh, hidden_dim,
+                               c + s * ldh, h_out + s * ldh, base);
+        }
+    }
+}
+
+void project_rows(const float* weights, size_t rows, size_t dim, const float* x, float* out) {
+    size_t tail = dim % 16;
+    __mmask16 tail_mask = static_cast<__mmask16>((1u << tail) - 1);
+
+    for (size_t r = 0; r < rows; ++r) {
+        const float* row = weights + r * dim;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        size_t j = 0;
+        for (; j + 32 <= dim; j += 32) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(row + j), _mm512_loadu_ps(x + j), acc0);
+            acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(row + j + 16), _mm512_loadu_ps(x + j + 16), acc1);
+        }
+        for (; j + 16 <= dim; j += 16) {
+            acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(row + j), _mm512_loadu_ps(x + j), acc0);
+        }
+        if (tail) {
+            acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(tail_mask, row + j),
+                                   _mm512_maskz_loadu_ps(tail_mask, x + j), acc1);
+        }
+        out[r] = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+    }
+}
+
+// R x S tile of dot products: each weight row load is shared by S sequences
+// and each sequence load by R rows
+template <size_t R, size_t S>
+static inline void project_tile(const float* weights, size_t dim, const float* x, size_t ldx, float* out, size_t ldo) {
+    __m512 acc[R][S];
+    #pragma GCC unroll 16
+    for (size_t r = 0; r < R; ++r) {
+        #pragma GCC unroll 16
+        for (size_t s = 0; s < S; ++s) {
+            acc[r][s] = _mm512_setzero_ps();
+        }
+    }
+
+    auto step = [&](size_t j, __mmask16 mask) {
+        __m512 xv[S];
+        #pragma GCC unroll 16
+        for (size_t s = 0; s < S; ++s) {
+            xv[s] = _mm512_maskz_loadu_ps(mask, x + s * ldx + j);
+        }
+        #pragma GCC unroll 16
+        for (size_t r = 0; r < R; ++r) {
+            __m512 wv = _mm512_maskz_loadu_ps(mask, weights + r * dim + j);
+            #pragma GCC unroll 16
+            for (size_t s = 0; s < S; ++s) {
+                acc[r][s] = _mm512_fmadd_ps(wv, xv[s], acc[r][s]);
+            }
+        }
+    };
+    size_t j = 0;
+    for (; j + 16 <= dim; j += 16) {
+        step(j, 0xFFFF);
+    }
+    if (j < dim) {
+        step(j, static_cast<__mmask16>((1u << (dim - j)) - 1));
+    }
+
+    #pragma GCC unroll 16
+    for (size_t r = 0; r < R; ++r) {
+        #pragma GCC unroll 16
+        for (size_t s = 0; s < S; ++s) {
+            out[s * ldo + r] = _mm512_reduce_add_ps(acc[r][s]);
+        }
+    }
+}
+
+void project_rows_batch(
+    const float* weights, size_t rows, size_t dim,
+    const float* x, size_t ldx, size_t batch,
+    float* out, size_t ldo
+) {
+    constexpr size_t kRows = 4;
+    constexpr size_t kSeqs = 4;
+
+    size_t r = 0;
+    for (; r + kRows <= rows; r += kRows) {
+        size_t s = 0;
+        for (; s + kSeqs <= batch; s += kSeqs) {
+            project_tile<kRows, kSeqs>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+        for (; s < batch; ++s) {
+            project_tile<kRows, 1>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+    }
+    for (; r < rows; ++r) {
+        size_t s = 0;
+        for (; s + kSeqs <= batch; s += kSeqs) {
+            project_tile<1, kSeqs>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+        for (; s < batch; ++s) {
+            project_tile<1, 1>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+    }
+}
+
+void topk_accumulate(LogitTopK& state, const float* logits, uint32_t first_token, size_t count) {
+    const __m512 neg_inf = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = std::min<size_t>(16, count - i);
+        __mmask16 valid = static_cast<__mmask16>(n == 16 ? 0xFFFF : (1u << n) - 1);
+        __m512 v = _mm512_mask_loadu_ps(neg_inf, valid, logits + i);
+
+        topk_rebase(state, _mm512_reduce_max_ps(v));
+        __m512 e = exp_ps(_mm512_sub_ps(v, _mm512_set1_ps(state.max_logit)));
+        state.sum_exp += _mm512_mask_reduce_add_ps(valid, e);
+
+        // Threshold filter: only lanes beating the current k-th best touch the heap
+        __mmask16 above = _mm512_mask_cmp_ps_mask(valid, v, _mm512_set1_ps(topk_threshold(state)), _CMP_GT_OQ);
+        while (above) {
+            unsigned lane = __builtin_ctz(above);
+            above &= above - 1;
+            topk_offer(state, first_token + static_cast<uint32_t>(i + lane), logits[i + lane]);
+        }
+    }
+}
+
+const char* lstm_kernel_isa() { return "avx512"; }
+
+#elif defined(__AVX2__)
+
+// Clamped at -87 like the AVX-512 version, so results stay normal
+static inline __m256 exp_ps(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+                               _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+
+    // Scale by 2^n through the exponent field
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+// 1 / (1 + exp(-x)); rcp plus one Newton step (~1e-6 relative) instead of a divide
+static inline __m256 sigmoid_ps(__m256 x) {
+    __m256 d = _mm256_add_ps(_mm256_set1_ps(1.0f), exp_ps(_mm256_sub_ps(_mm256_setzero_ps(), x)));
+    __m256 r = _mm256_rcp_ps(d);
+    return _mm256_mul_ps(r, _mm256_fnmadd_ps(d, r, _mm256_set1_ps(2.0f)));
+}
+
+static inline __m256 tanh_ps(__m256 x) {
+    __m256 s = sigmoid_ps(_mm256_add_ps(x, x));
+    return _mm256_sub_ps(_mm256_add_ps(s, s), _mm256_set1_ps(1.0f));
+}
+
+// c = sigmoid(f) * c + sigmoid(i) * tanh(g); h = sigmoid(o) * tanh(c)
+static inline void lstm_gate_update(__m256 acc_i, __m256 acc_f, __m256 acc_g, __m256 acc_o, float* c, float* h_out) {
+    __m256 cell = _mm256_fmadd_ps(sigmoid_ps(acc_f), _mm256_load_ps(c),
+                                  _mm256_mul_ps(sigmoid_ps(acc_i), tanh_ps(acc_g)));
+    _mm256_store_ps(c, cell);
+    _mm256_store_ps(h_out, _mm256_mul_ps(sigmoid_ps(acc_o), tanh_ps(cell)));
+}
+
+void lstm_cell_step(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x,
+    size_t input_dim,
+    const float* h_prev,
+    float* c,
+    float* h_out,
+    size_t hidden_dim
+) {
+    size_t num_cols = input_dim + hidden_dim;
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* w = packed_weights + b * num_cols * kLstmGates * kLstmBlock;
+        const float* bias = packed_bias + b * kLstmGates * kLstmBlock;
+
+        // Each gate spans two 8-wide registers (lo/hi halves of the block)
+        __m256 acc[kLstmGates][2];
+        #pragma GCC unroll 16
+        for (size_t g = 0; g < kLstmGates; ++g) {
+            acc[g][0] = _mm256_load_ps(bias + g * 16);
+            acc[g][1] = _mm256_load_ps(bias + g * 16 + 8);
+        }
+
+        // Fused W_ih x + W_hh h: one streaming pass over the block
+        auto accumulate = [&](const float* v, size_t n) {
+            for (size_t k = 0; k < n; ++k, w += kLstmGates * kLstmBlock) {
+                __m256 vk = _mm256_set1_ps(v[k]);
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < kLstmGates; ++g) {
+                    acc[g][0] = _mm256_fmadd_ps(_mm256_load_ps(w + g * 16), vk, acc[g][0]);
+                    acc[g][1] = _mm256_fmadd_ps(_mm256_load_ps(w + g * 16 + 8), vk, acc[g][1]);
+                }
+            }
+        };
+        accumulate(x, input_dim);
+        accumulate(h_prev, hidden_dim);
+
+        for (size_t half = 0; half < 2; ++half) {
+            size_t base = b * kLstmBlock + half * 8;
+            lstm_gate_update(acc[0][half], acc[1][half], acc[2][half], acc[3][half], c + base, h_out + base);
+        }
+    }
+}
+
+// Cell and hidden update from gate pre-activations laid out like the packed
+// bias (block, gate, lane)
+static void lstm_apply_gates(const float* gates, float* c, float* h_out, size_t hidden_dim) {
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* g = gates + b * kLstmGates * kLstmBlock;
+        for (size_t half = 0; half < 2; ++half) {
+            size_t base = b * kLstmBlock + half * 8;
+            lstm_gate_update(_mm256_load_ps(g + half * 8), _mm256_load_ps(g + 16 + half * 8),
+                             _mm256_load_ps(g + 32 + half * 8), _mm256_load_ps(g + 48 + half * 8),
+                             c + base, h_out + base);
+        }
+    }
+}
+
+// Gate accumulators for one 8-unit half block of S sequences, sharing every
+// weight load across the S sequences
+template <size_t S>
+static inline void lstm_half_block_tile(
+    const float* w,
+    const float* bias,
+    const float* x, size_t ldx, size_t input_dim,
+    const float* h_prev, size_t ldh, size_t hidden_dim,
+    float* c, float* h_out, size_t base
+) {
+    __m256 acc[S][kLstmGates];
+    #pragma GCC unroll 16
+    for (size_t s = 0; s < S; ++s) {
+        #pragma GCC unroll 16
+        for (size_t g = 0; g < kLstmGates; ++g) {
+            acc[s][g] = _mm256_load_ps(bias + g * 16);
+        }
+    }
+
+    auto accumulate = [&](const float* v, size_t ld, size_t n) {
+        for (size_t k = 0; k < n; ++k, w += kLstmGates * kLstmBlock) {
+            __m256 wg[kLstmGates];
+            #pragma GCC unroll 16
+            for (size_t g = 0; g < kLstmGates; ++g) {
+                wg[g] = _mm256_load_ps(w + g * 16);
+            }
+            #pragma GCC unroll 16
+            for (size_t s = 0; s < S; ++s) {
+                __m256 vk = _mm256_set1_ps(v[s * ld + k]);
+                #pragma GCC unroll 16
+                for (size_t g = 0; g < kLstmGates; ++g) {
+                    acc[s][g] = _mm256_fmadd_ps(wg[g], vk, acc[s][g]);
+                }
+            }
+        }
+    };
+    accumulate(x, ldx, input_dim);
+    accumulate(h_prev, ldh, hidden_dim);
+
+    #pragma GCC unroll 16
+    for (size_t s = 0; s < S; ++s) {
+        lstm_gate_update(acc[s][0], acc[s][1], acc[s][2], acc[s][3],
+                         c + s * ldh + base, h_out + s * ldh + base);
+    }
+}
+
+void lstm_cell_step_batch(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x, size_t ldx, size_t input_dim,
+    const float* h_prev, float* c, float* h_out, size_t ldh,
+    size_t hidden_dim,
+    size_t batch
+) {
+    constexpr size_t kTile = 2;     // 8 gate accumulators + 4 weight registers
+    size_t num_cols = input_dim + hidden_dim;
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+
+    // Block-major: one block's weights stay cache-resident across the batch
+    for (size_t b = 0; b < num_blocks; ++b) {
+        for (size_t half = 0; half < 2; ++half) {
+            const float* w = packed_weights + b * num_cols * kLstmGates * kLstmBlock + half * 8;
+            const float* bias = packed_bias + b * kLstmGates * kLstmBlock + half * 8;
+            size_t base = b * kLstmBlock + half * 8;
+
+            size_t s = 0;
+            for (; s + kTile <= batch; s += kTile) {
+                lstm_half_block_tile<kTile>(w, bias, x + s * ldx, ldx, input_dim, h_prev + s * ldh, ldh,
+                                            hidden_dim, c + s * ldh, h_out + s * ldh, base);
+            }
+            for (; s < batch; ++s) {
+                lstm_half_block_tile<1>(w, bias, x + s * ldx, ldx, input_dim, h_prev + s * ldh, ldh,
+                                        hidden_dim, c + s * ldh, h_out + s * ldh, base);
+            }
+        }
+    }
+}
+
+static inline float hsum_ps(__m256 v) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+    return _mm_cvtss_f32(lo);
+}
+
+static inline float hmax_ps(__m256 v) {
+    __m128 lo = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_max_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_max_ss(lo, _mm_movehdup_ps(lo));
+    return _mm_cvtss_f32(lo);
+}
+
+void project_rows(const float* weights, size_t rows, size_t dim, const float* x, float* out) {
+    for (size_t r = 0; r < rows; ++r) {
+        const float* row = weights + r * dim;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        size_t j = 0;
+        for (; j + 16 <= dim; j += 16) {
+            acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j), _mm256_loadu_ps(x + j), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j + 8), _mm256_loadu_ps(x + j + 8), acc1);
+        }
+        float sum = hsum_ps(_mm256_add_ps(acc0, acc1));
+        for (; j < dim; ++j) {
+            sum += row[j] * x[j];
+        }
+        out[r] = sum;
+    }
+}
+
+// R x S tile of dot products: each weight row load is shared by S sequences
+// and each sequence load by R rows
+template <size_t R, size_t S>
+static inline void project_tile(const float* weights, size_t dim, const float* x, size_t ldx, float* out, size_t ldo) {
+    __m256 acc[R][S];
+    #pragma GCC unroll 16
+    for (size_t r = 0; r < R; ++r) {
+        #pragma GCC unroll 16
+        for (size_t s = 0; s < S; ++s) {
+            acc[r][s] = _mm256_setzero_ps();
+        }
+    }
+
+    size_t j = 0;
+    for (; j + 8 <= dim; j += 8) {
+        __m256 xv[S];
+        #pragma GCC unroll 16
+        for (size_t s = 0; s < S; ++s) {
+            xv[s] = _mm256_loadu_ps(x + s * ldx + j);
+        }
+        #pragma GCC unroll 16
+        for (size_t r = 0; r < R; ++r) {
+            __m256 wv = _mm256_loadu_ps(weights + r * dim + j);
+            #pragma GCC unroll 16
+            for (size_t s = 0; s < S; ++s) {
+                acc[r][s] = _mm256_fmadd_ps(wv, xv[s], acc[r][s]);
+            }
+        }
+    }
+
+    #pragma GCC unroll 16
+    for (size_t r = 0; r < R; ++r) {
+        #pragma GCC unroll 16
+        for (size_t s = 0; s < S; ++s) {
+            float sum = hsum_ps(acc[r][s]);
+            for (size_t t = j; t < dim; ++t) {
+                sum += weights[r * dim + t] * x[s * ldx + t];
+            }
+            out[s * ldo + r] = sum;
+        }
+    }
+}
+
+void project_rows_batch(
+    const float* weights, size_t rows, size_t dim,
+    const float* x, size_t ldx, size_t batch,
+    float* out, size_t ldo
+) {
+    constexpr size_t kRows = 2;
+    constexpr size_t kSeqs = 4;
+
+    size_t r = 0;
+    for (; r + kRows <= rows; r += kRows) {
+        size_t s = 0;
+        for (; s + kSeqs <= batch; s += kSeqs) {
+            project_tile<kRows, kSeqs>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+        for (; s < batch; ++s) {
+            project_tile<kRows, 1>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+    }
+    for (; r < rows; ++r) {
+        size_t s = 0;
+        for (; s + kSeqs <= batch; s += kSeqs) {
+            project_tile<1, kSeqs>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+        for (; s < batch; ++s) {
+            project_tile<1, 1>(weights + r * dim, dim, x + s * ldx, ldx, out + s * ldo + r, ldo);
+        }
+    }
+}
+
+void topk_accumulate(LogitTopK& state, const float* logits, uint32_t first_token, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(logits + i);
+
+        topk_rebase(state, hmax_ps(v));
+        state.sum_exp += hsum_ps(exp_ps(_mm256_sub_ps(v, _mm256_set1_ps(state.max_logit))));
+
+        // Threshold filter: only lanes beating the current k-th best touch the heap
+        unsigned above = static_cast<unsigned>(_mm256_movemask_ps(
+            _mm256_cmp_ps(v, _mm256_set1_ps(topk_threshold(state)), _CMP_GT_OQ)));
+        while (above) {
+            unsigned lane = __builtin_ctz(above);
+            above &= above - 1;
+            topk_offer(state, first_token + static_cast<uint32_t>(i + lane), logits[i + lane]);
+        }
+    }
+
+    for (; i < count; ++i) {
+        topk_rebase(state, logits[i]);
+        state.sum_exp += std::exp(logits[i] - state.max_logit);
+        if (logits[i] > topk_threshold(state)) {
+            topk_offer(state, first_token + static_cast<uint32_t>(i), logits[i]);
+        }
+    }
+}
+
+const char* lstm_kernel_isa() { return "avx2"; }
+
+#else
+
+static inline float sigmoid(float x) {
+    return 1.0f / (1.0f + std::exp(-x));
+}
+
+void lstm_cell_step(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x,
+    size_t input_dim,
+    const float* h_prev,
+    float* c,
+    float* h_out,
+    size_t hidden_dim
+) {
+    size_t num_cols = input_dim + hidden_dim;
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* w = packed_weights + b * num_cols * kLstmGates * kLstmBlock;
+        float acc[kLstmGates][kLstmBlock];
+        std::memcpy(acc, packed_bias + b * kLstmGates * kLstmBlock, sizeof(acc));
+
+        for (size_t k = 0; k < num_cols; ++k, w += kLstmGates * kLstmBlock) {
+            float v = k < input_dim ? x[k] : h_prev[k - input_dim];
+            for (size_t g = 0; g < kLstmGates; ++g) {
+                for (size_t lane = 0; lane < kLstmBlock; ++lane) {
+                    acc[g][lane] += w[g * kLstmBlock + lane] * v;
+                }
+            }
+        }
+
+        for (size_t lane = 0; lane < kLstmBlock; ++lane) {
+            size_t unit = b * kLstmBlock + lane;
+            float cell = sigmoid(acc[1][lane]) * c[unit] + sigmoid(acc[0][lane]) * std::tanh(acc[2][lane]);
+            c[unit] = cell;
+            h_out[unit] = sigmoid(acc[3][lane]) * std::tanh(cell);
+        }
+    }
+}
+
+static void lstm_apply_gates(const float* gates, float* c, float* h_out, size_t hidden_dim) {
+    size_t num_blocks = round_up_to_block(hidden_dim) / kLstmBlock;
+    for (size_t b = 0; b < num_blocks; ++b) {
+        const float* g = gates + b * kLstmGates * kLstmBlock;
+        for (size_t lane = 0; lane < kLstmBlock; ++lane) {
+            size_t unit = b * kLstmBlock + lane;
+            float cell = sigmoid(g[kLstmBlock + lane]) * c[unit] + sigmoid(g[lane]) * std::tanh(g[2 * kLstmBlock + lane]);
+            c[unit] = cell;
+            h_out[unit] = sigmoid(g[3 * kLstmBlock + lane]) * std::tanh(cell);
+        }
+    }
+}
+
+void project_rows(const float* weights, size_t rows, size_t dim, const float* x, float* out) {
+    for (size_t r = 0; r < rows; ++r) {
+        const float* row = weights + r * dim;
+        float sum = 0.0f;
+        for (size_t j = 0; j < dim; ++j) {
+            sum += row[j] * x[j];
+        }
+        out[r] = sum;
+    }
+}
+
+void lstm_cell_step_batch(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x, size_t ldx, size_t input_dim,
+    const float* h_prev, float* c, float* h_out, size_t ldh,
+    size_t hidden_dim,
+    size_t batch
+) {
+    for (size_t s = 0; s < batch; ++s) {
+        lstm_cell_step(packed_weights, packed_bias, x + s * ldx, input_dim,
+                       h_prev + s * ldh, c + s * ldh, h_out + s * ldh, hidden_dim);
+    }
+}
+
+void project_rows_batch(
+    const float* weights, size_t rows, size_t dim,
+    const float* x, size_t ldx, size_t batch,
+    float* out, size_t ldo
+) {
+    for (size_t s = 0; s < batch; ++s) {
+        project_rows(weights, rows, dim, x + s * ldx, out + s * ldo);
+    }
+}
+
+void topk_accumulate(LogitTopK& state, const float* logits, uint32_t first_token, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        topk_rebase(state, logits[i]);
+        state.sum_exp += std::exp(logits[i] - state.max_logit);
+        if (logits[i] > topk_threshold(state)) {
+            topk_offer(state, first_token + static_cast<uint32_t>(i), logits[i]);
+        }
+    }
+}
+
+const char* lstm_kernel_isa() { return "scalar"; }
+
+#endif
+
+// ---------------------------------------------------------------------------
+// INT8 output projection
+// ---------------------------------------------------------------------------
+
+static inline size_t int8_padded_dim(size_t dim) {
+    return (dim + kInt8ColGroup - 1) / kInt8ColGroup * kInt8ColGroup;
+}
+
+size_t packed_int8_rows_size(size_t rows, size_t dim) {
+    size_t padded_rows = (rows + kInt8RowBlock - 1) / kInt8RowBlock * kInt8RowBlock;
+    return padded_rows * int8_padded_dim(dim);
+}
+
+size_t int8_activation_size(size_t dim) {
+    return int8_padded_dim(dim);
+}
+
+void quantize_rows_int8(
+    const float* weights,
+    size_t rows,
+    size_t dim,
+    int8_t* packed,
+    float* scales,
+    int32_t* row_sums
+) {
+    size_t padded_dim = int8_padded_dim(dim);
+    size_t padded_rows = (rows + kInt8RowBlock - 1) / kInt8RowBlock * kInt8RowBlock;
+    std::memset(packed, 0, padded_rows * padded_dim);
+
+    for (size_t r = 0; r < padded_rows; ++r) {
+        scales[r] = 0.0f;
+        row_sums[r] = 0;
+        if (r >= rows) {
+            continue;
+        }
+
+        const float* row = weights + r * dim;
+        float max_abs = 0.0f;
+        for (size_t j = 0; j < dim; ++j) {
+            max_abs = std::max(max_abs, std::fabs(row[j]));
+        }
+        scales[r] = max_abs / 127.0f;
+        float inv = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+
+        int8_t* block = packed + (r / kInt8RowBlock) * kInt8RowBlock * padded_dim;
+        size_t lane = r % kInt8RowBlock;
+        for (size_t j = 0; j < dim; ++j) {
+            int q = static_cast<int>(std::lround(row[j] * inv));
+            q = std::min(127, std::max(-127, q));
+            block[(j / kInt8ColGroup) * kInt8RowBlock * kInt8ColGroup + lane * kInt8ColGroup + j % kInt8ColGroup] =
+                static_cast<int8_t>(q);
+            row_sums[r] += q;
+        }
+    }
+}
+
+void dequantize_rows_int8(const int8_t* packed, const float* scales, size_t rows, size_t dim, float* out) {
+    size_t padded_dim = int8_padded_dim(dim);
+    for (size_t r = 0; r < rows; ++r) {
+        const int8_t* block = packed + (r / kInt8RowBlock) * kInt8RowBlock * padded_dim;
+        size_t lane = r % kInt8RowBlock;
+        for (size_t j = 0; j < dim; ++j) {
+            int8_t q = block[(j / kInt8ColGroup) * kInt8RowBlock * kInt8ColGroup + lane * kInt8ColGroup + j % kInt8ColGroup];
+            out[r * dim + j] = q * scales[r];
+        }
+    }
+}
+
+// Activations are stored as q + zero point so they fit the unsigned operand
+// of dpbusd / maddubs. maddubs saturates int16 pair sums, so the AVX2 path
+// keeps activations to 7 bits.
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+static constexpr int kActivationMax = 127;
+static constexpr int kActivationZero = 128;
+#elif defined(__AVX2__)
+static constexpr int kActivationMax = 63;
+static constexpr int kActivationZero = 64;
+#else
+static constexpr int kActivationMax = 127;
+static constexpr int kActivationZero = 128;
+#endif
+
+float quantize_activations_int8(const float* x, size_t dim, uint8_t* q) {
+    // Called per layer-step by lstm_cell_step_int8, so both passes are
+    // vectorized; the vector and scalar tails round to nearest even alike
+    float max_abs = 0.0f;
+    size_t j = 0;
+#if defined(__AVX512F__)
+    __m512 vmax = _mm512_setzero_ps();
+    for (; j + 16 <= dim; j += 16) {
+        vmax = _mm512_max_ps(vmax, _mm512_abs_ps(_mm512_loadu_ps(x + j)));
+    }
+    max_abs = _mm512_reduce_max_ps(vmax);
+#elif defined(__AVX2__)
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    __m256 vmax = _mm256_setzero_ps();
+    for (; j + 8 <= dim; j += 8) {
+        vmax = _mm256_max_ps(vmax, _mm256_and_ps(_mm256_loadu_ps(x + j), abs_mask));
+    }
+    max_abs = hmax_ps(vmax);
+#endif
+    for (; j < dim; ++j) {
+        max_abs = std::max(max_abs, std::fabs(x[j]));
+    }
+    float inv = max_abs > 0.0f ? kActivationMax / max_abs : 0.0f;
+
+    j = 0;
+#if defined(__AVX512F__)
+    const __m512 vinv = _mm512_set1_ps(inv);
+    for (; j + 16 <= dim; j += 16) {
+        __m512i v = _mm512_cvtps_epi32(_mm512_mul_ps(_mm512_loadu_ps(x + j), vinv));
+        v = _mm512_min_epi32(_mm512_max_epi32(v, _mm512_set1_epi32(-kActivationMax)), _mm512_set1_epi32(kActivationMax));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(q + j),
+                         _mm512_cvtepi32_epi8(_mm512_add_epi32(v, _mm512_set1_epi32(kActivationZero))));
+    }
+#elif defined(__AVX2__)
+    const __m256 vinv = _mm256_set1_ps(inv);
+    for (; j + 8 <= dim; j += 8) {
+        __m256i v = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + j), vinv));
+        v = _mm256_min_epi32(_mm256_max_epi32(v, _mm256_set1_epi32(-kActivationMax)), _mm256_set1_epi32(kActivationMax));
+        v = _mm256_add_epi32(v, _mm256_set1_epi32(kActivationZero));
+        // Per 128-bit lane, packing leaves four bytes at the bottom
+        __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(v, v), _mm256_setzero_si256());
+        uint32_t lo = static_cast<uint32_t>(_mm256_extract_epi32(bytes, 0));
+        uint32_t hi = static_cast<uint32_t>(_mm256_extract_epi32(bytes, 4));
+        std::memcpy(q + j, &lo, sizeof(lo));
+        std::memcpy(q + j + 4, &hi, sizeof(hi));
+    }
+#endif
+    for (; j < dim; ++j) {
+        int v = static_cast<int>(std::nearbyint(x[j] * inv));
+        q[j] = static_cast<uint8_t>(std::min(kActivationMax, std::max(-kActivationMax, v)) + kActivationZero);
+    }
+    // Padding columns have zero weights; any value works, keep it neutral
+    for (size_t j = dim; j < int8_padded_dim(dim); ++j) {
+        q[j] = static_cast<uint8_t>(kActivationZero);
+    }
+    return max_abs / kActivationMax;
+}
+
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+
+// Undo the activation zero point, dequantize and store one row block
+static inline void store_int8_block(
+    __m512i acc, size_t r0, size_t rows,
+    const float* scales, const int32_t* row_sums, float x_scale, float* out
+) {
+    __m512i dots = _mm512_sub_epi32(acc, _mm512_mullo_epi32(_mm512_set1_epi32(kActivationZero),
+                                                            _mm512_loadu_si512(row_sums + r0)));
+    __m512 logits = _mm512_mul_ps(_mm512_cvtepi32_ps(dots),
+                                  _mm512_mul_ps(_mm512_loadu_ps(scales + r0), _mm512_set1_ps(x_scale)));
+    size_t n = std::min(kInt8RowBlock, rows - r0);
+    _mm512_mask_storeu_ps(out + r0, static_cast<__mmask16>(n == 16 ? 0xFFFF : (1u << n) - 1), logits);
+}
+
+void project_rows_int8(
+    const int8_t* packed,
+    const float* scales,
+    const int32_t* row_sums,
+    size_t rows,
+    size_t dim,
+    const uint8_t* xq,
+    float x_scale,
+    float* out
+) {
+    constexpr size_t kTile = 4;     // row blocks sharing each activation broadcast
+    size_t groups = int8_padded_dim(dim) / kInt8ColGroup;
+    size_t block_bytes = groups * kInt8ColGroup * kInt8RowBlock;
+
+    // Each lane accumulates one row; x[4g..4g+3] is broadcast to all lanes.
+    // kTile blocks at a time keep kTile independent dpbusd chains in flight,
+    // which short (LSTM-sized) rows need to hide the dpbusd latency.
+    size_t r0 = 0;
+    for (; r0 + kTile * kInt8RowBlock <= rows; r0 += kTile * kInt8RowBlock) {
+        const int8_t* w = packed + r0 * groups * kInt8ColGroup;
+        __m512i acc[kTile];
+        #pragma GCC unroll 16
+        for (size_t t = 0; t < kTile; ++t) {
+            acc[t] = _mm512_setzero_si512();
+        }
+        for (size_t g = 0; g < groups; ++g) {
+            int32_t x0;
+            std::memcpy(&x0, xq + g * kInt8ColGroup, sizeof(x0));
+            __m512i xv = _mm512_set1_epi32(x0);
+            #pragma GCC unroll 16
+            for (size_t t = 0; t < kTile; ++t) {
+                acc[t] = _mm512_dpbusd_epi32(acc[t], xv, _mm512_load_si512(w + t * block_bytes + g * 64));
+            }
+        }
+        #pragma GCC unroll 16
+        for (size_t t = 0; t < kTile; ++t) {
+            store_int8_block(acc[t], r0 + t * kInt8RowBlock, rows, scales, row_sums, x_scale, out);
+        }
+    }
+
+    for (; r0 < rows; r0 += kInt8RowBlock) {
+        const int8_t* w = packed + r0 * groups * kInt8ColGroup;
+        __m512i acc0 = _mm512_setzero_si512();
+        __m512i acc1 = _mm512_setzero_si512();
+        size_t g = 0;
+        for (; g + 1 < groups; g += 2) {
+            int32_t x0, x1;
+            std::memcpy(&x0, xq + g * kInt8ColGroup, sizeof(x0));
+            std::memcpy(&x1, xq + (g + 1) * kInt8ColGroup, sizeof(x1));
+            acc0 = _mm512_dpbusd_epi32(acc0, _mm512_set1_epi32(x0), _mm512_load_si512(w + g * 64));
+            acc1 = _mm512_dpbusd_epi32(acc1, _mm512_set1_epi32(x1), _mm512_load_si512(w + (g + 1) * 64));
+        }
+        if (g < groups) {
+            int32_t x0;
+            std::memcpy(&x0, xq + g * kInt8ColGroup, sizeof(x0));
+            acc0 = _mm512_dpbusd_epi32(acc0, _mm512_set1_epi32(x0), _mm512_load_si512(w + g * 64));
+        }
+        store_int8_block(_mm512_add_epi32(acc0, acc1), r0, rows, scales, row_sums, x_scale, out);
+    }
+}
+
+const char* int8_kernel_isa() { return "avx512-vnni"; }
+
+#elif defined(__AVX2__)
+
+void project_rows_int8(
+    const int8_t* packed,
+    const float* scales,
+    const int32_t* row_sums,
+    size_t rows,
+    size_t dim,
+    const uint8_t* xq,
+    float x_scale,
+    float* out
+) {
+    size_t groups = int8_padded_dim(dim) / kInt8ColGroup;
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero_point = _mm256_set1_epi32(kActivationZero);
+
+    for (size_t r0 = 0; r0 < rows; r0 += kInt8RowBlock) {
+        const int8_t* w = packed + r0 * groups * kInt8ColGroup;
+
+        // Two 8-row halves; maddubs + madd(1) reduce each 4-column group to
+        // one 32-bit lane per row
+        __m256i acc[2] = {_mm256_setzero_si256(), _mm256_setzero_si256()};
+        for (size_t g = 0; g < groups; ++g) {
+            int32_t x0;
+            std::memcpy(&x0, xq + g * kInt8ColGroup, sizeof(x0));
+            __m256i xv = _mm256_set1_epi32(x0);
+            for (size_t half = 0; half < 2; ++half) {
+                __m256i wv = _mm256_load_si256(reinterpret_cast<const __m256i*>(w + g * 64 + half * 32));
+                __m256i pairs = _mm256_maddubs_epi16(xv, wv);
+                acc[half] = _mm256_add_epi32(acc[half], _mm256_madd_epi16(pairs, ones));
+            }
+        }
+
+        float logits[kInt8RowBlock];
+        for (size_t half = 0; half < 2; ++half) {
+            size_t base = r0 + half * 8;
+            __m256i dots = _mm256_sub_epi32(acc[half], _mm256_mullo_epi32(
+                zero_point, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row_sums + base))));
+            _mm256_storeu_ps(logits + half * 8, _mm256_mul_ps(_mm256_cvtepi32_ps(dots),
+                             _mm256_mul_ps(_mm256_loadu_ps(scales + base), _mm256_set1_ps(x_scale))));
+        }
+        std::memcpy(out + r0, logits, std::min(kInt8RowBlock, rows - r0) * sizeof(float));
+    }
+}
+
+const char* int8_kernel_isa() { return "avx2"; }
+
+#else
+
+void project_rows_int8(
+    const int8_t* packed,
+    const float* scales,
+    const int32_t* row_sums,
+    size_t rows,
+    size_t dim,
+    const uint8_t* xq,
+    float x_scale,
+    float* out
+) {
+    size_t groups = int8_padded_dim(dim) / kInt8ColGroup;
+
+    for (size_t r0 = 0; r0 < rows; r0 += kInt8RowBlock) {
+        const int8_t* w = packed + r0 * groups * kInt8ColGroup;
+        int32_t acc[kInt8RowBlock] = {};
+        for (size_t g = 0; g < groups; ++g) {
+            for (size_t lane = 0; lane < kInt8RowBlock; ++lane) {
+                for (size_t j = 0; j < kInt8ColGroup; ++j) {
+                    acc[lane] += static_cast<int32_t>(xq[g * kInt8ColGroup + j]) *
+                                 w[(g * kInt8RowBlock + lane) * kInt8ColGroup + j];
+                }
+            }
+        }
+
+        size_t n = std::min(kInt8RowBlock, rows - r0);
+        for (size_t lane = 0; lane < n; ++lane) {
+            int32_t dot = acc[lane] - kActivationZero * row_sums[r0 + lane];
+            out[r0 + lane] = static_cast<float>(dot) * scales[r0 + lane] * x_scale;
+        }
+    }
+}
+
+const char* int8_kernel_isa() { return "scalar"; }
+
+#endif
+
+// ---------------------------------------------------------------------------
+// INT8 LSTM layers
+// ---------------------------------------------------------------------------
+
+size_t packed_lstm_int8_size(size_t input_dim, size_t hidden_dim) {
+    size_t rows = lstm_gate_rows(hidden_dim);
+    return packed_int8_rows_size(rows, input_dim) + packed_int8_rows_size(rows, hidden_dim);
+}
+
+void quantize_lstm_weights_int8(
+    const float* packed_weights,
+    size_t input_dim,
+    size_t hidden_dim,
+    int8_t* packed,
+    float* scales,
+    int32_t* row_sums
+) {
+    size_t rows = lstm_gate_rows(hidden_dim);
+    size_t num_cols = input_dim + hidden_dim;
+    std::vector<float> w_x(rows * input_dim);
+    std::vector<float> w_h(rows * hidden_dim);
+
+    // Gate row r is lane r % kLstmBlock of gate (r / kLstmBlock) % kLstmGates
+    // in block r / (kLstmGates * kLstmBlock), the order of the packed bias
+    for (size_t r = 0; r < rows; ++r) {
+        size_t lane = r % kLstmBlock;
+        size_t g = (r / kLstmBlock) % kLstmGates;
+        const float* block = packed_weights + (r / (kLstmGates * kLstmBlock)) * num_cols * kLstmGates * kLstmBlock;
+        for (size_t k = 0; k < num_cols; ++k) {
+            float w = block[(k * kLstmGates + g) * kLstmBlock + lane];
+            if (k < input_dim) {
+                w_x[r * input_dim + k] = w;
+            } else {
+                w_h[r * hidden_dim + (k - input_dim)] = w;
+            }
+        }
+    }
+
+    quantize_rows_int8(w_x.data(), rows, input_dim, packed, scales, row_sums);
+    quantize_rows_int8(w_h.data(), rows, hidden_dim, packed + packed_int8_rows_size(rows, input_dim),
+                       scales + rows, row_sums + rows);
+}
+
+static inline size_t activation_scratch_floats(size_t dim) {
+    return round_up_to_block((int8_activation_size(dim) + sizeof(float) - 1) / sizeof(float));
+}
+
+size_t lstm_int8_scratch_floats(size_t input_dim, size_t hidden_dim) {
+    return 2 * lstm_gate_rows(hidden_dim) + activation_scratch_floats(input_dim) +
+           activation_scratch_floats(hidden_dim);
+}
+
+void lstm_cell_step_int8(
+    const int8_t* packed,
+    const float* scales,
+    const int32_t* row_sums,
+    const float* packed_bias,
+    const float* x,
+    size_t input_dim,
+    const float* h_prev,
+    float* c,
+    float* h_out,
+    size_t hidden_dim,
+    float* scratch
+) {
+    size_t rows = lstm_gate_rows(hidden_dim);
+    float* gates = scratch;
+    float* recurrent = scratch + rows;
+    uint8_t* xq = reinterpret_cast<uint8_t*>(scratch + 2 * rows);
+    uint8_t* hq = reinterpret_cast<uint8_t*>(scratch + 2 * rows + activation_scratch_floats(input_dim));
+
+    // Both GEMVs on the INT8 projection kernel, each with its own activation scale
+    float x_scale = quantize_activations_int8(x, input_dim, xq);
+    float h_scale = quantize_activations_int8(h_prev, hidden_dim, hq);
+    project_rows_int8(packed, scales, row_sums, rows, input_dim, xq, x_scale, gates);
+    project_rows_int8(packed + packed_int8_rows_size(rows, input_dim), scales + rows, row_sums + rows,
+                      rows, hidden_dim, hq, h_scale, recurrent);
+    for (size_t r = 0; r < rows; ++r) {
+        gates[r] += recurrent[r] + packed_bias[r];
+    }
+
+    lstm_apply_gates(gates, c, h_out, hidden_dim);
+}
+
+} // namespace cxlspeckv
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace cxlspeckv {
+
+// Hidden units processed together by the fused LSTM kernel (one AVX-512
+// register, two AVX2 registers). Packed weights are padded to this width.
+constexpr size_t kLstmBlock = 16;
+
+// Number of LSTM gates, packed in PyTorch order: input, forget, cell, output
+constexpr size_t kLstmGates = 4;
+
+// Alignment of every weight tensor and scratch buffer (one cache line)
+constexpr size_t kWeightAlignment = 64;
+
+inline size_t round_up_to_block(size_t n) {
+    return (n + kLstmBlock - 1) / kLstmBlock * kLstmBlock;
+}
+
+// Gate rows of one layer: kLstmGates per hidden unit, padded to kLstmBlock
+inline size_t lstm_gate_rows(size_t hidden_dim) {
+    return round_up_to_block(hidden_dim) * kLstmGates;
+}
+
+// 64-byte aligned float / byte buffers, from the aligned operator new
+struct AlignedDeleter {
+    template <typename T>
+    void operator()(T* ptr) const { ::operator delete(ptr, std::align_val_t(kWeightAlignment)); }
+};
+using AlignedFloatBuffer = std::unique_ptr<float[], AlignedDeleter>;
+using AlignedByteBuffer = std::unique_ptr<int8_t[], AlignedDeleter>;
+
+AlignedFloatBuffer allocate_aligned_floats(size_t count);
+AlignedByteBuffer allocate_aligned_bytes(size_t count);
+
+// Size in floats of one layer's packed weights / bias
+size_t packed_lstm_weights_size(size_t input_dim, size_t hidden_dim);
+size_t packed_lstm_bias_size(size_t hidden_dim);
+
+/**
+ * Pack one LSTM layer into the gate-interleaved layout used by lstm_cell_step.
+ *
+ * w_ih: [4*hidden_dim x input_dim] row-major, gates in i, f, g, o order
+ * w_hh: [4*hidden_dim x hidden_dim] row-major
+ * bias: [4*hidden_dim] (b_ih + b_hh)
+ *
+ * Layout: for each block of kLstmBlock hidden units, for each column k of
+ * [x | h], the 4 gates x kLstmBlock weights are contiguous (256 bytes), so a
+ * single pass over the block computes all four gates of both GEMVs.
+ */
+void pack_lstm_weights(
+    const float* w_ih,
+    const float* w_hh,
+    const float* bias,
+    size_t input_dim,
+    size_t hidden_dim,
+    float* packed_weights,
+    float* packed_bias
+);
+
+/**
+ * One LSTM time step for one layer:
+ *   gates = W_ih x + W_hh h_prev + b
+ *   c = sigmoid(f) * c + sigmoid(i) * tanh(g)
+ *   h_out = sigmoid(o) * tanh(c)
+ *
+ * h_prev, c and h_out hold round_up_to_block(hidden_dim) floats and must be
+ * 64-byte aligned. h_out must not alias h_prev; c is updated in place.
+ */
+void lstm_cell_step(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x,
+    size_t input_dim,
+    const float* h_prev,
+    float* c,
+    float* h_out,
+    size_t hidden_dim
+);
+
+/**
+ * lstm_cell_step for a batch of sequences stacked row-major: sequence s reads
+ * x + s*ldx and h_prev + s*ldh and updates c + s*ldh, h_out + s*ldh (ldh a
+ * multiple of kLstmBlock). Each packed weight load feeds several sequences,
+ * turning the per-sequence GEMVs into a register-blocked GEMM.
+ */
+void lstm_cell_step_batch(
+    const float* packed_weights,
+    const float* packed_bias,
+    const float* x, size_t ldx, size_t input_dim,
+    const float* h_prev, float* c, float* h_out, size_t ldh,
+    size_t hidden_dim,
+    size_t batch
+);
+
+// out[r] = dot(weights[r, :], x) for r < rows (weights row-major, rows x dim)
+void project_rows(const float* weights, size_t rows, size_t dim, const float* x, float* out);
+
+// out[s*ldo + r] = dot(weights[r, :], x + s*ldx) for r < rows, s < batch
+void project_rows_batch(
+    const float* weights, size_t rows, size_t dim,
+    const float* x, size_t ldx, size_t batch,
+    float* out, size_t ldo
+);
+
+// Rows interleaved per INT8 block (one 32-bit accumulator lane per row)
+constexpr size_t kInt8RowBlock = 16;
+
+// Columns of a row packed into each 32-bit lane
+constexpr size_t kInt8ColGroup = 4;
+
+// Bytes of a row-quantized matrix as laid out by quantize_rows_int8
+size_t packed_int8_rows_size(size_t rows, size_t dim);
+
+// Bytes needed by quantize_activations_int8 for a dim-wide vector
+size_t int8_activation_size(size_t dim);
+
+/**
+ * Symmetric per-row INT8 quantization of a row-major [rows x dim] matrix:
+ * q[r][j] = round(w[r][j] / scales[r]), scales[r] = max|w[r]| / 127.
+ *
+ * Layout: blocks of kInt8RowBlock rows; within a block, for each group of
+ * kInt8ColGroup columns, the 16 rows x 4 bytes are contiguous (64 bytes), so
+ * one VNNI dpbusd computes a 4-column partial dot product for 16 rows.
+ * scales and row_sums (sum of q[r], used to undo the activation zero point)
+ * must hold round_up(rows, kInt8RowBlock) entries.
+ */
+void quantize_rows_int8(
+    const float* weights,
+    size_t rows,
+    size_t dim,
+    int8_t* packed,
+    float* scales,
+    int32_t* row_sums
+);
+
+// Inverse of quantize_rows_int8 (exact for the quantized values)
+void dequantize_rows_int8(const int8_t* packed, const float* scales, size_t rows, size_t dim, float* out);
+
+// Quantize an activation vector to zero-point-shifted uint8; returns its scale
+float quantize_activations_int8(const float* x, size_t dim, uint8_t* q);
+
+/**
+ * out[r] = dot(weights[r, :], x) for r < rows on quantized operands.
+ * packed, scales and row_sums start at a multiple of kInt8RowBlock rows.
+ */
+void project_rows_int8(
+    const int8_t* packed,
+    const float* scales,
+    const int32_t* row_sums,
+    size_t rows,
+    size_t dim,
+    const uint8_t* xq,
+    float x_scale,
+    float* out
+);
+
+// Name of the INT8 kernel variant compiled in ("avx512-vnni", "avx2" or "scalar")
+const char* int8_kernel_isa();
+
+// Bytes of one layer as laid out by quantize_lstm_weights_int8
+size_t packed_lstm_int8_size(size_t input_dim, size_t hidden_dim);
+
+/**
+ * Quantize a layer packed by pack_lstm_weights for lstm_cell_step_int8.
+ *
+ * The gate rows, in packed bias order (block, gate, lane), become two
+ * quantize_rows_int8 matrices: the input columns, then the recurrent
+ * columns. Each has its own per-row scales and row sums, so scales and
+ * row_sums hold 2 * lstm_gate_rows(hidden_dim) entries (input rows first),
+ * and x and h_prev are quantized with separate activation scales.
+ */
+void quantize_lstm_weights_int8(
+    const float* packed_weights,
+    size_t input_dim,
+    size_t hidden_dim,
+    int8_t* packed,
+    float* scales,
+    int32_t* row_sums
+);
+
+// Floats of 64-byte aligned scratch needed by lstm_cell_step_int8
+size_t lstm_int8_scratch_floats(size_t input_dim, size_t hidden_dim);
+
+/**
+ * lstm_cell_step on a layer quantized by quantize_lstm_weights_int8. x and
+ * h_prev are quantized on entry, both GEMVs run on project_rows_int8, and
+ * the bias, gate nonlinearities and cell state stay in FP32. A quarter of
+ * the FP32 weight bytes is streamed per step.
+ */
+void lstm_cell_step_int8(
+    const int8_t* packed,
+    const float* scales,
+    const int32_t* row_sums,
+    const float* packed_bias,
+    const float* x,
+    size_t input_dim,
+    const float* h_prev,
+    float* c,
+    float* h_out,
+    size_t hidden_dim,
+    float* scratch
+);
+
+/**
+ * Streaming top-k selection with an online softmax normaliser.
+ *
+ * Logits are fed in chunks; only lanes above the current k-th best are
+ * inserted into a size-k min-heap, and the partition function is kept as a
+ * running (max, sum of exp) pair, so no vocabulary-sized buffer or sort is
+ * needed. topk_finalize() turns the surviving logits into softmax
+ * probabilities over the whole stream.
+ */
+struct LogitTopK {
+    std::pair<uint32_t, float>* heap;   // (token, logit), min-heap on logit
+    size_t k;
+    size_t size;
+    float max_logit;
+    float sum_exp;                      // sum of exp(logit - max_logit)
+};
+
+void topk_init(LogitTopK& state, std::pair<uint32_t, float>* heap, size_t k);
+void topk_accumulate(LogitTopK& state, const float* logits, uint32_t first_token, size_t count);
+
+// Add weight * exp(logit) to the normaliser without offering a candidate
+// (probability mass of tokens that were estimated rather than scored)
+void topk_add_mass(LogitTopK& state, float logit, float weight);
+
+// Writes the selected tokens to out, highest first, as (token, probability)
+size_t topk_finalize(LogitTopK& state, std::pair<uint32_t, float>* out);
+
+// Name of the kernel variant compiled in ("avx512", "avx2" or "scalar")
+const char* lstm_kernel_isa();
+
+} // namespace cxlspeckv
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace cxlspeckv {
+
+/**
+ * On-disk format of an LSTMPredictor model (little-endian).
+ *
+ *   LstmModelHeader                      64 bytes
+ *   LstmModelTensor[num_tensors]         32 bytes each
+ *   tensor data                          each at a kLstmModelAlignment offset
+ *
+ * Tensors are stored in the layout the kernels consume (LSTM layers packed
+ * by pack_lstm_weights, INT8 output rows packed by quantize_rows_int8), so a
+ * read-only mapping of the file is used in place without copies. The packing
+ * block sizes are recorded and must match the loading build.
+ */
+constexpr char kLstmModelMagic[8] = {'S', 'P', 'K', 'V', 'L', 'S', 'T', 'M'};
+constexpr uint32_t kLstmModelVersion = 1;
+constexpr size_t kLstmModelAlignment = 64;
+
+// Storage type of the embedding table and output projection
+// (LSTM layers are always FP32; INT8 step copies are rebuilt on load)
+enum LstmModelDType : uint32_t {
+    kLstmModelFP32 = 0,
+    kLstmModelINT8 = 1,
+};
+
+enum LstmTensorKind : uint32_t {
+    kTensorEmbedding = 1,           // FP32 or INT8, vocab_size x embedding_dim
+    kTensorEmbeddingScales = 2,     // INT8 only: float per token
+    kTensorOutput = 3,              // FP32 vocab_size x hidden_dim, or packed INT8
+    kTensorOutputScales = 4,        // INT8 only: float per row, padded to kInt8RowBlock
+    kTensorOutputRowSums = 5,       // INT8 only: int32 per row, padded to kInt8RowBlock
+    kTensorLayerWeights = 6,        // per layer, packed gate-interleaved
+    kTensorLayerBias = 7,           // per layer, packed
+};
+
+struct LstmModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;          // sizeof(LstmModelHeader)
+    uint32_t vocab_size;
+    uint32_t embedding_dim;
+    uint32_t hidden_dim;
+    uint32_t num_layers;
+    uint32_t history_length;
+    uint32_t dtype;                 // LstmModelDType
+    uint32_t lstm_block;            // kLstmBlock used to pack the layers
+    uint32_t int8_row_block;        // kInt8RowBlock used to pack INT8 output rows
+    uint32_t num_tensors;
+    uint32_t reserved;
+    uint64_t file_bytes;
+};
+
+struct LstmModelTensor {
+    uint32_t kind;                  // LstmTensorKind
+    uint32_t layer;                 // layer index for per-layer tensors, else 0
+    uint64_t offset;                // from start of file
+    uint64_t bytes;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(LstmModelHeader) == 64, "LstmModelHeader layout");
+static_assert(sizeof(LstmModelTensor) == 32, "LstmModelTensor layout");
+
+} // namespace cxlspeckv
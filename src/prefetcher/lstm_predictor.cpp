@@ -1,11 +1,87 @@
 #include "lstm_predictor.h"
+#include "lstm_model_format.h"
 #include <cmath>
 #include <algorithm>
 #include <fstream>
 #include <cstring>
+#include <limits>
+#include <chrono>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace cxlspeckv {
 
+namespace {
+
+// Per-thread scratch reused across predict_top_k calls, so a steady-state
+// prediction performs no heap allocation. Grows to the largest predictor
+// used on the thread.
+struct PredictScratch {
+    AlignedFloatBuffer floats;
+    size_t float_capacity = 0;
+    
+    float* reserve(size_t count) {
+        if (count > float_capacity) {
+            floats = allocate_aligned_floats(count);
+            float_capacity = count;
+        }
+        return floats.get();
+    }
+};
+
+PredictScratch& thread_scratch() {
+    thread_local PredictScratch scratch;
+    return scratch;
+}
+
+// Size in bytes of a model tensor, or 0 if it does not belong in a model
+// with this header's dimensions and dtype
+size_t model_tensor_bytes(uint32_t kind, uint32_t layer, const LstmModelHeader& header) {
+    size_t vocab = header.vocab_size;
+    size_t padded_rows = (vocab + kInt8RowBlock - 1) / kInt8RowBlock * kInt8RowBlock;
+    bool int8 = header.dtype == kLstmModelINT8;
+    
+    switch (kind) {
+        case kTensorEmbedding:
+            return vocab * header.embedding_dim * (int8 ? sizeof(int8_t) : sizeof(float));
+        case kTensorEmbeddingScales:
+            return int8 ? vocab * sizeof(float) : 0;
+        case kTensorOutput:
+            return int8 ? packed_int8_rows_size(vocab, header.hidden_dim)
+                        : vocab * header.hidden_dim * sizeof(float);
+        case kTensorOutputScales:
+            return int8 ? padded_rows * sizeof(float) : 0;
+        case kTensorOutputRowSums:
+            return int8 ? padded_rows * sizeof(int32_t) : 0;
+        case kTensorLayerWeights:
+            if (layer >= header.num_layers) {
+                return 0;
+            }
+            return packed_lstm_weights_size(layer == 0 ? header.embedding_dim : header.hidden_dim,
+                                            header.hidden_dim) * sizeof(float);
+        case kTensorLayerBias:
+            return layer < header.num_layers ? packed_lstm_bias_size(header.hidden_dim) * sizeof(float) : 0;
+        default:
+            return 0;
+    }
+}
+
+} // namespace
+
+struct LSTMPredictor::MappedModel {
+    void* data = MAP_FAILED;
+    size_t bytes = 0;
+    
+    ~MappedModel() {
+        if (data != MAP_FAILED) {
+            munmap(data, bytes);
+        }
+    }
+};
+
 LSTMPredictor::LSTMPredictor(
     size_t vocab_size,
     size_t embedding_dim,
@@ -15,177 +91,1648 @@ LSTMPredictor::LSTMPredictor(
 ) : vocab_size_(vocab_size),
     embedding_dim_(embedding_dim),
     hidden_dim_(hidden_dim),
-    num_layers_(num_layers),
-    history_length_(history_length)
+    num_layers_(std::clamp<size_t>(num_layers, 1, kMaxLstmLayers)),
+    history_length_(history_length),
+    precision_(WeightPrecision::FP32),
+    sequence_capacity_(kDefaultSequenceCacheCapacity),
+    batch_threads_(1),
+    stat_predictions_(0),
+    stat_layer_steps_(0),
+    stat_step_ns_(0),
+    stat_predict_ns_(0),
+    stat_sequence_hits_(0),
+    stat_sequence_misses_(0),
+    stat_sequence_evictions_(0),
+    stat_shortlist_predictions_(0),
+    stat_shortlist_fallbacks_(0),
+    stat_rows_scored_(0),
+    stat_adaptation_observations_(0),
+    stat_adaptation_dropped_(0),
+    stat_adaptation_versions_(0),
+    stat_adapted_predictions_(0)
 {
-    // Initialize model weights (simplified - in real implementation would load from file)
+    // Random weights until a trained model is loaded (load_model) or set
     embedding_weights_.resize(vocab_size_ * embedding_dim_, 0.0f);
-    lstm_weights_.resize(num_layers_ * hidden_dim_ * hidden_dim_ * 4, 0.0f);  // 4 gates
     output_weights_.resize(hidden_dim_ * vocab_size_, 0.0f);
     
+    auto small_random = []() {
+        return (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.1f;
+    };
+    
     // Initialize with small random values (Xavier initialization)
     for (size_t i = 0; i < embedding_weights_.size(); ++i) {
-        embedding_weights_[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.1f;
-    }
-    for (size_t i = 0; i < lstm_weights_.size(); ++i) {
-        lstm_weights_[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.1f;
+        embedding_weights_[i] = small_random();
     }
     for (size_t i = 0; i < output_weights_.size(); ++i) {
-        output_weights_[i] = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.1f;
+        output_weights_[i] = small_random();
+    }
+    weights_.embedding = embedding_weights_.data();
+    weights_.output = output_weights_.data();
+    
+    lstm_weights_.resize(num_layers_);
+    lstm_bias_.resize(num_layers_);
+    for (size_t layer = 0; layer < num_layers_; ++layer) {
+        size_t input_dim = layer_input_dim(layer);
+        std::vector<float> w_ih(4 * hidden_dim_ * input_dim);
+        std::vector<float> w_hh(4 * hidden_dim_ * hidden_dim_);
+        std::vector<float> bias(4 * hidden_dim_);
+        for (auto& w : w_ih) w = small_random();
+        for (auto& w : w_hh) w = small_random();
+        for (auto& b : bias) b = small_random();
+        set_layer_weights(layer, w_ih.data(), w_hh.data(), bias.data());
     }
 }
 
-LSTMPredictor::~LSTMPredictor() = default;
+LSTMPredictor::~LSTMPredictor() {
+    std::atomic_store(&batch_pool_, std::shared_ptr<BatchPool>());
+    disable_adaptation();
+}
 
 std::vector<std::pair<uint32_t, float>> LSTMPredictor::predict_top_k(
     const std::vector<uint32_t>& token_history,
     size_t k
 ) {
-    // Ensure history length matches
-    std::vector<uint32_t> history = token_history;
-    if (history.size() > history_length_) {
-        history = std::vector<uint32_t>(history.end() - history_length_, history.end());
-    } else if (history.size() < history_length_) {
-        // Pad with zeros
-        history.insert(history.begin(), history_length_ - history.size(), 0);
+    std::vector<std::pair<uint32_t, float>> result(std::min(k, vocab_size_));
+    result.resize(predict_top_k(token_history.data(), token_history.size(), k, result.data()));
+    return result;
+}
+
+size_t LSTMPredictor::predict_top_k(
+    const uint32_t* token_history,
+    size_t history_len,
+    size_t k,
+    std::pair<uint32_t, float>* out
+) {
+    auto predict_start = std::chrono::steady_clock::now();
+    
+    LSTMState states[kMaxLstmLayers];
+    PredictBuffers buffers = init_states(thread_scratch().reserve(scratch_floats()), states);
+    
+    replay_history(token_history, history_len, states, buffers);
+    
+    // Select the top-k tokens straight from the output projection
+    size_t count = compute_top_k(states[num_layers_ - 1].hidden, token_history, history_len,
+                                 buffers, k, out);
+    
+    auto predict_end = std::chrono::steady_clock::now();
+    stat_predictions_++;
+    stat_predict_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(predict_end - predict_start).count();
+    
+    return count;
+}
+
+std::vector<std::vector<std::pair<uint32_t, float>>> LSTMPredictor::predict_top_k_batch(
+    const std::vector<std::vector<uint32_t>>& token_histories,
+    size_t k
+) {
+    size_t batch = token_histories.size();
+    std::vector<const uint32_t*> histories(batch);
+    std::vector<size_t> lens(batch);
+    for (size_t s = 0; s < batch; ++s) {
+        histories[s] = token_histories[s].data();
+        lens[s] = token_histories[s].size();
+    }
+    
+    std::vector<std::pair<uint32_t, float>> flat(batch * k);
+    std::vector<size_t> counts(batch);
+    predict_top_k_batch(histories.data(), lens.data(), batch, k, flat.data(), counts.data());
+    
+    std::vector<std::vector<std::pair<uint32_t, float>>> results(batch);
+    for (size_t s = 0; s < batch; ++s) {
+        results[s].assign(flat.begin() + s * k, flat.begin() + s * k + counts[s]);
+    }
+    return results;
+}
+
+void LSTMPredictor::predict_top_k_batch(
+    const uint32_t* const* token_histories,
+    const size_t* history_lens,
+    size_t batch,
+    size_t k,
+    std::pair<uint32_t, float>* out,
+    size_t* counts
+) {
+    if (batch == 0) {
+        return;
+    }
+    
+    auto predict_start = std::chrono::steady_clock::now();
+    
+    // Each thread takes a contiguous run of chunks and uses its own scratch
+    size_t chunks = (batch + kBatchChunk - 1) / kBatchChunk;
+    std::shared_ptr<BatchPool> pool = std::atomic_load(&batch_pool_);
+    size_t threads = pool ? std::min(pool->threads.size() + 1, chunks) : 1;
+    std::unique_lock<std::mutex> dispatch;
+    if (threads > 1) {
+        dispatch = std::unique_lock<std::mutex>(pool->dispatch, std::try_to_lock);
+        if (!dispatch.owns_lock()) {
+            threads = 1;
+        }
     }
+    BatchJob job{token_histories, history_lens, batch, k, out, counts,
+                 (chunks + threads - 1) / threads * kBatchChunk};
     
-    // Initialize LSTM state
-    LSTMState state;
-    state.hidden.resize(hidden_dim_, 0.0f);
-    state.cell.resize(hidden_dim_, 0.0f);
+    if (threads == 1) {
+        run_batch_slice(job, 0, batch);
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            pool->job = job;
+            pool->remaining = pool->threads.size();
+            pool->generation++;
+        }
+        pool->wake.notify_all();
+        run_batch_slice(job, 0, std::min(batch, job.per_thread));
+        
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->done.wait(lock, [&pool] { return pool->remaining == 0; });
+    }
+    
+    // Latency is amortised over the batch
+    auto predict_end = std::chrono::steady_clock::now();
+    stat_predictions_ += batch;
+    stat_predict_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(predict_end - predict_start).count();
+}
+
+void LSTMPredictor::set_batch_threads(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    std::shared_ptr<BatchPool> pool;
+    if (threads > 1) {
+        pool = std::make_shared<BatchPool>();
+        pool->threads.reserve(threads - 1);
+        for (size_t i = 1; i < threads; ++i) {
+            pool->threads.emplace_back(&LSTMPredictor::batch_worker, this, pool.get(), i);
+        }
+    }
+    // A batch still running on the old pool keeps it alive until it returns
+    std::atomic_store(&batch_pool_, pool);
+    batch_threads_ = threads;
+}
+
+LSTMPredictor::BatchPool::~BatchPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void LSTMPredictor::run_batch_slice(const BatchJob& job, size_t begin, size_t end) {
+    for (size_t first = begin; first < end; first += kBatchChunk) {
+        size_t count = std::min(kBatchChunk, end - first);
+        predict_batch_chunk(job.token_histories + first, job.history_lens + first, count, job.k,
+                            job.out + first * job.k, job.counts + first);
+    }
+}
+
+void LSTMPredictor::batch_worker(BatchPool* pool, size_t index) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    while (true) {
+        pool->wake.wait(lock, [pool, seen] { return pool->stop || pool->generation != seen; });
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->generation;
+        BatchJob job = pool->job;
+        lock.unlock();
+        
+        size_t begin = index * job.per_thread;
+        if (begin < job.batch) {
+            run_batch_slice(job, begin, std::min(job.batch, begin + job.per_thread));
+        }
+        
+        lock.lock();
+        if (--pool->remaining == 0) {
+            pool->done.notify_one();
+        }
+    }
+}
+
+size_t LSTMPredictor::get_batch_threads() const {
+    return batch_threads_.load();
+}
+
+void LSTMPredictor::predict_batch_chunk(
+    const uint32_t* const* token_histories,
+    const size_t* history_lens,
+    size_t batch,
+    size_t k,
+    std::pair<uint32_t, float>* out,
+    size_t* counts
+) {
+    size_t padded_hidden = round_up_to_block(hidden_dim_);
+    size_t padded_embed = round_up_to_block(embedding_dim_);
+    
+    // Arena layout: [per-layer hidden/cell/next_hidden, batch rows each]
+    // [stacked embeddings][logit chunk per sequence][quantized activations]
+    // [shortlist scratch][INT8 layer-step scratch]
+    float* arena = thread_scratch().reserve(batch_scratch_floats(batch));
+    std::memset(arena, 0, batch_scratch_floats(batch) * sizeof(float));
     
-    // Process history through LSTM layers
+    float* hidden[kMaxLstmLayers];
+    float* cell[kMaxLstmLayers];
+    float* next_hidden[kMaxLstmLayers];
+    for (size_t layer = 0; layer < num_layers_; ++layer) {
+        hidden[layer] = arena;
+        cell[layer] = arena + batch * padded_hidden;
+        next_hidden[layer] = arena + 2 * batch * padded_hidden;
+        arena += 3 * batch * padded_hidden;
+    }
+    float* inputs = arena;
+    float* logits = inputs + batch * padded_embed;
+    uint8_t* acts = reinterpret_cast<uint8_t*>(logits + batch * kLogitChunk);
+    size_t act_stride = activation_floats() * sizeof(float);
+    float* shortlist_scratch = logits + batch * (kLogitChunk + activation_floats());
+    float* gate_scratch = shortlist_scratch + shortlist_floats();
+    
+    // Process every history through the LSTM layers, one time step for the
+    // whole batch at a time (same windowing and padding as predict_top_k)
+    auto steps_start = std::chrono::steady_clock::now();
     for (size_t t = 0; t < history_length_; ++t) {
-        // Embed token
-        std::vector<float> embedded = embed_token(history[t]);
+        for (size_t s = 0; s < batch; ++s) {
+            size_t len = history_lens[s];
+            size_t pad = len < history_length_ ? history_length_ - len : 0;
+            const uint32_t* window = token_histories[s] + (len > history_length_ ? len - history_length_ : 0);
+            uint32_t token = t < pad ? 0 : window[t - pad];
+            float* row = inputs + s * padded_embed;
+            const float* embedding = embed_token(token, row);
+            if (embedding != row) {
+                std::memcpy(row, embedding, embedding_dim_ * sizeof(float));
+            }
+        }
         
-        // Forward through LSTM layers
+        const float* input = inputs;
+        size_t input_stride = padded_embed;
         for (size_t layer = 0; layer < num_layers_; ++layer) {
-            size_t weight_offset = layer * hidden_dim_ * hidden_dim_ * 4;
-            lstm_forward(embedded, state, 
-                        std::vector<float>(lstm_weights_.begin() + weight_offset,
-                                         lstm_weights_.begin() + weight_offset + hidden_dim_ * hidden_dim_ * 4));
+            if (precision_ == WeightPrecision::INT8) {
+                // An INT8 layer is small enough to stay in L1 across the batch
+                const QuantizedLayer& q = lstm_q_[layer];
+                for (size_t s = 0; s < batch; ++s) {
+                    lstm_cell_step_int8(q.weights.get(), q.scales.data(), q.row_sums.data(),
+                                        weights_.lstm_bias[layer], input + s * input_stride,
+                                        layer_input_dim(layer), hidden[layer] + s * padded_hidden,
+                                        cell[layer] + s * padded_hidden, next_hidden[layer] + s * padded_hidden,
+                                        hidden_dim_, gate_scratch);
+                }
+            } else {
+                lstm_cell_step_batch(weights_.lstm_weights[layer], weights_.lstm_bias[layer],
+                                     input, input_stride, layer_input_dim(layer),
+                                     hidden[layer], cell[layer], next_hidden[layer], padded_hidden,
+                                     hidden_dim_, batch);
+            }
+            std::swap(hidden[layer], next_hidden[layer]);
+            input = hidden[layer];
+            input_stride = padded_hidden;
         }
     }
+    auto steps_end = std::chrono::steady_clock::now();
+    stat_layer_steps_ += history_length_ * num_layers_ * batch;
+    stat_step_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(steps_end - steps_start).count();
     
-    // Compute output probabilities
-    std::vector<float> probs = compute_output_probs(state.hidden);
+    const float* top_hidden = hidden[num_layers_ - 1];
+    if (shortlist_) {
+        // Each sequence probes its own clusters, so the shortlist runs per
+        // sequence; it scores far fewer rows than the batched full GEMM
+        for (size_t s = 0; s < batch; ++s) {
+            PredictBuffers buffers{inputs + s * padded_embed,
+                                   acts + s * act_stride,
+                                   shortlist_scratch,
+                                   gate_scratch};
+            counts[s] = compute_top_k(top_hidden + s * padded_hidden, token_histories[s],
+                                      history_lens[s], buffers, k, out + s * k);
+        }
+        return;
+    }
     
-    // Get top-k tokens
-    std::vector<std::pair<uint32_t, float>> token_probs;
-    token_probs.reserve(vocab_size_);
-    for (size_t i = 0; i < vocab_size_; ++i) {
-        token_probs.emplace_back(static_cast<uint32_t>(i), probs[i]);
+    // Vocabulary projection as a GEMM over row chunks, each chunk streamed
+    // through every sequence's top-k filter while it is cache-resident
+    LogitTopK topk[kBatchChunk];
+    for (size_t s = 0; s < batch; ++s) {
+        topk_init(topk[s], out + s * k, std::min(k, vocab_size_));
+    }
+    float act_scales[kBatchChunk] = {};
+    if (precision_ == WeightPrecision::INT8) {
+        for (size_t s = 0; s < batch; ++s) {
+            act_scales[s] = quantize_activations_int8(top_hidden + s * padded_hidden, hidden_dim_,
+                                                      acts + s * act_stride);
+        }
     }
+    for (size_t row = 0; row < vocab_size_; row += kLogitChunk) {
+        size_t count = std::min(kLogitChunk, vocab_size_ - row);
+        if (precision_ == WeightPrecision::INT8) {
+            // The chunk's INT8 rows stay in L1 across the batch
+            for (size_t s = 0; s < batch; ++s) {
+                project_output(row, count, top_hidden + s * padded_hidden, acts + s * act_stride,
+                               act_scales[s], logits + s * kLogitChunk);
+            }
+        } else {
+            project_rows_batch(weights_.output + row * hidden_dim_, count, hidden_dim_,
+                               top_hidden, padded_hidden, batch, logits, kLogitChunk);
+        }
+        for (size_t s = 0; s < batch; ++s) {
+            topk_accumulate(topk[s], logits + s * kLogitChunk, static_cast<uint32_t>(row), count);
+        }
+    }
+    std::shared_ptr<const PublishedNgram> ngram = std::atomic_load(&ngram_);
+    for (size_t s = 0; s < batch; ++s) {
+        counts[s] = finalize_top_k(topk[s], ngram.get(), token_histories[s], history_lens[s],
+                                   top_hidden + s * padded_hidden, acts + s * act_stride, act_scales[s],
+                                   out + s * k);
+    }
+    stat_rows_scored_ += vocab_size_ * batch;
+}
+
+size_t LSTMPredictor::predict_next(
+    uint64_t sequence_id,
+    uint64_t position,
+    const uint32_t* token_history,
+    size_t history_len,
+    size_t k,
+    std::pair<uint32_t, float>* out
+) {
+    if (history_len == 0) {
+        return predict_top_k(token_history, history_len, k, out);
+    }
+    
+    auto predict_start = std::chrono::steady_clock::now();
+    
+    LSTMState states[kMaxLstmLayers];
+    PredictBuffers buffers = init_states(thread_scratch().reserve(scratch_floats()), states);
+    size_t padded_hidden = round_up_to_block(hidden_dim_);
     
-    // Sort by probability (descending)
-    std::sort(token_probs.begin(), token_probs.end(),
-              [](const auto& a, const auto& b) { return a.second > b.second; });
+    std::unique_lock<std::mutex> entry_lock;
+    SequenceState* seq = acquire_sequence(sequence_id, entry_lock);
     
-    // Return top-k
-    std::vector<std::pair<uint32_t, float>> result;
-    result.reserve(k);
-    for (size_t i = 0; i < std::min(k, token_probs.size()); ++i) {
-        result.push_back(token_probs[i]);
+    if (seq) {
+        // The cached state is reusable at its own position, or one token
+        // later, when the window's older tokens are the ones it consumed
+        uint64_t consumed = seq->position;
+        bool advance = position == consumed + 1;
+        bool extends = consumed > 0 && (advance || position == consumed);
+        if (extends) {
+            size_t older = advance ? history_len - 1 : history_len;
+            size_t overlap = std::min(older, seq->recent_len);
+            extends = std::equal(token_history + older - overlap, token_history + older,
+                                 seq->recent.data() + seq->recent_len - overlap);
+        }
+        
+        if (extends) {
+            stat_sequence_hits_++;
+            const float* cached = seq->state.get();
+            for (size_t layer = 0; layer < num_layers_; ++layer) {
+                std::memcpy(states[layer].hidden, cached, padded_hidden * sizeof(float));
+                std::memcpy(states[layer].cell, cached + padded_hidden, padded_hidden * sizeof(float));
+                cached += 2 * padded_hidden;
+            }
+            if (advance) {
+                auto steps_start = std::chrono::steady_clock::now();
+                step_token(token_history[history_len - 1], states, buffers);
+                auto steps_end = std::chrono::steady_clock::now();
+                stat_layer_steps_ += num_layers_;
+                stat_step_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(steps_end - steps_start).count();
+                
+                // The new token is the true successor of the last prediction
+                observe_token(token_history, history_len - 1, token_history[history_len - 1]);
+                
+                if (seq->recent_len == history_length_) {
+                    std::memmove(seq->recent.data(), seq->recent.data() + 1,
+                                 (history_length_ - 1) * sizeof(uint32_t));
+                    seq->recent_len--;
+                }
+                seq->recent[seq->recent_len++] = token_history[history_len - 1];
+            }
+        } else {
+            stat_sequence_misses_++;
+            replay_history(token_history, history_len, states, buffers);
+            
+            seq->recent_len = std::min(history_len, history_length_);
+            std::memcpy(seq->recent.data(), token_history + history_len - seq->recent_len,
+                        seq->recent_len * sizeof(uint32_t));
+        }
+        
+        float* cached = seq->state.get();
+        for (size_t layer = 0; layer < num_layers_; ++layer) {
+            std::memcpy(cached, states[layer].hidden, padded_hidden * sizeof(float));
+            std::memcpy(cached + padded_hidden, states[layer].cell, padded_hidden * sizeof(float));
+            cached += 2 * padded_hidden;
+        }
+        seq->position = position;
+        entry_lock.unlock();
+    } else {
+        // Cache disabled
+        stat_sequence_misses_++;
+        replay_history(token_history, history_len, states, buffers);
     }
     
-    return result;
+    size_t count = compute_top_k(states[num_layers_ - 1].hidden, token_history, history_len,
+                                 buffers, k, out);
+    
+    auto predict_end = std::chrono::steady_clock::now();
+    stat_predictions_++;
+    stat_predict_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(predict_end - predict_start).count();
+    
+    return count;
+}
+
+void LSTMPredictor::release_sequence(uint64_t sequence_id) {
+    std::lock_guard<std::mutex> cache_lock(sequence_mutex_);
+    auto it = sequences_.find(sequence_id);
+    if (it == sequences_.end()) {
+        return;
+    }
+    
+    // Wait for an in-flight step on this sequence before freeing its state
+    { std::lock_guard<std::mutex> entry_lock(it->second->mutex); }
+    sequence_lru_.erase(it->second->lru_position);
+    sequences_.erase(it);
+}
+
+void LSTMPredictor::set_sequence_cache_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> cache_lock(sequence_mutex_);
+    sequence_capacity_ = capacity;
+    evict_sequences_locked(capacity);
+}
+
+size_t LSTMPredictor::get_sequence_cache_size() const {
+    std::lock_guard<std::mutex> cache_lock(sequence_mutex_);
+    return sequences_.size();
+}
+
+LSTMPredictor::SequenceState* LSTMPredictor::acquire_sequence(
+    uint64_t sequence_id,
+    std::unique_lock<std::mutex>& entry_lock
+) {
+    std::lock_guard<std::mutex> cache_lock(sequence_mutex_);
+    if (sequence_capacity_ == 0) {
+        return nullptr;
+    }
+    
+    auto it = sequences_.find(sequence_id);
+    if (it != sequences_.end()) {
+        SequenceState* seq = it->second.get();
+        sequence_lru_.splice(sequence_lru_.begin(), sequence_lru_, seq->lru_position);
+        entry_lock = std::unique_lock<std::mutex>(seq->mutex);
+        return seq;
+    }
+    
+    if (sequences_.size() >= sequence_capacity_) {
+        // Recycle the least recently used entry in place (map node, LRU node
+        // and state buffer are reused, so steady-state decode never allocates)
+        auto node = sequences_.extract(sequence_lru_.back());
+        SequenceState* seq = node.mapped().get();
+        entry_lock = std::unique_lock<std::mutex>(seq->mutex);
+        stat_sequence_evictions_++;
+        
+        node.key() = sequence_id;
+        sequence_lru_.back() = sequence_id;
+        sequence_lru_.splice(sequence_lru_.begin(), sequence_lru_, seq->lru_position);
+        seq->position = 0;
+        seq->recent_len = 0;
+        sequences_.insert(std::move(node));
+        return seq;
+    }
+    
+    auto seq = std::make_unique<SequenceState>();
+    seq->state = allocate_aligned_floats(num_layers_ * 2 * round_up_to_block(hidden_dim_));
+    seq->recent.resize(history_length_);
+    sequence_lru_.push_front(sequence_id);
+    seq->lru_position = sequence_lru_.begin();
+    entry_lock = std::unique_lock<std::mutex>(seq->mutex);
+    
+    SequenceState* raw = seq.get();
+    sequences_.emplace(sequence_id, std::move(seq));
+    return raw;
+}
+
+void LSTMPredictor::evict_sequences_locked(size_t capacity) {
+    while (sequences_.size() > capacity) {
+        auto it = sequences_.find(sequence_lru_.back());
+        { std::lock_guard<std::mutex> entry_lock(it->second->mutex); }
+        sequence_lru_.pop_back();
+        sequences_.erase(it);
+        stat_sequence_evictions_++;
+    }
 }
 
 bool LSTMPredictor::load_model(const std::string& model_path) {
-    // In real implementation, would load actual model weights from file
-    // For now, return true (using initialized weights)
+    int fd = ::open(model_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(LstmModelHeader)) {
+        ::close(fd);
+        return false;
+    }
+    
+    // Shared read-only mapping: every process serving this file reads the
+    // same page-cache pages, and nothing is copied at startup
+    auto mapped = std::make_unique<MappedModel>();
+    mapped->bytes = static_cast<size_t>(st.st_size);
+    mapped->data = ::mmap(nullptr, mapped->bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped->data == MAP_FAILED) {
+        return false;
+    }
+    
+    const uint8_t* base = static_cast<const uint8_t*>(mapped->data);
+    LstmModelHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    
+    bool int8 = header.dtype == kLstmModelINT8;
+    if (std::memcmp(header.magic, kLstmModelMagic, sizeof(header.magic)) != 0 ||
+        header.version != kLstmModelVersion ||
+        header.header_bytes != sizeof(LstmModelHeader) ||
+        header.file_bytes != mapped->bytes ||
+        header.vocab_size == 0 || header.embedding_dim == 0 || header.hidden_dim == 0 ||
+        header.num_layers == 0 || header.num_layers > kMaxLstmLayers || header.history_length == 0 ||
+        (header.dtype != kLstmModelFP32 && !int8) ||
+        header.lstm_block != kLstmBlock ||
+        (int8 && header.int8_row_block != kInt8RowBlock) ||
+        sizeof(LstmModelHeader) + static_cast<uint64_t>(header.num_tensors) * sizeof(LstmModelTensor) > mapped->bytes) {
+        return false;
+    }
+    
+    // Resolve every tensor to a view into the mapping
+    WeightViews views;
+    size_t layer_tensors = 0;
+    const LstmModelTensor* table = reinterpret_cast<const LstmModelTensor*>(base + sizeof(LstmModelHeader));
+    for (uint32_t i = 0; i < header.num_tensors; ++i) {
+        const LstmModelTensor& tensor = table[i];
+        size_t expected = model_tensor_bytes(tensor.kind, tensor.layer, header);
+        if (expected == 0 || tensor.bytes != expected ||
+            tensor.offset % kLstmModelAlignment != 0 || tensor.offset > mapped->bytes ||
+            tensor.bytes > mapped->bytes - tensor.offset) {
+            return false;
+        }
+        
+        const uint8_t* data = base + tensor.offset;
+        switch (tensor.kind) {
+            case kTensorEmbedding:
+                if (int8) {
+                    views.embedding_q = reinterpret_cast<const int8_t*>(data);
+                } else {
+                    views.embedding = reinterpret_cast<const float*>(data);
+                }
+                break;
+            case kTensorEmbeddingScales:
+                views.embedding_scales = reinterpret_cast<const float*>(data);
+                break;
+            case kTensorOutput:
+                if (int8) {
+                    views.output_q = reinterpret_cast<const int8_t*>(data);
+                } else {
+                    views.output = reinterpret_cast<const float*>(data);
+                }
+                break;
+            case kTensorOutputScales:
+                views.output_scales = reinterpret_cast<const float*>(data);
+                break;
+            case kTensorOutputRowSums:
+                views.output_row_sums = reinterpret_cast<const int32_t*>(data);
+                break;
+            case kTensorLayerWeights:
+                layer_tensors += views.lstm_weights[tensor.layer] ? 0 : 1;
+                views.lstm_weights[tensor.layer] = reinterpret_cast<const float*>(data);
+                break;
+            case kTensorLayerBias:
+                layer_tensors += views.lstm_bias[tensor.layer] ? 0 : 1;
+                views.lstm_bias[tensor.layer] = reinterpret_cast<const float*>(data);
+                break;
+        }
+    }
+    
+    bool complete = layer_tensors == 2 * header.num_layers &&
+                    (int8 ? views.embedding_q && views.embedding_scales && views.output_q &&
+                            views.output_scales && views.output_row_sums
+                          : views.embedding && views.output);
+    if (!complete) {
+        return false;
+    }
+    ::madvise(mapped->data, mapped->bytes, MADV_WILLNEED);
+    
+    // Adopt the file's model; cached sequence state no longer matches it
+    {
+        std::lock_guard<std::mutex> cache_lock(sequence_mutex_);
+        sequences_.clear();
+        sequence_lru_.clear();
+    }
+    vocab_size_ = header.vocab_size;
+    embedding_dim_ = header.embedding_dim;
+    hidden_dim_ = header.hidden_dim;
+    num_layers_ = header.num_layers;
+    history_length_ = header.history_length;
+    precision_ = int8 ? WeightPrecision::INT8 : WeightPrecision::FP32;
+    weights_ = views;
+    shortlist_.reset();
+    
+    std::vector<float>().swap(embedding_weights_);
+    std::vector<float>().swap(output_weights_);
+    lstm_weights_.clear();
+    lstm_bias_.clear();
+    lstm_weights_.resize(num_layers_);
+    lstm_bias_.resize(num_layers_);
+    embedding_q_.reset();
+    std::vector<float>().swap(embedding_scales_);
+    output_q_.reset();
+    std::vector<float>().swap(output_scales_);
+    std::vector<int32_t>().swap(output_row_sums_);
+    lstm_q_.clear();
+    mapped_model_ = std::move(mapped);
+    
+    // The file keeps layers in FP32; INT8 steps run on copies made here
+    if (precision_ == WeightPrecision::INT8) {
+        lstm_q_.resize(num_layers_);
+        for (size_t layer = 0; layer < num_layers_; ++layer) {
+            quantize_layer(layer);
+        }
+    }
     return true;
 }
 
 bool LSTMPredictor::save_model(const std::string& model_path) const {
-    // In real implementation, would save model weights to file
+    struct TensorData {
+        uint32_t kind;
+        uint32_t layer;
+        const void* data;
+    };
+    std::vector<TensorData> tensors;
+    if (precision_ == WeightPrecision::INT8) {
+        tensors.push_back({kTensorEmbedding, 0, weights_.embedding_q});
+        tensors.push_back({kTensorEmbeddingScales, 0, weights_.embedding_scales});
+        tensors.push_back({kTensorOutput, 0, weights_.output_q});
+        tensors.push_back({kTensorOutputScales, 0, weights_.output_scales});
+        tensors.push_back({kTensorOutputRowSums, 0, weights_.output_row_sums});
+    } else {
+        tensors.push_back({kTensorEmbedding, 0, weights_.embedding});
+        tensors.push_back({kTensorOutput, 0, weights_.output});
+    }
+    for (uint32_t layer = 0; layer < num_layers_; ++layer) {
+        tensors.push_back({kTensorLayerWeights, layer, weights_.lstm_weights[layer]});
+        tensors.push_back({kTensorLayerBias, layer, weights_.lstm_bias[layer]});
+    }
+    
+    LstmModelHeader header{};
+    std::memcpy(header.magic, kLstmModelMagic, sizeof(header.magic));
+    header.version = kLstmModelVersion;
+    header.header_bytes = sizeof(LstmModelHeader);
+    header.vocab_size = static_cast<uint32_t>(vocab_size_);
+    header.embedding_dim = static_cast<uint32_t>(embedding_dim_);
+    header.hidden_dim = static_cast<uint32_t>(hidden_dim_);
+    header.num_layers = static_cast<uint32_t>(num_layers_);
+    header.history_length = static_cast<uint32_t>(history_length_);
+    header.dtype = precision_ == WeightPrecision::INT8 ? kLstmModelINT8 : kLstmModelFP32;
+    header.lstm_block = kLstmBlock;
+    header.int8_row_block = kInt8RowBlock;
+    header.num_tensors = static_cast<uint32_t>(tensors.size());
+    
+    auto align = [](uint64_t offset) {
+        return (offset + kLstmModelAlignment - 1) / kLstmModelAlignment * kLstmModelAlignment;
+    };
+    std::vector<LstmModelTensor> table(tensors.size());
+    uint64_t offset = align(sizeof(LstmModelHeader) + table.size() * sizeof(LstmModelTensor));
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        table[i] = {tensors[i].kind, tensors[i].layer, offset,
+                    model_tensor_bytes(tensors[i].kind, tensors[i].layer, header), 0};
+        offset = align(offset + table[i].bytes);
+    }
+    header.file_bytes = offset;
+    
+    // Write a private temporary file and rename it over the target, so
+    // readers (including processes mapping the old file) never see a
+    // partially written model
+    std::string tmp_path = model_path + ".tmp." + std::to_string(::getpid());
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    
+    uint64_t written = 0;
+    auto write_all = [&](const void* data, size_t bytes) {
+        const char* ptr = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = ::write(fd, ptr, bytes);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            ptr += n;
+            bytes -= static_cast<size_t>(n);
+            written += static_cast<uint64_t>(n);
+        }
+        return true;
+    };
+    auto pad_to = [&](uint64_t target) {
+        static const char zeros[kLstmModelAlignment] = {};
+        while (written < target) {
+            if (!write_all(zeros, std::min<uint64_t>(sizeof(zeros), target - written))) {
+                return false;
+            }
+        }
+        return true;
+    };
+    
+    bool ok = write_all(&header, sizeof(header)) &&
+              write_all(table.data(), table.size() * sizeof(LstmModelTensor));
+    for (size_t i = 0; ok && i < tensors.size(); ++i) {
+        ok = pad_to(table[i].offset) && write_all(tensors[i].data, table[i].bytes);
+    }
+    ok = ok && pad_to(header.file_bytes) && ::fsync(fd) == 0;
+    ok = ::close(fd) == 0 && ok;
+    
+    if (!ok || ::rename(tmp_path.c_str(), model_path.c_str()) != 0) {
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
     return true;
 }
 
 size_t LSTMPredictor::get_model_size() const {
-    // Model size in bytes (FP16 = 2 bytes per parameter)
-    size_t embedding_params = vocab_size_ * embedding_dim_;
-    size_t lstm_params = num_layers_ * hidden_dim_ * hidden_dim_ * 4;
-    size_t output_params = hidden_dim_ * vocab_size_;
-    size_t total_params = embedding_params + lstm_params + output_params;
-    return total_params * 2;  // FP16 = 2 bytes
+    // Bytes held: embedding and output projection at their storage precision
+    // (plus per-row scales in INT8 mode), LSTM layers in packed FP32 plus
+    // their INT8 copies in INT8 mode
+    size_t table_rows = 2 * vocab_size_;
+    size_t table_params = vocab_size_ * (embedding_dim_ + hidden_dim_);
+    size_t table_bytes = precision_ == WeightPrecision::INT8
+        ? table_params + table_rows * sizeof(float) + vocab_size_ * sizeof(int32_t)
+        : table_params * sizeof(float);
+    
+    size_t lstm_bytes = 0;
+    for (size_t layer = 0; layer < num_layers_; ++layer) {
+        lstm_bytes += (packed_lstm_weights_size(layer_input_dim(layer), hidden_dim_) +
+                       packed_lstm_bias_size(hidden_dim_)) * sizeof(float);
+        if (precision_ == WeightPrecision::INT8) {
+            lstm_bytes += packed_lstm_int8_size(layer_input_dim(layer), hidden_dim_) +
+                          2 * lstm_gate_rows(hidden_dim_) * (sizeof(float) + sizeof(int32_t));
+        }
+    }
+    
+    size_t shortlist_bytes = 0;
+    if (shortlist_) {
+        const Shortlist& list = *shortlist_;
+        shortlist_bytes = list.num_clusters * hidden_dim_ * sizeof(float) +
+                          (list.row_tokens.size() + 2 * vocab_size_ + 2 * list.num_clusters) * sizeof(uint32_t) +
+                          (precision_ == WeightPrecision::INT8
+                              ? packed_int8_rows_size(list.padded_rows, hidden_dim_) +
+                                list.padded_rows * (sizeof(float) + sizeof(int32_t))
+                              : list.padded_rows * hidden_dim_ * sizeof(float));
+    }
+    return table_bytes + lstm_bytes + shortlist_bytes;
+}
+
+void LSTMPredictor::quantize_weights() {
+    if (precision_ == WeightPrecision::INT8) {
+        return;
+    }
+    
+    // Embedding: row-major, one scale per token (dequantized on lookup)
+    embedding_q_ = allocate_aligned_bytes(vocab_size_ * embedding_dim_);
+    embedding_scales_.assign(vocab_size_, 0.0f);
+    for (size_t token = 0; token < vocab_size_; ++token) {
+        const float* row = weights_.embedding + token * embedding_dim_;
+        float max_abs = 0.0f;
+        for (size_t j = 0; j < embedding_dim_; ++j) {
+            max_abs = std::max(max_abs, std::fabs(row[j]));
+        }
+        embedding_scales_[token] = max_abs / 127.0f;
+        float inv = max_abs > 0.0f ? 127.0f / max_abs : 0.0f;
+        for (size_t j = 0; j < embedding_dim_; ++j) {
+            embedding_q_[token * embedding_dim_ + j] = static_cast<int8_t>(std::lround(row[j] * inv));
+        }
+    }
+    
+    // Output projection: packed for the INT8 GEMV kernel
+    size_t padded_rows = (vocab_size_ + kInt8RowBlock - 1) / kInt8RowBlock * kInt8RowBlock;
+    output_q_ = allocate_aligned_bytes(packed_int8_rows_size(vocab_size_, hidden_dim_));
+    output_scales_.assign(padded_rows, 0.0f);
+    output_row_sums_.assign(padded_rows, 0);
+    quantize_rows_int8(weights_.output, vocab_size_, hidden_dim_,
+                       output_q_.get(), output_scales_.data(), output_row_sums_.data());
+    
+    if (shortlist_) {
+        Shortlist& list = *shortlist_;
+        list.weights_q = allocate_aligned_bytes(packed_int8_rows_size(list.padded_rows, hidden_dim_));
+        list.scales.assign(list.padded_rows, 0.0f);
+        list.row_sums.assign(list.padded_rows, 0);
+        quantize_rows_int8(list.weights.get(), list.padded_rows, hidden_dim_,
+                           list.weights_q.get(), list.scales.data(), list.row_sums.data());
+        list.weights.reset();
+    }
+    
+    // LSTM layers: INT8 copies next to the packed FP32 weights
+    lstm_q_.resize(num_layers_);
+    for (size_t layer = 0; layer < num_layers_; ++layer) {
+        quantize_layer(layer);
+    }
+    
+    weights_.embedding_q = embedding_q_.get();
+    weights_.embedding_scales = embedding_scales_.data();
+    weights_.output_q = output_q_.get();
+    weights_.output_scales = output_scales_.data();
+    weights_.output_row_sums = output_row_sums_.data();
+    weights_.embedding = nullptr;
+    weights_.output = nullptr;
+    std::vector<float>().swap(embedding_weights_);
+    std::vector<float>().swap(output_weights_);
+    precision_ = WeightPrecision::INT8;
+}
+
+bool LSTMPredictor::enable_shortlist(const ShortlistConfig& config) {
+    if (config.num_clusters == 0 || config.probe_clusters == 0) {
+        return false;
+    }
+    
+    size_t vocab = vocab_size_;
+    size_t dim = hidden_dim_;
+    size_t clusters = std::min(config.num_clusters, vocab);
+    
+    // Cluster FP32 rows (dequantized in INT8 mode; requantizing them below
+    // reproduces the same INT8 values)
+    std::vector<float> dequantized;
+    const float* rows = weights_.output;
+    if (precision_ == WeightPrecision::INT8) {
+        dequantized.resize(vocab * dim);
+        dequantize_rows_int8(weights_.output_q, weights_.output_scales, vocab, dim, dequantized.data());
+        rows = dequantized.data();
+    }
+    
+    // Spherical k-means: rows go to the unit-length centre with the largest
+    // dot product, so tokens whose logits move together share a cluster.
+    // Centres are seeded with evenly spaced rows.
+    std::vector<float> centers(clusters * dim);
+    auto normalize = [dim](float* center) {
+        float norm = 0.0f;
+        for (size_t j = 0; j < dim; ++j) {
+            norm += center[j] * center[j];
+        }
+        float inv = norm > 0.0f ? 1.0f / std::sqrt(norm) : 0.0f;
+        for (size_t j = 0; j < dim; ++j) {
+            center[j] *= inv;
+        }
+    };
+    for (size_t c = 0; c < clusters; ++c) {
+        std::memcpy(&centers[c * dim], rows + (c * vocab / clusters) * dim, dim * sizeof(float));
+        normalize(&centers[c * dim]);
+    }
+    
+    constexpr size_t kAssignBatch = 256;
+    std::vector<float> scores(kAssignBatch * clusters);
+    std::vector<uint32_t> assignment(vocab);
+    std::vector<uint32_t> sizes(clusters);
+    size_t iterations = std::max<size_t>(config.kmeans_iterations, 1);
+    for (size_t iter = 0; ; ++iter) {
+        for (size_t t0 = 0; t0 < vocab; t0 += kAssignBatch) {
+            size_t n = std::min(kAssignBatch, vocab - t0);
+            project_rows_batch(centers.data(), clusters, dim, rows + t0 * dim, dim, n,
+                               scores.data(), clusters);
+            for (size_t s = 0; s < n; ++s) {
+                const float* row_scores = &scores[s * clusters];
+                assignment[t0 + s] = static_cast<uint32_t>(
+                    std::max_element(row_scores, row_scores + clusters) - row_scores);
+            }
+        }
+        if (iter + 1 == iterations) {
+            break;
+        }
+        
+        // Empty clusters keep their previous centre
+        std::vector<float> sums(clusters * dim, 0.0f);
+        std::fill(sizes.begin(), sizes.end(), 0);
+        for (size_t t = 0; t < vocab; ++t) {
+            float* sum = &sums[assignment[t] * dim];
+            for (size_t j = 0; j < dim; ++j) {
+                sum[j] += rows[t * dim + j];
+            }
+            sizes[assignment[t]]++;
+        }
+        for (size_t c = 0; c < clusters; ++c) {
+            if (sizes[c] > 0) {
+                std::memcpy(&centers[c * dim], &sums[c * dim], dim * sizeof(float));
+                normalize(&centers[c * dim]);
+            }
+        }
+    }
+    
+    // Drop empty clusters and lay the rest out contiguously, each starting
+    // on an INT8 row block
+    std::fill(sizes.begin(), sizes.end(), 0);
+    for (size_t t = 0; t < vocab; ++t) {
+        sizes[assignment[t]]++;
+    }
+    auto list = std::make_unique<Shortlist>();
+    std::vector<uint32_t> remap(clusters);
+    size_t padded_rows = 0;
+    for (size_t c = 0; c < clusters; ++c) {
+        if (sizes[c] == 0) {
+            continue;
+        }
+        remap[c] = static_cast<uint32_t>(list->cluster_begin.size());
+        list->cluster_begin.push_back(static_cast<uint32_t>(padded_rows));
+        list->cluster_size.push_back(sizes[c]);
+        padded_rows += (sizes[c] + kInt8RowBlock - 1) / kInt8RowBlock * kInt8RowBlock;
+    }
+    list->num_clusters = list->cluster_begin.size();
+    list->padded_rows = padded_rows;
+    list->config = config;
+    list->config.probe_clusters = std::min(config.probe_clusters, list->num_clusters);
+    
+    list->row_tokens.assign(padded_rows, 0);
+    list->token_rows.resize(vocab);
+    list->token_cluster.resize(vocab);
+    list->weights = allocate_aligned_floats(padded_rows * dim);
+    list->centroids = allocate_aligned_floats(list->num_clusters * dim);
+    std::vector<uint32_t> cursor(list->cluster_begin);
+    for (size_t t = 0; t < vocab; ++t) {
+        uint32_t c = remap[assignment[t]];
+        uint32_t row = cursor[c]++;
+        list->row_tokens[row] = static_cast<uint32_t>(t);
+        list->token_rows[t] = row;
+        list->token_cluster[t] = c;
+        std::memcpy(list->weights.get() + row * dim, rows + t * dim, dim * sizeof(float));
+        float* centroid = list->centroids.get() + c * dim;
+        for (size_t j = 0; j < dim; ++j) {
+            centroid[j] += rows[t * dim + j];
+        }
+    }
+    for (size_t c = 0; c < list->num_clusters; ++c) {
+        float inv = 1.0f / list->cluster_size[c];
+        float* centroid = list->centroids.get() + c * dim;
+        for (size_t j = 0; j < dim; ++j) {
+            centroid[j] *= inv;
+        }
+    }
+    
+    if (precision_ == WeightPrecision::INT8) {
+        list->weights_q = allocate_aligned_bytes(packed_int8_rows_size(padded_rows, dim));
+        list->scales.assign(padded_rows, 0.0f);
+        list->row_sums.assign(padded_rows, 0);
+        quantize_rows_int8(list->weights.get(), padded_rows, dim,
+                           list->weights_q.get(), list->scales.data(), list->row_sums.data());
+        list->weights.reset();
+    }
+    
+    shortlist_ = std::move(list);
+    return true;
+}
+
+void LSTMPredictor::disable_shortlist() {
+    shortlist_.reset();
+}
+
+bool LSTMPredictor::enable_adaptation(const AdaptationConfig& config) {
+    if (config.table_entries == 0 || config.queue_capacity == 0 || config.publish_interval == 0) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> control(adaptation_control_);
+    stop_adaptation_locked();
+    auto adaptation = std::make_shared<Adaptation>(config);
+    adaptation->ring.resize(config.queue_capacity);
+    adaptation->thread = std::thread(&LSTMPredictor::adaptation_loop, this, adaptation.get());
+    std::atomic_store(&adaptation_, adaptation);
+    return true;
+}
+
+void LSTMPredictor::disable_adaptation() {
+    std::lock_guard<std::mutex> control(adaptation_control_);
+    stop_adaptation_locked();
+}
+
+void LSTMPredictor::stop_adaptation_locked() {
+    // Unpublish first; observers that already loaded the trainer keep it
+    // alive and queue into a ring nobody drains
+    std::shared_ptr<Adaptation> adaptation = std::atomic_exchange(&adaptation_, std::shared_ptr<Adaptation>());
+    if (!adaptation) {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(adaptation->mutex);
+        adaptation->stop = true;
+    }
+    adaptation->wake.notify_all();
+    adaptation->idle.notify_all();
+    adaptation->thread.join();
+    std::atomic_store(&ngram_, std::shared_ptr<const PublishedNgram>());
+}
+
+void LSTMPredictor::observe_token(const uint32_t* context, size_t context_len, uint32_t next_token) {
+    if (!context || context_len == 0) {
+        return;
+    }
+    std::shared_ptr<Adaptation> adaptation = std::atomic_load(&adaptation_);
+    if (!adaptation) {
+        return;
+    }
+    
+    Observation observation;
+    observation.context_len = static_cast<uint32_t>(std::min<size_t>(context_len, 2));
+    for (uint32_t i = 0; i < observation.context_len; ++i) {
+        observation.context[i] = context[context_len - observation.context_len + i];
+    }
+    observation.next_token = next_token;
+    
+    {
+        std::lock_guard<std::mutex> lock(adaptation->mutex);
+        size_t capacity = adaptation->ring.size();
+        if (adaptation->size == capacity) {
+            stat_adaptation_dropped_++;
+            return;
+        }
+        adaptation->ring[(adaptation->head + adaptation->size) % capacity] = observation;
+        adaptation->size++;
+    }
+    adaptation->wake.notify_one();
+}
+
+void LSTMPredictor::flush_adaptation() {
+    std::shared_ptr<Adaptation> adaptation = std::atomic_load(&adaptation_);
+    if (!adaptation) {
+        return;
+    }
+    
+    std::unique_lock<std::mutex> lock(adaptation->mutex);
+    adaptation->idle.wait(lock, [&adaptation] {
+        return adaptation->stop || (adaptation->size == 0 && !adaptation->busy);
+    });
+    if (!adaptation->stop && adaptation->unpublished > 0) {
+        publish_adaptation(*adaptation);
+    }
+}
+
+void LSTMPredictor::adaptation_loop(Adaptation* trainer) {
+    Adaptation& adaptation = *trainer;
+    constexpr size_t kTrainBatch = 256;
+    Observation batch[kTrainBatch];
+    
+    std::unique_lock<std::mutex> lock(adaptation.mutex);
+    while (true) {
+        adaptation.wake.wait(lock, [&adaptation] { return adaptation.stop || adaptation.size > 0; });
+        if (adaptation.stop) {
+            break;
+        }
+        
+        // Take a batch and apply it without the lock, so producers only ever
+        // wait for a ring copy
+        size_t capacity = adaptation.ring.size();
+        size_t n = std::min(kTrainBatch, adaptation.size);
+        for (size_t i = 0; i < n; ++i) {
+            batch[i] = adaptation.ring[(adaptation.head + i) % capacity];
+        }
+        adaptation.head = (adaptation.head + n) % capacity;
+        adaptation.size -= n;
+        adaptation.busy = true;
+        lock.unlock();
+        
+        for (size_t i = 0; i < n; ++i) {
+            adaptation.working.observe(batch[i].context, batch[i].context_len, batch[i].next_token);
+        }
+        stat_adaptation_observations_ += n;
+        adaptation.unpublished += n;
+        if (adaptation.unpublished >= adaptation.config.publish_interval) {
+            publish_adaptation(adaptation);
+        }
+        
+        lock.lock();
+        adaptation.busy = false;
+        if (adaptation.size == 0) {
+            adaptation.idle.notify_all();
+        }
+    }
+}
+
+void LSTMPredictor::publish_adaptation(Adaptation& adaptation) {
+    // Readers keep the version they loaded until their prediction finishes
+    std::shared_ptr<const PublishedNgram> version = std::make_shared<PublishedNgram>(PublishedNgram{
+        adaptation.working, adaptation.config.max_weight, adaptation.config.prior_count});
+    std::atomic_store(&ngram_, version);
+    adaptation.unpublished = 0;
+    stat_adaptation_versions_++;
+}
+
+bool LSTMPredictor::set_embedding_weights(const float* weights) {
+    if (!weights || precision_ != WeightPrecision::FP32) {
+        return false;
+    }
+    
+    embedding_weights_.assign(weights, weights + vocab_size_ * embedding_dim_);
+    weights_.embedding = embedding_weights_.data();
+    return true;
+}
+
+bool LSTMPredictor::set_output_weights(const float* weights) {
+    if (!weights || precision_ != WeightPrecision::FP32) {
+        return false;
+    }
+    
+    output_weights_.assign(weights, weights + vocab_size_ * hidden_dim_);
+    weights_.output = output_weights_.data();
+    shortlist_.reset();
+    return true;
+}
+
+bool LSTMPredictor::set_layer_weights(
+    size_t layer,
+    const float* w_ih,
+    const float* w_hh,
+    const float* bias
+) {
+    if (layer >= num_layers_ || !w_ih || !w_hh || !bias) {
+        return false;
+    }
+    
+    // A mapped layer is read-only; the replacement gets its own buffer
+    if (!lstm_weights_[layer]) {
+        lstm_weights_[layer] = allocate_aligned_floats(packed_lstm_weights_size(layer_input_dim(layer), hidden_dim_));
+        lstm_bias_[layer] = allocate_aligned_floats(packed_lstm_bias_size(hidden_dim_));
+    }
+    pack_lstm_weights(w_ih, w_hh, bias, layer_input_dim(layer), hidden_dim_,
+                      lstm_weights_[layer].get(), lstm_bias_[layer].get());
+    weights_.lstm_weights[layer] = lstm_weights_[layer].get();
+    weights_.lstm_bias[layer] = lstm_bias_[layer].get();
+    if (precision_ == WeightPrecision::INT8) {
+        quantize_layer(layer);
+    }
+    return true;
+}
+
+void LSTMPredictor::quantize_layer(size_t layer) {
+    size_t rows = lstm_gate_rows(hidden_dim_);
+    QuantizedLayer& q = lstm_q_[layer];
+    q.weights = allocate_aligned_bytes(packed_lstm_int8_size(layer_input_dim(layer), hidden_dim_));
+    q.scales.assign(2 * rows, 0.0f);
+    q.row_sums.assign(2 * rows, 0);
+    quantize_lstm_weights_int8(weights_.lstm_weights[layer], layer_input_dim(layer), hidden_dim_,
+                               q.weights.get(), q.scales.data(), q.row_sums.data());
+}
+
+LSTMPredictor::PredictorStatistics LSTMPredictor::get_statistics() const {
+    PredictorStatistics stats{};
+    stats.predictions = stat_predictions_.load();
+    stats.layer_steps = stat_layer_steps_.load();
+    stats.sequence_hits = stat_sequence_hits_.load();
+    stats.sequence_misses = stat_sequence_misses_.load();
+    stats.sequence_evictions = stat_sequence_evictions_.load();
+    stats.shortlist_predictions = stat_shortlist_predictions_.load();
+    stats.shortlist_fallbacks = stat_shortlist_fallbacks_.load();
+    stats.adaptation_observations = stat_adaptation_observations_.load();
+    stats.adaptation_dropped = stat_adaptation_dropped_.load();
+    stats.adaptation_versions = stat_adaptation_versions_.load();
+    stats.adapted_predictions = stat_adapted_predictions_.load();
+    if (stats.layer_steps > 0) {
+        stats.avg_step_latency_ns = static_cast<double>(stat_step_ns_.load()) / stats.layer_steps;
+    }
+    if (stats.predictions > 0) {
+        stats.avg_predict_latency_us = static_cast<double>(stat_predict_ns_.load()) / stats.predictions / 1000.0;
+        stats.avg_rows_scored = static_cast<double>(stat_rows_scored_.load()) / stats.predictions;
+    }
+    return stats;
+}
+
+void LSTMPredictor::reset_statistics() {
+    stat_predictions_ = 0;
+    stat_layer_steps_ = 0;
+    stat_step_ns_ = 0;
+    stat_predict_ns_ = 0;
+    stat_sequence_hits_ = 0;
+    stat_sequence_misses_ = 0;
+    stat_sequence_evictions_ = 0;
+    stat_shortlist_predictions_ = 0;
+    stat_shortlist_fallbacks_ = 0;
+    stat_rows_scored_ = 0;
+    stat_adaptation_observations_ = 0;
+    stat_adaptation_dropped_ = 0;
+    stat_adaptation_versions_ = 0;
+    stat_adapted_predictions_ = 0;
+}
+
+size_t LSTMPredictor::scratch_floats() const {
+    return num_layers_ * 3 * round_up_to_block(hidden_dim_) +
+           round_up_to_block(embedding_dim_) + activation_floats() + shortlist_floats() +
+           gate_scratch_floats();
+}
+
+size_t LSTMPredictor::batch_scratch_floats(size_t batch) const {
+    return batch * (num_layers_ * 3 * round_up_to_block(hidden_dim_) +
+                    round_up_to_block(embedding_dim_) + kLogitChunk + activation_floats()) +
+           shortlist_floats() + gate_scratch_floats();
+}
+
+size_t LSTMPredictor::gate_scratch_floats() const {
+    if (precision_ != WeightPrecision::INT8) {
+        return 0;
+    }
+    return lstm_int8_scratch_floats(std::max(embedding_dim_, hidden_dim_), hidden_dim_);
+}
+
+size_t LSTMPredictor::activation_floats() const {
+    return round_up_to_block((int8_activation_size(hidden_dim_) + sizeof(float) - 1) / sizeof(float));
+}
+
+size_t LSTMPredictor::shortlist_floats() const {
+    if (!shortlist_) {
+        return 0;
+    }
+    // Cluster scores, then (cluster, score) pairs of the probed clusters,
+    // then the recent tokens, then the fallback's bitmap of rows to skip
+    static_assert(sizeof(std::pair<uint32_t, float>) == 2 * sizeof(float), "probe pair layout");
+    const ShortlistConfig& config = shortlist_->config;
+    return round_up_to_block(shortlist_->num_clusters) +
+           round_up_to_block(2 * config.probe_clusters) +
+           round_up_to_block(config.recent_tokens) +
+           round_up_to_block((shortlist_->padded_rows + 63) / 64 * 2);
+}
+
+LSTMPredictor::PredictBuffers LSTMPredictor::init_states(float* arena, LSTMState* states) const {
+    // Arena layout: [per-layer hidden/cell/next_hidden][embedding row]
+    // [quantized activations][shortlist scratch][INT8 layer-step scratch]
+    size_t padded_hidden = round_up_to_block(hidden_dim_);
+    std::memset(arena, 0, scratch_floats() * sizeof(float));
+    
+    for (size_t layer = 0; layer < num_layers_; ++layer) {
+        states[layer].hidden = arena;
+        states[layer].cell = arena + padded_hidden;
+        states[layer].next_hidden = arena + 2 * padded_hidden;
+        arena += 3 * padded_hidden;
+    }
+    
+    PredictBuffers buffers;
+    buffers.embed = arena;
+    arena += round_up_to_block(embedding_dim_);
+    buffers.act = reinterpret_cast<uint8_t*>(arena);
+    buffers.shortlist = arena + activation_floats();
+    buffers.gates = buffers.shortlist + shortlist_floats();
+    return buffers;
+}
+
+void LSTMPredictor::step_token(uint32_t token, LSTMState* states, const PredictBuffers& buffers) {
+    // Embed token (a view into the embedding table in FP32 mode)
+    const float* input = embed_token(token, buffers.embed);
+    
+    // Forward through LSTM layers; each layer consumes the hidden state below it
+    for (size_t layer = 0; layer < num_layers_; ++layer) {
+        lstm_forward(input, states[layer], layer, buffers.gates);
+        input = states[layer].hidden;
+    }
+}
+
+void LSTMPredictor::replay_history(
+    const uint32_t* token_history,
+    size_t history_len,
+    LSTMState* states,
+    const PredictBuffers& buffers
+) {
+    // Only the last history_length_ tokens are used; shorter histories are
+    // left-padded with token 0 (no copy of the history is made)
+    size_t pad = history_len < history_length_ ? history_length_ - history_len : 0;
+    const uint32_t* window = token_history + (history_len > history_length_ ? history_len - history_length_ : 0);
+    
+    auto steps_start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < history_length_; ++t) {
+        step_token(t < pad ? 0 : window[t - pad], states, buffers);
+    }
+    auto steps_end = std::chrono::steady_clock::now();
+    
+    stat_layer_steps_ += history_length_ * num_layers_;
+    stat_step_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(steps_end - steps_start).count();
 }
 
 void LSTMPredictor::lstm_forward(
-    const std::vector<float>& input,
+    const float* input,
     LSTMState& state,
-    const std::vector<float>& weights
+    size_t layer,
+    float* gates
 ) {
-    // Simplified LSTM forward pass
-    // In real implementation, would compute all 4 gates (i, f, o, g)
-    // For now, simplified update
-    
-    size_t input_dim = input.size();
-    size_t hidden_dim = state.hidden.size();
-    
-    // Compute gates (simplified - would use proper matrix multiplication)
-    for (size_t i = 0; i < hidden_dim; ++i) {
-        // Input gate
-        float i_gate = 0.5f;  // Simplified
-        // Forget gate
-        float f_gate = 0.5f;  // Simplified
-        // Output gate
-        float o_gate = 0.5f;  // Simplified
-        // Candidate
-        float g = 0.0f;
-        for (size_t j = 0; j < input_dim && j < hidden_dim; ++j) {
-            g += input[j] * 0.1f;  // Simplified weight
+    if (precision_ == WeightPrecision::INT8) {
+        // Both GEMVs on the layer's INT8 copy (a quarter of the FP32 bytes)
+        const QuantizedLayer& q = lstm_q_[layer];
+        lstm_cell_step_int8(q.weights.get(), q.scales.data(), q.row_sums.data(), weights_.lstm_bias[layer],
+                            input, layer_input_dim(layer), state.hidden, state.cell, state.next_hidden,
+                            hidden_dim_, gates);
+    } else {
+        // All four gates (i, f, g, o) of W_ih x + W_hh h are computed in one fused
+        // pass over the packed weights, then the cell and hidden state are updated
+        lstm_cell_step(weights_.lstm_weights[layer], weights_.lstm_bias[layer],
+                       input, layer_input_dim(layer),
+                       state.hidden, state.cell, state.next_hidden,
+                       hidden_dim_);
+    }
+    std::swap(state.hidden, state.next_hidden);
+}
+
+const float* LSTMPredictor::embed_token(uint32_t token_id, float* buffer) const {
+    if (token_id >= vocab_size_) {
+        std::memset(buffer, 0, embedding_dim_ * sizeof(float));
+        return buffer;
+    }
+    
+    size_t offset = static_cast<size_t>(token_id) * embedding_dim_;
+    if (precision_ == WeightPrecision::INT8) {
+        const int8_t* q = weights_.embedding_q + offset;
+        float scale = weights_.embedding_scales[token_id];
+        for (size_t j = 0; j < embedding_dim_; ++j) {
+            buffer[j] = q[j] * scale;
         }
-        
-        // Update cell state
-        state.cell[i] = f_gate * state.cell[i] + i_gate * std::tanh(g);
-        // Update hidden state
-        state.hidden[i] = o_gate * std::tanh(state.cell[i]);
+        return buffer;
     }
+    return weights_.embedding + offset;
 }
 
-std::vector<float> LSTMPredictor::embed_token(uint32_t token_id) {
-    std::vector<float> embedding(embedding_dim_, 0.0f);
+void LSTMPredictor::project_output(
+    size_t row,
+    size_t count,
+    const float* hidden,
+    const uint8_t* act,
+    float act_scale,
+    float* logits
+) const {
+    if (precision_ == WeightPrecision::INT8) {
+        project_rows_int8(weights_.output_q + row * int8_activation_size(hidden_dim_),
+                          weights_.output_scales + row, weights_.output_row_sums + row,
+                          count, hidden_dim_, act, act_scale, logits);
+    } else {
+        project_rows(weights_.output + row * hidden_dim_, count, hidden_dim_, hidden, logits);
+    }
+}
+
+void LSTMPredictor::project_shortlist(
+    size_t row,
+    size_t count,
+    const float* hidden,
+    const uint8_t* act,
+    float act_scale,
+    float* logits
+) const {
+    const Shortlist& list = *shortlist_;
+    if (precision_ == WeightPrecision::INT8) {
+        project_rows_int8(list.weights_q.get() + row * int8_activation_size(hidden_dim_),
+                          list.scales.data() + row, list.row_sums.data() + row,
+                          count, hidden_dim_, act, act_scale, logits);
+    } else {
+        project_rows(list.weights.get() + row * hidden_dim_, count, hidden_dim_, hidden, logits);
+    }
+}
+
+size_t LSTMPredictor::compute_top_k(
+    const float* hidden,
+    const uint32_t* token_history,
+    size_t history_len,
+    const PredictBuffers& buffers,
+    size_t k,
+    std::pair<uint32_t, float>* out
+) {
+    float act_scale = 0.0f;
+    if (precision_ == WeightPrecision::INT8) {
+        act_scale = quantize_activations_int8(hidden, hidden_dim_, buffers.act);
+    }
     
-    if (token_id < vocab_size_) {
-        size_t offset = token_id * embedding_dim_;
-        for (size_t i = 0; i < embedding_dim_; ++i) {
-            embedding[i] = embedding_weights_[offset + i];
+    // The caller's output buffer doubles as the heap
+    LogitTopK topk;
+    topk_init(topk, out, std::min(k, vocab_size_));
+    if (shortlist_) {
+        // A fallback completes the full-vocabulary stream itself
+        if (shortlist_top_k(hidden, token_history, history_len, buffers, act_scale, topk)) {
+            stat_shortlist_predictions_++;
+        } else {
+            stat_shortlist_fallbacks_++;
         }
+    } else {
+        full_top_k(hidden, buffers.act, act_scale, topk);
     }
     
-    return embedding;
+    std::shared_ptr<const PublishedNgram> ngram = std::atomic_load(&ngram_);
+    return finalize_top_k(topk, ngram.get(), token_history, history_len,
+                          hidden, buffers.act, act_scale, out);
+}
+
+void LSTMPredictor::full_top_k(
+    const float* hidden,
+    const uint8_t* act,
+    float act_scale,
+    LogitTopK& topk
+) {
+    // Logits are produced a chunk at a time and streamed through the top-k filter
+    float logits[kLogitChunk];
+    for (size_t row = 0; row < vocab_size_; row += kLogitChunk) {
+        size_t count = std::min(kLogitChunk, vocab_size_ - row);
+        project_output(row, count, hidden, act, act_scale, logits);
+        topk_accumulate(topk, logits, static_cast<uint32_t>(row), count);
+    }
+    stat_rows_scored_ += vocab_size_;
 }
 
-std::vector<float> LSTMPredictor::compute_output_probs(const std::vector<float>& hidden) {
-    std::vector<float> logits(vocab_size_, 0.0f);
+float LSTMPredictor::token_logit(
+    uint32_t token,
+    const float* hidden,
+    const uint8_t* act,
+    float act_scale
+) const {
+    // INT8 rows are projected a block at a time
+    float logits[kInt8RowBlock];
+    size_t first = precision_ == WeightPrecision::INT8 ? token - token % kInt8RowBlock : token;
+    project_output(first, token - first + 1, hidden, act, act_scale, logits);
+    return logits[token - first];
+}
+
+size_t LSTMPredictor::finalize_top_k(
+    LogitTopK& topk,
+    const PublishedNgram* ngram,
+    const uint32_t* token_history,
+    size_t history_len,
+    const float* hidden,
+    const uint8_t* act,
+    float act_scale,
+    std::pair<uint32_t, float>* out
+) {
+    size_t count = topk_finalize(topk, out);
+    if (!ngram || topk.k == 0) {
+        return count;
+    }
+    
+    uint32_t tokens[TokenNgramTable::kWays];
+    float probs[TokenNgramTable::kWays];
+    float total = 0.0f;
+    size_t found = ngram->table.lookup(token_history, history_len, tokens, probs, total);
+    if (found == 0) {
+        return count;
+    }
+    stat_adapted_predictions_++;
     
-    // Compute logits (simplified - would use proper matrix multiplication)
-    for (size_t i = 0; i < vocab_size_; ++i) {
-        for (size_t j = 0; j < hidden_dim_ && j < hidden.size(); ++j) {
-            size_t weight_idx = i * hidden_dim_ + j;
-            if (weight_idx < output_weights_.size()) {
-                logits[i] += hidden[j] * output_weights_[weight_idx];
+    // p = (1 - w) p_lstm + w p_ngram, with w growing as the context is
+    // observed more often
+    float weight = ngram->max_weight * total / (total + ngram->prior_count);
+    for (size_t i = 0; i < count; ++i) {
+        out[i].second *= 1.0f - weight;
+    }
+    for (size_t j = 0; j < found; ++j) {
+        uint32_t token = tokens[j];
+        if (token >= vocab_size_) {
+            continue;
+        }
+        auto match = std::find_if(out, out + count, [token](const std::pair<uint32_t, float>& p) {
+            return p.first == token;
+        });
+        if (match != out + count) {
+            match->second += weight * probs[j];
+            continue;
+        }
+        
+        // Outside the LSTM's top-k: its LSTM probability comes from its own
+        // row and the stream's normaliser
+        float p_lstm = topk.sum_exp > 0.0f
+            ? std::min(std::exp(token_logit(token, hidden, act, act_scale) - topk.max_logit) / topk.sum_exp, 1.0f)
+            : 0.0f;
+        float p = (1.0f - weight) * p_lstm + weight * probs[j];
+        if (count < topk.k) {
+            out[count++] = {token, p};
+        } else {
+            auto weakest = std::min_element(out, out + count, [](const auto& a, const auto& b) {
+                return a.second < b.second;
+            });
+            if (p > weakest->second) {
+                *weakest = {token, p};
             }
         }
     }
+    std::sort(out, out + count, [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+    return count;
+}
+
+bool LSTMPredictor::shortlist_top_k(
+    const float* hidden,
+    const uint32_t* token_history,
+    size_t history_len,
+    const PredictBuffers& buffers,
+    float act_scale,
+    LogitTopK& topk
+) {
+    const Shortlist& list = *shortlist_;
+    const ShortlistConfig& config = list.config;
+    float* cluster_scores = buffers.shortlist;
+    auto* probes = reinterpret_cast<std::pair<uint32_t, float>*>(
+        cluster_scores + round_up_to_block(list.num_clusters));
+    uint32_t* recent = reinterpret_cast<uint32_t*>(
+        cluster_scores + round_up_to_block(list.num_clusters) + round_up_to_block(2 * config.probe_clusters));
+    
+    // A centroid's logit is the mean logit of its cluster's rows; probe the
+    // clusters with the highest ones
+    project_rows(list.centroids.get(), list.num_clusters, hidden_dim_, hidden, cluster_scores);
+    LogitTopK probe;
+    topk_init(probe, probes, config.probe_clusters);
+    topk_accumulate(probe, cluster_scores, 0, list.num_clusters);
+    size_t num_probes = probe.size;
+    auto is_probed = [&](uint32_t cluster) {
+        for (size_t i = 0; i < num_probes; ++i) {
+            if (probes[i].first == cluster) {
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    // The heap is keyed by clustered row until it is rekeyed to tokens at the end
+    float logits[kLogitChunk];
+    size_t rows_scored = list.num_clusters;
+    for (size_t i = 0; i < num_probes; ++i) {
+        size_t begin = list.cluster_begin[probes[i].first];
+        size_t size = list.cluster_size[probes[i].first];
+        for (size_t offset = 0; offset < size; offset += kLogitChunk) {
+            size_t chunk = std::min(kLogitChunk, size - offset);
+            project_shortlist(begin + offset, chunk, hidden, buffers.act, act_scale, logits);
+            topk_accumulate(topk, logits, static_cast<uint32_t>(begin + offset), chunk);
+        }
+        rows_scored += size;
+    }
+    
+    // Recently seen tokens recur in decode streams; score the ones outside
+    // the probed clusters individually (INT8 rows a block at a time)
+    size_t num_recent = 0;
+    size_t first = history_len > config.recent_tokens ? history_len - config.recent_tokens : 0;
+    for (size_t t = first; t < history_len; ++t) {
+        uint32_t token = token_history[t];
+        if (token >= vocab_size_ || is_probed(list.token_cluster[token]) ||
+            std::find(recent, recent + num_recent, token) != recent + num_recent) {
+            continue;
+        }
+        recent[num_recent++] = token;
+        size_t row = list.token_rows[token];
+        size_t block_row = precision_ == WeightPrecision::INT8 ? row - row % kInt8RowBlock : row;
+        project_shortlist(block_row, row - block_row + 1, hidden, buffers.act, act_scale, logits);
+        topk_accumulate(topk, logits + (row - block_row), static_cast<uint32_t>(row), 1);
+    }
+    rows_scored += num_recent;
+    stat_rows_scored_ += rows_scored;
     
-    // Softmax
-    float max_logit = *std::max_element(logits.begin(), logits.end());
-    float sum_exp = 0.0f;
-    for (size_t i = 0; i < vocab_size_; ++i) {
-        logits[i] = std::exp(logits[i] - max_logit);
-        sum_exp += logits[i];
+    // Estimate the softmax mass of every unscored row from its centroid
+    float scored_max = topk.max_logit;
+    float scored_sum = topk.sum_exp;
+    for (uint32_t c = 0; c < list.num_clusters; ++c) {
+        if (is_probed(c)) {
+            continue;
+        }
+        size_t unscored = list.cluster_size[c];
+        for (size_t i = 0; i < num_recent; ++i) {
+            unscored -= list.token_cluster[recent[i]] == c ? 1 : 0;
+        }
+        topk_add_mass(topk, cluster_scores[c], static_cast<float>(unscored));
     }
     
-    for (size_t i = 0; i < vocab_size_; ++i) {
-        logits[i] /= sum_exp;
+    float scored_mass = scored_sum * std::exp(scored_max - topk.max_logit);
+    bool confident = topk.sum_exp > 0.0f && scored_mass >= config.min_scored_mass * topk.sum_exp;
+    if (!confident) {
+        // Too uncertain: drop the estimates and stream the rest of the
+        // clustered matrix through the same heap, skipping the rows already
+        // in it and the padding between clusters
+        topk.max_logit = scored_max;
+        topk.sum_exp = scored_sum;
+        uint64_t* skip = reinterpret_cast<uint64_t*>(recent + round_up_to_block(config.recent_tokens));
+        std::memset(skip, 0, (list.padded_rows + 63) / 64 * sizeof(uint64_t));
+        auto mark = [skip](size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                skip[row / 64] |= uint64_t(1) << (row % 64);
+            }
+        };
+        for (size_t c = 0; c < list.num_clusters; ++c) {
+            size_t begin = list.cluster_begin[c];
+            size_t end = c + 1 < list.num_clusters ? list.cluster_begin[c + 1] : list.padded_rows;
+            mark(is_probed(static_cast<uint32_t>(c)) ? begin : begin + list.cluster_size[c], end);
+        }
+        for (size_t i = 0; i < num_recent; ++i) {
+            mark(list.token_rows[recent[i]], list.token_rows[recent[i]] + 1);
+        }
+        
+        static_assert(kLogitChunk == 64, "one skip word per logit chunk");
+        for (size_t row = 0; row < list.padded_rows; row += kLogitChunk) {
+            uint64_t mask = skip[row / 64];
+            if (mask == ~uint64_t(0)) {
+                continue;
+            }
+            size_t count = std::min(kLogitChunk, list.padded_rows - row);
+            project_shortlist(row, count, hidden, buffers.act, act_scale, logits);
+            // A -inf logit adds no mass and never enters the heap; masking
+            // keeps the chunk whole for the vector path
+            for (; mask != 0; mask &= mask - 1) {
+                logits[__builtin_ctzll(mask)] = -std::numeric_limits<float>::infinity();
+            }
+            topk_accumulate(topk, logits, static_cast<uint32_t>(row), count);
+        }
+        stat_rows_scored_ += vocab_size_ - (rows_scored - list.num_clusters);
     }
     
-    return logits;
+    // Rekeying does not disturb the heap, which is ordered by logit
+    for (size_t i = 0; i < topk.size; ++i) {
+        topk.heap[i].first = list.row_tokens[topk.heap[i].first];
+    }
+    return confident;
 }
 
 } // namespace cxlspeckv
-
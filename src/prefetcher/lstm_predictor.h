@@ -3,18 +3,59 @@
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <condition_variable>
+#include "lstm_kernels.h"
+#include "online_adaptation.h"
 
 namespace cxlspeckv {
 
+// Maximum number of stacked LSTM layers
+constexpr size_t kMaxLstmLayers = 8;
+
+// Default number of sequences whose LSTM state is kept between decode steps
+constexpr size_t kDefaultSequenceCacheCapacity = 4096;
+
+// Storage precision of the embedding table and output projection, and the
+// precision the LSTM layers run at
+enum class WeightPrecision {
+    FP32,
+    INT8    // Per-row symmetric scales; output projection and LSTM steps on VNNI/AVX2 kernels
+};
+
+// Candidate shortlist for the output projection. The vocabulary is split
+// into clusters of similar output rows; a prediction scores the cluster
+// centroids, then only the rows of the best clusters and of recently seen
+// tokens. The softmax mass of the skipped clusters is estimated from their
+// centroids, and a prediction whose scored rows hold too little of the
+// estimated mass falls back to the full projection, reusing the rows
+// already scored.
+struct ShortlistConfig {
+    size_t num_clusters = 256;
+    size_t probe_clusters = 8;          // clusters scored per prediction
+    size_t recent_tokens = 16;          // trailing history tokens always scored
+    float min_scored_mass = 0.3f;       // fallback below this scored fraction
+    size_t kmeans_iterations = 3;
+};
+
 // Lightweight LSTM-based token predictor
-// Architecture: 2-layer LSTM with 128 hidden units per layer
-// Total parameters: ~128K (512KB in FP16)
+// Architecture: 2-layer LSTM with 64 hidden units per layer, sized so a
+// layer-step fits the prefetch latency budget (a 64x64 INT8 layer is 32KB
+// and stays in L1)
+// Parameters: ~66K in the LSTM layers, plus vocab_size x (embedding_dim +
+// hidden_dim) in the embedding and output projection (~4M at 32K vocab:
+// 16MB in FP32, 4MB in INT8)
 class LSTMPredictor {
 public:
     LSTMPredictor(
         size_t vocab_size = 32000,
         size_t embedding_dim = 64,
-        size_t hidden_dim = 128,
+        size_t hidden_dim = 64,
         size_t num_layers = 2,
         size_t history_length = 16
     );
@@ -27,15 +68,164 @@ public:
         const std::vector<uint32_t>& token_history,
         size_t k = 4
     );
+    
+    // Allocation-free variant: writes up to k results to out and returns the
+    // number written. Runs on views of the weights and per-thread scratch.
+    size_t predict_top_k(
+        const uint32_t* token_history,
+        size_t history_len,
+        size_t k,
+        std::pair<uint32_t, float>* out
+    );
+
+    // Batched prediction for many sequences (continuous batching). Sequences
+    // are stacked so the gate and vocabulary projections run as register-
+    // blocked GEMMs over cache-sized chunks of the batch; the batch is split
+    // across get_batch_threads() threads.
+    std::vector<std::vector<std::pair<uint32_t, float>>> predict_top_k_batch(
+        const std::vector<std::vector<uint32_t>>& token_histories,
+        size_t k = 4
+    );
+    
+    // Pointer variant: results of sequence s go to out + s*k and their number
+    // to counts[s]. Allocation-free in steady state.
+    void predict_top_k_batch(
+        const uint32_t* const* token_histories,
+        const size_t* history_lens,
+        size_t batch,
+        size_t k,
+        std::pair<uint32_t, float>* out,
+        size_t* counts
+    );
+    
+    // Threads used by predict_top_k_batch (default 1): the caller plus
+    // threads - 1 workers, started here and parked between batches. A batch
+    // that finds the workers busy with another batch runs on its caller.
+    void set_batch_threads(size_t threads);
+    size_t get_batch_threads() const;
+    
+    // Incremental prediction for a decoding sequence. position is the number
+    // of tokens the sequence holds up to and including the last token of
+    // token_history, which may be the whole history or a trailing window of
+    // it. The LSTM state reached after the previous call for sequence_id is
+    // cached with that call's position and tokens. A call one position later
+    // whose window agrees with those tokens costs one time step instead of a
+    // full replay. A call at the same position costs none. Any other call
+    // (first call, evicted state, diverged tokens) replays the last
+    // history_length tokens and re-seeds the cache. Unlike the stateless API,
+    // the cached state carries context past history_length.
+    size_t predict_next(
+        uint64_t sequence_id,
+        uint64_t position,
+        const uint32_t* token_history,
+        size_t history_len,
+        size_t k,
+        std::pair<uint32_t, float>* out
+    );
+    
+    // Same, with position = history_len: token_history must be the
+    // sequence's whole, growing history. Callers that pass a fixed-size
+    // window must use the overload above, or every step replays.
+    size_t predict_next(
+        uint64_t sequence_id,
+        const uint32_t* token_history,
+        size_t history_len,
+        size_t k,
+        std::pair<uint32_t, float>* out
+    ) {
+        return predict_next(sequence_id, history_len, token_history, history_len, k, out);
+    }
+    
+    // Drop the cached state of a finished sequence
+    void release_sequence(uint64_t sequence_id);
+    
+    // Bound on cached sequences; least recently used state is evicted first.
+    // 0 disables the cache (predict_next always replays).
+    void set_sequence_cache_capacity(size_t capacity);
+    size_t get_sequence_cache_size() const;
 
-    // Load pre-trained model weights
+    // Load a model saved by save_model (format: lstm_model_format.h). The file
+    // is mapped read-only and used in place, so processes loading the same
+    // file share its pages. Dimensions and precision are taken from the file;
+    // cached sequence state is dropped. Not safe concurrently with predictions.
+    // The file must not be rewritten in place while mapped (save_model
+    // replaces files by rename, which is safe).
     bool load_model(const std::string& model_path);
     
-    // Save model weights
+    // Write the model atomically (temporary file, fsync, rename)
     bool save_model(const std::string& model_path) const;
     
-    // Get model size in bytes
+    // True while the weights are served from a mapped model file
+    bool is_model_mapped() const { return mapped_model_ != nullptr; }
+    
+    // Get model size in bytes (as held in memory at the current precision)
     size_t get_model_size() const;
+    
+    // Convert the embedding table and output projection to INT8 with per-row
+    // scales and release the FP32 copies. The LSTM layers also get INT8
+    // copies (quantize_lstm_weights_int8) that every step runs on; their
+    // packed FP32 weights are kept, as the model file stores layers in FP32.
+    // Call before serving predictions.
+    void quantize_weights();
+    WeightPrecision get_weight_precision() const { return precision_; }
+    
+    // Build the output shortlist from the current output projection (k-means
+    // over its rows) and use it for every prediction. Rebuild after replacing
+    // the output weights or loading a model, which drop it. Not safe
+    // concurrently with predictions.
+    bool enable_shortlist(const ShortlistConfig& config = ShortlistConfig());
+    void disable_shortlist();
+    bool is_shortlist_enabled() const { return shortlist_ != nullptr; }
+    
+    // Start the background trainer (online_adaptation.h). Observed next
+    // tokens update an n-gram side table off the prediction path; each
+    // published version is swapped in atomically, and predictions mix its
+    // next-token distribution with the LSTM's. predict_next observes every
+    // token a sequence advances by; other feedback goes through
+    // observe_token. Returns false for an invalid config. The trainer is
+    // published atomically, so adaptation can be toggled while predictions
+    // are served; observations queued to a stopped trainer are dropped.
+    bool enable_adaptation(const AdaptationConfig& config = AdaptationConfig());
+    void disable_adaptation();
+    bool is_adaptation_enabled() const { return std::atomic_load(&adaptation_) != nullptr; }
+    
+    // Queue the true token that followed context (never blocks on the
+    // trainer; dropped when the queue is full or adaptation is disabled)
+    void observe_token(const uint32_t* context, size_t context_len, uint32_t next_token);
+    
+    // Wait until every queued observation is applied and published
+    void flush_adaptation();
+    
+    // Replace the embedding table (vocab_size x embedding_dim) or output
+    // projection (vocab_size x hidden_dim), row-major FP32. FP32 mode only.
+    bool set_embedding_weights(const float* weights);
+    bool set_output_weights(const float* weights);
+    
+    // Replace one layer's weights (PyTorch nn.LSTM layout, gates i, f, g, o)
+    // w_ih: [4*hidden_dim x input_dim], w_hh: [4*hidden_dim x hidden_dim],
+    // bias: [4*hidden_dim] (b_ih + b_hh already summed)
+    bool set_layer_weights(size_t layer, const float* w_ih, const float* w_hh, const float* bias);
+    
+    // Latency accounting (a layer-step is one lstm_cell_step call)
+    struct PredictorStatistics {
+        uint64_t predictions;
+        uint64_t layer_steps;
+        double avg_step_latency_ns;
+        double avg_predict_latency_us;
+        uint64_t sequence_hits;         // predict_next calls served from cached state
+        uint64_t sequence_misses;       // predict_next calls that replayed the history
+        uint64_t sequence_evictions;
+        uint64_t shortlist_predictions; // predictions answered from the shortlist
+        uint64_t shortlist_fallbacks;   // shortlist too uncertain; full projection used
+        double avg_rows_scored;         // output rows projected per prediction
+        uint64_t adaptation_observations;   // observations applied by the trainer
+        uint64_t adaptation_dropped;        // observations lost to a full queue
+        uint64_t adaptation_versions;       // n-gram table versions published
+        uint64_t adapted_predictions;       // predictions mixed with the n-gram table
+    };
+    
+    PredictorStatistics get_statistics() const;
+    void reset_statistics();
 
 private:
     size_t vocab_size_;
@@ -44,30 +234,308 @@ private:
     size_t num_layers_;
     size_t history_length_;
     
-    // Model weights (simplified representation)
-    // In real implementation, these would be actual weight tensors
+    // Model weights as read by the kernels: views into the owned buffers
+    // below or into a mapped model file. LSTM layers are packed gate-
+    // interleaved (see pack_lstm_weights) and 64-byte aligned so
+    // lstm_cell_step streams them with aligned loads.
+    struct WeightViews {
+        const float* embedding = nullptr;           // vocab_size x embedding_dim (FP32)
+        const float* output = nullptr;              // vocab_size x hidden_dim (FP32)
+        const int8_t* embedding_q = nullptr;        // vocab_size x embedding_dim (INT8)
+        const float* embedding_scales = nullptr;
+        const int8_t* output_q = nullptr;           // packed by quantize_rows_int8
+        const float* output_scales = nullptr;       // padded to kInt8RowBlock rows
+        const int32_t* output_row_sums = nullptr;
+        const float* lstm_weights[kMaxLstmLayers] = {};
+        const float* lstm_bias[kMaxLstmLayers] = {};
+    };
+    
+    WeightPrecision precision_;
+    WeightViews weights_;
+    
+    // Owned storage (empty where the view points into the mapped file)
     std::vector<float> embedding_weights_;
-    std::vector<float> lstm_weights_;
     std::vector<float> output_weights_;
+    std::vector<AlignedFloatBuffer> lstm_weights_;  // per layer
+    std::vector<AlignedFloatBuffer> lstm_bias_;     // per layer
+    AlignedByteBuffer embedding_q_;
+    std::vector<float> embedding_scales_;
+    AlignedByteBuffer output_q_;
+    std::vector<float> output_scales_;
+    std::vector<int32_t> output_row_sums_;
+    
+    // INT8 copy of one LSTM layer, derived from its packed FP32 weights in
+    // INT8 mode (always owned, also for a mapped model)
+    struct QuantizedLayer {
+        AlignedByteBuffer weights;          // quantize_lstm_weights_int8 layout
+        std::vector<float> scales;          // input rows, then recurrent rows
+        std::vector<int32_t> row_sums;
+    };
+    std::vector<QuantizedLayer> lstm_q_;    // per layer; empty in FP32 mode
+    
+    // Read-only mapping of the loaded model file
+    struct MappedModel;
+    std::unique_ptr<MappedModel> mapped_model_;
+    
+    // Output rows regrouped by cluster: cluster c owns clustered rows
+    // [cluster_begin[c], cluster_begin[c] + cluster_size[c]), with
+    // cluster_begin aligned to kInt8RowBlock so each cluster is projected
+    // on its own. Empty clusters are dropped at build time.
+    struct Shortlist {
+        ShortlistConfig config;
+        size_t num_clusters = 0;
+        size_t padded_rows = 0;
+        std::vector<uint32_t> row_tokens;       // clustered row -> token
+        std::vector<uint32_t> token_rows;       // token -> clustered row
+        std::vector<uint32_t> token_cluster;    // token -> cluster
+        std::vector<uint32_t> cluster_begin;
+        std::vector<uint32_t> cluster_size;
+        AlignedFloatBuffer centroids;           // num_clusters x hidden_dim (mean rows)
+        AlignedFloatBuffer weights;             // padded_rows x hidden_dim (FP32)
+        AlignedByteBuffer weights_q;            // packed by quantize_rows_int8 (INT8)
+        std::vector<float> scales;
+        std::vector<int32_t> row_sums;
+    };
+    std::unique_ptr<Shortlist> shortlist_;
+    
+    // Background trainer: a bounded ring of observations drained by one
+    // thread into its private table, which is copied out every
+    // publish_interval observations
+    struct Observation {
+        uint32_t context[2];
+        uint32_t context_len;
+        uint32_t next_token;
+    };
+    struct Adaptation {
+        AdaptationConfig config;
+        std::mutex mutex;
+        std::condition_variable wake;       // observations queued or stop
+        std::condition_variable idle;       // queue drained
+        std::vector<Observation> ring;
+        size_t head = 0;
+        size_t size = 0;
+        bool busy = false;
+        bool stop = false;
+        TokenNgramTable working;
+        size_t unpublished = 0;
+        std::thread thread;
+        
+        explicit Adaptation(const AdaptationConfig& cfg)
+            : config(cfg), working(cfg.table_entries, cfg.max_context_count) {}
+    };
+    
+    // Current trainer (std::atomic_load / atomic_store); observe_token keeps
+    // the one it loaded alive. enable/disable are serialized by
+    // adaptation_control_.
+    std::shared_ptr<Adaptation> adaptation_;
+    std::mutex adaptation_control_;
+    
+    // A published table version with the mixing weights of its trainer
+    struct PublishedNgram {
+        TokenNgramTable table;
+        float max_weight;
+        float prior_count;
+    };
+    
+    // Published table read by predictions (std::atomic_load / atomic_store)
+    std::shared_ptr<const PublishedNgram> ngram_;
     
-    // LSTM state
+    // LSTM state of one layer (views into thread scratch, padded to kLstmBlock)
     struct LSTMState {
-        std::vector<float> hidden;
-        std::vector<float> cell;
+        float* hidden;
+        float* cell;
+        float* next_hidden;
+    };
+    
+    // Cached LSTM state of one decoding sequence: per layer, hidden then cell
+    // (padded to kLstmBlock). recent holds the last recent_len consumed tokens
+    // (at most history_length, oldest first) to check that a window extends
+    // them. Guarded by its own mutex, which is only taken with
+    // sequence_mutex_ held, so eviction never races an in-flight step.
+    struct SequenceState {
+        std::mutex mutex;
+        AlignedFloatBuffer state;
+        uint64_t position = 0;          // tokens consumed; 0 = no state
+        std::vector<uint32_t> recent;
+        size_t recent_len = 0;
+        std::list<uint64_t>::iterator lru_position;
+    };
+    
+    mutable std::mutex sequence_mutex_;
+    std::unordered_map<uint64_t, std::unique_ptr<SequenceState>> sequences_;
+    std::list<uint64_t> sequence_lru_;      // front = most recently used
+    size_t sequence_capacity_;
+    
+    // Sequences processed together by the batched path; sized so a chunk's
+    // activations stay in L2 next to the layer weights
+    static constexpr size_t kBatchChunk = 64;
+    std::atomic<size_t> batch_threads_;
+    
+    // One predict_top_k_batch call, split into per_thread-sequence slices
+    struct BatchJob {
+        const uint32_t* const* token_histories;
+        const size_t* history_lens;
+        size_t batch;
+        size_t k;
+        std::pair<uint32_t, float>* out;
+        size_t* counts;
+        size_t per_thread;
+    };
+    
+    // Workers of the batched path: worker i runs slice i of each posted job.
+    // The pool is replaced by set_batch_threads and joined when the last
+    // batch using it lets go.
+    struct BatchPool {
+        std::mutex dispatch;                // held by the batch using the workers
+        std::mutex mutex;
+        std::condition_variable wake;       // job posted or stop
+        std::condition_variable done;       // every worker finished the job
+        BatchJob job{};
+        uint64_t generation = 0;
+        size_t remaining = 0;
+        bool stop = false;
+        std::vector<std::thread> threads;
+        
+        ~BatchPool();
+    };
+    
+    // Current pool (std::atomic_load / atomic_store); null when single-threaded
+    std::shared_ptr<BatchPool> batch_pool_;
+    
+    // Latency accounting
+    std::atomic<uint64_t> stat_predictions_;
+    std::atomic<uint64_t> stat_layer_steps_;
+    std::atomic<uint64_t> stat_step_ns_;
+    std::atomic<uint64_t> stat_predict_ns_;
+    std::atomic<uint64_t> stat_sequence_hits_;
+    std::atomic<uint64_t> stat_sequence_misses_;
+    std::atomic<uint64_t> stat_sequence_evictions_;
+    std::atomic<uint64_t> stat_shortlist_predictions_;
+    std::atomic<uint64_t> stat_shortlist_fallbacks_;
+    std::atomic<uint64_t> stat_rows_scored_;
+    std::atomic<uint64_t> stat_adaptation_observations_;
+    std::atomic<uint64_t> stat_adaptation_dropped_;
+    std::atomic<uint64_t> stat_adaptation_versions_;
+    std::atomic<uint64_t> stat_adapted_predictions_;
+    
+    size_t layer_input_dim(size_t layer) const {
+        return layer == 0 ? embedding_dim_ : hidden_dim_;
+    }
+    
+    // Floats of per-thread scratch needed by one prediction
+    size_t scratch_floats() const;
+    
+    // Floats of per-thread scratch needed by one batch chunk
+    size_t batch_scratch_floats(size_t batch) const;
+    
+    // Run the sequences [begin, end) of a job chunk by chunk, and the body of
+    // a pool worker
+    void run_batch_slice(const BatchJob& job, size_t begin, size_t end);
+    void batch_worker(BatchPool* pool, size_t index);
+    
+    // Batched forward pass and top-k for at most kBatchChunk sequences
+    void predict_batch_chunk(
+        const uint32_t* const* token_histories,
+        const size_t* history_lens,
+        size_t batch,
+        size_t k,
+        std::pair<uint32_t, float>* out,
+        size_t* counts
+    );
+    
+    // Floats reserved for one quantized activation vector
+    size_t activation_floats() const;
+    
+    // Floats of INT8 layer-step scratch; 0 in FP32 mode
+    size_t gate_scratch_floats() const;
+    
+    // Floats of shortlist scratch (cluster scores, probed clusters, recent
+    // tokens, fallback skip bitmap); 0 when the shortlist is disabled
+    size_t shortlist_floats() const;
+    
+    // Per-prediction buffers that follow the layer states in the arena
+    struct PredictBuffers {
+        float* embed;           // one embedding row
+        uint8_t* act;           // quantized hidden state
+        float* shortlist;       // shortlist_floats() of shortlist scratch
+        float* gates;           // gate_scratch_floats() for INT8 layer-steps
     };
     
-    // Forward pass through LSTM
+    // Point states at zeroed per-layer buffers in arena and carve the
+    // per-prediction buffers from the rest
+    PredictBuffers init_states(float* arena, LSTMState* states) const;
+    
+    // Advance every layer by one token
+    void step_token(uint32_t token, LSTMState* states, const PredictBuffers& buffers);
+    
+    // Run the last history_length_ tokens (left-padded with token 0)
+    void replay_history(const uint32_t* token_history, size_t history_len,
+                        LSTMState* states, const PredictBuffers& buffers);
+    
+    // Find or create the cache entry of a sequence and lock it
+    // (recycles the least recently used entry at capacity)
+    SequenceState* acquire_sequence(uint64_t sequence_id, std::unique_lock<std::mutex>& entry_lock);
+    void evict_sequences_locked(size_t capacity);
+    
+    // Forward pass of one layer for one time step (gates: INT8 step scratch)
     void lstm_forward(
-        const std::vector<float>& input,
+        const float* input,
         LSTMState& state,
-        const std::vector<float>& weights
+        size_t layer,
+        float* gates
     );
     
-    // Embedding lookup
-    std::vector<float> embed_token(uint32_t token_id);
+    // Build the INT8 copy of one layer from its packed FP32 weights
+    void quantize_layer(size_t layer);
+    
+    // Embedding lookup: a view into the FP32 table, or buffer filled with the
+    // dequantized row (zeros for unknown ids)
+    const float* embed_token(uint32_t token_id, float* buffer) const;
+    
+    // Output logits computed per chunk before top-k filtering
+    static constexpr size_t kLogitChunk = 64;
+    
+    // Logits of output rows [row, row + count) for one hidden state; act and
+    // act_scale are its quantized form (used in INT8 mode only)
+    void project_output(size_t row, size_t count, const float* hidden,
+                        const uint8_t* act, float act_scale, float* logits) const;
+    
+    // Logits of clustered shortlist rows [row, row + count)
+    void project_shortlist(size_t row, size_t count, const float* hidden,
+                           const uint8_t* act, float act_scale, float* logits) const;
+    
+    // Top-k tokens with softmax confidences, from the shortlist when enabled
+    // (history supplies its recent tokens) or the full vocabulary
+    size_t compute_top_k(const float* hidden, const uint32_t* token_history, size_t history_len,
+                         const PredictBuffers& buffers, size_t k, std::pair<uint32_t, float>* out);
+    
+    // Full-vocabulary top-k into topk (act already holds the quantized
+    // hidden state)
+    void full_top_k(const float* hidden, const uint8_t* act, float act_scale, LogitTopK& topk);
+    
+    // Shortlist top-k into topk, keyed by token; returns false when the
+    // scored rows hold less than min_scored_mass of the estimated softmax
+    // mass, after scoring the remaining rows into topk (full-vocabulary top-k)
+    bool shortlist_top_k(const float* hidden, const uint32_t* token_history, size_t history_len,
+                         const PredictBuffers& buffers, float act_scale, LogitTopK& topk);
+    
+    // Logit of one vocabulary row
+    float token_logit(uint32_t token, const float* hidden, const uint8_t* act, float act_scale) const;
+    
+    // Write the selected tokens as probabilities, mixed with the published
+    // n-gram table's distribution after history when adaptation is enabled
+    size_t finalize_top_k(LogitTopK& topk, const PublishedNgram* ngram,
+                          const uint32_t* token_history, size_t history_len,
+                          const float* hidden, const uint8_t* act, float act_scale,
+                          std::pair<uint32_t, float>* out);
+    
+    // Trainer thread body, and publication of its table (on the trainer
+    // thread, or by flush_adaptation while the trainer is idle)
+    void adaptation_loop(Adaptation* adaptation);
+    void publish_adaptation(Adaptation& adaptation);
     
-    // Compute output probabilities
-    std::vector<float> compute_output_probs(const std::vector<float>& hidden);
+    // Unpublish, stop and join the trainer (adaptation_control_ held)
+    void stop_adaptation_locked();
 };
 
 } // namespace cxlspeckv
@@ -0,0 +1,146 @@
+#include "online_adaptation.h"
+#include <algorithm>
+
+namespace cxlspeckv {
+
+namespace {
+
+// Bigram keys put this in place of the older context token
+constexpr uint32_t kNoToken = 0xFFFFFFFFu;
+
+uint64_t context_key(uint32_t older, uint32_t previous) {
+    return (static_cast<uint64_t>(older) << 32) | previous;
+}
+
+} // namespace
+
+TokenNgramTable::TokenNgramTable(size_t entries, float max_context_count)
+    : max_context_count_(std::max(max_context_count, 2.0f))
+{
+    size_t capacity = kProbeWindow;
+    while (capacity < entries) {
+        capacity <<= 1;
+    }
+    entries_.assign(capacity, Entry{});
+    mask_ = capacity - 1;
+}
+
+void TokenNgramTable::observe(const uint32_t* context, size_t context_len, uint32_t next_token) {
+    if (context_len == 0) {
+        return;
+    }
+
+    uint32_t previous = context[context_len - 1];
+    count(find_or_insert(context_key(kNoToken, previous)), next_token);
+    if (context_len >= 2) {
+        count(find_or_insert(context_key(context[context_len - 2], previous)), next_token);
+    }
+}
+
+size_t TokenNgramTable::lookup(
+    const uint32_t* history,
+    size_t history_len,
+    uint32_t* tokens,
+    float* probs,
+    float& total
+) const {
+    total = 0.0f;
+    if (history_len == 0) {
+        return 0;
+    }
+
+    uint32_t previous = history[history_len - 1];
+    const Entry* entry = history_len >= 2 ? find(context_key(history[history_len - 2], previous)) : nullptr;
+    if (!entry) {
+        entry = find(context_key(kNoToken, previous));
+    }
+    if (!entry) {
+        return 0;
+    }
+
+    size_t found = 0;
+    for (size_t way = 0; way < kWays; ++way) {
+        if (entry->counts[way] > 0.0f) {
+            tokens[found] = entry->tokens[way];
+            probs[found] = entry->counts[way] / entry->total;
+            found++;
+        }
+    }
+    total = entry->total;
+    return found;
+}
+
+size_t TokenNgramTable::size() const {
+    size_t used = 0;
+    for (const Entry& entry : entries_) {
+        used += entry.total > 0.0f ? 1 : 0;
+    }
+    return used;
+}
+
+size_t TokenNgramTable::home_slot(uint64_t key) const {
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & mask_;
+}
+
+const TokenNgramTable::Entry* TokenNgramTable::find(uint64_t key) const {
+    size_t slot = home_slot(key);
+    for (size_t i = 0; i < kProbeWindow; ++i) {
+        const Entry& entry = entries_[(slot + i) & mask_];
+        if (entry.total > 0.0f && entry.key == key) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+TokenNgramTable::Entry& TokenNgramTable::find_or_insert(uint64_t key) {
+    // Reuse the key's entry, else the first free one in the window, else
+    // displace the least observed context in the window
+    size_t slot = home_slot(key);
+    Entry* target = nullptr;
+    for (size_t i = 0; i < kProbeWindow; ++i) {
+        Entry& entry = entries_[(slot + i) & mask_];
+        if (entry.total > 0.0f && entry.key == key) {
+            return entry;
+        }
+        if (!target || (target->total > 0.0f && entry.total < target->total)) {
+            target = &entry;
+        }
+    }
+
+    *target = Entry{};
+    target->key = key;
+    return *target;
+}
+
+void TokenNgramTable::count(Entry& entry, uint32_t next_token) {
+    size_t way = kWays;
+    size_t weakest = 0;
+    for (size_t w = 0; w < kWays; ++w) {
+        if (entry.counts[w] > 0.0f && entry.tokens[w] == next_token) {
+            way = w;
+            break;
+        }
+        if (entry.counts[w] < entry.counts[weakest]) {
+            weakest = w;
+        }
+    }
+    if (way == kWays) {
+        // Displaced counts stay in the total, so candidates' probabilities
+        // remain conditional on everything seen in this context
+        way = weakest;
+        entry.tokens[way] = next_token;
+        entry.counts[way] = 0.0f;
+    }
+
+    entry.counts[way] += 1.0f;
+    entry.total += 1.0f;
+    if (entry.total > max_context_count_) {
+        for (float& c : entry.counts) {
+            c *= 0.5f;
+        }
+        entry.total *= 0.5f;
+    }
+}
+
+} // namespace cxlspeckv
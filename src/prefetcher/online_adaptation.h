@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace cxlspeckv {
+
+// Online adaptation of the token predictor (LSTMPredictor::enable_adaptation).
+// True next tokens observed on the decode path are counted in an n-gram side
+// table by a background thread; predictions mix its next-token distribution
+// into the LSTM's, so the predictor follows the live traffic mix.
+struct AdaptationConfig {
+    size_t table_entries = 65536;       // contexts kept (rounded up to a power of two)
+    size_t queue_capacity = 8192;       // pending observations; further ones are dropped
+    size_t publish_interval = 1024;     // observations per published table version
+    float max_weight = 0.5f;            // n-gram share of the mixture for a well-observed context
+    float prior_count = 8.0f;           // observations at which a context gets half of max_weight
+    float max_context_count = 256.0f;   // a context's counts halve past this, so old traffic fades
+};
+
+/**
+ * Hashed bigram/trigram table of observed next tokens.
+ *
+ * Each context (the previous one or two tokens) keeps its kWays most frequent
+ * next tokens; a new token displaces the least frequent one. Counts decay by
+ * halving once a context's total passes max_context_count. The table is a
+ * flat open-addressed array, so a published version is a plain copy.
+ */
+class TokenNgramTable {
+public:
+    static constexpr size_t kWays = 4;
+
+    TokenNgramTable(size_t entries, float max_context_count);
+
+    // Count next_token after the last (up to two) tokens of context
+    void observe(const uint32_t* context, size_t context_len, uint32_t next_token);
+
+    // Next-token distribution after history: the trigram context when it has
+    // been observed, else the bigram one. Writes up to kWays candidates and
+    // their conditional probabilities; total is the context's observation
+    // count. Returns the number of candidates.
+    size_t lookup(const uint32_t* history, size_t history_len,
+                  uint32_t* tokens, float* probs, float& total) const;
+
+    // Contexts currently held, and bytes of the table
+    size_t size() const;
+    size_t memory_bytes() const { return entries_.size() * sizeof(Entry); }
+
+private:
+    struct Entry {
+        uint64_t key;
+        float total;                    // 0 marks a free entry
+        float counts[kWays];
+        uint32_t tokens[kWays];
+    };
+
+    // Entries probed from a key's home slot before one is displaced
+    static constexpr size_t kProbeWindow = 8;
+
+    std::vector<Entry> entries_;
+    size_t mask_;
+    float max_context_count_;
+
+    size_t home_slot(uint64_t key) const;
+    const Entry* find(uint64_t key) const;
+    Entry& find_or_insert(uint64_t key);
+    void count(Entry& entry, uint32_t next_token);
+};
+
+} // namespace cxlspeckv
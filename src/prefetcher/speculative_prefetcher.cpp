@@ -11,11 +11,13 @@ SpeculativePrefetcher::SpeculativePrefetcher(
     size_t prefetch_depth,
     size_t history_length
 ) : memory_manager_(memory_manager),
-    predictor_(std::make_unique<LSTMPredictor>(32000, 64, 128, 2, history_length)),
+    predictor_(std::make_unique<LSTMPredictor>(32000, 64, 64, 2, history_length)),
     prefetch_depth_(prefetch_depth),
     history_length_(history_length),
-    adaptive_depth_(prefetch_depth),
-    accuracy_window_size_(100)
+    external_link_utilization_(0.0),
+    measured_link_utilization_(0.0),
+    window_bytes_(0.0),
+    window_start_(std::chrono::steady_clock::now())
 {
     reset_statistics();
 }
@@ -29,23 +31,106 @@ std::vector<PrefetchRequest> SpeculativePrefetcher::prefetch(
 ) {
     auto start_time = std::chrono::high_resolution_clock::now();
     
-    size_t actual_depth = (depth > 0) ? depth : adaptive_depth_.load();
+    size_t actual_depth = depth;
+    size_t ranked_depth = resolve_depth(layer_id, actual_depth);
+    
+    // Remember the history tail so the reported next token can train the
+    // predictor (once, however many layers prefetch from this history)
+    if (!token_history.empty()) {
+        std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+        size_t len = std::min<size_t>(token_history.size(), last_context_.size());
+        std::array<uint32_t, 2> context{};
+        std::copy(token_history.end() - len, token_history.end(), context.begin());
+        if (token_history.size() != last_history_size_ || context != last_context_) {
+            last_context_ = context;
+            last_context_len_ = len;
+            last_history_size_ = token_history.size();
+            context_pending_ = true;
+        }
+    }
     
     // Step 1: Predict tokens using LSTM
-    auto predictions = predictor_->predict_top_k(token_history, actual_depth);
+    // Rank past the issued depth so the layer's model sees hit rates at deeper ranks
+    auto predictions = predictor_->predict_top_k(token_history, ranked_depth);
     
+    return issue_predictions(predictions, 0, layer_id, actual_depth, start_time);
+}
+
+std::vector<PrefetchRequest> SpeculativePrefetcher::prefetch(
+    uint32_t request_id,
+    uint64_t position,
+    const std::vector<uint32_t>& token_history,
+    uint32_t layer_id,
+    size_t depth
+) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    
+    size_t actual_depth = depth;
+    size_t ranked_depth = resolve_depth(layer_id, actual_depth);
+    
+    // Step 1: Predict tokens from the request's cached LSTM state (one step
+    // per new token; repeated calls for other layers reuse the same state)
+    std::vector<std::pair<uint32_t, float>> predictions(ranked_depth);
+    predictions.resize(predictor_->predict_next(request_id, position, token_history.data(), token_history.size(),
+                                                ranked_depth, predictions.data()));
+    
+    return issue_predictions(predictions, request_id, layer_id, actual_depth, start_time);
+}
+
+void SpeculativePrefetcher::release_request(uint32_t request_id) {
+    predictor_->release_sequence(request_id);
+}
+
+bool SpeculativePrefetcher::enable_adaptation(const AdaptationConfig& config) {
+    return predictor_->enable_adaptation(config);
+}
+
+void SpeculativePrefetcher::disable_adaptation() {
+    predictor_->disable_adaptation();
+}
+
+void SpeculativePrefetcher::observe_actual_token(uint32_t actual_token) {
+    std::array<uint32_t, 2> context;
+    size_t len;
+    {
+        std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+        if (!context_pending_) {
+            return;
+        }
+        context = last_context_;
+        len = last_context_len_;
+        context_pending_ = false;
+    }
+    predictor_->observe_token(context.data(), len, actual_token);
+}
+
+size_t SpeculativePrefetcher::resolve_depth(uint32_t layer_id, size_t& actual_depth) {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    if (actual_depth == 0) {
+        actual_depth = layer_state_locked(layer_id).depth;
+    }
+    return std::max(actual_depth, cost_model_.max_depth);
+}
+
+std::vector<PrefetchRequest> SpeculativePrefetcher::issue_predictions(
+    const std::vector<std::pair<uint32_t, float>>& predictions,
+    uint32_t request_id,
+    uint32_t layer_id,
+    size_t actual_depth,
+    std::chrono::high_resolution_clock::time_point start_time
+) {
     std::vector<PrefetchRequest> prefetch_requests;
     prefetch_requests.reserve(actual_depth);
     
     // Step 2: For each predicted token, compute KV-cache address and issue prefetch
-    for (size_t i = 0; i < predictions.size(); ++i) {
+    for (size_t i = 0; i < predictions.size() && i < actual_depth; ++i) {
         uint32_t predicted_token = predictions[i].first;
         float confidence = predictions[i].second;
         
         // Compute virtual address for KV-cache entry
         // Simplified: assume we can compute from (request_id, layer_id, position)
         // In real implementation, this would use proper address translation
-        uint64_t virtual_addr = compute_kv_address(0, layer_id, i + 1);  // position = i+1 for next tokens
+        uint64_t virtual_addr = compute_kv_address(request_id, layer_id, i + 1);  // position = i+1 for next tokens
         
         // Check if already in L1 or L2
         if (memory_manager_->is_in_cache(virtual_addr, MemoryTier::L1_GPU_LOCAL) ||
@@ -66,6 +151,17 @@ std::vector<PrefetchRequest> SpeculativePrefetcher::prefetch(
         issue_dma_prefetch(req);
     }
     
+    {
+        std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+        auto& layer = layer_state_locked(layer_id);
+        layer.last_predictions.clear();
+        for (const auto& prediction : predictions) {
+            layer.last_predictions.push_back(prediction.first);
+        }
+        layer.issued_depth = std::min(actual_depth, predictions.size());
+        account_issued_locked(layer, prefetch_requests.size());
+    }
+    
     auto end_time = std::chrono::high_resolution_clock::now();
     auto latency_us = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count();
     
@@ -86,6 +182,7 @@ void SpeculativePrefetcher::handle_misprediction(
     const std::vector<uint32_t>& predicted_tokens
 ) {
     bool was_correct = std::find(predicted_tokens.begin(), predicted_tokens.end(), actual_token) != predicted_tokens.end();
+    observe_actual_token(actual_token);
     
     if (!was_correct) {
         std::lock_guard<std::mutex> stats_lock(stats_mutex_);
@@ -96,31 +193,105 @@ void SpeculativePrefetcher::handle_misprediction(
     }
 }
 
-void SpeculativePrefetcher::update_prediction_accuracy(uint32_t request_id, bool was_correct) {
-    accuracy_history_.push_back(was_correct ? 1.0 : 0.0);
-    if (accuracy_history_.size() > accuracy_window_size_) {
-        accuracy_history_.erase(accuracy_history_.begin());
+void SpeculativePrefetcher::record_outcome(
+    uint32_t layer_id,
+    uint32_t actual_token,
+    const std::vector<uint32_t>& predicted_tokens
+) {
+    size_t rank = kMaxPrefetchDepth;
+    {
+        std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+        const auto& ranked = predicted_tokens.empty()
+            ? layer_state_locked(layer_id).last_predictions
+            : predicted_tokens;
+        auto it = std::find(ranked.begin(), ranked.end(), actual_token);
+        if (it != ranked.end()) {
+            rank = static_cast<size_t>(it - ranked.begin());
+        }
     }
     
-    // Compute recent accuracy
-    if (accuracy_history_.size() >= 10) {
-        double recent_accuracy = 0.0;
-        for (size_t i = accuracy_history_.size() - 10; i < accuracy_history_.size(); ++i) {
-            recent_accuracy += accuracy_history_[i];
+    update_prediction_accuracy(layer_id, rank, rank < kMaxPrefetchDepth);
+    observe_actual_token(actual_token);
+}
+
+void SpeculativePrefetcher::update_prediction_accuracy(uint32_t layer_id, size_t hit_rank, bool was_correct) {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    auto& layer = layer_state_locked(layer_id);
+    
+    // EWMA of the probability that the true token sits at each rank
+    double alpha = cost_model_.ewma_alpha;
+    for (size_t r = 0; r < kMaxPrefetchDepth; ++r) {
+        double observed = (was_correct && r == hit_rank) ? 1.0 : 0.0;
+        layer.rank_hit_prob[r] = (1.0 - alpha) * layer.rank_hit_prob[r] + alpha * observed;
+    }
+    
+    // Only ranks that were actually prefetched count as useful; the depth
+    // may have moved since the predictions were issued
+    layer.samples++;
+    if (was_correct && hit_rank < layer.issued_depth) {
+        layer.useful++;
+    }
+    
+    recompute_depth_locked(layer);
+}
+
+size_t SpeculativePrefetcher::get_adaptive_depth(uint32_t layer_id) const {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    if (layer_id < layer_depth_.size() && layer_depth_[layer_id].depth > 0) {
+        return layer_depth_[layer_id].depth;
+    }
+    return std::clamp(prefetch_depth_, cost_model_.min_depth, cost_model_.max_depth);
+}
+
+std::vector<LayerDepthDecision> SpeculativePrefetcher::get_layer_depths() const {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    
+    std::vector<LayerDepthDecision> decisions;
+    double utilization = link_utilization_locked();
+    for (size_t i = 0; i < layer_depth_.size(); ++i) {
+        const auto& layer = layer_depth_[i];
+        if (layer.depth == 0) {
+            continue;  // Layer never used
         }
-        recent_accuracy /= 10.0;
         
-        // Adaptively adjust depth
-        if (recent_accuracy > 0.95 && adaptive_depth_.load() < 8) {
-            adaptive_depth_++;
-        } else if (recent_accuracy < 0.85 && adaptive_depth_.load() > 2) {
-            adaptive_depth_--;
+        LayerDepthDecision decision;
+        decision.layer_id = static_cast<uint32_t>(i);
+        decision.depth = layer.depth;
+        decision.accuracy = layer.issued > 0 ? static_cast<double>(layer.useful) / layer.issued : 0.0;
+        decision.bytes_fetched = layer.bytes_fetched;
+        decision.bytes_per_hit = layer.useful > 0 ? layer.bytes_fetched / layer.useful : 0.0;
+        decision.link_utilization = utilization;
+        decision.samples = layer.samples;
+        decisions.push_back(decision);
+    }
+    return decisions;
+}
+
+void SpeculativePrefetcher::set_cost_model(const DepthCostModel& model) {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    cost_model_ = model;
+    cost_model_.max_depth = std::clamp<size_t>(cost_model_.max_depth, 1, kMaxPrefetchDepth);
+    cost_model_.min_depth = std::clamp<size_t>(cost_model_.min_depth, 1, cost_model_.max_depth);
+    for (auto& layer : layer_depth_) {
+        if (layer.depth > 0) {
+            recompute_depth_locked(layer);
         }
     }
 }
 
-size_t SpeculativePrefetcher::get_adaptive_depth() const {
-    return adaptive_depth_.load();
+DepthCostModel SpeculativePrefetcher::get_cost_model() const {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    return cost_model_;
+}
+
+void SpeculativePrefetcher::set_link_utilization(double utilization) {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
+    external_link_utilization_ = std::clamp(utilization, 0.0, 1.0);
+    for (auto& layer : layer_depth_) {
+        if (layer.depth > 0) {
+            recompute_depth_locked(layer);
+        }
+    }
 }
 
 SpeculativePrefetcher::PrefetchStatistics SpeculativePrefetcher::get_statistics() const {
@@ -142,8 +313,14 @@ void SpeculativePrefetcher::reset_statistics() {
 }
 
 void SpeculativePrefetcher::set_prefetch_depth(size_t depth) {
+    std::lock_guard<std::mutex> depth_lock(depth_mutex_);
     prefetch_depth_ = depth;
-    adaptive_depth_ = depth;
+    
+    // Restart every layer from the new default; the cost model takes over again after warmup
+    for (auto& layer : layer_depth_) {
+        layer = LayerDepthState{};
+        layer.depth = std::clamp(prefetch_depth_, cost_model_.min_depth, cost_model_.max_depth);
+    }
 }
 
 size_t SpeculativePrefetcher::get_prefetch_depth() const {
@@ -184,5 +361,66 @@ bool SpeculativePrefetcher::is_already_prefetched(uint64_t virtual_addr) {
     return false;
 }
 
+SpeculativePrefetcher::LayerDepthState& SpeculativePrefetcher::layer_state_locked(uint32_t layer_id) {
+    if (layer_id >= layer_depth_.size()) {
+        layer_depth_.resize(layer_id + 1);
+    }
+    
+    auto& layer = layer_depth_[layer_id];
+    if (layer.depth == 0) {
+        layer.depth = std::clamp(prefetch_depth_, cost_model_.min_depth, cost_model_.max_depth);
+    }
+    return layer;
+}
+
+void SpeculativePrefetcher::account_issued_locked(LayerDepthState& layer, size_t issued) {
+    double bytes = issued * cost_model_.kv_entry_bytes;
+    layer.issued += issued;
+    layer.bytes_fetched += bytes;
+    
+    // Estimate link utilization from the prefetch traffic we generated over ~1ms windows
+    window_bytes_ += bytes;
+    auto now = std::chrono::steady_clock::now();
+    double elapsed_us = std::chrono::duration<double, std::micro>(now - window_start_).count();
+    if (elapsed_us >= 1000.0) {
+        double capacity_bytes = cost_model_.link_bandwidth_gbps * 1e3 * elapsed_us;  // GB/s = 1e3 B/us
+        double utilization = capacity_bytes > 0.0 ? std::min(window_bytes_ / capacity_bytes, 1.0) : 1.0;
+        measured_link_utilization_ = 0.5 * measured_link_utilization_ + 0.5 * utilization;
+        window_bytes_ = 0.0;
+        window_start_ = now;
+    }
+}
+
+void SpeculativePrefetcher::recompute_depth_locked(LayerDepthState& layer) {
+    if (layer.samples < cost_model_.warmup_samples) {
+        layer.depth = std::clamp(prefetch_depth_, cost_model_.min_depth, cost_model_.max_depth);
+        return;
+    }
+    
+    // Cost of one more entry: its transfer time on the link, inflated by queueing as the
+    // link fills up. Benefit: the stall it avoids, weighted by how often that rank hits.
+    double utilization = link_utilization_locked();
+    double bytes_per_us = cost_model_.link_bandwidth_gbps * 1e3 * std::max(1.0 - utilization, 0.05);
+    double transfer_cost_us = cost_model_.kv_entry_bytes / bytes_per_us;
+    
+    // Pick the prefix length with the largest cumulative net benefit
+    size_t best_depth = 0;
+    double best_net = 0.0;
+    double net = 0.0;
+    for (size_t r = 0; r < cost_model_.max_depth; ++r) {
+        net += layer.rank_hit_prob[r] * cost_model_.miss_penalty_us - transfer_cost_us;
+        if (net > best_net) {
+            best_net = net;
+            best_depth = r + 1;
+        }
+    }
+    
+    layer.depth = std::clamp(best_depth, cost_model_.min_depth, cost_model_.max_depth);
+}
+
+double SpeculativePrefetcher::link_utilization_locked() const {
+    return std::max(external_link_utilization_, measured_link_utilization_);
+}
+
 } // namespace cxlspeckv
 
@@ -6,6 +6,10 @@
 #include <mutex>
 #include <queue>
 #include <atomic>
+#include <array>
+#include <chrono>
+#include <utility>
+#include "online_adaptation.h"
 
 namespace cxlspeckv {
 
@@ -28,6 +32,32 @@ struct PrefetchRequest {
     uint64_t timestamp;
 };
 
+// Upper bound on prefetch depth; the predictor is always asked for this many
+// candidates so that hit rates beyond the issued depth remain observable.
+constexpr size_t kMaxPrefetchDepth = 8;
+
+// Cost model used to pick the prefetch depth of each layer
+struct DepthCostModel {
+    size_t min_depth = 1;
+    size_t max_depth = kMaxPrefetchDepth;
+    double kv_entry_bytes = 64.0 * 1024;    // Bytes moved per prefetched KV entry
+    double link_bandwidth_gbps = 32.0;      // CXL/PCIe link bandwidth available to prefetch
+    double miss_penalty_us = 10.0;          // Stall cost of a demand fetch on a miss
+    double ewma_alpha = 0.05;               // Smoothing for per-rank hit probabilities
+    size_t warmup_samples = 16;             // Outcomes needed before leaving the default depth
+};
+
+// Per-layer depth decision (exported for monitoring)
+struct LayerDepthDecision {
+    uint32_t layer_id;
+    size_t depth;
+    double accuracy;                        // Fraction of issued prefetches that were used
+    double bytes_fetched;
+    double bytes_per_hit;
+    double link_utilization;
+    uint64_t samples;
+};
+
 // Speculative Prefetcher
 class SpeculativePrefetcher {
 public:
@@ -47,13 +77,52 @@ public:
         uint32_t layer_id,
         size_t depth = 0  // 0 means use default
     );
+    
+    // Decode-path variant: the predictor keeps the request's LSTM state
+    // between calls, so each new token costs one LSTM step. position is the
+    // request's token count through the last token of token_history, which
+    // may be the trailing window H_t (see LSTMPredictor::predict_next).
+    std::vector<PrefetchRequest> prefetch(
+        uint32_t request_id,
+        uint64_t position,
+        const std::vector<uint32_t>& token_history,
+        uint32_t layer_id,
+        size_t depth = 0
+    );
+    
+    // Drop predictor state of a finished request
+    void release_request(uint32_t request_id);
 
     // Handle misprediction
     void handle_misprediction(uint32_t actual_token, const std::vector<uint32_t>& predicted_tokens);
     
-    // Adaptive prediction depth adjustment
-    void update_prediction_accuracy(uint32_t request_id, bool was_correct);
-    size_t get_adaptive_depth() const;
+    // Online adaptation of the predictor to the observed token stream. The
+    // decode path (request_id prefetch) feeds it directly; for stateless
+    // prefetches the true token reported through record_outcome or
+    // handle_misprediction is fed once per history. Returns false for an
+    // invalid config (see LSTMPredictor::enable_adaptation). Either call may
+    // be made while prefetches are being served.
+    bool enable_adaptation(const AdaptationConfig& config = AdaptationConfig());
+    void disable_adaptation();
+    
+    // Feed the true next token for a layer back into that layer's depth model.
+    // predicted_tokens defaults to the last ranked candidates produced for the layer.
+    void record_outcome(uint32_t layer_id, uint32_t actual_token,
+                        const std::vector<uint32_t>& predicted_tokens = {});
+    
+    // Adaptive prediction depth adjustment (per layer)
+    void update_prediction_accuracy(uint32_t layer_id, size_t hit_rank, bool was_correct);
+    size_t get_adaptive_depth(uint32_t layer_id = 0) const;
+    std::vector<LayerDepthDecision> get_layer_depths() const;
+    
+    // Cost model configuration
+    void set_cost_model(const DepthCostModel& model);
+    DepthCostModel get_cost_model() const;
+    
+    // Externally measured link utilization (0.0 - 1.0), e.g. from FPGA counters.
+    // The larger of this and the prefetcher's own estimate is used; layer
+    // depths are re-evaluated right away.
+    void set_link_utilization(double utilization);
     
     // Statistics
     struct PrefetchStatistics {
@@ -80,10 +149,33 @@ private:
     size_t history_length_;
     
     // Adaptive depth management
-    std::atomic<size_t> adaptive_depth_;
+    struct LayerDepthState {
+        std::array<double, kMaxPrefetchDepth> rank_hit_prob{};  // P(actual token at rank r)
+        std::vector<uint32_t> last_predictions;
+        size_t issued_depth = 0;                                // Ranks prefetched from last_predictions
+        size_t depth = 0;
+        uint64_t samples = 0;
+        uint64_t issued = 0;
+        uint64_t useful = 0;
+        double bytes_fetched = 0.0;
+    };
+    
     mutable std::mutex depth_mutex_;
-    std::vector<double> accuracy_history_;
-    size_t accuracy_window_size_;
+    DepthCostModel cost_model_;
+    std::vector<LayerDepthState> layer_depth_;
+    
+    // Tail of the last stateless prefetch history, pending until its true
+    // next token is reported (guarded by depth_mutex_)
+    std::array<uint32_t, 2> last_context_{};
+    size_t last_context_len_ = 0;
+    size_t last_history_size_ = 0;
+    bool context_pending_ = false;
+    
+    // Link utilization estimate
+    double external_link_utilization_;
+    double measured_link_utilization_;
+    double window_bytes_;
+    std::chrono::steady_clock::time_point window_start_;
     
     // Outstanding prefetch requests
     std::queue<PrefetchRequest> outstanding_prefetches_;
@@ -94,9 +186,24 @@ private:
     mutable std::mutex stats_mutex_;
     
     // Helper functions
+    size_t resolve_depth(uint32_t layer_id, size_t& actual_depth);
+    void observe_actual_token(uint32_t actual_token);
+    std::vector<PrefetchRequest> issue_predictions(
+        const std::vector<std::pair<uint32_t, float>>& predictions,
+        uint32_t request_id,
+        uint32_t layer_id,
+        size_t actual_depth,
+        std::chrono::high_resolution_clock::time_point start_time
+    );
     uint64_t compute_kv_address(uint32_t req_id, uint32_t layer_id, uint32_t position);
     void issue_dma_prefetch(const PrefetchRequest& req);
     bool is_already_prefetched(uint64_t virtual_addr);
+    
+    // Depth model helpers (depth_mutex_ must be held)
+    LayerDepthState& layer_state_locked(uint32_t layer_id);
+    void account_issued_locked(LayerDepthState& layer, size_t issued);
+    void recompute_depth_locked(LayerDepthState& layer);
+    double link_utilization_locked() const;
 };
 
 } // namespace cxlspeckv
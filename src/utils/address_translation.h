@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <mutex>
+#include <vector>
 
 namespace cxlspeckv {
 
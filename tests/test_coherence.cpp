@@ -6,11 +6,18 @@
  */
 
 #include "../src/cxl_memory/coherence_manager.h"
+#include "../src/cxl_memory/write_combining_buffer.h"
 #include "../host/include/speckv_driver.h"
+#include "../host/include/speckv_sim_driver.h"
 #include <iostream>
 #include <cassert>
 #include <cstring>
 #include <iomanip>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <future>
+#include <poll.h>
 
 using namespace cxlspeckv;
 
@@ -55,9 +62,32 @@ public:
     }
 };
 
+// Backend for the tests: the software home agent unless --device names hardware
+static std::string device_path;
+
+std::shared_ptr<SpeckvDriver> make_driver() {
+    if (!device_path.empty()) {
+        auto driver = std::make_shared<SpeckvDriver>(device_path);
+        driver->open();
+        return driver;
+    }
+    return std::make_shared<SpeckvSimDriver>();
+}
+
+// Software home agent that keeps a copy of every batch descriptor it executes
+class RecordingSimDriver : public SpeckvSimDriver {
+public:
+    bool coherence_batch(CoherenceDescriptor* descriptors, size_t count) override {
+        recorded.insert(recorded.end(), descriptors, descriptors + count);
+        return SpeckvSimDriver::coherence_batch(descriptors, count);
+    }
+    
+    std::vector<CoherenceDescriptor> recorded;
+};
+
 // Test 1: Basic initialization
 bool test_initialization() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     TEST_ASSERT(true, "CoherenceManager initialization");
@@ -72,7 +102,7 @@ bool test_initialization() {
 
 // Test 2: Read operations
 bool test_read_operations() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0x10000;
@@ -105,7 +135,7 @@ bool test_read_operations() {
 
 // Test 3: Write operations with invalidations
 bool test_write_operations() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0x20000;
@@ -120,6 +150,9 @@ bool test_write_operations() {
     TEST_ASSERT(state == CoherenceManager::CoherenceState::SHARED,
                 "Initial state is SHARED");
     
+    // A second agent shares the line
+    coherence_mgr.request_read(addr, buffer, sizeof(buffer), 1);
+    
     // Now write - should trigger invalidation
     bool success = coherence_mgr.request_write(addr, data, sizeof(data));
     TEST_ASSERT(success, "Write request succeeds");
@@ -138,7 +171,7 @@ bool test_write_operations() {
 
 // Test 4: Invalidation operations
 bool test_invalidation() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0x30000;
@@ -165,7 +198,7 @@ bool test_invalidation() {
 
 // Test 5: Writeback operations
 bool test_writeback() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0x40000;
@@ -196,7 +229,7 @@ bool test_writeback() {
 
 // Test 6: Memory tier promotion
 bool test_tier_promotion() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0x50000;
@@ -219,7 +252,7 @@ bool test_tier_promotion() {
 
 // Test 7: Memory tier demotion
 bool test_tier_demotion() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0x60000;
@@ -244,7 +277,7 @@ bool test_tier_demotion() {
 
 // Test 8: Batch invalidations
 bool test_batch_operations() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     std::vector<uint64_t> addrs = {0x70000, 0x70040, 0x70080, 0x700C0};
@@ -275,7 +308,7 @@ bool test_batch_operations() {
 
 // Test 9: Flush all operations
 bool test_flush_all() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     // Create multiple modified entries
@@ -304,7 +337,7 @@ bool test_flush_all() {
 
 // Test 10: Statistics tracking
 bool test_statistics() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     // Perform various operations
@@ -339,7 +372,7 @@ bool test_statistics() {
 
 // Test 11: State transitions
 bool test_state_transitions() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     uint64_t addr = 0xA0000;
@@ -379,7 +412,7 @@ bool test_state_transitions() {
 
 // Test 12: Concurrent addresses
 bool test_multiple_addresses() {
-    auto driver = std::make_shared<SpeckvDriver>("/dev/speckv0");
+    auto driver = make_driver();
     CoherenceManager coherence_mgr(driver, 64);
     
     const int NUM_ADDRS = 10;
@@ -401,12 +434,1070 @@ bool test_multiple_addresses() {
     return true;
 }
 
+// Test 13: Concurrent queries and operations across shards
+bool test_concurrent_access() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    const int NUM_THREADS = 4;
+    const int LINES_PER_THREAD = 512;
+    const uint64_t shared_addr = 0xC0000;
+    std::atomic<bool> stop{false};
+    std::atomic<int> bad_states{0};
+    
+    // Readers poll state lock-free while writers move lines through MESI
+    std::thread reader([&] {
+        while (!stop.load()) {
+            for (int i = 0; i < LINES_PER_THREAD; i++) {
+                auto state = coherence_mgr.get_state(0xD00000 + i * 64);
+                if (state == CoherenceManager::CoherenceState::EXCLUSIVE) {
+                    bad_states++;  // never produced by this workload
+                }
+                coherence_mgr.is_valid(shared_addr);
+            }
+        }
+    });
+    
+    std::vector<std::thread> workers;
+    for (int t = 0; t < NUM_THREADS; t++) {
+        workers.emplace_back([&, t] {
+            char data[64];
+            std::memset(data, t, sizeof(data));
+            for (int i = 0; i < LINES_PER_THREAD; i++) {
+                uint64_t addr = 0xD00000 + (uint64_t)(t * LINES_PER_THREAD + i) * 64;
+                coherence_mgr.request_read(addr, data, sizeof(data));
+                coherence_mgr.request_write(addr, data, sizeof(data));
+                coherence_mgr.request_write(shared_addr, data, sizeof(data));
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    stop = true;
+    reader.join();
+    
+    TEST_ASSERT(bad_states.load() == 0, "Queries never observe a torn state");
+    
+    int modified = 0;
+    for (int i = 0; i < NUM_THREADS * LINES_PER_THREAD; i++) {
+        modified += coherence_mgr.is_modified(0xD00000 + (uint64_t)i * 64) ? 1 : 0;
+    }
+    TEST_ASSERT(modified == NUM_THREADS * LINES_PER_THREAD, "Every written line is MODIFIED");
+    TEST_ASSERT(coherence_mgr.is_modified(shared_addr), "Contended line is MODIFIED");
+    
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.total_writes >= (uint64_t)NUM_THREADS * LINES_PER_THREAD * 2,
+                "All concurrent writes recorded");
+    
+    TEST_ASSERT(coherence_mgr.flush_all(), "Flush after concurrent writes succeeds");
+    TEST_ASSERT(!coherence_mgr.is_modified(shared_addr), "Contended line clean after flush");
+    
+    return true;
+}
+
+// Test 14: Directory growth keeps every line reachable
+bool test_directory_growth() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    coherence_mgr.set_directory_capacity(0);    // unbounded: exercise growth
+    
+    const int NUM_LINES = 100000;
+    const uint64_t base = 0x10000000;
+    std::atomic<int> inserted{0};
+    std::atomic<int> lost{0};
+    
+    // Lookups run while shards grow and migrate entries to larger tables
+    std::thread reader([&] {
+        uint64_t seed = 1;
+        while (inserted.load() < NUM_LINES) {
+            int known = inserted.load();
+            if (known == 0) {
+                continue;
+            }
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            uint64_t addr = base + (seed >> 33) % known * 64;
+            if (coherence_mgr.get_state(addr) != CoherenceManager::CoherenceState::SHARED) {
+                lost++;
+            }
+        }
+    });
+    
+    char buffer[64];
+    for (int i = 0; i < NUM_LINES; i++) {
+        coherence_mgr.request_read(base + (uint64_t)i * 64, buffer, sizeof(buffer));
+        inserted.store(i + 1);
+    }
+    reader.join();
+    
+    TEST_ASSERT(lost.load() == 0, "Lines stay visible during resize");
+    TEST_ASSERT(coherence_mgr.directory_size() == NUM_LINES, "Directory tracks every line once");
+    
+    int shared = 0;
+    for (int i = 0; i < NUM_LINES; i++) {
+        shared += coherence_mgr.get_state(base + (uint64_t)i * 64) ==
+                  CoherenceManager::CoherenceState::SHARED ? 1 : 0;
+    }
+    TEST_ASSERT(shared == NUM_LINES, "Every line SHARED after growth");
+    
+    // 16-byte entries at no less than 7/16 load, plus tables not yet freed
+    size_t per_line = coherence_mgr.directory_memory_bytes() / NUM_LINES;
+    TEST_ASSERT(per_line <= 80, "Directory stays compact per line");
+    
+    return true;
+}
+
+// Test 15: Region-granular tracking and split on sharing conflicts
+bool test_region_mode() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    const size_t PAGE = 4096;
+    TEST_ASSERT(!coherence_mgr.enable_region_mode(100), "Region size must be a power of two");
+    TEST_ASSERT(coherence_mgr.enable_region_mode(PAGE), "Region mode enabled on empty directory");
+    
+    // A page written whole, then read, stays one directory entry
+    uint64_t page = 0x200000;
+    char data[PAGE];
+    std::memset(data, 0x5A, sizeof(data));
+    TEST_ASSERT(coherence_mgr.request_write(page, data, sizeof(data)), "Page write succeeds");
+    TEST_ASSERT(coherence_mgr.is_modified(page + 1024), "Whole page MODIFIED");
+    TEST_ASSERT(coherence_mgr.writeback(page + 64, data, sizeof(data)), "Page writeback succeeds");
+    TEST_ASSERT(coherence_mgr.get_state(page + PAGE - 64) == CoherenceManager::CoherenceState::SHARED,
+                "Whole page SHARED after writeback");
+    for (size_t offset = 0; offset < PAGE; offset += 64) {
+        coherence_mgr.request_read(page + offset, data, 64);
+    }
+    TEST_ASSERT(coherence_mgr.directory_size() == 1, "Page tracked by one entry");
+    
+    // Bulk invalidation of every line in a page is one region operation
+    std::vector<uint64_t> lines;
+    for (size_t offset = 0; offset < PAGE; offset += 64) {
+        lines.push_back(page + offset);
+    }
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.batch_invalidate(lines), "Region batch invalidate succeeds");
+    TEST_ASSERT(coherence_mgr.get_statistics().invalidations_sent == 1, "One invalidation per region");
+    TEST_ASSERT(!coherence_mgr.is_valid(page + 2048), "Whole page invalid");
+    
+    // Promotion moves the region as a unit
+    TEST_ASSERT(coherence_mgr.promote_to_l1(page + 128), "Region promote succeeds");
+    TEST_ASSERT(coherence_mgr.get_tier(page + 3968) == CoherenceManager::MemoryTier::L1_GPU,
+                "Whole page promoted");
+    
+    // A write into a read-shared page splits it into lines
+    uint64_t shared_page = 0x300000;
+    coherence_mgr.request_read(shared_page, data, 64);
+    TEST_ASSERT(coherence_mgr.request_write(shared_page + 640, data, 64), "Conflicting write succeeds");
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.region_splits == 1, "Region split recorded");
+    TEST_ASSERT(coherence_mgr.is_modified(shared_page + 640), "Written line MODIFIED");
+    TEST_ASSERT(coherence_mgr.get_state(shared_page + 704) == CoherenceManager::CoherenceState::SHARED,
+                "Neighbouring line keeps SHARED");
+    TEST_ASSERT(coherence_mgr.invalidate(shared_page), "Line invalidate in split region");
+    TEST_ASSERT(!coherence_mgr.is_valid(shared_page) && coherence_mgr.is_valid(shared_page + 64),
+                "Split region invalidates per line");
+    
+    TEST_ASSERT(!coherence_mgr.disable_region_mode(), "Mode is fixed while lines are tracked");
+    
+    return true;
+}
+
+// Test 16: Sealed pages bypass the directory and trap writes
+bool test_sealed_pages() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    const size_t PAGE = CoherenceManager::kSealedPageSize;
+    uint64_t page = 0x400000;
+    char data[64];
+    std::memset(data, 0x11, sizeof(data));
+    
+    // Last write to the page, then seal it
+    coherence_mgr.request_write(page + 128, data, sizeof(data));
+    TEST_ASSERT(coherence_mgr.seal_pages(page, PAGE), "Sealing succeeds");
+    TEST_ASSERT(coherence_mgr.is_sealed(page + PAGE - 1), "Whole page sealed");
+    TEST_ASSERT(!coherence_mgr.is_sealed(page + PAGE), "Next page not sealed");
+    TEST_ASSERT(coherence_mgr.get_state(page + 128) == CoherenceManager::CoherenceState::SHARED,
+                "Modified line written back to SHARED on seal");
+    TEST_ASSERT(coherence_mgr.get_state(page + 1024) == CoherenceManager::CoherenceState::SHARED,
+                "Untouched line fetched to SHARED on seal");
+    
+    size_t tracked = coherence_mgr.directory_size();
+    coherence_mgr.reset_statistics();
+    for (size_t offset = 0; offset < PAGE; offset += 64) {
+        TEST_ASSERT(coherence_mgr.request_read(page + offset, data, sizeof(data)), "Sealed read succeeds");
+    }
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.sealed_reads == PAGE / 64, "Reads served by the sealed path");
+    TEST_ASSERT(stats.directory_hits == 0 && stats.directory_misses == 0, "Directory untouched");
+    TEST_ASSERT(coherence_mgr.directory_size() == tracked, "No entries added by sealed reads");
+    
+    // Writes are trapped and reported
+    TEST_ASSERT(!coherence_mgr.request_write(page + 256, data, sizeof(data)), "Write to sealed page rejected");
+    TEST_ASSERT(coherence_mgr.get_statistics().sealed_write_violations == 1, "Violation reported");
+    TEST_ASSERT(!coherence_mgr.is_modified(page + 256), "Rejected write leaves state unchanged");
+    
+    // Recycling the page lifts the seal
+    coherence_mgr.unseal_pages(page, PAGE);
+    TEST_ASSERT(!coherence_mgr.is_sealed(page), "Page unsealed");
+    TEST_ASSERT(coherence_mgr.request_write(page + 256, data, sizeof(data)), "Write after unseal succeeds");
+    
+    // Invalidation also drops the seal
+    coherence_mgr.seal_pages(page, PAGE);
+    coherence_mgr.invalidate(page + 64);
+    TEST_ASSERT(!coherence_mgr.is_sealed(page), "Invalidated page unsealed");
+    
+    return true;
+}
+
+// Test 17: Asynchronous pipeline with futures, callbacks and eventfd
+static void count_completion(void* user_data, uint64_t addr, bool success) {
+    if (success) {
+        static_cast<std::atomic<int>*>(user_data)->fetch_add(1);
+    }
+}
+
+bool test_async_operations() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    // Reaper thread mode: futures plus an eventfd for completions
+    TEST_ASSERT(coherence_mgr.enable_async(), "Async pipeline enabled");
+    TEST_ASSERT(!coherence_mgr.enable_async(), "Second enable rejected");
+    TEST_ASSERT(coherence_mgr.completion_fd() >= 0, "Completion fd available");
+    
+    char data[64];
+    std::memset(data, 0x5A, sizeof(data));
+    const int NUM_LINES = 2000;
+    std::vector<std::future<bool>> futures;
+    for (int i = 0; i < NUM_LINES; i++) {
+        futures.push_back(coherence_mgr.submit_async(CoherenceManager::CoherenceOp::READ, i * 64, data, 64));
+    }
+    int succeeded = 0;
+    for (auto& f : futures) {
+        succeeded += f.get() ? 1 : 0;
+    }
+    TEST_ASSERT(succeeded == NUM_LINES, "All async reads succeed");
+    TEST_ASSERT(coherence_mgr.get_state(64 * 7) == CoherenceManager::CoherenceState::SHARED,
+                "Async read leaves line SHARED");
+    
+    struct pollfd pfd = {coherence_mgr.completion_fd(), POLLIN, 0};
+    TEST_ASSERT(poll(&pfd, 1, 1000) == 1, "Completion fd readable");
+    
+    // Ops on the same line complete in submission order
+    uint64_t addr = 0x100000;
+    auto write = coherence_mgr.submit_async(CoherenceManager::CoherenceOp::WRITE, addr, data, 64);
+    auto writeback = coherence_mgr.submit_async(CoherenceManager::CoherenceOp::WRITEBACK, addr, data, 64);
+    TEST_ASSERT(write.get() && writeback.get(), "Write then writeback succeed");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::SHARED,
+                "Writeback applied after write");
+    
+    // Sealed page writes fail without entering the pipeline
+    coherence_mgr.seal_pages(0x200000, CoherenceManager::kSealedPageSize);
+    auto sealed = coherence_mgr.submit_async(CoherenceManager::CoherenceOp::WRITE, 0x200000, data, 64);
+    TEST_ASSERT(!sealed.get(), "Async write to sealed page rejected");
+    
+    coherence_mgr.disable_async();
+    TEST_ASSERT(!coherence_mgr.is_async_enabled(), "Async pipeline disabled");
+    
+    // Caller-reaped mode with callbacks and a small queue
+    CoherenceManager::AsyncConfig config;
+    config.queue_depth = 16;
+    config.reaper_thread = false;
+    TEST_ASSERT(coherence_mgr.enable_async(config), "Async pipeline re-enabled");
+    
+    std::atomic<int> completions(0);
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT(coherence_mgr.submit_async(CoherenceManager::CoherenceOp::WRITE, 0x300000 + i * 64,
+                                               data, 64, count_completion, &completions),
+                    "Callback submission accepted");
+    }
+    TEST_ASSERT(coherence_mgr.outstanding_async_ops() == 16, "Queue full before reaping");
+    TEST_ASSERT(coherence_mgr.poll_completions() == 16, "All ops reaped in one pass");
+    TEST_ASSERT(completions.load() == 16, "All callbacks fired");
+    TEST_ASSERT(coherence_mgr.outstanding_async_ops() == 0, "Nothing outstanding");
+    TEST_ASSERT(coherence_mgr.is_modified(0x300000 + 15 * 64), "Async write left line MODIFIED");
+    
+    return true;
+}
+
+// Test 18: Batches reach the FPGA with a single doorbell
+bool test_batch_single_doorbell() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    // Track every line of a 2 MB region
+    const uint64_t base = 0x40000000;
+    const size_t REGION = 2 * 1024 * 1024;
+    char data[64];
+    std::memset(data, 0x3C, sizeof(data));
+    std::vector<uint64_t> lines;
+    for (size_t offset = 0; offset < REGION; offset += 64) {
+        coherence_mgr.request_read(base + offset, data, sizeof(data));
+        lines.push_back(base + offset);
+    }
+    TEST_ASSERT(lines.size() == 32768, "2 MB region is 32768 lines");
+    
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.batch_invalidate(lines), "Batch invalidate succeeds");
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.device_round_trips == 1, "2 MB invalidate is one round trip");
+    TEST_ASSERT(stats.invalidations_sent == lines.size(), "Every line invalidated");
+    TEST_ASSERT(coherence_mgr.get_state(base + REGION - 64) == CoherenceManager::CoherenceState::INVALID,
+                "Last line INVALID");
+    
+    // Writebacks: only modified lines are sent, still in one round trip
+    std::vector<std::pair<uint64_t, const void*>> writebacks;
+    for (int i = 0; i < 100; i++) {
+        uint64_t addr = base + i * 64;
+        if (i % 2 == 0) {
+            coherence_mgr.request_write(addr, data, sizeof(data));
+        }
+        writebacks.emplace_back(addr, data);
+    }
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.batch_writeback(writebacks), "Batch writeback succeeds");
+    TEST_ASSERT(coherence_mgr.get_statistics().device_round_trips == 1, "Batch writeback is one round trip");
+    TEST_ASSERT(!coherence_mgr.is_modified(base), "Modified line written back");
+    TEST_ASSERT(coherence_mgr.get_state(base + 64) == CoherenceManager::CoherenceState::INVALID,
+                "Unmodified line untouched");
+    
+    // Nothing tracked: no doorbell at all
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.batch_invalidate({0x7000000000ull}), "Untracked batch succeeds");
+    TEST_ASSERT(coherence_mgr.get_statistics().device_round_trips == 0, "No round trip for untracked lines");
+    
+    // Cleaning a region entry writes back the whole region
+    auto recorder = std::make_shared<RecordingSimDriver>();
+    CoherenceManager region_mgr(recorder, 64);
+    TEST_ASSERT(region_mgr.enable_region_mode(4096), "Region mode enabled");
+    region_mgr.request_write(0x20000, data, sizeof(data));
+    region_mgr.request_write(0x20800, data, sizeof(data));
+    TEST_ASSERT(region_mgr.batch_writeback({{0x20000, data}}), "Region writeback succeeds");
+    TEST_ASSERT(recorder->recorded.size() == 1 && recorder->recorded[0].size == 4096,
+                "One writeback descriptor spanning the region");
+    TEST_ASSERT(!region_mgr.is_modified(0x20800) && region_mgr.dirty_lines() == 0, "Whole region clean");
+    
+    return true;
+}
+
+// Test 19: Dirty set and background writeback daemon
+bool test_writeback_daemon() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    char data[64];
+    std::memset(data, 0x77, sizeof(data));
+    
+    // flush_all only touches dirty lines
+    for (int i = 0; i < 20000; i++) {
+        coherence_mgr.request_read(i * 64, data, sizeof(data));
+    }
+    for (int i = 0; i < 10; i++) {
+        coherence_mgr.request_write(i * 64, data, sizeof(data));
+    }
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 10, "Dirty set holds modified lines");
+    coherence_mgr.writeback(0, data, sizeof(data));
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 9, "Writeback leaves the dirty set");
+    coherence_mgr.reset_statistics();
+    coherence_mgr.flush_all();
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.writebacks_performed == 9, "Flush wrote back dirty lines only");
+    TEST_ASSERT(stats.device_round_trips == 1, "Flush sent as one batch");
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 0, "Dirty set empty after flush");
+    
+    // Daemon cleans down to the low watermark once the high one is reached
+    CoherenceManager::WritebackConfig config;
+    config.high_watermark = 256;
+    config.low_watermark = 64;
+    config.batch_size = 32;
+    TEST_ASSERT(coherence_mgr.start_writeback_daemon(config), "Daemon started");
+    TEST_ASSERT(!coherence_mgr.start_writeback_daemon(config), "Second start rejected");
+    
+    for (int i = 0; i < 200; i++) {
+        coherence_mgr.request_write(0x1000000 + i * 64, data, sizeof(data));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 200, "Below high watermark nothing is written");
+    
+    // The last write crosses the high watermark, so the daemon drains a settled set
+    for (int i = 200; i < 256; i++) {
+        coherence_mgr.request_write(0x1000000 + i * 64, data, sizeof(data));
+    }
+    for (int wait = 0; wait < 200 && coherence_mgr.dirty_lines() > 64; wait++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_ASSERT(coherence_mgr.dirty_lines() <= 64, "Daemon reached low watermark");
+    TEST_ASSERT(coherence_mgr.get_statistics().background_writebacks >= 192, "Background writebacks counted");
+    TEST_ASSERT(coherence_mgr.get_state(0x1000000) == CoherenceManager::CoherenceState::SHARED,
+                "Least recently written line cleaned first");
+    TEST_ASSERT(coherence_mgr.get_tier(0x1000000) == CoherenceManager::MemoryTier::L1_GPU,
+                "Cleaned line keeps its tier");
+    coherence_mgr.stop_writeback_daemon();
+    
+    // Rate limiting: 400 lines at 2000 lines/s take at least ~150 ms
+    coherence_mgr.flush_all();
+    config.high_watermark = 401;
+    config.low_watermark = 0;
+    config.max_lines_per_second = 2000;
+    config.batch_size = 50;
+    TEST_ASSERT(coherence_mgr.start_writeback_daemon(config), "Rate-limited daemon started");
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 401; i++) {
+        coherence_mgr.request_write(0x2000000 + i * 64, data, sizeof(data));
+    }
+    for (int wait = 0; wait < 300 && coherence_mgr.dirty_lines() > 0; wait++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 0, "Rate-limited daemon drained the dirty set");
+    TEST_ASSERT(elapsed >= std::chrono::milliseconds(150), "Writeback rate limited");
+    coherence_mgr.stop_writeback_daemon();
+    
+    return true;
+}
+
+// Test 20: Write-combining buffer merges writes to a line or region
+bool test_write_combining() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    TEST_ASSERT(coherence_mgr.enable_region_mode(4096), "Region mode enabled");
+    
+    WriteCombiningBuffer::Config config;
+    config.window = std::chrono::seconds(10);   // only fences issue here
+    WriteCombiningBuffer wc(coherence_mgr, config);
+    
+    // K and V for 32 heads appended into one page: 64 writes, one transition
+    uint64_t page = 0x800000;
+    char head[32];
+    std::memset(head, 0x42, sizeof(head));
+    for (int i = 0; i < 64; i++) {
+        TEST_ASSERT(wc.write(page + i * 32, head, sizeof(head)), "Buffered write accepted");
+    }
+    TEST_ASSERT(wc.open_entries() == 1, "Writes combined into one entry");
+    TEST_ASSERT(coherence_mgr.get_state(page) == CoherenceManager::CoherenceState::INVALID,
+                "Nothing issued before the fence");
+    
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(wc.fence(), "Fence succeeds");
+    auto stats = wc.get_statistics();
+    TEST_ASSERT(stats.writes_received == 64 && stats.writes_combined == 63, "Combining counted");
+    TEST_ASSERT(stats.transitions_issued == 1, "One transition for the page");
+    TEST_ASSERT(stats.bytes_issued == 64 * sizeof(head), "One contiguous transfer");
+    TEST_ASSERT(coherence_mgr.get_statistics().device_round_trips == 1, "One device operation");
+    TEST_ASSERT(coherence_mgr.is_modified(page + 1024), "Page MODIFIED after fence");
+    TEST_ASSERT(wc.open_entries() == 0, "Fence empties the buffer");
+    
+    // Disjoint runs in one page issue one write each
+    wc.reset_statistics();
+    wc.write(page + 4096, head, sizeof(head));
+    wc.write(page + 4096 + 512, head, sizeof(head));
+    wc.write(page + 4096 + 32, head, sizeof(head));   // joins the first run
+    TEST_ASSERT(wc.fence() && wc.get_statistics().transitions_issued == 2, "One write per contiguous run");
+    
+    // drain() issues only the requested range
+    wc.write(page + 3 * 4096, head, sizeof(head));
+    wc.write(page + 5 * 4096, head, sizeof(head));
+    TEST_ASSERT(wc.drain(page + 3 * 4096, 4096), "Drain succeeds");
+    TEST_ASSERT(coherence_mgr.is_modified(page + 3 * 4096), "Drained page issued");
+    TEST_ASSERT(!coherence_mgr.is_modified(page + 5 * 4096), "Other page still buffered");
+    TEST_ASSERT(wc.open_entries() == 1, "One entry left open");
+    
+    // Capacity and window both force issue
+    config.max_entries = 4;
+    config.window = std::chrono::microseconds(0);
+    WriteCombiningBuffer eager(coherence_mgr, config);
+    eager.write(page + 10 * 4096, head, sizeof(head));
+    TEST_ASSERT(eager.open_entries() == 0, "Expired entry issued on write");
+    
+    // Sealed pages are rejected up front
+    coherence_mgr.seal_pages(page + 20 * 4096, 4096);
+    TEST_ASSERT(!wc.write(page + 20 * 4096, head, sizeof(head)), "Write to sealed page rejected");
+    
+    return true;
+}
+
+// Test 21: Directory capacity and eviction
+bool test_directory_capacity() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    char data[64];
+    std::memset(data, 0x21, sizeof(data));
+    
+    // Default matches the FPGA directory
+    TEST_ASSERT(coherence_mgr.directory_capacity() == CoherenceManager::kDefaultDirectoryCapacity,
+                "Default capacity is NUM_ENTRIES");
+    for (int i = 0; i < 50000; i++) {
+        coherence_mgr.request_read(i * 64, data, sizeof(data));
+    }
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(coherence_mgr.directory_size() <= 4096, "Directory stays within capacity");
+    TEST_ASSERT(stats.directory_entries == coherence_mgr.directory_size(), "Occupancy published");
+    TEST_ASSERT(stats.directory_capacity == 4096, "Capacity published");
+    TEST_ASSERT(stats.evictions == 50000 - coherence_mgr.directory_size(), "Evictions counted");
+    TEST_ASSERT(coherence_mgr.get_state(49999 * 64) == CoherenceManager::CoherenceState::SHARED,
+                "Recent line still tracked");
+    TEST_ASSERT(coherence_mgr.get_state(0) == CoherenceManager::CoherenceState::INVALID,
+                "Least recently used line evicted");
+    size_t bounded_bytes = coherence_mgr.directory_memory_bytes();
+    for (int i = 50000; i < 100000; i++) {
+        coherence_mgr.request_read(i * 64, data, sizeof(data));
+    }
+    TEST_ASSERT(coherence_mgr.directory_memory_bytes() <= bounded_bytes * 2, "Host memory stays bounded");
+    
+    // INVALID entries go first, then clean ones; dirty ones are written back
+    CoherenceManager small(driver, 64);
+    small.set_directory_capacity(CoherenceManager::kDirectoryShards);   // one entry per shard
+    uint64_t line = 0;
+    small.request_write(line, data, sizeof(data));
+    small.reset_statistics();
+    uint64_t other = 64;
+    while (true) {
+        small.request_read(other, data, sizeof(data));
+        if (small.get_state(line) == CoherenceManager::CoherenceState::INVALID) {
+            break;  // other shares line's shard
+        }
+        other += 64;
+    }
+    stats = small.get_statistics();
+    TEST_ASSERT(stats.dirty_evictions == 1, "Modified line written back before eviction");
+    TEST_ASSERT(stats.writebacks_performed == 1, "Eviction writeback counted");
+    TEST_ASSERT(small.dirty_lines() == 0, "Evicted line left the dirty set");
+    
+    small.invalidate(other);
+    small.reset_statistics();
+    small.request_read(line, data, sizeof(data));
+    stats = small.get_statistics();
+    TEST_ASSERT(stats.evictions == 1 && stats.dirty_evictions == 0, "INVALID entry evicted without writeback");
+    TEST_ASSERT(small.directory_size() <= CoherenceManager::kDirectoryShards, "Small directory bounded");
+    
+    // Evicting a shared line back-invalidates it on the device
+    auto sim = std::make_shared<SpeckvSimDriver>();
+    CoherenceManager bounded(sim, 64);
+    bounded.set_directory_capacity(CoherenceManager::kDirectoryShards);
+    uint64_t shared = 0x5000000;
+    bounded.request_read(shared, data, sizeof(data), 1);
+    bounded.reset_statistics();
+    for (other = shared + 64; bounded.get_state(shared) != CoherenceManager::CoherenceState::INVALID; other += 64) {
+        bounded.request_read(other, data, sizeof(data));
+    }
+    stats = bounded.get_statistics();
+    size_t invalidate_op = static_cast<size_t>(CoherenceManager::CoherenceOp::INVALIDATE);
+    TEST_ASSERT(stats.evictions >= 1 && stats.device_ops[invalidate_op].count == stats.evictions,
+                "One device INVALIDATE per evicted line");
+    TEST_ASSERT(stats.sharer_invalidations == stats.evictions, "Each evicted line had one sharer");
+    std::vector<SpeckvDriver::DirectorySnapshotEntry> device(8192);
+    size_t count = 0;
+    TEST_ASSERT(sim->snapshot_directory(device.data(), device.size(), &count), "Device snapshot");
+    bool still_tracked = false;
+    for (size_t i = 0; i < count; i++) {
+        still_tracked |= device[i].addr == shared;
+    }
+    TEST_ASSERT(!still_tracked, "Device dropped the evicted line");
+    TEST_ASSERT(count <= bounded.directory_size(), "Device tracks no more than the host");
+    
+    // A victim that cannot be written back keeps its entry and the insert fails
+    uint64_t dirty_line = shared;
+    bounded.request_write(dirty_line, data, sizeof(data));
+    bounded.reset_statistics();
+    sim->set_failure_rate(1.0);
+    bool any_failed = false;
+    for (int i = 0; i < 256; i++) {
+        any_failed |= !bounded.request_read(other + i * 64, data, sizeof(data));
+    }
+    sim->set_failure_rate(0.0);
+    stats = bounded.get_statistics();
+    TEST_ASSERT(any_failed && stats.eviction_failures >= 1, "Failed evictions refuse the insert");
+    TEST_ASSERT(bounded.directory_size() <= CoherenceManager::kDirectoryShards, "Shards did not grow past capacity");
+    TEST_ASSERT(bounded.is_modified(dirty_line), "Dirty victim kept");
+    
+    return true;
+}
+
+// Test 22: Multiple agents with per-line sharer tracking
+bool test_multi_agent_sharers() {
+    auto driver = make_driver();
+    CoherenceManager coherence_mgr(driver, 64);
+    
+    uint64_t addr = 0x900000;
+    char data[64];
+    std::memset(data, 0x5E, sizeof(data));
+    
+    for (uint8_t agent = 0; agent < 3; agent++) {
+        TEST_ASSERT(coherence_mgr.request_read(addr, data, sizeof(data), agent), "Agent read succeeds");
+    }
+    TEST_ASSERT(coherence_mgr.get_sharers(addr) == 0x7, "Three sharers tracked");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::SHARED, "Line SHARED");
+    TEST_ASSERT(!coherence_mgr.request_read(addr, data, sizeof(data), CoherenceManager::kMaxAgents),
+                "Unknown agent rejected");
+    
+    // A write invalidates exactly the other sharers
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.request_write(addr, data, sizeof(data), 3), "Agent 3 write succeeds");
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.sharer_invalidations == 3, "Three sharers invalidated");
+    TEST_ASSERT(stats.invalidations_sent == 1, "One invalidation fan-out");
+    TEST_ASSERT(coherence_mgr.get_sharers(addr) == 0x8, "Writer is the only sharer");
+    TEST_ASSERT(coherence_mgr.is_modified(addr), "Line MODIFIED");
+    
+    // Reading another agent's dirty line shares it without a writeback
+    coherence_mgr.reset_statistics();
+    coherence_mgr.request_read(addr, data, sizeof(data), 0);
+    stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.snoop_writebacks == 0 && stats.writebacks_saved == 1, "Dirty data forwarded to the reader");
+    TEST_ASSERT(coherence_mgr.get_sharers(addr) == 0x9, "Owner and reader share the line");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::OWNED, "Line OWNED");
+    TEST_ASSERT(coherence_mgr.request_read(addr, data, sizeof(data), 0) &&
+                coherence_mgr.get_statistics().directory_hits >= 1, "Sharer read hits");
+    
+    // A sole sharer upgrades without invalidations
+    uint64_t own = 0x910000;
+    coherence_mgr.request_read(own, data, sizeof(data), 2);
+    coherence_mgr.reset_statistics();
+    coherence_mgr.request_write(own, data, sizeof(data), 2);
+    TEST_ASSERT(coherence_mgr.get_statistics().sharer_invalidations == 0, "No invalidation for a sole sharer");
+    
+    // Dropping copies
+    TEST_ASSERT(coherence_mgr.release_copy(addr, 3), "Agent 3 drops its copy");
+    TEST_ASSERT(coherence_mgr.get_sharers(addr) == 0x1, "Agent 0 remains");
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.release_copy(own, 2), "Dirty copy dropped");
+    TEST_ASSERT(coherence_mgr.get_statistics().writebacks_performed == 1, "Dirty copy written back");
+    TEST_ASSERT(coherence_mgr.get_state(own) == CoherenceManager::CoherenceState::INVALID,
+                "Line INVALID without sharers");
+    
+    // Concurrent agents: a MODIFIED line always has exactly one sharer
+    const int LINES = 64;
+    std::vector<std::thread> agents;
+    for (uint8_t agent = 0; agent < CoherenceManager::kMaxAgents; agent++) {
+        agents.emplace_back([&, agent] {
+            char buffer[64] = {};
+            for (int i = 0; i < 2000; i++) {
+                uint64_t line = 0xA00000 + ((i * 7 + agent) % LINES) * 64;
+                if (i % 3 == 0) {
+                    coherence_mgr.request_write(line, buffer, sizeof(buffer), agent);
+                } else {
+                    coherence_mgr.request_read(line, buffer, sizeof(buffer), agent);
+                }
+            }
+        });
+    }
+    for (auto& t : agents) {
+        t.join();
+    }
+    for (int i = 0; i < LINES; i++) {
+        uint64_t line = 0xA00000 + i * 64;
+        uint8_t sharers = coherence_mgr.get_sharers(line);
+        if (coherence_mgr.is_modified(line)) {
+            TEST_ASSERT(sharers != 0 && (sharers & (sharers - 1)) == 0, "MODIFIED line has one owner");
+        } else {
+            TEST_ASSERT(sharers != 0, "Valid line has sharers");
+        }
+    }
+    
+    return true;
+}
+
+// Test 23: Software home agent (SpeckvSimDriver) timing, queueing and failures
+bool test_simulated_home_agent() {
+    SpeckvSimDriver::Config config;
+    config.read_latency = std::chrono::microseconds(200);
+    config.write_latency = std::chrono::microseconds(20);
+    config.queue_depth = 2;
+    auto sim = std::make_shared<SpeckvSimDriver>(config);
+    CoherenceManager coherence_mgr(sim, 64);
+    
+    // Device latency is visible on a miss and absent on a hit
+    uint64_t addr = 0xB00000;
+    char data[64];
+    std::memset(data, 0x11, sizeof(data));
+    auto start = std::chrono::steady_clock::now();
+    TEST_ASSERT(coherence_mgr.request_read(addr, data, sizeof(data)), "Read miss succeeds");
+    auto miss_time = std::chrono::steady_clock::now() - start;
+    TEST_ASSERT(miss_time >= std::chrono::microseconds(200), "Miss waits for the home agent");
+    start = std::chrono::steady_clock::now();
+    coherence_mgr.request_read(addr, data, sizeof(data));
+    TEST_ASSERT(std::chrono::steady_clock::now() - start < miss_time, "Hit skips the device");
+    
+    // The MMIO directory registers follow coherence_directory.v
+    coherence_mgr.request_read(addr + 64, data, sizeof(data));
+    coherence_mgr.request_write(addr, data, sizeof(data));
+    uint64_t value = 0;
+    TEST_ASSERT(sim->read_mmio(MMIO_DIR_ENTRIES_USED_REG, &value) && value == 2, "Two device entries");
+    TEST_ASSERT(sim->read_mmio(MMIO_DIR_MODIFIED_COUNT_REG, &value) && value == 1, "One MODIFIED device entry");
+    TEST_ASSERT(sim->read_mmio(MMIO_COHERENCE_OPS_COUNT_REG, &value) && value == 1, "Write invalidated the sharer");
+    
+    // Async ops never overrun the device queue
+    CoherenceManager::AsyncConfig async_config;
+    async_config.reaper_thread = true;
+    TEST_ASSERT(coherence_mgr.enable_async(async_config), "Async enabled");
+    std::vector<std::future<bool>> futures;
+    for (int i = 0; i < 32; i++) {
+        futures.push_back(coherence_mgr.submit_async(CoherenceManager::CoherenceOp::WRITE, 0xC00000 + i * 64,
+                                                     data, sizeof(data)));
+    }
+    bool all_done = true;
+    for (auto& f : futures) {
+        all_done &= f.get();
+    }
+    coherence_mgr.disable_async();
+    auto device = sim->get_device_statistics();
+    TEST_ASSERT(all_done, "Every async write completed");
+    TEST_ASSERT(device.max_queue_occupancy <= 2, "Queue depth respected");
+    TEST_ASSERT(device.dropped_doorbells == 0, "No doorbell dropped");
+    
+    // Injected failures leave both directories unchanged
+    sim->set_failure_rate(1.0);
+    uint64_t fresh = 0xD00000;
+    TEST_ASSERT(!coherence_mgr.request_read(fresh, data, sizeof(data)), "Failed read reported");
+    TEST_ASSERT(coherence_mgr.get_state(fresh) == CoherenceManager::CoherenceState::INVALID,
+                "Failed read leaves the line INVALID");
+    TEST_ASSERT(!coherence_mgr.batch_invalidate({addr + 64}), "Failed batch reported");
+    size_t dirty = coherence_mgr.dirty_lines();
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(!coherence_mgr.batch_writeback({{addr, data}}), "Failed batch writeback reported");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::MODIFIED,
+                "Failed writeback leaves the line MODIFIED");
+    TEST_ASSERT(coherence_mgr.dirty_lines() == dirty, "Failed writeback keeps the line dirty");
+    TEST_ASSERT(coherence_mgr.get_statistics().writebacks_performed == 0, "Failed writeback not counted");
+    TEST_ASSERT(!coherence_mgr.invalidate(addr), "Failed invalidation reported");
+    TEST_ASSERT(coherence_mgr.is_modified(addr) && coherence_mgr.dirty_lines() == dirty,
+                "Failed invalidation keeps the dirty line");
+    TEST_ASSERT(coherence_mgr.get_statistics().writebacks_performed == 0, "Failed invalidation writeback not counted");
+    sim->set_failure_rate(0.0);
+    TEST_ASSERT(coherence_mgr.batch_writeback({{addr, data}}), "Batch writeback succeeds once failures stop");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::SHARED,
+                "Written-back line SHARED");
+    TEST_ASSERT(coherence_mgr.get_statistics().writebacks_performed == 1, "One writeback counted");
+    TEST_ASSERT(coherence_mgr.request_read(fresh, data, sizeof(data)), "Read succeeds once failures stop");
+    TEST_ASSERT(sim->get_device_statistics().failed_commands >= 2, "Device counted the failures");
+    
+    // Invalidating a dirty line writes it back in the same batch
+    coherence_mgr.request_write(fresh, data, sizeof(data));
+    dirty = coherence_mgr.dirty_lines();
+    uint64_t batched = sim->get_device_statistics().batch_commands;
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.invalidate(fresh), "Dirty invalidation succeeds");
+    TEST_ASSERT(sim->get_device_statistics().batch_commands == batched + 2, "Writeback and invalidation batched");
+    TEST_ASSERT(coherence_mgr.get_statistics().writebacks_performed == 1, "Invalidation writeback counted");
+    TEST_ASSERT(coherence_mgr.get_state(fresh) == CoherenceManager::CoherenceState::INVALID &&
+                coherence_mgr.dirty_lines() == dirty - 1, "Invalidated line left the dirty set");
+    
+    return true;
+}
+
+// Test 24: Directory snapshot and reconciliation with the device
+bool test_directory_sync() {
+    auto sim = std::make_shared<SpeckvSimDriver>();
+    CoherenceManager writer(sim, 64);
+    
+    uint64_t addr = 0xE00000;
+    char data[64];
+    std::memset(data, 0x24, sizeof(data));
+    for (int i = 0; i < 8; i++) {
+        writer.request_read(addr + i * 64, data, sizeof(data));
+    }
+    writer.request_write(addr, data, sizeof(data));
+    writer.request_write(addr + 64, data, sizeof(data));
+    
+    // A restarted host rebuilds its shadow directory from the device
+    CoherenceManager coherence_mgr(sim, 64);
+    CoherenceManager::SyncReport report;
+    TEST_ASSERT(coherence_mgr.sync_directory_from_fpga(&report), "Sync succeeds");
+    TEST_ASSERT(report.device_entries == 8, "Snapshot has every device line");
+    TEST_ASSERT(report.device_only == 8 && report.repaired == 8, "Missing lines adopted");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::MODIFIED,
+                "Written line is MODIFIED");
+    TEST_ASSERT(coherence_mgr.get_state(addr + 2 * 64) == CoherenceManager::CoherenceState::SHARED,
+                "Read line is SHARED");
+    TEST_ASSERT(sim->get_device_statistics().snapshots == 1, "One snapshot DMA");
+    
+    TEST_ASSERT(coherence_mgr.sync_directory_from_fpga(&report), "Second sync succeeds");
+    TEST_ASSERT(report.matched == 8 && report.differences.empty(), "Directories agree after repair");
+    
+    // A device-side upgrade is adopted; a host MODIFIED line is kept
+    sim->coherence_request(SpeckvDriver::CoherenceOp::WRITE, addr + 2 * 64);
+    sim->coherence_wait_complete();
+    sim->coherence_request(SpeckvDriver::CoherenceOp::WRITEBACK, addr);
+    sim->coherence_wait_complete();
+    TEST_ASSERT(coherence_mgr.sync_directory_from_fpga(&report), "Sync after divergence");
+    TEST_ASSERT(report.state_mismatches == 2 && report.differences.size() == 2, "Both mismatches reported");
+    TEST_ASSERT(report.repaired == 1 && report.skipped == 1, "One repaired, one kept");
+    TEST_ASSERT(coherence_mgr.get_state(addr + 2 * 64) == CoherenceManager::CoherenceState::MODIFIED,
+                "Host adopted the device's MODIFIED");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::MODIFIED,
+                "Owed writeback keeps MODIFIED");
+    
+    // After a device reset the host lines are reported, not dropped
+    sim->reset_directory();
+    TEST_ASSERT(coherence_mgr.sync_directory_from_fpga(&report, false), "Report-only sync");
+    TEST_ASSERT(report.device_entries == 0 && report.host_only == 8, "Host-only lines reported");
+    TEST_ASSERT(report.host_entries == 8, "Host entries kept");
+    
+    sim->close();
+    TEST_ASSERT(!coherence_mgr.sync_directory_from_fpga(&report), "No device, no sync");
+    sim->open();
+    
+    return true;
+}
+
+// Test 25: MOESI OWNED state for dirty lines shared between agents
+bool test_owned_state() {
+    auto sim = std::make_shared<SpeckvSimDriver>();
+    CoherenceManager coherence_mgr(sim, 64);
+    
+    uint64_t addr = 0xF00000;
+    char data[64];
+    std::memset(data, 0x25, sizeof(data));
+    
+    // Readers of a freshly written line are served by the writer
+    TEST_ASSERT(coherence_mgr.request_write(addr, data, sizeof(data), 1), "Agent 1 writes");
+    coherence_mgr.reset_statistics();
+    TEST_ASSERT(coherence_mgr.request_read(addr, data, sizeof(data), 0), "Agent 0 reads");
+    TEST_ASSERT(coherence_mgr.request_read(addr, data, sizeof(data), 2), "Agent 2 reads");
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::OWNED, "Line OWNED");
+    TEST_ASSERT(coherence_mgr.get_owner(addr) == 1, "Writer owns the line");
+    TEST_ASSERT(coherence_mgr.get_sharers(addr) == 0x7, "Owner and readers share it");
+    TEST_ASSERT(stats.writebacks_performed == 0 && stats.snoop_writebacks == 0, "No writeback for the readers");
+    TEST_ASSERT(stats.owned_forwards == 1 && stats.writebacks_saved == 1, "One writeback deferred");
+    TEST_ASSERT(sim->get_device_statistics().owned_reads == 2, "Device forwarded both reads");
+    TEST_ASSERT(coherence_mgr.request_read(addr, data, sizeof(data), 2) &&
+                coherence_mgr.get_statistics().directory_hits >= 1, "Reader hits on an OWNED line");
+    
+    // A reader leaves silently; the owner writes back when it leaves
+    TEST_ASSERT(coherence_mgr.release_copy(addr, 2), "Reader drops its copy");
+    TEST_ASSERT(coherence_mgr.get_statistics().writebacks_performed == 0, "Reader copy dropped silently");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::OWNED, "Still OWNED");
+    TEST_ASSERT(coherence_mgr.release_copy(addr, 1), "Owner drops its copy");
+    stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.writebacks_performed == 1, "Owner wrote back");
+    TEST_ASSERT(stats.owned_forwards == 1 && stats.writebacks_saved == 0, "Deferred writeback no longer saved");
+    TEST_ASSERT(coherence_mgr.get_state(addr) == CoherenceManager::CoherenceState::SHARED, "Reader keeps it SHARED");
+    TEST_ASSERT(coherence_mgr.get_owner(addr) == -1, "Clean line has no owner");
+    
+    // A sharer's write takes the line over without a writeback
+    uint64_t line = addr + 64;
+    coherence_mgr.request_write(line, data, sizeof(data), 3);
+    coherence_mgr.reset_statistics();
+    coherence_mgr.request_read(line, data, sizeof(data), 0);
+    TEST_ASSERT(coherence_mgr.request_write(line, data, sizeof(data), 0), "Reader writes");
+    stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(coherence_mgr.is_modified(line) && coherence_mgr.get_owner(line) == 0, "Writer holds it MODIFIED");
+    TEST_ASSERT(stats.sharer_invalidations == 1 && stats.writebacks_performed == 0, "Old owner invalidated");
+    TEST_ASSERT(stats.writebacks_saved == 1, "Superseded owner's writeback saved");
+
+    // Writing another agent's MODIFIED line writes that copy back in the
+    // write's batch, and counts it only once the device has done it
+    auto recorder = std::make_shared<RecordingSimDriver>();
+    CoherenceManager snooped(recorder, 64);
+    uint64_t dirty = addr + 256;
+    snooped.request_write(dirty, data, sizeof(data), 1);
+    TEST_ASSERT(snooped.request_write(dirty, data, sizeof(data), 2), "Second writer takes the line");
+    stats = snooped.get_statistics();
+    TEST_ASSERT(stats.snoop_writebacks == 1 && stats.writebacks_performed == 1, "Snoop writeback counted");
+    TEST_ASSERT(recorder->recorded.size() == 2 &&
+                recorder->recorded[0].op == static_cast<uint16_t>(SpeckvDriver::CoherenceOp::WRITEBACK) &&
+                recorder->recorded[1].op == static_cast<uint16_t>(SpeckvDriver::CoherenceOp::WRITE),
+                "Writeback and write sent in one batch");
+    TEST_ASSERT(recorder->recorded[0].status == 0, "Device wrote the line back");
+    TEST_ASSERT(snooped.get_owner(dirty) == 2, "Second writer owns the line");
+    recorder->set_failure_rate(1.0);
+    TEST_ASSERT(!snooped.request_write(dirty, data, sizeof(data), 3), "Failed batch fails the write");
+    stats = snooped.get_statistics();
+    TEST_ASSERT(stats.snoop_writebacks == 1 && stats.writebacks_performed == 1, "Failed snoop writeback not counted");
+    TEST_ASSERT(snooped.get_owner(dirty) == 2, "Owner kept after the failure");
+    TEST_ASSERT(!snooped.request_read(dirty, data, sizeof(data), 0), "Failed forward fails the read");
+    TEST_ASSERT(snooped.get_statistics().owned_forwards == 0, "Failed forward not counted");
+    recorder->set_failure_rate(0.0);
+    
+    // OWNED lines are dirty: a flush writes them back
+    uint64_t shared = addr + 128;
+    coherence_mgr.request_write(shared, data, sizeof(data), 2);
+    coherence_mgr.request_read(shared, data, sizeof(data), 1);
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 2, "OWNED and MODIFIED lines are dirty");
+    coherence_mgr.flush_all();
+    TEST_ASSERT(coherence_mgr.get_state(shared) == CoherenceManager::CoherenceState::SHARED, "Flushed line SHARED");
+    TEST_ASSERT(coherence_mgr.dirty_lines() == 0, "No dirty lines after flush");
+    stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.owned_forwards == 2 && stats.writebacks_saved == 1, "Flushed OWNED line no longer saved");
+    std::vector<SpeckvDriver::DirectorySnapshotEntry> entries(16);
+    size_t count = 0;
+    TEST_ASSERT(sim->snapshot_directory(entries.data(), entries.size(), &count) && count == 3, "Three device lines");
+    bool clean = true;
+    for (size_t i = 0; i < count; i++) {
+        clean &= entries[i].state == static_cast<uint8_t>(CoherenceManager::CoherenceState::SHARED);
+    }
+    TEST_ASSERT(clean, "Device lines clean after the flush");
+    
+    return true;
+}
+
+// Test 26: Per-op device counters, latency histograms and lock waits
+bool test_latency_statistics() {
+    // Histogram percentiles stay within a bucket (1/32) of the exact value
+    LatencyHistogram histogram;
+    for (uint64_t ns = 1; ns <= 100000; ns++) {
+        histogram.record(ns);
+    }
+    TEST_ASSERT(histogram.count() == 100000 && histogram.max() == 100000, "Histogram counts samples");
+    uint64_t p50 = histogram.percentile(0.50);
+    uint64_t p99 = histogram.percentile(0.99);
+    uint64_t p999 = histogram.percentile(0.999);
+    TEST_ASSERT(p50 >= 50000 && p50 <= 50000 + 50000 / 32, "p50 within a bucket");
+    TEST_ASSERT(p99 >= 99000 && p99 <= 99000 + 99000 / 32, "p99 within a bucket");
+    TEST_ASSERT(p999 >= 99900 && p999 <= 100000, "p999 capped at the max");
+    TEST_ASSERT(LatencyHistogram().percentile(0.5) == 0, "Empty histogram reports 0");
+    
+    SpeckvSimDriver::Config config;
+    config.read_latency = std::chrono::microseconds(200);
+    config.invalidate_latency = std::chrono::microseconds(50);
+    auto sim = std::make_shared<SpeckvSimDriver>(config);
+    CoherenceManager coherence_mgr(sim, 64);
+    using Op = CoherenceManager::CoherenceOp;
+    auto op_stats = [&](Op op) { return coherence_mgr.get_statistics().device_ops[static_cast<size_t>(op)]; };
+    
+    // A miss and a hit: one read each, one device round trip in total
+    uint64_t addr = 0x1100000;
+    char data[64];
+    std::memset(data, 0x26, sizeof(data));
+    coherence_mgr.request_read(addr, data, sizeof(data));
+    coherence_mgr.request_read(addr, data, sizeof(data));
+    auto stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.total_reads == 2, "Device op not counted as a read");
+    TEST_ASSERT(stats.directory_hits == 1 && stats.directory_misses == 1, "Device op not counted as a hit");
+    auto read = op_stats(Op::READ);
+    TEST_ASSERT(read.count == 1 && read.failures == 0, "One READ round trip");
+    TEST_ASSERT(read.p50_ns >= 200000, "READ latency includes the device");
+    TEST_ASSERT(read.p50_ns <= read.p99_ns && read.p99_ns <= read.p999_ns && read.p999_ns <= read.max_ns,
+                "Percentiles ordered");
+    
+    // Writes, single and batched invalidations land in their own op type
+    coherence_mgr.request_write(addr + 64, data, sizeof(data));
+    coherence_mgr.invalidate(addr);
+    std::vector<uint64_t> lines = {addr + 128, addr + 192, addr + 256};
+    for (uint64_t line : lines) {
+        coherence_mgr.request_read(line, data, sizeof(data));
+    }
+    uint64_t round_trips = coherence_mgr.get_statistics().device_round_trips;
+    coherence_mgr.batch_invalidate(lines);
+    TEST_ASSERT(op_stats(Op::WRITE).count == 1, "One WRITE round trip");
+    TEST_ASSERT(op_stats(Op::INVALIDATE).count == 4, "Batch descriptors counted per op");
+    TEST_ASSERT(coherence_mgr.get_statistics().device_round_trips == round_trips + 1, "Batch is one round trip");
+    TEST_ASSERT(op_stats(Op::INVALIDATE).p50_ns >= 50000, "INVALIDATE latency includes the device");
+    
+    // Failed round trips are counted per op
+    sim->set_failure_rate(1.0);
+    coherence_mgr.request_read(addr + 4096, data, sizeof(data));
+    sim->set_failure_rate(0.0);
+    TEST_ASSERT(op_stats(Op::READ).failures == 1, "READ failure counted");
+    
+    // Contended directory locks are timed
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&coherence_mgr, t] {
+            char buffer[64] = {};
+            for (int i = 0; i < 2000; i++) {
+                coherence_mgr.request_write(0x1200000 + (i % 8) * 64, buffer, sizeof(buffer), t % 2);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.lock_contentions == 0 || stats.lock_wait_ns > 0, "Lock waits timed");
+    TEST_ASSERT(stats.entry_waits == 0 || stats.entry_wait_ns > 0, "Entry waits timed");
+    
+    coherence_mgr.reset_statistics();
+    stats = coherence_mgr.get_statistics();
+    TEST_ASSERT(stats.device_ops[static_cast<size_t>(Op::READ)].count == 0 && stats.lock_wait_ns == 0,
+                "Latency statistics reset");
+    
+    return true;
+}
+
+// Test 27: Poll mode never blocks a submitter on a full queue
+struct ResubmitState {
+    CoherenceManager* mgr;
+    std::atomic<int> accepted{0};
+    std::atomic<int> rejected{0};
+};
+
+static void count_outcome(void* user_data, uint64_t addr, bool success) {
+    auto* state = static_cast<ResubmitState*>(user_data);
+    (success ? state->accepted : state->rejected).fetch_add(1);
+}
+
+static void resubmit_twice(void* user_data, uint64_t addr, bool success) {
+    auto* state = static_cast<ResubmitState*>(user_data);
+    for (int i = 1; i <= 2; i++) {
+        state->mgr->submit_async(CoherenceManager::CoherenceOp::WRITE, addr + i * 0x10000, nullptr, 64,
+                                 count_outcome, state);
+    }
+}
+
+bool test_async_poll_mode_backpressure() {
+    SpeckvSimDriver::Config sim_config;
+    sim_config.read_latency = std::chrono::microseconds(50);
+    sim_config.write_latency = std::chrono::microseconds(50);
+    auto sim = std::make_shared<SpeckvSimDriver>(sim_config);
+    CoherenceManager coherence_mgr(sim, 64);
+    
+    CoherenceManager::AsyncConfig config;
+    config.queue_depth = 4;
+    config.reaper_thread = false;
+    TEST_ASSERT(coherence_mgr.enable_async(config), "Poll-mode pipeline enabled");
+    
+    // A single thread submits more than queue_depth ops; the overflow reaps inline
+    const int NUM_OPS = 20;
+    std::vector<std::future<bool>> futures;
+    for (int i = 0; i < NUM_OPS; i++) {
+        futures.push_back(coherence_mgr.submit_async(CoherenceManager::CoherenceOp::READ, 0xE00000 + i * 64));
+        TEST_ASSERT(coherence_mgr.outstanding_async_ops() <= config.queue_depth, "Queue depth respected");
+    }
+    while (coherence_mgr.outstanding_async_ops() > 0) {
+        coherence_mgr.poll_completions();
+    }
+    int succeeded = 0;
+    for (auto& f : futures) {
+        succeeded += f.get() ? 1 : 0;
+    }
+    TEST_ASSERT(succeeded == NUM_OPS, "Every op past queue_depth completed, got " << succeeded);
+    
+    // Callbacks resubmitting into a full queue fail instead of deadlocking the reaper
+    ResubmitState state;
+    state.mgr = &coherence_mgr;
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT(coherence_mgr.submit_async(CoherenceManager::CoherenceOp::WRITE, 0xF00000 + i * 64, nullptr, 64,
+                                               resubmit_twice, &state),
+                    "Resubmitting op accepted");
+    }
+    while (coherence_mgr.outstanding_async_ops() > 0) {
+        coherence_mgr.poll_completions();
+    }
+    TEST_ASSERT(state.accepted.load() + state.rejected.load() == 8, "Every resubmission completed");
+    TEST_ASSERT(state.accepted.load() >= 4, "Freed slots reused by callbacks, got " << state.accepted.load());
+    TEST_ASSERT(state.rejected.load() > 0, "Submissions into a full queue rejected");
+    
+    coherence_mgr.disable_async();
+    return true;
+}
+
 int main(int argc, char** argv) {
     std::cout << "=============================================================╗" << std::endl;
     std::cout << "|     CXL-SpecKV Coherence Manager Unit Tests               |" << std::endl;
     std::cout << "=============================================================╝" << std::endl;
     
-    std::cout << "\nNote: These tests use mock operations when /dev/speckv0 is not available." << std::endl;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--device") {
+            device_path = argv[i + 1];
+        }
+    }
+    std::cout << "\nBackend: " << (device_path.empty() ? "software home agent (SpeckvSimDriver)" : device_path)
+              << " (use --device PATH for hardware)" << std::endl;
     
     // Run all tests
     RUN_TEST(test_initialization);
@@ -421,6 +1512,21 @@ int main(int argc, char** argv) {
     RUN_TEST(test_statistics);
     RUN_TEST(test_state_transitions);
     RUN_TEST(test_multiple_addresses);
+    RUN_TEST(test_concurrent_access);
+    RUN_TEST(test_directory_growth);
+    RUN_TEST(test_region_mode);
+    RUN_TEST(test_sealed_pages);
+    RUN_TEST(test_async_operations);
+    RUN_TEST(test_batch_single_doorbell);
+    RUN_TEST(test_writeback_daemon);
+    RUN_TEST(test_write_combining);
+    RUN_TEST(test_directory_capacity);
+    RUN_TEST(test_multi_agent_sharers);
+    RUN_TEST(test_simulated_home_agent);
+    RUN_TEST(test_directory_sync);
+    RUN_TEST(test_owned_state);
+    RUN_TEST(test_latency_statistics);
+    RUN_TEST(test_async_poll_mode_backpressure);
     
     // Print summary
     std::cout << "\n" << std::string(60, '=') << std::endl;
@@ -0,0 +1,999 @@
+/**
+ * test_predictor.cpp
+ *
+ * Unit tests for the LSTM token predictor
+ * Tests the fused LSTM kernel against a scalar reference, the top-k interface,
+ * the per-sequence state cache and the prefetcher's per-layer depth model
+ */
+
+#include "../src/prefetcher/lstm_predictor.h"
+#include "../src/prefetcher/lstm_kernels.h"
+#include "../src/prefetcher/speculative_prefetcher.h"
+#include "../src/cxl_memory/cxl_memory_manager.h"
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <new>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+
+using namespace cxlspeckv;
+
+// Count heap allocations so tests can assert allocation-free paths. The
+// aligned forms cover allocate_aligned_floats/bytes (weights, scratch arenas,
+// sequence state). Kept out of line so GCC does not pair the inlined free()
+// with the new-expression it was called from (-Wmismatched-new-delete).
+static std::atomic<size_t> g_allocations{0};
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    g_allocations++;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new(size_t size, std::align_val_t align) {
+    g_allocations++;
+    size_t alignment = static_cast<size_t>(align);
+    size_t bytes = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if (void* ptr = std::aligned_alloc(alignment, bytes)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+// Test counter
+static int tests_passed = 0;
+static int tests_failed = 0;
+
+#define TEST_ASSERT(condition, msg) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << "[FAIL] FAILED: " << msg << std::endl; \
+            tests_failed++; \
+            return false; \
+        } else { \
+            tests_passed++; \
+        } \
+    } while(0)
+
+#define RUN_TEST(test_func) \
+    do { \
+        std::cout << "\n> Running " << #test_func << "..." << std::endl; \
+        if (test_func()) { \
+            std::cout << "[PASS] " << #test_func << " PASSED" << std::endl; \
+        } else { \
+            std::cout << "[FAIL] " << #test_func << " FAILED" << std::endl; \
+        } \
+    } while(0)
+
+static std::vector<float> random_vector(size_t n, float scale) {
+    std::vector<float> v(n);
+    for (auto& x : v) {
+        x = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 2.0f * scale;
+    }
+    return v;
+}
+
+static float sigmoid_ref(float x) {
+    return 1.0f / (1.0f + std::exp(-x));
+}
+
+// Straightforward LSTM cell on unpacked PyTorch-layout weights
+static void lstm_cell_reference(
+    const std::vector<float>& w_ih, const std::vector<float>& w_hh, const std::vector<float>& bias,
+    const std::vector<float>& x, std::vector<float>& h, std::vector<float>& c,
+    size_t input_dim, size_t hidden_dim
+) {
+    std::vector<float> gates(4 * hidden_dim);
+    for (size_t row = 0; row < 4 * hidden_dim; ++row) {
+        float acc = bias[row];
+        for (size_t k = 0; k < input_dim; ++k) acc += w_ih[row * input_dim + k] * x[k];
+        for (size_t k = 0; k < hidden_dim; ++k) acc += w_hh[row * hidden_dim + k] * h[k];
+        gates[row] = acc;
+    }
+    for (size_t u = 0; u < hidden_dim; ++u) {
+        float i = sigmoid_ref(gates[u]);
+        float f = sigmoid_ref(gates[hidden_dim + u]);
+        float g = std::tanh(gates[2 * hidden_dim + u]);
+        float o = sigmoid_ref(gates[3 * hidden_dim + u]);
+        c[u] = f * c[u] + i * g;
+        h[u] = o * std::tanh(c[u]);
+    }
+}
+
+// Test 1: Fused kernel matches the reference LSTM cell (incl. padded hidden dim)
+bool test_lstm_kernel_matches_reference() {
+    const size_t input_dim = 24;
+    const size_t hidden_dims[] = {16, 20, 128};
+
+    for (size_t hidden_dim : hidden_dims) {
+        auto w_ih = random_vector(4 * hidden_dim * input_dim, 0.5f);
+        auto w_hh = random_vector(4 * hidden_dim * hidden_dim, 0.5f);
+        auto bias = random_vector(4 * hidden_dim, 0.5f);
+
+        auto packed_w = allocate_aligned_floats(packed_lstm_weights_size(input_dim, hidden_dim));
+        auto packed_b = allocate_aligned_floats(packed_lstm_bias_size(hidden_dim));
+        pack_lstm_weights(w_ih.data(), w_hh.data(), bias.data(), input_dim, hidden_dim,
+                          packed_w.get(), packed_b.get());
+
+        size_t padded = round_up_to_block(hidden_dim);
+        auto h = allocate_aligned_floats(padded);
+        auto h_next = allocate_aligned_floats(padded);
+        auto c = allocate_aligned_floats(padded);
+        std::vector<float> h_ref(hidden_dim, 0.0f), c_ref(hidden_dim, 0.0f);
+
+        float max_err = 0.0f;
+        for (int step = 0; step < 8; ++step) {
+            auto x = random_vector(input_dim, 1.0f);
+            lstm_cell_step(packed_w.get(), packed_b.get(), x.data(), input_dim,
+                           h.get(), c.get(), h_next.get(), hidden_dim);
+            std::swap(h, h_next);
+            lstm_cell_reference(w_ih, w_hh, bias, x, h_ref, c_ref, input_dim, hidden_dim);
+
+            for (size_t u = 0; u < hidden_dim; ++u) {
+                max_err = std::max(max_err, std::fabs(h[u] - h_ref[u]));
+                max_err = std::max(max_err, std::fabs(c[u] - c_ref[u]));
+            }
+        }
+
+        TEST_ASSERT(max_err < 1e-4f, "Kernel (" << lstm_kernel_isa() << ") matches reference, hidden_dim="
+                    << hidden_dim << " max_err=" << max_err);
+    }
+
+    return true;
+}
+
+// Test 2: Top-k predictions are ranked and confidences are probabilities
+bool test_predict_top_k() {
+    LSTMPredictor predictor(1000, 32, 64, 2, 16);
+    std::vector<uint32_t> history = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    auto predictions = predictor.predict_top_k(history, 4);
+    TEST_ASSERT(predictions.size() == 4, "Returns k predictions");
+
+    for (size_t i = 0; i < predictions.size(); ++i) {
+        TEST_ASSERT(predictions[i].first < 1000, "Token id within vocabulary");
+        TEST_ASSERT(predictions[i].second > 0.0f && predictions[i].second <= 1.0f,
+                    "Confidence is a probability");
+        if (i > 0) {
+            TEST_ASSERT(predictions[i - 1].second >= predictions[i].second, "Sorted by confidence");
+        }
+    }
+
+    // Same history, same answer
+    auto again = predictor.predict_top_k(history, 4);
+    TEST_ASSERT(again.size() == predictions.size() && again[0].first == predictions[0].first,
+                "Prediction is deterministic");
+
+    auto stats = predictor.get_statistics();
+    TEST_ASSERT(stats.predictions == 2, "Predictions counted");
+    TEST_ASSERT(stats.layer_steps == 2 * 16 * 2, "Layer steps counted");
+
+    return true;
+}
+
+// Test 3: History influences the prediction (gates are not constant)
+bool test_history_sensitivity() {
+    LSTMPredictor predictor(1000, 32, 64, 2, 16);
+
+    bool differs = false;
+    for (uint32_t t = 1; t < 20 && !differs; ++t) {
+        auto a = predictor.predict_top_k({t, t, t, t}, 4);
+        auto b = predictor.predict_top_k({t + 100, t + 200, t + 300, t + 400}, 4);
+        differs = a != b;
+    }
+    TEST_ASSERT(differs, "Different histories give different predictions");
+
+    return true;
+}
+
+// Test 4: Steady-state prediction performs no heap allocation
+bool test_no_allocations_per_prediction() {
+    LSTMPredictor predictor(2000, 32, 64, 2, 16);
+    std::vector<uint32_t> history = {11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27};
+    history.reserve(64);
+    std::pair<uint32_t, float> out[4];
+
+    // Scratch arenas and sequence state come from allocate_aligned_*; the
+    // counter has to see them
+    size_t before = g_allocations.load();
+    AlignedFloatBuffer probe = allocate_aligned_floats(kLstmBlock);
+    TEST_ASSERT(g_allocations.load() == before + 1, "Aligned buffers are counted");
+    probe.reset();
+
+    // Warm up the thread's scratch arena
+    size_t n = predictor.predict_top_k(history.data(), history.size(), 4, out);
+    TEST_ASSERT(n == 4, "Pointer API returns k predictions");
+
+    before = g_allocations.load();
+    for (int i = 0; i < 10; ++i) {
+        history.push_back(static_cast<uint32_t>(100 + i));
+        predictor.predict_top_k(history.data(), history.size(), 4, out);
+    }
+    size_t after = g_allocations.load();
+    TEST_ASSERT(after == before, "No allocations per prediction (got " << (after - before) << ")");
+
+    // Vector API agrees with the pointer API
+    auto expected = predictor.predict_top_k(history, 4);
+    predictor.predict_top_k(history.data(), history.size(), 4, out);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        TEST_ASSERT(expected[i] == out[i], "Vector and pointer APIs agree");
+    }
+
+    return true;
+}
+
+// Test 5: Streaming top-k matches a full softmax + sort over the vocabulary
+bool test_streaming_topk_matches_sort() {
+    const size_t vocab = 1003;
+    const size_t k = 8;
+    auto logits = random_vector(vocab, 6.0f);
+
+    std::pair<uint32_t, float> out[k];
+    LogitTopK topk;
+    topk_init(topk, out, k);
+    for (size_t first = 0; first < vocab; first += 37) {
+        size_t count = std::min<size_t>(37, vocab - first);
+        topk_accumulate(topk, logits.data() + first, static_cast<uint32_t>(first), count);
+    }
+    size_t n = topk_finalize(topk, out);
+    TEST_ASSERT(n == k, "Streaming top-k returns k entries");
+
+    float max_logit = *std::max_element(logits.begin(), logits.end());
+    double sum = 0.0;
+    std::vector<std::pair<uint32_t, float>> ref(vocab);
+    for (size_t t = 0; t < vocab; ++t) sum += std::exp(logits[t] - max_logit);
+    for (size_t t = 0; t < vocab; ++t) {
+        ref[t] = {static_cast<uint32_t>(t), static_cast<float>(std::exp(logits[t] - max_logit) / sum)};
+    }
+    std::sort(ref.begin(), ref.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    for (size_t i = 0; i < k; ++i) {
+        TEST_ASSERT(out[i].first == ref[i].first, "Rank " << i << " token matches full sort");
+        TEST_ASSERT(std::fabs(out[i].second - ref[i].second) < 1e-5f,
+                    "Rank " << i << " probability matches full softmax");
+    }
+
+    // k larger than the stream returns everything, still ranked
+    std::pair<uint32_t, float> small[16];
+    topk_init(topk, small, 16);
+    topk_accumulate(topk, logits.data(), 0, 5);
+    n = topk_finalize(topk, small);
+    TEST_ASSERT(n == 5, "Short stream returns every token");
+    float total = 0.0f;
+    for (size_t i = 0; i < n; ++i) total += small[i].second;
+    TEST_ASSERT(std::fabs(total - 1.0f) < 1e-5f, "Probabilities of a full stream sum to 1");
+
+    return true;
+}
+
+// Test 6: Per-sequence state advances one step per token and falls back to replay
+bool test_sequence_state_cache() {
+    LSTMPredictor predictor(1000, 32, 64, 2, 16);
+    std::vector<uint32_t> history = {5, 6, 7, 8, 9};
+    history.reserve(64);
+    std::pair<uint32_t, float> out[4];
+    std::pair<uint32_t, float> ref[4];
+
+    // First call replays and matches the stateless path exactly
+    size_t n = predictor.predict_next(42, history.data(), history.size(), 4, out);
+    predictor.predict_top_k(history.data(), history.size(), 4, ref);
+    TEST_ASSERT(n == 4, "predict_next returns k predictions");
+    for (size_t i = 0; i < n; ++i) {
+        TEST_ASSERT(out[i] == ref[i], "Miss replays the same window as predict_top_k");
+    }
+
+    predictor.reset_statistics();
+    size_t before = g_allocations.load();
+    for (uint32_t t = 0; t < 20; ++t) {
+        history.push_back(100 + t);
+        predictor.predict_next(42, history.data(), history.size(), 4, out);
+    }
+    size_t after = g_allocations.load();
+    auto stats = predictor.get_statistics();
+    TEST_ASSERT(stats.sequence_hits == 20 && stats.sequence_misses == 0, "Decode steps hit the cache");
+    TEST_ASSERT(stats.layer_steps == 20 * 2, "One LSTM step per new token");
+    TEST_ASSERT(after == before, "Incremental steps do not allocate (got " << (after - before) << ")");
+
+    // Re-querying the same history (e.g. for another layer) does no LSTM work
+    std::pair<uint32_t, float> again[4];
+    predictor.predict_next(42, history.data(), history.size(), 4, again);
+    TEST_ASSERT(predictor.get_statistics().layer_steps == 20 * 2, "Repeated history costs no steps");
+    for (size_t i = 0; i < 4; ++i) {
+        TEST_ASSERT(again[i] == out[i], "Repeated history gives the same prediction");
+    }
+
+    // A diverged history replays
+    history.back() = 999;
+    history.push_back(3);
+    predictor.predict_next(42, history.data(), history.size(), 4, out);
+    TEST_ASSERT(predictor.get_statistics().sequence_misses == 1, "Diverged history replays");
+
+    // Released sequences replay on next use
+    predictor.release_sequence(42);
+    TEST_ASSERT(predictor.get_sequence_cache_size() == 0, "Released sequence is dropped");
+    predictor.predict_next(42, history.data(), history.size(), 4, out);
+    predictor.predict_top_k(history.data(), history.size(), 4, ref);
+    for (size_t i = 0; i < 4; ++i) {
+        TEST_ASSERT(out[i] == ref[i], "Replay after release matches predict_top_k");
+    }
+
+    // Capacity bound evicts least recently used sequences
+    predictor.set_sequence_cache_capacity(2);
+    predictor.reset_statistics();
+    for (uint64_t seq = 1; seq <= 3; ++seq) {
+        predictor.predict_next(seq, history.data(), history.size(), 4, out);
+    }
+    stats = predictor.get_statistics();
+    TEST_ASSERT(predictor.get_sequence_cache_size() == 2, "Cache bounded by capacity");
+    TEST_ASSERT(stats.sequence_evictions == 2, "Evictions counted (42 and 1)");
+    predictor.predict_next(3, history.data(), history.size(), 4, out);
+    TEST_ASSERT(predictor.get_statistics().sequence_hits == 1, "Most recent sequence retained");
+
+    return true;
+}
+
+// Test 7: Batched prediction matches per-sequence prediction
+bool test_batch_matches_serial() {
+    LSTMPredictor predictor(1000, 32, 40, 2, 16);
+
+    // Larger recurrent weights give well-separated logits, so rank order is
+    // not decided by rounding differences between the two kernels
+    for (size_t layer = 0; layer < 2; ++layer) {
+        size_t input_dim = layer == 0 ? 32 : 40;
+        auto w_ih = random_vector(4 * 40 * input_dim, 0.5f);
+        auto w_hh = random_vector(4 * 40 * 40, 0.5f);
+        auto bias = random_vector(4 * 40, 0.5f);
+        predictor.set_layer_weights(layer, w_ih.data(), w_hh.data(), bias.data());
+    }
+
+    // 70 sequences: one full chunk plus a ragged tail, mixed history lengths
+    std::vector<std::vector<uint32_t>> histories;
+    for (uint32_t s = 0; s < 70; ++s) {
+        std::vector<uint32_t> history;
+        for (uint32_t t = 0; t < 5 + s % 20; ++t) {
+            history.push_back((s * 37 + t * 11) % 1000);
+        }
+        histories.push_back(history);
+    }
+
+    for (size_t threads : {1, 2}) {
+        predictor.set_batch_threads(threads);
+        auto batched = predictor.predict_top_k_batch(histories, 4);
+        TEST_ASSERT(batched.size() == histories.size(), "One result per sequence");
+
+        for (size_t s = 0; s < histories.size(); ++s) {
+            auto serial = predictor.predict_top_k(histories[s], 4);
+            TEST_ASSERT(batched[s].size() == serial.size(), "Batched result has k entries");
+            for (size_t i = 0; i < serial.size(); ++i) {
+                TEST_ASSERT(batched[s][i].first == serial[i].first,
+                            "Sequence " << s << " rank " << i << " token matches (threads=" << threads << ")");
+                TEST_ASSERT(std::fabs(batched[s][i].second - serial[i].second) < 1e-4f,
+                            "Sequence " << s << " rank " << i << " confidence matches");
+            }
+        }
+    }
+
+    // Workers persist across batches: steady state starts no threads and
+    // allocates nothing
+    predictor.set_batch_threads(3);
+    std::vector<const uint32_t*> ptrs;
+    std::vector<size_t> lens;
+    for (const auto& history : histories) {
+        ptrs.push_back(history.data());
+        lens.push_back(history.size());
+    }
+    std::vector<std::pair<uint32_t, float>> flat(histories.size() * 4);
+    std::vector<size_t> counts(histories.size());
+    predictor.predict_top_k_batch(ptrs.data(), lens.data(), histories.size(), 4, flat.data(), counts.data());
+    size_t before = g_allocations.load();
+    predictor.predict_top_k_batch(ptrs.data(), lens.data(), histories.size(), 4, flat.data(), counts.data());
+    TEST_ASSERT(g_allocations.load() == before, "Pooled batch does not allocate");
+
+    // Concurrent batches share the pool (one runs on its caller)
+    std::vector<std::pair<uint32_t, float>> other(flat.size());
+    std::vector<size_t> other_counts(counts.size());
+    std::thread concurrent([&] {
+        predictor.predict_top_k_batch(ptrs.data(), lens.data(), histories.size(), 4, other.data(),
+                                      other_counts.data());
+    });
+    predictor.predict_top_k_batch(ptrs.data(), lens.data(), histories.size(), 4, flat.data(), counts.data());
+    concurrent.join();
+    TEST_ASSERT(other == flat && other_counts == counts, "Concurrent batches agree");
+    predictor.set_batch_threads(1);
+
+    return true;
+}
+
+// Test 8: INT8 projection tracks the FP32 projection
+bool test_int8_projection() {
+    const size_t rows = 83;     // ragged final row block
+    const size_t dim = 130;     // ragged final column group
+    auto weights = random_vector(rows * dim, 0.3f);
+    auto x = random_vector(dim, 1.0f);
+
+    std::vector<float> expected(rows);
+    project_rows(weights.data(), rows, dim, x.data(), expected.data());
+
+    size_t padded_rows = (rows + kInt8RowBlock - 1) / kInt8RowBlock * kInt8RowBlock;
+    auto packed = allocate_aligned_bytes(packed_int8_rows_size(rows, dim));
+    std::vector<float> scales(padded_rows);
+    std::vector<int32_t> row_sums(padded_rows);
+    quantize_rows_int8(weights.data(), rows, dim, packed.get(), scales.data(), row_sums.data());
+
+    std::vector<uint8_t> xq(int8_activation_size(dim));
+    float x_scale = quantize_activations_int8(x.data(), dim, xq.data());
+    std::vector<float> actual(rows + 1, -1.0f);
+    project_rows_int8(packed.get(), scales.data(), row_sums.data(), rows, dim, xq.data(), x_scale, actual.data());
+
+    // Error bound: both operands quantized to ~1% of their range
+    float max_err = 0.0f;
+    for (size_t r = 0; r < rows; ++r) {
+        max_err = std::max(max_err, std::fabs(actual[r] - expected[r]));
+    }
+    TEST_ASSERT(max_err < 0.1f, "INT8 (" << int8_kernel_isa() << ") projection close to FP32, max_err=" << max_err);
+    TEST_ASSERT(actual[rows] == -1.0f, "No write past the requested rows");
+
+    return true;
+}
+
+// Test 9: Quantized predictor serves predictions from a smaller model
+bool test_quantized_predictor() {
+    // Vocabulary large enough that the tables dominate, as in the deployed
+    // model; INT8 mode keeps the FP32 layers next to their INT8 copies
+    LSTMPredictor predictor(8000, 32, 64, 2, 16);
+    std::vector<uint32_t> history = {3, 1, 4, 1, 5, 9, 2, 6};
+
+    size_t fp32_size = predictor.get_model_size();
+    auto fp32 = predictor.predict_top_k(history, 8);
+
+    predictor.quantize_weights();
+    TEST_ASSERT(predictor.get_weight_precision() == WeightPrecision::INT8, "Precision switched to INT8");
+    TEST_ASSERT(predictor.get_model_size() < fp32_size / 2, "INT8 model is much smaller");
+
+    auto int8 = predictor.predict_top_k(history, 8);
+    TEST_ASSERT(int8.size() == 8, "INT8 predictor returns k predictions");
+    for (size_t i = 0; i < int8.size(); ++i) {
+        TEST_ASSERT(std::fabs(int8[i].second - fp32[i].second) < 1e-3f, "Confidences close to FP32 at rank " << i);
+    }
+
+    // Batched and serial paths agree in INT8 mode too
+    auto batched = predictor.predict_top_k_batch({history, history}, 8);
+    for (size_t i = 0; i < int8.size(); ++i) {
+        TEST_ASSERT(batched[1][i].first == int8[i].first, "Batched INT8 matches serial at rank " << i);
+    }
+
+    return true;
+}
+
+// Test 10: Models round-trip through the mapped binary format
+bool test_model_save_load() {
+    const std::string path = "test_predictor_model.bin";
+    std::vector<uint32_t> history = {7, 7, 3, 12, 40, 41};
+
+    for (bool quantized : {false, true}) {
+        LSTMPredictor source(1500, 24, 48, 3, 12);
+        if (quantized) {
+            source.quantize_weights();
+        }
+        auto expected = source.predict_top_k(history, 4);
+        TEST_ASSERT(source.save_model(path), "Model saved");
+
+        // Loading adopts the file's dimensions and precision
+        LSTMPredictor loaded(100, 8, 16, 1, 4);
+        TEST_ASSERT(loaded.load_model(path), "Model loaded");
+        TEST_ASSERT(loaded.is_model_mapped(), "Weights served from the mapping");
+        TEST_ASSERT(loaded.get_model_size() == source.get_model_size(), "Same model size after load");
+        TEST_ASSERT(loaded.get_weight_precision() == source.get_weight_precision(), "Precision preserved");
+
+        auto actual = loaded.predict_top_k(history, 4);
+        TEST_ASSERT(actual == expected, "Loaded model predicts identically (quantized=" << quantized << ")");
+
+        // A mapped model can be saved again and re-loaded
+        TEST_ASSERT(loaded.save_model(path), "Mapped model re-saved");
+        LSTMPredictor reloaded;
+        TEST_ASSERT(reloaded.load_model(path) && reloaded.predict_top_k(history, 4) == expected,
+                    "Re-saved model predicts identically");
+    }
+
+    // Replacing a mapped layer copies it out of the read-only mapping
+    LSTMPredictor mapped;
+    TEST_ASSERT(mapped.load_model(path), "Model loaded for update");
+    auto before = mapped.predict_top_k(history, 4);
+    auto w_ih = random_vector(4 * 48 * 24, 0.5f);
+    auto w_hh = random_vector(4 * 48 * 48, 0.5f);
+    auto bias = random_vector(4 * 48, 0.5f);
+    TEST_ASSERT(mapped.set_layer_weights(0, w_ih.data(), w_hh.data(), bias.data()), "Mapped layer replaced");
+    TEST_ASSERT(mapped.predict_top_k(history, 4) != before, "Replacement takes effect");
+
+    // Corrupt or missing files are rejected without disturbing the model
+    // (written to another path: a mapped file must not be modified in place)
+    const std::string corrupt_path = "test_predictor_corrupt.bin";
+    {
+        std::ifstream good(path, std::ios::binary);
+        std::ofstream corrupt(corrupt_path, std::ios::binary | std::ios::trunc);
+        std::vector<char> head(200);
+        good.read(head.data(), head.size());
+        corrupt.write(head.data(), head.size());
+    }
+    TEST_ASSERT(!mapped.load_model(corrupt_path), "Truncated file rejected");
+    TEST_ASSERT(!mapped.load_model("does_not_exist.bin"), "Missing file rejected");
+    TEST_ASSERT(mapped.predict_top_k(history, 4).size() == 4, "Model still usable after failed loads");
+
+    std::remove(corrupt_path.c_str());
+    std::remove(path.c_str());
+    return true;
+}
+
+// Test 11: Shortlist projection agrees with the full projection
+bool test_output_shortlist() {
+    const size_t vocab = 2000;
+    LSTMPredictor predictor(vocab, 32, 64, 2, 16);
+    std::vector<uint32_t> history = {3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5};
+    auto full = predictor.predict_top_k(history, 8);
+
+    auto expect_same = [&](const std::vector<std::pair<uint32_t, float>>& got,
+                           const std::vector<std::pair<uint32_t, float>>& want, const char* what) {
+        TEST_ASSERT(got.size() == want.size(), what << ": same number of predictions");
+        for (size_t i = 0; i < got.size(); ++i) {
+            TEST_ASSERT(got[i].first == want[i].first, what << ": same token at rank " << i);
+            TEST_ASSERT(std::fabs(got[i].second - want[i].second) < 1e-5f, what << ": same confidence at rank " << i);
+        }
+        return true;
+    };
+
+    // Probing every cluster scores every row: exact softmax, same answer
+    ShortlistConfig all;
+    all.num_clusters = 32;
+    all.probe_clusters = 32;
+    all.min_scored_mass = 0.0f;
+    TEST_ASSERT(predictor.enable_shortlist(all), "Shortlist built");
+    TEST_ASSERT(predictor.is_shortlist_enabled(), "Shortlist enabled");
+    predictor.reset_statistics();
+    if (!expect_same(predictor.predict_top_k(history, 8), full, "Probe-all shortlist")) {
+        return false;
+    }
+    auto stats = predictor.get_statistics();
+    TEST_ASSERT(stats.shortlist_predictions == 1 && stats.shortlist_fallbacks == 0, "Served from the shortlist");
+
+    // A narrow probe scores a fraction of the vocabulary; recent tokens are
+    // always candidates
+    ShortlistConfig narrow;
+    narrow.num_clusters = 32;
+    narrow.probe_clusters = 2;
+    narrow.min_scored_mass = 0.0f;
+    TEST_ASSERT(predictor.enable_shortlist(narrow), "Narrow shortlist built");
+    predictor.reset_statistics();
+    auto shortlisted = predictor.predict_top_k(history, 8);
+    stats = predictor.get_statistics();
+    TEST_ASSERT(shortlisted.size() == 8, "Narrow shortlist returns k predictions");
+    TEST_ASSERT(stats.avg_rows_scored < vocab / 4.0, "Narrow shortlist scores few rows (" << stats.avg_rows_scored << ")");
+    float total = 0.0f;
+    for (const auto& p : shortlisted) {
+        TEST_ASSERT(p.first < vocab && p.second > 0.0f, "Valid shortlisted prediction");
+        total += p.second;
+    }
+    TEST_ASSERT(total <= 1.0f + 1e-5f, "Shortlist confidences are a sub-distribution");
+
+    // Demanding all of the estimated mass forces the full projection
+    narrow.min_scored_mass = 1.0f;
+    TEST_ASSERT(predictor.enable_shortlist(narrow), "Strict shortlist built");
+    predictor.reset_statistics();
+    if (!expect_same(predictor.predict_top_k(history, 8), full, "Fallback")) {
+        return false;
+    }
+    stats = predictor.get_statistics();
+    TEST_ASSERT(stats.shortlist_fallbacks == 1, "Fallback counted");
+    TEST_ASSERT(stats.avg_rows_scored <= vocab + narrow.num_clusters,
+                "Fallback scores each row once (" << stats.avg_rows_scored << ")");
+
+    // Steady state stays allocation-free with the shortlist enabled
+    std::pair<uint32_t, float> out[8];
+    TEST_ASSERT(predictor.enable_shortlist(all), "Shortlist rebuilt");
+    predictor.predict_top_k(history.data(), history.size(), 8, out);
+    size_t before = g_allocations.load();
+    predictor.predict_top_k(history.data(), history.size(), 8, out);
+    TEST_ASSERT(g_allocations.load() == before, "No allocations per shortlist prediction");
+
+    // The shortlist follows the weights into INT8 and batched mode
+    auto fp32_batched = predictor.predict_top_k_batch({history, history}, 8);
+    predictor.quantize_weights();
+    predictor.disable_shortlist();
+    auto int8_full = predictor.predict_top_k(history, 8);
+    TEST_ASSERT(predictor.enable_shortlist(all), "INT8 shortlist built");
+    if (!expect_same(predictor.predict_top_k(history, 8), int8_full, "INT8 probe-all shortlist")) {
+        return false;
+    }
+    TEST_ASSERT(predictor.enable_shortlist(narrow), "INT8 strict shortlist built");
+    if (!expect_same(predictor.predict_top_k(history, 8), int8_full, "INT8 fallback")) {
+        return false;
+    }
+    TEST_ASSERT(predictor.enable_shortlist(all), "INT8 shortlist rebuilt");
+    if (!expect_same(predictor.predict_top_k_batch({history, history}, 8)[1], int8_full, "INT8 batched shortlist") ||
+        !expect_same(fp32_batched[0], full, "FP32 batched shortlist")) {
+        return false;
+    }
+
+    // Replacing the output weights drops the stale shortlist
+    LSTMPredictor fp32(vocab, 32, 64, 2, 16);
+    TEST_ASSERT(fp32.enable_shortlist(all), "Shortlist built");
+    std::vector<float> output = random_vector(vocab * 64, 0.1f);
+    TEST_ASSERT(fp32.set_output_weights(output.data()), "Output weights replaced");
+    TEST_ASSERT(!fp32.is_shortlist_enabled(), "Shortlist dropped with its weights");
+
+    return true;
+}
+
+// Test 12: Online adaptation follows a drifting decode stream
+bool test_online_adaptation() {
+    // The side table keeps the most frequent successors of each context
+    TokenNgramTable table(64, 16.0f);
+    const uint32_t context[2] = {5, 7};
+    for (int i = 0; i < 30; ++i) {
+        table.observe(context, 2, i % 3 == 0 ? 11u : 12u);
+    }
+    uint32_t tokens[TokenNgramTable::kWays];
+    float probs[TokenNgramTable::kWays];
+    float total = 0.0f;
+    size_t found = table.lookup(context, 2, tokens, probs, total);
+    TEST_ASSERT(found == 2, "Two successors observed");
+    TEST_ASSERT(total <= 16.0f, "Context counts decay");
+    float p12 = tokens[0] == 12 ? probs[0] : probs[1];
+    TEST_ASSERT(std::fabs(p12 - 2.0f / 3.0f) < 0.1f, "Successor probability tracks frequency (" << p12 << ")");
+    const uint32_t unseen[2] = {6, 7};
+    TEST_ASSERT(table.lookup(unseen, 2, tokens, probs, total) == 2, "Unseen trigram backs off to the bigram");
+
+    const size_t vocab = 2000;
+    LSTMPredictor predictor(vocab, 32, 64, 2, 8);
+    std::vector<uint32_t> query = {1, 2, 3, 5, 7};
+    auto base = predictor.predict_top_k(query, 4);
+
+    AdaptationConfig config;
+    config.publish_interval = 64;
+    TEST_ASSERT(predictor.enable_adaptation(config), "Adaptation enabled");
+
+    // Decode stream in which token 7 is always followed by `follower`
+    size_t observed = 0;
+    auto decode = [&](uint64_t sequence, uint32_t follower, size_t steps) {
+        std::vector<uint32_t> history = {1, 2, 3};
+        std::pair<uint32_t, float> out[4];
+        predictor.predict_next(sequence, history.data(), history.size(), 4, out);
+        for (size_t i = 0; i < steps; ++i) {
+            history.push_back(history.back() == 7 ? follower : (i % 3 == 0 ? 7u : 100u + (i * 7) % 50));
+            predictor.predict_next(sequence, history.data(), history.size(), 4, out);
+            observed++;
+        }
+        predictor.release_sequence(sequence);
+    };
+
+    decode(1, 1234, 300);
+    predictor.flush_adaptation();
+    auto adapted = predictor.predict_top_k(query, 4);
+    TEST_ASSERT(adapted[0].first == 1234, "Observed successor ranks first (got " << adapted[0].first << ")");
+    TEST_ASSERT(adapted[0].second > 0.3f, "Observed successor is confident");
+    auto stats = predictor.get_statistics();
+    TEST_ASSERT(stats.adaptation_observations == observed, "Every decode step observed once");
+    TEST_ASSERT(stats.adaptation_versions >= 1 && stats.adapted_predictions >= 1, "Table published and used");
+
+    // Batched predictions read the same published table
+    auto batched = predictor.predict_top_k_batch({query, query}, 4);
+    for (size_t i = 0; i < adapted.size(); ++i) {
+        TEST_ASSERT(batched[1][i].first == adapted[i].first, "Batched adapted prediction matches serial at rank " << i);
+    }
+
+    // Reading the published table allocates nothing
+    std::pair<uint32_t, float> out[4];
+    predictor.predict_top_k(query.data(), query.size(), 4, out);
+    size_t before = g_allocations.load();
+    predictor.predict_top_k(query.data(), query.size(), 4, out);
+    TEST_ASSERT(g_allocations.load() == before, "No allocations per adapted prediction");
+
+    // The workload drifts: the new successor takes over
+    decode(2, 99, 900);
+    predictor.flush_adaptation();
+    auto drifted = predictor.predict_top_k(query, 4);
+    TEST_ASSERT(drifted[0].first == 99, "Drifted successor ranks first (got " << drifted[0].first << ")");
+
+    // Feedback can also be reported directly
+    const uint32_t feedback_context[2] = {8, 9};
+    for (int i = 0; i < 32; ++i) {
+        predictor.observe_token(feedback_context, 2, 555);
+    }
+    predictor.flush_adaptation();
+    TEST_ASSERT(predictor.predict_top_k({8, 9}, 4)[0].first == 555, "Reported successor ranks first");
+
+    predictor.disable_adaptation();
+    TEST_ASSERT(!predictor.is_adaptation_enabled(), "Adaptation disabled");
+    auto restored = predictor.predict_top_k(query, 4);
+    for (size_t i = 0; i < base.size(); ++i) {
+        TEST_ASSERT(restored[i] == base[i], "Static predictions restored at rank " << i);
+    }
+
+    return true;
+}
+
+// Test 13: A sliding window with its absolute position advances the cached state
+bool test_windowed_sequence_state() {
+    LSTMPredictor predictor(1000, 32, 64, 2, 16);
+    const size_t WINDOW = 16;
+    std::vector<uint32_t> full;
+    std::pair<uint32_t, float> windowed[4];
+    std::pair<uint32_t, float> growing[4];
+
+    // Repeated tokens make consecutive windows identical; only the position
+    // tells a new token from a repeated query
+    predictor.reset_statistics();
+    for (uint32_t t = 0; t < 48; ++t) {
+        full.push_back(t < 8 ? 10 + t : (t < 32 ? 7 : 20 + t % 3));
+        size_t len = std::min(full.size(), WINDOW);
+        const uint32_t* window = full.data() + full.size() - len;
+        size_t n = predictor.predict_next(1, full.size(), window, len, 4, windowed);
+        predictor.predict_next(2, full.data(), full.size(), 4, growing);
+        for (size_t i = 0; i < n; ++i) {
+            TEST_ASSERT(windowed[i] == growing[i], "Window matches growing history at step " << t);
+        }
+    }
+    auto stats = predictor.get_statistics();
+    TEST_ASSERT(stats.sequence_misses == 2 && stats.sequence_hits == 2 * 47, "Every later step hits the cache");
+    TEST_ASSERT(stats.layer_steps == 2 * (2 * 16 + 2 * 47), "One LSTM step per new token after the replays");
+
+    // Same position again (another layer's query) does no LSTM work
+    const uint32_t* window = full.data() + full.size() - WINDOW;
+    predictor.predict_next(1, full.size(), window, WINDOW, 4, windowed);
+    TEST_ASSERT(predictor.get_statistics().layer_steps == stats.layer_steps, "Repeated position costs no steps");
+
+    // A window that disagrees with the consumed tokens replays
+    std::vector<uint32_t> diverged(window, window + WINDOW);
+    diverged[WINDOW / 2] = 999;
+    diverged.push_back(3);
+    predictor.predict_next(1, full.size() + 1, diverged.data() + 1, WINDOW, 4, windowed);
+    TEST_ASSERT(predictor.get_statistics().sequence_misses == 3, "Diverged window replays");
+
+    return true;
+}
+
+// Test 14: Adaptation can be toggled while predictions are served
+bool test_adaptation_toggle_while_serving() {
+    LSTMPredictor predictor(500, 16, 32, 2, 8);
+
+    AdaptationConfig invalid;
+    invalid.publish_interval = 0;
+    TEST_ASSERT(!predictor.enable_adaptation(invalid), "Invalid config rejected");
+    TEST_ASSERT(!predictor.is_adaptation_enabled(), "Rejected config leaves adaptation off");
+
+    AdaptationConfig config;
+    config.table_entries = 256;
+    config.publish_interval = 8;
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> served{0};
+    std::vector<std::thread> workers;
+    for (uint64_t w = 0; w < 2; ++w) {
+        workers.emplace_back([&, w]() {
+            std::vector<uint32_t> history = {1, 2, 3};
+            std::pair<uint32_t, float> out[4];
+            while (!done.load()) {
+                history.push_back(static_cast<uint32_t>((history.back() * 31 + w) % 500));
+                size_t n = predictor.predict_next(w, history.data(), history.size(), 4, out);
+                if (n > 0) {
+                    served++;
+                }
+                const uint32_t context[2] = {history[history.size() - 2], history.back()};
+                predictor.observe_token(context, 2, 42);
+                if (history.size() > 64) {
+                    predictor.release_sequence(w);
+                    history.resize(3);
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < 50; ++i) {
+        TEST_ASSERT(predictor.enable_adaptation(config), "Adaptation enabled while serving");
+        predictor.flush_adaptation();
+        predictor.disable_adaptation();
+    }
+    done = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    TEST_ASSERT(served.load() > 0, "Predictions served throughout");
+    TEST_ASSERT(!predictor.is_adaptation_enabled(), "Adaptation left disabled");
+    return true;
+}
+
+// Test 15: INT8 LSTM step tracks the FP32 reference cell
+bool test_lstm_int8_step() {
+    const size_t input_dim = 24;
+    const size_t hidden_dims[] = {20, 64};
+
+    for (size_t hidden_dim : hidden_dims) {
+        auto w_ih = random_vector(4 * hidden_dim * input_dim, 0.5f);
+        auto w_hh = random_vector(4 * hidden_dim * hidden_dim, 0.5f);
+        auto bias = random_vector(4 * hidden_dim, 0.5f);
+
+        auto packed_w = allocate_aligned_floats(packed_lstm_weights_size(input_dim, hidden_dim));
+        auto packed_b = allocate_aligned_floats(packed_lstm_bias_size(hidden_dim));
+        pack_lstm_weights(w_ih.data(), w_hh.data(), bias.data(), input_dim, hidden_dim,
+                          packed_w.get(), packed_b.get());
+
+        size_t gate_rows = lstm_gate_rows(hidden_dim);
+        auto packed_q = allocate_aligned_bytes(packed_lstm_int8_size(input_dim, hidden_dim));
+        std::vector<float> scales(2 * gate_rows);
+        std::vector<int32_t> row_sums(2 * gate_rows);
+        quantize_lstm_weights_int8(packed_w.get(), input_dim, hidden_dim, packed_q.get(),
+                                   scales.data(), row_sums.data());
+
+        size_t padded = round_up_to_block(hidden_dim);
+        auto h = allocate_aligned_floats(padded);
+        auto h_next = allocate_aligned_floats(padded);
+        auto c = allocate_aligned_floats(padded);
+        auto scratch = allocate_aligned_floats(lstm_int8_scratch_floats(input_dim, hidden_dim));
+        std::vector<float> h_ref(hidden_dim, 0.0f), c_ref(hidden_dim, 0.0f);
+
+        // Error bound: gate pre-activations carry ~1% quantization error
+        float max_err = 0.0f;
+        for (int step = 0; step < 16; ++step) {
+            auto x = random_vector(input_dim, 1.0f);
+            lstm_cell_step_int8(packed_q.get(), scales.data(), row_sums.data(), packed_b.get(),
+                                x.data(), input_dim, h.get(), c.get(), h_next.get(), hidden_dim, scratch.get());
+            std::swap(h, h_next);
+            lstm_cell_reference(w_ih, w_hh, bias, x, h_ref, c_ref, input_dim, hidden_dim);
+
+            for (size_t u = 0; u < hidden_dim; ++u) {
+                max_err = std::max(max_err, std::fabs(h[u] - h_ref[u]));
+            }
+        }
+
+        TEST_ASSERT(max_err < 0.05f, "INT8 step (" << int8_kernel_isa() << ") tracks reference, hidden_dim="
+                    << hidden_dim << " max_err=" << max_err);
+    }
+
+    return true;
+}
+
+// Test 16: Layers with different hit profiles converge to different depths
+bool test_per_layer_depth() {
+    CXLMemoryManager memory_manager;
+    SpeculativePrefetcher prefetcher(&memory_manager, 4, 16);
+
+    DepthCostModel model = prefetcher.get_cost_model();
+    model.warmup_samples = 8;
+    model.ewma_alpha = 0.1;
+    prefetcher.set_cost_model(model);
+    TEST_ASSERT(prefetcher.get_adaptive_depth(0) == 4, "Default depth before any outcome");
+
+    // Layer 0: the true token is always the top candidate. Layer 1: it is
+    // spread evenly over the first four ranks.
+    for (size_t i = 0; i < 200; ++i) {
+        prefetcher.update_prediction_accuracy(0, 0, true);
+        prefetcher.record_outcome(1, 100 + i % 4, {100, 101, 102, 103, 104, 105, 106, 107});
+    }
+
+    size_t depth0 = prefetcher.get_adaptive_depth(0);
+    size_t depth1 = prefetcher.get_adaptive_depth(1);
+    TEST_ASSERT(depth0 == 1, "Top-1 layer prefetches one entry, got " << depth0);
+    TEST_ASSERT(depth1 == 4, "Spread layer prefetches four entries, got " << depth1);
+
+    auto decisions = prefetcher.get_layer_depths();
+    TEST_ASSERT(decisions.size() == 2, "One decision per layer in use");
+    TEST_ASSERT(decisions[0].layer_id == 0 && decisions[0].depth == depth0, "Layer 0 decision exported");
+    TEST_ASSERT(decisions[1].layer_id == 1 && decisions[1].depth == depth1, "Layer 1 decision exported");
+    TEST_ASSERT(decisions[1].samples == 200, "Samples counted per layer");
+
+    // A costlier miss makes deeper ranks worth their transfer
+    model.miss_penalty_us = 100.0;
+    prefetcher.set_cost_model(model);
+    TEST_ASSERT(prefetcher.get_adaptive_depth(1) == 4, "Spread layer keeps its four ranks");
+    model.max_depth = 2;
+    prefetcher.set_cost_model(model);
+    TEST_ASSERT(prefetcher.get_adaptive_depth(1) == 2, "Cost model caps the depth");
+
+    return true;
+}
+
+// Test 17: A busy link shrinks the prefetch depth
+bool test_link_utilization_shrinks_depth() {
+    CXLMemoryManager memory_manager;
+    SpeculativePrefetcher prefetcher(&memory_manager, 4, 16);
+
+    for (size_t i = 0; i < 200; ++i) {
+        prefetcher.update_prediction_accuracy(0, i % 4, true);
+    }
+    TEST_ASSERT(prefetcher.get_adaptive_depth(0) == 4, "Idle link: four ranks worth prefetching");
+
+    prefetcher.set_link_utilization(0.9);
+    TEST_ASSERT(prefetcher.get_adaptive_depth(0) < 4, "Busy link shrinks depth, got " << prefetcher.get_adaptive_depth(0));
+    TEST_ASSERT(prefetcher.get_layer_depths()[0].link_utilization >= 0.9, "Utilization exported");
+
+    prefetcher.set_link_utilization(0.0);
+    TEST_ASSERT(prefetcher.get_adaptive_depth(0) == 4, "Depth recovers when the link frees up");
+    return true;
+}
+
+// Test 18: Hits are credited against the depth the predictions were issued with
+bool test_useful_counts_issued_depth() {
+    CXLMemoryManager memory_manager;
+    SpeculativePrefetcher prefetcher(&memory_manager, 4, 16);
+    std::vector<uint32_t> history = {3, 1, 4, 1, 5, 9, 2, 6};
+
+    auto issued = prefetcher.prefetch(history, 0, 2);
+    TEST_ASSERT(issued.size() == 2, "Two entries issued");
+
+    // Rank 3 was ranked but never prefetched; rank 1 was
+    prefetcher.record_outcome(0, 13, {10, 11, 12, 13});
+    TEST_ASSERT(prefetcher.get_layer_depths()[0].accuracy == 0.0, "Unissued rank is not a useful prefetch");
+    prefetcher.record_outcome(0, 11, {10, 11, 12, 13});
+    auto decision = prefetcher.get_layer_depths()[0];
+    TEST_ASSERT(decision.accuracy == 0.5, "Issued rank is useful, accuracy=" << decision.accuracy);
+    TEST_ASSERT(decision.bytes_per_hit == decision.bytes_fetched, "One hit for the bytes fetched");
+    return true;
+}
+
+int main() {
+    std::cout << "=============================================================" << std::endl;
+    std::cout << "|     CXL-SpecKV LSTM Predictor Unit Tests                  |" << std::endl;
+    std::cout << "=============================================================" << std::endl;
+
+    std::cout << "\nLSTM kernel: " << lstm_kernel_isa() << ", INT8 kernel: " << int8_kernel_isa() << std::endl;
+
+    // Run all tests
+    RUN_TEST(test_lstm_kernel_matches_reference);
+    RUN_TEST(test_predict_top_k);
+    RUN_TEST(test_history_sensitivity);
+    RUN_TEST(test_no_allocations_per_prediction);
+    RUN_TEST(test_streaming_topk_matches_sort);
+    RUN_TEST(test_sequence_state_cache);
+    RUN_TEST(test_batch_matches_serial);
+    RUN_TEST(test_int8_projection);
+    RUN_TEST(test_quantized_predictor);
+    RUN_TEST(test_model_save_load);
+    RUN_TEST(test_output_shortlist);
+    RUN_TEST(test_online_adaptation);
+    RUN_TEST(test_windowed_sequence_state);
+    RUN_TEST(test_adaptation_toggle_while_serving);
+    RUN_TEST(test_lstm_int8_step);
+    RUN_TEST(test_per_layer_depth);
+    RUN_TEST(test_link_utilization_shrinks_depth);
+    RUN_TEST(test_useful_counts_issued_depth);
+
+    // Print summary
+    std::cout << "\n" << std::string(60, '=') << std::endl;
+    std::cout << "Test Summary:" << std::endl;
+    std::cout << "  [PASS] Passed: " << tests_passed << std::endl;
+    std::cout << "  [FAIL] Failed: " << tests_failed << std::endl;
+    std::cout << "  Total:  " << (tests_passed + tests_failed) << std::endl;
+    std::cout << std::string(60, '=') << std::endl;
+
+    if (tests_failed == 0) {
+        std::cout << "\nSuccess! All tests passed!" << std::endl;
+        return 0;
+    } else {
+        std::cout << "\n[FAIL] Some tests failed." << std::endl;
+        return 1;
+    }
+}